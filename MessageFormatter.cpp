@@ -184,6 +184,39 @@ formatString( const unsigned char * buf, std::ostream & os ) {
    return lengthString( buf );
 }
 
+unsigned
+lengthBlob( const unsigned char * buf ) {
+   uint32_t len;
+   memcpy( &len, buf, sizeof( len ) );
+   return sizeof( len ) + len;
+}
+
+// whether the blob parameter at buf, with its length, ends before end
+static bool
+blobFits( const unsigned char * buf, const unsigned char * end ) {
+   uint32_t len;
+   if ( end - buf < static_cast< ptrdiff_t >( sizeof( len ) ) ) {
+      return false;
+   }
+   memcpy( &len, buf, sizeof( len ) );
+   return len <= end - buf - sizeof( len );
+}
+
+unsigned
+formatBlob( const unsigned char * buf, std::ostream & os ) {
+   // a hex string, as qtpkt takes it
+   static const char digits[] = "0123456789abcdef";
+   uint32_t len;
+   memcpy( &len, buf, sizeof( len ) );
+   std::string hex( 2 * len, '0' );
+   for ( uint32_t i = 0; i < len; i++ ) {
+      hex[ 2 * i ] = digits[ buf[ sizeof( len ) + i ] >> 4 ];
+      hex[ 2 * i + 1 ] = digits[ buf[ sizeof( len ) + i ] & 0xf ];
+   }
+   os << hex;
+   return lengthBlob( buf );
+}
+
 unsigned
 lengthU8( const unsigned char * ) {
    return 1;
@@ -352,7 +385,11 @@ MessageFormatter::addPlugin() {
 }
 
 int
-MessageFormatter::format( const unsigned char * buf, std::ostream & os ) const {
+MessageFormatter::format( const unsigned char * buf, std::ostream & os,
+                          const unsigned char * end ) const {
+   if ( end != nullptr && hasBlobs() && length( buf, end ) < 0 ) {
+      return -1; // a blob reaches past end
+   }
    int n = 0;
    for ( auto & formatter : formatters_ ) {
       if ( formatter.second != nullptr ) {
@@ -373,10 +410,18 @@ MessageFormatter::format( const unsigned char * buf, std::ostream & os ) const {
 }
 
 int
-MessageFormatter::length( const unsigned char * buf ) const {
+MessageFormatter::length( const unsigned char * buf,
+                          const unsigned char * end ) const {
    int n = 0;
-   for ( auto & length : lengths_ ) {
-      unsigned l = length( buf + n );
+   auto blob = blobParams_.begin();
+   for ( size_t i = 0; i < lengths_.size(); i++ ) {
+      if ( blob != blobParams_.end() && i == *blob ) {
+         if ( end != nullptr && !blobFits( buf + n, end ) ) {
+            return -1; // blob length past the end of the buffer
+         }
+         ++blob;
+      }
+      unsigned l = lengths_[ i ]( buf + n );
       if ( l == 0 ) {
          return -1; // failed to decode parameters
       }
@@ -385,6 +430,29 @@ MessageFormatter::length( const unsigned char * buf ) const {
    return n;
 }
 
+std::vector< std::pair< const unsigned char *, uint32_t > >
+MessageFormatter::blobs( const unsigned char * buf,
+                         const unsigned char * end ) const {
+   std::vector< std::pair< const unsigned char *, uint32_t > > ret;
+   int n = 0;
+   auto blob = blobParams_.begin();
+   for ( size_t i = 0; i < lengths_.size() && blob != blobParams_.end(); i++ ) {
+      if ( i == *blob && end != nullptr && !blobFits( buf + n, end ) ) {
+         break; // blob length past the end of the buffer
+      }
+      unsigned l = lengths_[ i ]( buf + n );
+      if ( l == 0 ) {
+         break; // failed to decode parameters
+      }
+      if ( i == *blob ) {
+         ret.emplace_back( buf + n + sizeof( uint32_t ), l - sizeof( uint32_t ) );
+         ++blob;
+      }
+      n += l;
+   }
+   return ret;
+}
+
 void
 MessageFormatter::addNewFormattersById( std::string name,
                                         MessageFormatter::FormatterType type ) {
@@ -528,6 +596,9 @@ MessageFormatter::init() {
       formatters_.push_back( std::make_pair( formatter, nullptr ) );
 
       MessageFormatter::LengthType lenById = selectLength( fmt );
+      if ( fmt == "B" ) {
+         blobParams_.push_back( lengths_.size() );
+      }
       lengths_.push_back( lenById );
       fmtPtr = fmtEnd;
       if ( *fmtEnd == ',' ) {
@@ -615,7 +686,9 @@ MessageFormatter::init() {
    // two different fields, we can reuse the existing formatString 'q'.
    static const char * wcFormatStr = "q,q,";
    static unsigned wcFormatStrLen = strlen( wcFormatStr );
+   // Messages with line number WallClockLineNo only have their tsc.
    if ( lineno() == 0 && strncmp( fmtPtr, wcFormatStr, wcFormatStrLen ) == 0 ) {
+      wallClockFields_ = true;
       fmtPtr += wcFormatStrLen;
       MessageFormatter::FormatterType formatter = selectFormatter( "w", false );
       MessageFormatter::LengthType lenById = selectLength( "w" );
@@ -676,6 +749,7 @@ MessageFormatter::init() {
       // due to programming errors. in these cases, for compatibility with qtcat,
       // emit the log message and the parameters separately
       lengths_.clear();
+      blobParams_.clear();
       formatters_.clear();
       formatters_.push_back( std::make_pair( formatStatic, &msg()[ 0 ] ) );
       formatters_.push_back( std::make_pair( formatStatic, " % (" ) );
@@ -725,6 +799,7 @@ std::unordered_map< std::string, MessageFormatter::FormatterType >
       { "b", formatBool }, // QuickTrace
       { "f", formatFloat }, // QuickTrace
       { "d", formatDouble }, // QuickTrace
+      { "B", formatBlob }, // QuickTrace
       { "w", formatWallClockRingBuf } // Used internally by qttail
    };
 
@@ -745,6 +820,7 @@ std::unordered_map< std::string, MessageFormatter::LengthType >
       { "b", lengthBool },
       { "f", lengthFloat },
       { "d", lengthDouble },
+      { "B", lengthBlob },
       { "w", lengthWallClock }
    };
 
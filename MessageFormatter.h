@@ -31,6 +31,7 @@
 #include <vector>
 #include <functional>
 #include <QuickTrace/MessageParser.h>
+#include <QuickTrace/QuickTraceFileHeader.h>
 
 namespace QuickTrace {
 
@@ -45,9 +46,26 @@ public:
    MessageFormatter( const MessageFormatter & ) = delete;
    MessageFormatter & operator=( const MessageFormatter & ) = delete;
 
-   int format( const unsigned char * buf, std::ostream & os ) const;
+   // Blob parameters carry their own 32 bit length, so a corrupt or
+   // partially written one could point anywhere. Given the end of the
+   // buffer holding buf, format(), length() and blobs() fail to decode a
+   // blob reaching past it rather than read it.
+   int format( const unsigned char * buf, std::ostream & os,
+               const unsigned char * end = nullptr ) const;
    void formatWallClock( const unsigned char * buf, std::ostream & os ) const;
-   int length( const unsigned char * buf ) const;
+   // whether this is a WCQT message, see QuickTrace::WallClockLineNo
+   bool wallClock() {
+      return lineno() == 0 || lineno() == QuickTrace::WallClockLineNo;
+   }
+   // whether the message starts with the result of gettimeofday(), for
+   // formatWallClock(), rather than only having its tsc
+   bool hasWallClockFields() const { return wallClockFields_; }
+   int length( const unsigned char * buf,
+               const unsigned char * end = nullptr ) const;
+   // the blob parameters in buf, as ( data, length ) pairs
+   std::vector< std::pair< const unsigned char *, uint32_t > >
+   blobs( const unsigned char * buf, const unsigned char * end = nullptr ) const;
+   bool hasBlobs() const { return !blobParams_.empty(); }
 
    using FormatterType =
       std::function< unsigned( const unsigned char *, std::ostream & ) >;
@@ -104,6 +122,8 @@ public:
 
    std::vector< std::pair< FormatterType, const char * > > formatters_;
    std::vector< LengthType > lengths_;
+   std::vector< size_t > blobParams_; // indexes into lengths_
+   bool wallClockFields_ = false;
    std::string tokenizedMsg_;
 };
 } // namespace QuickTrace
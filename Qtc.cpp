@@ -34,6 +34,7 @@ extern "C" {
 #include <QuickTrace/QtcDecl.h>
 
 void *default_hdl = 0;
+int qt_nonTscClock = 0;
 
 void*
 qt_initialize_handle ( char const *filename, char const *sizeStr )
@@ -127,15 +128,25 @@ qt_endMsg ( void *hdl, int level )
    sl.endMsg();
 }
 
+// The clock the handle's file takes its timestamps from, see
+// QuickTrace::ClockSource
+uint64_t
+qt_timestamp ( void *hdl )
+{
+   QuickTrace::TraceHandle *th = (QuickTrace::TraceHandle *)hdl;
+   QuickTrace::TraceFile *tf = th->getFile();
+   return tf ? tf->timestamp() : 0;
+}
+
 void
 qtprof_eob ( void *tmp_var)
 {
    qtprof_t *prof = (qtprof_t *)tmp_var;
    void *hdl = prof->th;
    if( QUICKTRACE_LIKELY( !!( qt_isInitialized(hdl) ) ) ) {
-      uint64_t now = rdtsc();
-      uint64_t delta = now - prof->tsc;
       QuickTrace::TraceHandle *thdl = (QuickTrace::TraceHandle *)hdl;
+      uint64_t now = (thdl->getFile())->timestamp();
+      uint64_t delta = now - prof->tsc;
       QuickTrace::MsgCounter * mc = 
                    (thdl->getFile())->msgCounter( prof->mid );
       mc->tscCount += delta;
@@ -149,9 +160,9 @@ qtproff_eob ( void *tmp_var)
    qtprof_t *prof = (qtprof_t *)tmp_var;
    void *hdl = prof->th;
    if( QUICKTRACE_LIKELY( !!( qt_isInitialized(hdl) ) ) ) {
-      uint64_t now = rdtsc();
-      uint64_t delta = now - prof->tsc;
       QuickTrace::TraceHandle *thdl = (QuickTrace::TraceHandle *)hdl;
+      uint64_t now = (thdl->getFile())->timestamp();
+      uint64_t delta = now - prof->tsc;
       QuickTrace::MsgCounter * mc = 
                    (thdl->getFile())->msgCounter( prof->mid );
       mc->tscCount += delta;
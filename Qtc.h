@@ -264,7 +264,8 @@ static struct ignoreme_ {} ignoreme;
             }                                                               \
         }                                                                   \
         qtvar(_qprof_tmp_var).mid = qtvar(_qt_msgid);                       \
-        qtvar(_qprof_tmp_var).tsc = rdtsc();                                \
+        qtvar(_qprof_tmp_var).tsc = QUICKTRACE_LIKELY( !qt_nonTscClock ) ? \
+                                    rdtsc() : qt_timestamp( hdl );          \
     }                                                                       \
 
 /*
@@ -31,6 +31,10 @@
 #include <stdint.h>
 
 extern void *default_hdl;
+// Set once a TraceHandle of the process takes its timestamps from a clock
+// other than the TSC, until then QPROF reads the TSC without a call to
+// qt_timestamp()
+extern int qt_nonTscClock;
 
 bool qt_initialize_default_handle( char const *filename, char const *sizeStr );
 void *qt_initialize_handle( char const *filename, char const *sizeStr );
@@ -42,6 +46,7 @@ void qt_addMsg( void *dp, const char *msg );
 void qt_finish( void *dp );
 void qt_startMsg( void *hdl, uint64_t *tsc, int id, int level );
 void qt_endMsg( void *hdl, int level );
+uint64_t qt_timestamp( void *hdl );
 void qtprof_eob( void *tmp_var );
 void qtproff_eob( void *tmp_var );
 
@@ -28,12 +28,21 @@
 #include <QuickTrace/Registration.h>
 #include <stdlib.h>
 #include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <cassert>
 #include <climits>
+#include <cmath>
 #include <string.h>
 #include <stdio.h>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
 #include <iomanip>
 #include <ctype.h>
 #include <cstring>
@@ -49,19 +58,44 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <dlfcn.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <fstream>
 #include <unordered_set>
+#include <zlib.h>
 #ifdef QT_USE_ATFORK_LIB
 #include <AtFork/AtFork.h>
 #else
 #include <pthread.h>
 #endif
+#if defined( __SSE2__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#include <immintrin.h>
+// put() switches to the AVX2 versions of stringLength() and copyString()
+// when the CPU has it, see stringAvx2
+#define QT_STRING_AVX2 1
+#elif defined( __SSE2__ )
+#include <emmintrin.h>
+#elif defined( __ARM_NEON )
+#include <arm_neon.h>
+#endif
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <cpuid.h>
+#endif
+#if __has_include( <linux/io_uring.h> ) && defined( __NR_io_uring_setup )
+#include <linux/io_uring.h>
+#define QUICKTRACE_IO_URING 1
+#endif
 
 // A QuickTrace file has the following format:
 // --------------------------------
 // - TraceFileHeader (starts with file version)
-// - 512 MsgCounters by default (can be configured via initialize)
-// - 10 circular RingBufs for the different trace levels
+// - MsgCounters, indexed by message id, 512 of them by default (can be
+//   configured via initialize). Those of the message ids after them are
+//   in the counters file, see MsgCounters.
+// - 10 circular RingBufs for the different trace levels. Each record is
+//     8 byte tsc, 4 byte message id, the arguments,
+//     2 byte thread tag (only when TraceFileFlagSharedRing is set),
+//     1 byte length of the record up to and excluding the length byte
 // - The QuickTraceDict, variable size, containing a sequence of MsgDescs.
 //   Each one looks like this:
 //     "<timestamp> __FILE__ __LINE__ " (ascii)
@@ -72,6 +106,9 @@
 //     byte length of key string
 //     deserialization key, of the form "ddd" for a message with 3 integer params
 
+// See QtcDecl.h, defined with the C API
+extern "C" int qt_nonTscClock;
+
 namespace QuickTrace {
 
 TraceHandle * defaultQuickTraceHandle;
@@ -94,20 +131,17 @@ static constexpr uint32_t SMALL_MEMORY_MAX_SIZE = 512;
 static constexpr uint64_t SMALL_SYSTEM_MEM_SIZE = 0x100000000ULL / 1024;
 #endif
 
-// Touch every page in some file by writing one byte of zero to it and
-// return errno if we failed, 0 otherwise.
-int
-touchEveryPage( int fd, int sz ) noexcept {
-   int data = 0;
-   const int pagesize = 4 * 1024;
-   for( int i = 0; i < sz; i += pagesize ) {
-      lseek( fd, i, SEEK_SET );
-      int err = write( fd, &data, 1 );
-      if( err <= 0 )  return errno;
+static constexpr int pageSize = 4 * 1024;
+
+// Reserve the blocks backing [start, end) of some file and return
+// errno if we failed, 0 otherwise. glibc falls back to writing a byte
+// to every block on filesystems that do not support fallocate().
+static int
+reserveBlocks( int fd, off_t start, off_t end ) noexcept {
+   if( end <= start ) {
+      return 0;
    }
-   lseek( fd, sz-1, SEEK_SET );
-   int err = write( fd, &data, 1 );
-   return (err <= 0) ? errno : 0;
+   return posix_fallocate( fd, start, end - start );
 }
 
 static int getfile( char const * filename, int sz ) noexcept {
@@ -135,12 +169,13 @@ static int getfile( char const * filename, int sz ) noexcept {
                 << ":" << strerror( errno ) << std::endl;
    }
 
-   // If the filesystem is full, then touchEveryPage will fail.
-   // Touching every page up front ensures that we don't get a sigbus
+   // If the filesystem is full, then reserving the blocks will fail.
+   // Reserving every block up front ensures that we don't get a sigbus
    // later when we attempt to allocate memory for the page.
-   err = touchEveryPage( fd, realSize );
+   err = reserveBlocks( fd, 0, realSize );
    if( err ) {
-      std::cerr << "Filesystem full touchEveryPage failed" << std::endl;
+      std::cerr << "Filesystem full reserving " << filename << " failed ("
+                << err << "): " << strerror( err ) << std::endl;
       int rc = ::close( fd );
       assert( rc == 0 );
       unlink( filename );
@@ -151,6 +186,31 @@ static int getfile( char const * filename, int sz ) noexcept {
    return fd;
 }
 
+static uint32_t
+msgCounterStride( MsgCounterLayout layout ) noexcept {
+   return layout == MsgCounterLayout::cacheLineAligned ?
+      MsgCounterCacheLineSize : sizeof( MsgCounter );
+}
+
+// Offset of the first MsgCounter in a file whose header, and TSC offsets
+// if it has them, end at start. Aligned counters start on a cache line of
+// their own.
+static uint32_t
+msgCountersOffset( MsgCounterLayout layout,
+                   uint32_t start = sizeof( TraceFileHeader ) ) noexcept {
+   uint32_t stride = msgCounterStride( layout );
+   return ( start + stride - 1 ) / stride * stride;
+}
+
+// The number of CPUs a file that records CPU ids has TSC offsets for,
+// see TraceFileHeader::tscOffsetsStart: enough for the ids of all the
+// CPUs that can be online, which are not necessarily contiguous
+static uint32_t
+tscOffsetCpus() noexcept {
+   long n = sysconf( _SC_NPROCESSORS_CONF );
+   return std::clamp( n, 1L, ( long )CPU_SETSIZE );
+}
+
 void MsgFormatString::put( char const * ss ) noexcept {
    if( ptr_ != key_ ) { *ptr_++ = ','; }
    ptr_ = (char*)memccpy( ptr_, ss, 0, key_ + keySize - ptr_ );
@@ -159,20 +219,30 @@ void MsgFormatString::put( char const * ss ) noexcept {
 
 MsgDesc::MsgDesc( TraceFile * tf, MsgId *msgIdPtr,
                   char const * file, int line ) noexcept
-      : tf_( tf ),
+      : sharedMutex_( tf->multiThreading_ == MultiThreading::shared ?
+                      &tf->msgDescMutex_ : nullptr ),
+        msgIdPtr_( msgIdPtr ),
+        tf_( tf ),
         buf_( tf->msgDescBuf_ ),
         ptr_( tf->msgDescBuf_ ),
         end_( tf->msgDescBuf_ + MsgDesc::bufSize ),
         formatString_( tf->msgFormatStringKey_ ) {
+   if( sharedMutex_ ) {
+      sharedMutex_->lock();
+   }
    // Message IDs are shared across threads so another thread may have
    // already allocated one for this message.
-   if( 0 == *msgIdPtr ) {
+   id_ = *msgIdPtr;
+   if( 0 == id_ ) {
       tf->traceHandle_->allocateMsgId( msgIdPtr );
+      id_ = *msgIdPtr;
    }
-   id_ = *msgIdPtr;
+   tf->mapMsgCounter( id_ );
 
    // Store the message Id, timestamp, file, and line
-   int n = sprintf( ptr_, "%" PRId64 " %s %d %d ", rdtsc(), file, line, id_ );
+   // The line is unsigned so that WallClockLineNo comes out as such
+   int n = sprintf( ptr_, "%" PRId64 " %s %u %d ", tf->timestamp(), file,
+                    ( unsigned )line, id_ );
    ptr_ += n;
 
    // save room to store the length
@@ -209,6 +279,9 @@ MsgDesc::finish() noexcept {
       }
    }
    tf_->msgIdInitializedIs( id_ );
+   if( sharedMutex_ ) {
+      sharedMutex_->unlock();
+   }
 }
 
 MsgDesc &
@@ -260,116 +333,2663 @@ static double utc() noexcept {
    return tv.tv_sec + 0.000001 * tv.tv_usec;
 }
 
+static inline void
+cpuRelax( int spins ) noexcept {
+   if( spins < 100 ) {
+#if defined( __x86_64__ ) || defined( __i386__ )
+      __builtin_ia32_pause();
+#elif defined( __aarch64__ )
+      asm volatile( "yield" );
+#endif
+   } else {
+      // The writer we are waiting for has most likely been preempted
+      sched_yield();
+   }
+}
+
+// The exact frequency of the counter read by rdtsc(), in Hz, and how it
+// was obtained, or a frequency of 0 when the hardware does not say. On
+// x86 CPUID only describes the TSC frequency when the TSC is invariant,
+// and is only consulted then. Leaf 0x16 is left out, see
+// nominalTscFrequency(). The kernel's own calibration, tsc_khz, is not
+// exported to user space.
+static std::pair< uint64_t, TscFrequencySource >
+exactTscFrequency() noexcept {
+#if defined( QT_RDTSC_MOCK )
+   return { 0, TscFrequencySource() };
+#elif defined( __x86_64__ ) || defined( __i386__ )
+   unsigned eax, ebx, ecx, edx;
+   unsigned maxLeaf = __get_cpuid_max( 0, nullptr );
+   if( __get_cpuid( 1, &eax, &ebx, &ecx, &edx ) && ( ecx & ( 1u << 31 ) ) ) {
+      // Running under a hypervisor, which may have its own timing leaf
+      __cpuid( 0x40000000, eax, ebx, ecx, edx );
+      if( eax >= 0x40000010 ) {
+         __cpuid( 0x40000010, eax, ebx, ecx, edx );
+         if( eax ) {
+            return { ( uint64_t )eax * 1000, TscFrequencyHypervisor };
+         }
+      }
+   }
+   if( !__get_cpuid( 0x80000007, &eax, &ebx, &ecx, &edx ) ||
+       !( edx & ( 1u << 8 ) ) ) {
+      return { 0, TscFrequencySource() };
+   }
+   if( maxLeaf >= 0x15 ) {
+      __cpuid( 0x15, eax, ebx, ecx, edx );
+      if( eax && ebx && ecx ) {
+         return { ( uint64_t )ecx * ebx / eax, TscFrequencyCpuidTsc };
+      }
+   }
+   return { 0, TscFrequencySource() };
+#elif defined( __aarch64__ )
+   uint64_t frequency;
+   asm volatile( "mrs %0, cntfrq_el0" : "=r"( frequency ) );
+   return { frequency, TscFrequencyCntfrq };
+#else
+   return { 0, TscFrequencySource() };
+#endif
+}
+
+// The processor base frequency of CPUID leaf 0x16, in Hz, which an
+// invariant TSC runs at give or take, or 0. It is rounded to the MHz, so
+// it only seeds the provisional calibration, see provisionalSample(), and
+// is never recorded as the TSC frequency.
+static uint64_t
+nominalTscFrequency() noexcept {
+#if !defined( QT_RDTSC_MOCK ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+   unsigned eax, ebx, ecx, edx;
+   if( __get_cpuid_max( 0, nullptr ) < 0x16 ||
+       !__get_cpuid( 0x80000007, &eax, &ebx, &ecx, &edx ) ||
+       !( edx & ( 1u << 8 ) ) ) {
+      return 0;
+   }
+   __cpuid( 0x16, eax, ebx, ecx, edx );
+   return ( uint64_t )eax * 1000000;
+#else
+   return 0;
+#endif
+}
+
+// Set by setRecordCpuId()
+static bool recordCpuId;
+
+static void wakeTscCalibrationThread() noexcept;
+
+void
+setRecordCpuId() noexcept {
+#if defined( __x86_64__ ) || defined( __i386__ )
+   unsigned eax, ebx, ecx, edx;
+   if( !__get_cpuid( 0x80000001, &eax, &ebx, &ecx, &edx ) ||
+       !( edx & ( 1u << 27 ) ) ) {
+      std::cerr << "QuickTrace can not record CPU ids without rdtscp" << std::endl;
+      return;
+   }
+#endif
+   __atomic_store_n( &recordCpuId, true, __ATOMIC_RELAXED );
+   // The calibration thread measures the TSC offsets of the CPUs
+   wakeTscCalibrationThread();
+}
+
+static bool
+pinToCpu( int cpu ) noexcept {
+   cpu_set_t set;
+   CPU_ZERO( &set );
+   CPU_SET( cpu, &set );
+   return pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) == 0;
+}
+
+// measureTscOffset() sends pings from the reference CPU, and a thread
+// pinned to the CPU being measured answers each of them with its TSC.
+struct TscPingPong {
+   enum State { starting, ready, ping, pong, failed };
+   int cpu;
+   int rounds;
+   int state;
+   uint64_t tsc;
+   bool onCpu;
+};
+
+static void *
+tscPongThread( void * arg ) noexcept {
+   TscPingPong * pp = ( TscPingPong * )arg;
+   if( !pinToCpu( pp->cpu ) ) {
+      __atomic_store_n( &pp->state, TscPingPong::failed, __ATOMIC_RELEASE );
+      return nullptr;
+   }
+   __atomic_store_n( &pp->state, TscPingPong::ready, __ATOMIC_RELEASE );
+   for( int i = 0; i < pp->rounds; ++i ) {
+      for( int spins = 0;
+           __atomic_load_n( &pp->state, __ATOMIC_ACQUIRE ) != TscPingPong::ping;
+           ++spins ) {
+         cpuRelax( spins );
+      }
+      uint32_t cpu;
+      pp->tsc = rdtscp( &cpu );
+      pp->onCpu = ( int )cpu == pp->cpu;
+      __atomic_store_n( &pp->state, TscPingPong::pong, __ATOMIC_RELEASE );
+   }
+   return nullptr;
+}
+
+// How many ticks the TSC of cpu is ahead of that of refCpu, which the
+// calling thread is pinned to. Of all the round trips, the one with the
+// lowest latency gives the best estimate: the pong's TSC was read about
+// halfway between sending the ping and getting the pong back.
+static bool
+measureTscOffset( int refCpu, int cpu, int64_t * offset ) noexcept {
+   TscPingPong pp = { cpu, 1000, TscPingPong::starting, 0, false };
+   pthread_t thread;
+   if( pthread_create( &thread, nullptr, tscPongThread, &pp ) ) {
+      return false;
+   }
+   int state;
+   for( int spins = 0;
+        ( state = __atomic_load_n( &pp.state, __ATOMIC_ACQUIRE ) ) ==
+           TscPingPong::starting;
+        ++spins ) {
+      cpuRelax( spins );
+   }
+   uint64_t best = UINT64_MAX;
+   for( int i = 0; state == TscPingPong::ready && i < pp.rounds; ++i ) {
+      uint32_t c0, c2;
+      uint64_t t0 = rdtscp( &c0 );
+      __atomic_store_n( &pp.state, TscPingPong::ping, __ATOMIC_RELEASE );
+      for( int spins = 0;
+           __atomic_load_n( &pp.state, __ATOMIC_ACQUIRE ) != TscPingPong::pong;
+           ++spins ) {
+         cpuRelax( spins );
+      }
+      uint64_t t2 = rdtscp( &c2 );
+      if( pp.onCpu && ( int )c0 == refCpu && ( int )c2 == refCpu &&
+          t2 - t0 < best ) {
+         best = t2 - t0;
+         *offset = ( int64_t )( pp.tsc - t0 - ( t2 - t0 ) / 2 );
+      }
+   }
+   pthread_join( thread, nullptr );
+   return best != UINT64_MAX;
+}
+
+// Measure the TSC offsets of all the CPUs the calling thread may run on,
+// relative to the first of them. Returns the reference CPU.
+static uint32_t
+measureTscOffsets( std::vector< int64_t > * offsets ) noexcept {
+   offsets->assign( tscOffsetCpus(), 0 );
+   cpu_set_t allowed;
+   if( sched_getaffinity( 0, sizeof( allowed ), &allowed ) ) {
+      return 0;
+   }
+   int refCpu = 0;
+   while( refCpu < CPU_SETSIZE && !CPU_ISSET( refCpu, &allowed ) ) {
+      ++refCpu;
+   }
+   if( refCpu == CPU_SETSIZE || !pinToCpu( refCpu ) ) {
+      return 0;
+   }
+   for( int cpu = refCpu + 1; cpu < ( int )offsets->size(); ++cpu ) {
+      if( CPU_ISSET( cpu, &allowed ) &&
+          !measureTscOffset( refCpu, cpu, &( *offsets )[ cpu ] ) ) {
+         ( *offsets )[ cpu ] = 0;
+      }
+   }
+   pthread_setaffinity_np( pthread_self(), sizeof( allowed ), &allowed );
+   return refCpu;
+}
+
+// A calibration point, along with CLOCK_MONOTONIC_RAW for the TraceFiles
+// whose timestamps come from it rather than the TSC
+struct ClockSample {
+   CalibrationPoint point;
+   uint64_t monotonicRaw;
+};
+
+// Samples the TSC, the monotonic clock and the wall clock together. The
+// TSC is read on both sides of the clocks, and the tightest of a few
+// tries is kept, so that a preemption does not skew the sample.
+static ClockSample
+sampleClocks() noexcept {
+   ClockSample best = {};
+   uint64_t bestWindow = UINT64_MAX;
+   for( int i = 0; i < 3; ++i ) {
+      uint64_t before = rdtsc();
+      double mt = monotime();
+      double ut = utc();
+      uint64_t raw = monotonicRawNs();
+      uint64_t after = rdtsc();
+      if( after - before < bestWindow ) {
+         bestWindow = after - before;
+         best = { { before + ( after - before ) / 2, mt, ut }, raw };
+      }
+   }
+   return best;
+}
+
+// The calibration point of sample for a TraceFile with the given clock
+// source. CLOCK_MONOTONIC_COARSE is CLOCK_MONOTONIC as of the last tick,
+// so it is converted from the monotonic time rather than read.
+static CalibrationPoint
+calibrationPoint( ClockSample const & sample, ClockSource source ) noexcept {
+   CalibrationPoint point = sample.point;
+   if( source == ClockSourceMonotonicRaw ) {
+      point.tsc = sample.monotonicRaw;
+   } else if( source == ClockSourceMonotonicCoarse ) {
+      point.tsc = llround( point.monotime * 1e9 );
+   }
+   return point;
+}
+
+// TSC calibration, shared by all the TraceFiles of the process. Readers
+// convert TSCs to time with tsc0/monotime0 and a later tsc1/monotime1
+// sample, which have to be far enough apart for the TSC rate to be
+// accurate. Rather than every TraceFile spinning until that is the case,
+// the first TraceFile of the process takes tsc0/monotime0 for all of them
+// and starts a thread that fills in tsc1/monotime1 of the TraceFiles
+// created so far once calibrationInterval has passed. Later TraceFiles
+// fill them in straight away. Until then the TraceFiles hold a
+// provisional sample, see provisionalSample(), so that what they trace
+// can be read straight away, even if the process dies before the
+// calibration is done.
+//
+// The thread then keeps checking the clocks, every calibrationCheckPeriod
+// at first. When the TSC rate has drifted, or the wall clock has been
+// stepped, by more than calibrationTolerance since the last calibration
+// point, it adds a new point to every TraceFile, see
+// TraceFileHeader::calibrationPoints. Each check that finds the clocks
+// within calibrationTolerance doubles the period, up to
+// calibrationMaxCheckPeriod, so that a steady clock costs next to no
+// wakeups.
+//
+// The state is never destroyed, as the thread may still be running while
+// the process exits.
+struct TscCalibration {
+   std::mutex mutex;
+   // Wakes the thread before the period is over, see
+   // wakeTscCalibrationThread()
+   std::condition_variable wake;
+   ClockSample start = {};
+   // See provisionalSample()
+   ClockSample provisional = {};
+   // Set under the mutex, read without it, see TscCalibrationStart
+   bool started = false;
+   bool threadRunning = false;
+   bool atExitRegistered = false;
+   bool exiting = false;
+   // Set once calibrationInterval has passed, read without the mutex
+   bool done = false;
+   // See exactTscFrequency() and nominalTscFrequency()
+   std::pair< uint64_t, TscFrequencySource > frequency;
+   uint64_t nominalFrequency = 0;
+   // See measureTscOffsets(), only measured once a TraceFile records
+   // CPU ids
+   bool offsetsMeasured = false;
+   uint32_t refCpu = 0;
+   std::vector< int64_t > offsets;
+   // The last two calibration points added to the TraceFiles
+   ClockSample prev = {};
+   ClockSample last = {};
+   std::vector< TraceFile * > traceFiles;
+};
+
+static constexpr double calibrationInterval = 0.1;
+static constexpr double calibrationCheckPeriod = 1.0;
+static constexpr double calibrationMaxCheckPeriod = 64.0;
+static constexpr double calibrationTolerance = 0.00005;
+static constexpr double provisionalCalibrationInterval = 0.001;
+
+static TscCalibration &
+tscCalibration() noexcept {
+   static TscCalibration * calibration = new TscCalibration;
+   return *calibration;
+}
+
+// Has the thread look at recordCpuId, and the clocks, now
+static void
+wakeTscCalibrationThread() noexcept {
+   TscCalibration & c = tscCalibration();
+   std::lock_guard< std::mutex > lock( c.mutex );
+   c.wake.notify_one();
+}
+
+// Called with the mutex held
+static void
+finishTscCalibration( TscCalibration & c ) noexcept {
+   if( c.done ) {
+      return;
+   }
+   c.prev = c.start;
+   c.last = sampleClocks();
+   for( TraceFile * tf : c.traceFiles ) {
+      tf->calibrate( calibrationPoint( c.prev, tf->clockSource() ),
+                     calibrationPoint( c.last, tf->clockSource() ) );
+   }
+   __atomic_store_n( &c.done, true, __ATOMIC_RELEASE );
+}
+
+// Adds a calibration point to every TraceFile if the clocks no longer
+// follow the last two points, and returns whether it did. Called with
+// the mutex held.
+static bool
+maybeAddCalibrationPoint( TscCalibration & c ) noexcept {
+   ClockSample sample = sampleClocks();
+   CalibrationPoint const & now = sample.point;
+   CalibrationPoint const & last = c.last.point;
+   CalibrationPoint const & prev = c.prev.point;
+   double rate = ( last.monotime - prev.monotime ) /
+                 ( double )( last.tsc - prev.tsc );
+   double drift = now.monotime - last.monotime -
+                  ( double )( now.tsc - last.tsc ) * rate;
+   double step = ( now.utc - now.monotime ) - ( last.utc - last.monotime );
+   if( fabs( drift ) <= calibrationTolerance &&
+       fabs( step ) <= calibrationTolerance ) {
+      return false;
+   }
+   for( TraceFile * tf : c.traceFiles ) {
+      tf->addCalibrationPoint( calibrationPoint( sample, tf->clockSource() ) );
+   }
+   c.prev = c.last;
+   c.last = sample;
+   return true;
+}
+
+static void
+sleepFor( double seconds ) noexcept {
+   struct timespec ts = { ( time_t )seconds,
+                          ( long )( ( seconds - ( time_t )seconds ) * 1000000000 ) };
+   while( nanosleep( &ts, &ts ) < 0 && errno == EINTR ) {
+   }
+}
+
+// Measures the TSC offsets if CPU ids are recorded and they have not
+// been measured yet, and hands them to the TraceFiles recording CPU ids.
+// Called without the mutex held, as the measurement takes a while.
+static void
+maybeMeasureTscOffsets( TscCalibration & c ) noexcept {
+   if( !__atomic_load_n( &recordCpuId, __ATOMIC_RELAXED ) || c.offsetsMeasured ) {
+      return;
+   }
+   std::vector< int64_t > offsets;
+   uint32_t refCpu = measureTscOffsets( &offsets );
+   std::lock_guard< std::mutex > lock( c.mutex );
+   c.offsets = std::move( offsets );
+   c.refCpu = refCpu;
+   c.offsetsMeasured = true;
+   for( TraceFile * tf : c.traceFiles ) {
+      tf->tscOffsetsIs( c.refCpu, c.offsets );
+   }
+}
+
+static void *
+tscCalibrationThread( void * ) noexcept {
+   TscCalibration & c = tscCalibration();
+   // Before the files are calibrated, so that readers get the offsets
+   // along with the calibration
+   maybeMeasureTscOffsets( c );
+   double remaining = c.start.point.monotime + calibrationInterval - monotime();
+   if( remaining > 0 ) {
+      sleepFor( remaining );
+   }
+   double period = calibrationCheckPeriod;
+   for( ;; ) {
+      maybeMeasureTscOffsets( c );
+      std::unique_lock< std::mutex > lock( c.mutex );
+      if( c.exiting ) {
+         return nullptr;
+      }
+      if( !c.done ) {
+         finishTscCalibration( c );
+      } else if( maybeAddCalibrationPoint( c ) ) {
+         period = calibrationCheckPeriod;
+      } else {
+         period = std::min( 2 * period, calibrationMaxCheckPeriod );
+      }
+      c.wake.wait_for( lock, std::chrono::duration< double >( period ) );
+   }
+}
+
+// A process that exits before calibrationInterval has passed still
+// leaves calibrated files behind, just with a shorter interval. The
+// thread leaves the TraceFiles alone from then on.
+static void
+finishTscCalibrationAtExit() noexcept {
+   TscCalibration & c = tscCalibration();
+   std::lock_guard< std::mutex > lock( c.mutex );
+   finishTscCalibration( c );
+   c.exiting = true;
+   c.wake.notify_one();
+}
+
+// What the first TraceFile of the process starts the calibration with:
+// tsc0/monotime0, the frequencies, and a sample calibrationInterval past
+// start for the TraceFiles to hold until they are calibrated. Measuring
+// the sample can take provisionalCalibrationInterval, so it is taken
+// before the mutex, and the TraceFiles that lose the race to publish
+// theirs throw it away.
+struct TscCalibrationStart {
+   ClockSample start;
+   std::pair< uint64_t, TscFrequencySource > frequency;
+   uint64_t nominalFrequency;
+   ClockSample provisional;
+};
+
+// The TSC rate of the provisional sample is the exact frequency where it
+// is known, then the nominal one, and is otherwise measured over
+// provisionalCalibrationInterval since start, which the first TraceFile
+// of the process then waits out.
+static ClockSample
+provisionalSample( TscCalibrationStart const & c ) noexcept {
+   CalibrationPoint const & start = c.start.point;
+   double rate = ( double )( c.frequency.first ?: c.nominalFrequency );
+   if( !rate ) {
+      CalibrationPoint now;
+      do {
+         now = sampleClocks().point;
+      } while( now.monotime - start.monotime < provisionalCalibrationInterval );
+      rate = ( double )( now.tsc - start.tsc ) / ( now.monotime - start.monotime );
+   }
+   ClockSample sample = c.start;
+   sample.point.tsc += std::max( ( uint64_t )( rate * calibrationInterval ),
+                                 ( uint64_t )1 );
+   sample.point.monotime += calibrationInterval;
+   sample.point.utc += calibrationInterval;
+   sample.monotonicRaw += ( uint64_t )( calibrationInterval * 1e9 );
+   return sample;
+}
+
+static TscCalibrationStart
+sampleTscCalibrationStart() noexcept {
+   TscCalibrationStart s;
+   s.start = sampleClocks();
+   s.frequency = exactTscFrequency();
+   s.nominalFrequency = nominalTscFrequency();
+   s.provisional = provisionalSample( s );
+   return s;
+}
+
+// Publishes start, taken without the mutex unless null, as tsc0/monotime0
+// for the process and starts the calibration thread, unless that was
+// already done. Called with the mutex held.
+static void
+maybeStartTscCalibration( TscCalibration & c,
+                          TscCalibrationStart const * start ) noexcept {
+   if( !c.started ) {
+      TscCalibrationStart s = start ? *start : sampleTscCalibrationStart();
+      c.start = s.start;
+      c.frequency = s.frequency;
+      c.nominalFrequency = s.nominalFrequency;
+      c.provisional = s.provisional;
+      __atomic_store_n( &c.started, true, __ATOMIC_RELEASE );
+   }
+   if( !c.atExitRegistered ) {
+      c.atExitRegistered = true;
+      atexit( finishTscCalibrationAtExit );
+   }
+   if( c.threadRunning || c.exiting ) {
+      return;
+   }
+   pthread_t thread;
+   pthread_attr_t attr;
+   pthread_attr_init( &attr );
+   pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+   int err = pthread_create( &thread, &attr, tscCalibrationThread, nullptr );
+   pthread_attr_destroy( &attr );
+   if( err ) {
+      // The files are still calibrated when they are closed
+      std::cerr << "QuickTrace failed to start the TSC calibration thread ("
+                << err << "): " << strerror( err ) << std::endl;
+      return;
+   }
+   c.threadRunning = true;
+}
+
 int qtMaxStringLen = 24;
 
 static SizeSpec defaultTraceFileSizes = { 8,8,8,8,8,8,8,8,8,8 }; // in Kilobytes
 
-void saveOldFiles( char const * path ) noexcept {
-   char old[256];
-   char oldest[256];
-   int old_len = snprintf( old, sizeof(old), "%s.1.gz", path );
-   int oldest_len = snprintf( oldest, sizeof(oldest), "%s.2.gz", path );
+// Copies the bytes of srcFd from from up to size to the same offsets of
+// destFd within the kernel, with copy_file_range(), or sendfile() on
+// older kernels and across filesystems. Only makes system calls, so that
+// it can run in a signal handler. Returns false, with errno set, if the
+// copy failed.
+static bool
+copyFileData( int srcFd, int destFd, off_t size, off_t from = 0 ) noexcept {
+   loff_t offset = from;
+   bool useSendfile = false;
+   while( offset < size ) {
+      ssize_t n;
+      if( !useSendfile ) {
+         loff_t destOffset = offset;
+         n = copy_file_range( srcFd, &offset, destFd, &destOffset,
+                              size - offset, 0 );
+         if( n == -1 && offset == from &&
+             ( errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+               errno == EOPNOTSUPP ) ) {
+            useSendfile = true;
+            if( lseek( destFd, from, SEEK_SET ) < 0 ) {
+               return false;
+            }
+            continue;
+         }
+      } else {
+         n = sendfile( destFd, srcFd, &offset, size - offset );
+      }
+      if( n <= 0 ) {
+         return false;
+      }
+   }
+   return true;
+}
+
+// Copies the memory file of a memory-only TraceFile (see
+// setMemoryOnlyTraceFiles()) to path, through tmpPath so that path is
+// replaced in one go. Can run in a signal handler.
+static bool
+persistMemoryFile( int fd, char const * path, char const * tmpPath ) noexcept {
+   struct stat st;
+   if( fstat( fd, &st ) != 0 ) {
+      return false;
+   }
+   int destFd = open( tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+   if( destFd < 0 ) {
+      return false;
+   }
+   bool ok = copyFileData( fd, destFd, st.st_size );
+   ::close( destFd );
+   if( !ok || rename( tmpPath, path ) != 0 ) {
+      unlink( tmpPath );
+      return false;
+   }
+   return true;
+}
+
+// Rotated files are path.1 (the most recent) to path.<generations>, each
+// of which may have been compressed to path.<k>.gz. path.0 is the file
+// the TraceFile moved out of its way, which rotateFile() then moves to
+// path.1.
+static std::string
+generationName( std::string const & path, uint32_t k ) noexcept {
+   return path + "." + std::to_string( k );
+}
+
+// Where the memory file of the trace file at path is copied to, by
+// persistTraceFiles(), TraceFile::persist() and the crash handler. The
+// trace file stays a link to the memory file, so that the rings can still
+// be read live.
+static std::string
+snapshotPath( std::string const & path ) noexcept {
+   return path + ".snapshot";
+}
+
+// The file of generation k, compressed or not, empty when there is none
+static std::string
+generationFile( std::string const & path, uint32_t k ) noexcept {
+   std::string name = generationName( path, k );
+   if( access( name.c_str(), F_OK ) == 0 ) {
+      return name;
+   }
+   name += ".gz";
+   return access( name.c_str(), F_OK ) == 0 ? name : std::string();
+}
+
+static void
+removeGeneration( std::string const & path, uint32_t k ) noexcept {
+   std::string name = generationName( path, k );
+   unlink( name.c_str() );                // may get ENOENT, but we don't care
+   unlink( ( name + ".gz" ).c_str() );    // may get ENOENT, but we don't care
+}
+
+// Moves generation from to generation to, replacing it
+static void
+moveGeneration( std::string const & path, uint32_t from, uint32_t to ) noexcept {
+   std::string file = generationFile( path, from );
+   if( file.empty() ) {
+      return;
+   }
+   bool compressed = file.size() > 3 &&
+                     file.compare( file.size() - 3, 3, ".gz" ) == 0;
+   removeGeneration( path, to );
+   std::string target = generationName( path, to ) + ( compressed ? ".gz" : "" );
+   rename( file.c_str(), target.c_str() );
+}
 
-   bool old_is_gz = access( old, F_OK ) == 0; // Is the old file (.1) compressed ?
+// A path.0 that is a link to the memory file of a memory-only TraceFile
+// is replaced with a copy of it, the memory file being removed. The link
+// is just removed once the memory file is gone, with a reboot.
+static void
+persistGeneration0( std::string const & path ) noexcept {
+   std::string staged = generationName( path, 0 );
+   struct stat st;
+   if( lstat( staged.c_str(), &st ) != 0 || !S_ISLNK( st.st_mode ) ) {
+      return;
+   }
+   char target[ PATH_MAX ];
+   ssize_t n = readlink( staged.c_str(), target, sizeof( target ) - 1 );
+   int fd = open( staged.c_str(), O_RDONLY | O_CLOEXEC );
+   if( fd < 0 ) {
+      unlink( staged.c_str() );
+      return;
+   }
+   bool ok = persistMemoryFile( fd, staged.c_str(), ( staged + ".tmp" ).c_str() );
+   ::close( fd );
+   if( !ok ) {
+      std::cerr << "QuickTrace failed to persist " << staged << ": "
+                << strerror( errno ) << std::endl;
+      return;
+   }
+   if( n > 0 ) {
+      target[ n ] = '\0';
+      unlink( target );
+   }
+}
 
-   // Remove .gz extension
-   if( !old_is_gz ) {
-      old[ old_len - 3 ] = '\0';
+// Moves path.0 to path.1, making room for it. With keepOldest, the
+// oldest generation stays once all generations exist, and the one
+// before it is dropped instead, so that the file of the first of a
+// series of crashes survives the restarts that follow.
+static void
+rotateGenerations( std::string const & path,
+                   RotationPolicy const & policy ) noexcept {
+   uint32_t n = policy.generations;
+   persistGeneration0( path );
+   if( generationFile( path, 0 ).empty() ) {
+      return;
+   }
+   if( n == 0 ) {
+      removeGeneration( path, 0 );
+      return;
+   }
+   uint32_t last = n;
+   if( policy.keepOldest && n > 1 && !generationFile( path, n ).empty() ) {
+      last = n - 1;
    }
+   for( uint32_t k = last - 1; k >= 1; --k ) {
+      moveGeneration( path, k, k + 1 );
+   }
+   moveGeneration( path, 0, 1 );
+}
+
+// Set by setRotatedFileCompression(), 0 when rotated files are kept as is
+static int rotatedFileCompressionLevel;
+
+void
+setRotatedFileCompression( int level ) noexcept {
+   level = std::max( 0, std::min( level, Z_BEST_COMPRESSION ) );
+   __atomic_store_n( &rotatedFileCompressionLevel, level, __ATOMIC_RELAXED );
+}
+
+// The generations are renamed while the TraceFile is created, before
+// it traces anything, the rotated files are then pruned and compressed
+// by a background thread, so that an agent restarting in a loop does
+// not pay for it on startup. The thread runs at idle I/O priority, so
+// as not to compete for the disk with the processes doing real work. A
+// file is only removed once its compressed copy is complete, so a
+// compression that does not finish before the process exits is just
+// done again by the next rotation.
+//
+// The forever log backups of a TraceFile whose foreverLogPath is its
+// own path are written to the same path.<k> names. The thread only
+// touches the files that were there when the generations were renamed,
+// which it tells apart from the backups written since by their inode,
+// and it checks and removes or replaces them with the mutex held, which
+// the renames and the creation of a backup take as well.
+//
+// The state is never destroyed, as the thread may still be running while
+// the process exits.
+struct FileRotations {
+   // A rotated file, generation k of the job's path
+   struct File {
+      uint32_t k;
+      bool compressed;
+      dev_t dev;
+      ino_t ino;
+   };
+   struct Job {
+      std::string path;
+      RotationPolicy policy;
+      std::vector< File > files;
+   };
+   std::mutex mutex;
+   // Signalled when a job is queued
+   std::condition_variable queued;
+   std::deque< Job > jobs;
+   bool threadRunning = false;
+};
+
+static FileRotations &
+fileRotations() noexcept {
+   static FileRotations * rotations = new FileRotations;
+   return *rotations;
+}
 
-   if( access( oldest, F_OK ) == -1 ) {
-      // The oldest file (.2) is not compressed
-      oldest[ oldest_len - 3 ] = '\0';
+static std::string
+rotatedFileName( std::string const & path, FileRotations::File const & f ) noexcept {
+   return generationName( path, f.k ) + ( f.compressed ? ".gz" : "" );
+}
+
+// Whether name is still the rotated file f. Called with the mutex held.
+static bool
+isRotatedFile( std::string const & name, FileRotations::File const & f ) noexcept {
+   struct stat st;
+   return lstat( name.c_str(), &st ) == 0 && st.st_dev == f.dev &&
+          st.st_ino == f.ino;
+}
 
-      if( access( oldest, F_OK ) == -1 ) {
-         // The oldest file (.2) does not exist
-         if( old_is_gz ) {
-            oldest[ oldest_len - 3 ] = '.';
+// The rotated files of path, as they are right after the rotation: the
+// generations up to policy.generations, and those beyond, left by a
+// policy that kept more. Called with the mutex held.
+static std::vector< FileRotations::File >
+rotatedFiles( std::string const & path, RotationPolicy const & policy ) noexcept {
+   std::vector< FileRotations::File > files;
+   for( uint32_t k = 1;; ++k ) {
+      std::string file = generationFile( path, k );
+      struct stat st;
+      if( file.empty() || lstat( file.c_str(), &st ) != 0 ) {
+         if( k > policy.generations ) {
+            break;
          }
+         continue;
+      }
+      bool compressed = file.size() > 3 &&
+                        file.compare( file.size() - 3, 3, ".gz" ) == 0;
+      files.push_back( { k, compressed, st.st_dev, st.st_ino } );
+   }
+   return files;
+}
+
+// Removes the rotated file f, unless it was replaced since
+static void
+removeRotatedFile( FileRotations & r, std::string const & path,
+                   FileRotations::File const & f ) noexcept {
+   std::string name = rotatedFileName( path, f );
+   std::lock_guard< std::mutex > lock( r.mutex );
+   if( isRotatedFile( name, f ) ) {
+      unlink( name.c_str() );
+   }
+}
+
+// Removes the rotated files beyond policy.generations, and those older
+// than policy.maxAgeSeconds. With budget, also removes the oldest ones
+// until all of them use at most policy.maxTotalBytes on disk. The files
+// removed are dropped from files.
+static void
+pruneGenerations( FileRotations & r, std::string const & path,
+                  RotationPolicy const & policy,
+                  std::vector< FileRotations::File > & files,
+                  bool budget ) noexcept {
+   time_t now = time( nullptr );
+   std::vector< uint64_t > used;
+   uint64_t total = 0;
+   for( auto it = files.begin(); it != files.end(); ) {
+      struct stat st;
+      if( it->k > policy.generations ||
+          ( policy.maxAgeSeconds &&
+            stat( rotatedFileName( path, *it ).c_str(), &st ) == 0 &&
+            now - st.st_mtime > policy.maxAgeSeconds ) ) {
+         removeRotatedFile( r, path, *it );
+         it = files.erase( it );
+         continue;
+      }
+      // Trace files are sparse, it is the blocks that count
+      used.push_back( stat( rotatedFileName( path, *it ).c_str(), &st ) == 0 ?
+                      uint64_t( st.st_blocks ) * 512 : 0 );
+      total += used.back();
+      ++it;
+   }
+   if( !budget || !policy.maxTotalBytes ) {
+      return;
+   }
+   // The files are in the order of their generations, the oldest last
+   for( size_t i = files.size(); i > 0 && total > policy.maxTotalBytes; --i ) {
+      removeRotatedFile( r, path, files[ i - 1 ] );
+      total -= used[ i - 1 ];
+      files.pop_back();
+   }
+}
+
+// Compresses the rotated file f to its .gz, going through .gz.tmp so
+// that a partially written file never looks like a rotated one
+static void
+compressRotatedFile( FileRotations & r, std::string const & path,
+                     FileRotations::File & f, int level ) noexcept {
+   std::string name = rotatedFileName( path, f );
+   int in = open( name.c_str(), O_RDONLY | O_CLOEXEC );
+   if( in < 0 ) {
+      return; // may get ENOENT, but we don't care
+   }
+   struct stat compressed;
+   if( fstat( in, &compressed ) != 0 || compressed.st_dev != f.dev ||
+       compressed.st_ino != f.ino ) {
+      // A forever log backup took its name since
+      ::close( in );
+      return;
+   }
+   std::string gzPath = name + ".gz";
+   std::string tmpPath = gzPath + ".tmp";
+   char mode[] = { 'w', 'b', char( '0' + level ), '\0' };
+   gzFile out = gzopen( tmpPath.c_str(), mode );
+   if( !out ) {
+      std::cerr << "QuickTrace failed to create " << tmpPath << ": "
+                << strerror( errno ) << std::endl;
+      ::close( in );
+      return;
+   }
+   std::vector< char > buf( 256 * 1024 );
+   bool ok = true;
+   for( ;; ) {
+      ssize_t n = read( in, buf.data(), buf.size() );
+      if( n < 0 && errno == EINTR ) {
+         continue;
+      }
+      if( n <= 0 ) {
+         ok = n == 0;
+         break;
+      }
+      if( gzwrite( out, buf.data(), n ) != n ) {
+         ok = false;
+         break;
+      }
+   }
+   ::close( in );
+   if( gzclose( out ) != Z_OK || !ok ) {
+      unlink( tmpPath.c_str() );
+      return;
+   }
+   std::lock_guard< std::mutex > lock( r.mutex );
+   struct stat gz;
+   // The file may have been rotated meanwhile, by this process or
+   // another one
+   if( !isRotatedFile( name, f ) || rename( tmpPath.c_str(), gzPath.c_str() ) != 0 ||
+       stat( gzPath.c_str(), &gz ) != 0 ) {
+      unlink( tmpPath.c_str() );
+      return;
+   }
+   unlink( name.c_str() );
+   f.compressed = true;
+   f.dev = gz.st_dev;
+   f.ino = gz.st_ino;
+}
+
+static void
+compressGenerations( FileRotations & r, FileRotations::Job & job ) noexcept {
+   int level = __atomic_load_n( &rotatedFileCompressionLevel, __ATOMIC_RELAXED );
+   if( !level ) {
+      return;
+   }
+   for( FileRotations::File & f : job.files ) {
+      if( !f.compressed ) {
+         compressRotatedFile( r, job.path, f, level );
+      }
+   }
+}
+
+static void *
+fileRotationThread( void * ) noexcept {
+   // Idle I/O class and lowest CPU priority, both of which apply to the
+   // calling thread only (see ioprio_set(2) and setpriority(2))
+   constexpr int ioprioWhoProcess = 1;
+   constexpr int ioprioClassIdle = 3;
+   constexpr int ioprioClassShift = 13;
+   syscall( SYS_ioprio_set, ioprioWhoProcess, 0,
+            ioprioClassIdle << ioprioClassShift );
+   setpriority( PRIO_PROCESS, syscall( SYS_gettid ), 19 );
+
+   FileRotations & r = fileRotations();
+   std::unique_lock< std::mutex > lock( r.mutex );
+   for( ;; ) {
+      r.queued.wait( lock, [ &r ] { return !r.jobs.empty(); } );
+      FileRotations::Job job = std::move( r.jobs.front() );
+      r.jobs.pop_front();
+      lock.unlock();
+      pruneGenerations( r, job.path, job.policy, job.files, false );
+      compressGenerations( r, job );
+      pruneGenerations( r, job.path, job.policy, job.files, true );
+      lock.lock();
+   }
+   return nullptr;
+}
 
-         // We rename the old (.1) to the oldest (.2) only if the last doesn't exist
-         // to keep the first log file if the agent restarts many times.
-         // (Please refer to the README, Section 2.5: Turning QuickTrace on)
-         rename( old, oldest ); // may get ENOENT, but we don't care        
+// Queues the pruning and compression of the files rotated by
+// rotateFile() to the thread, which is started unless it is already
+// running. Called with the mutex held.
+static void
+queueFileRotation( FileRotations & r, std::unique_lock< std::mutex > & lock,
+                   FileRotations::Job job ) noexcept {
+   if( !r.threadRunning ) {
+      pthread_t thread;
+      pthread_attr_t attr;
+      pthread_attr_init( &attr );
+      pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+      int err = pthread_create( &thread, &attr, fileRotationThread, nullptr );
+      pthread_attr_destroy( &attr );
+      if( err ) {
+         // The files are then pruned here, and left uncompressed
+         std::cerr << "QuickTrace failed to start the file rotation thread ("
+                   << err << "): " << strerror( err ) << std::endl;
+         lock.unlock();
+         pruneGenerations( r, job.path, job.policy, job.files, true );
+         return;
       }
+      r.threadRunning = true;
+   }
+   r.jobs.push_back( std::move( job ) );
+   lock.unlock();
+   r.queued.notify_one();
+}
+
+// Moves path out of the way of the file that replaces it, and rotates
+// its generations, before the file is created. When the file is
+// memory-only, the memory file of the previous process, which path
+// links to, is the file being replaced: path.0 is then a link to it,
+// which the rotation replaces with a copy. Once the memory file is gone,
+// with a reboot, the snapshot of it persisted last, if any, is the file
+// being replaced instead.
+static void
+rotateFile( std::string const & path, RotationPolicy const & policy,
+            std::string const & memoryPath ) noexcept {
+   FileRotations & r = fileRotations();
+   std::unique_lock< std::mutex > lock( r.mutex );
+   std::string staged = generationName( path, 0 );
+   // Left behind by a process that died while rotating the files, which
+   // is moved out of the way first
+   rotateGenerations( path, policy );
+   std::string rotatedMemoryPath = memoryPath + ".0";
+   std::string snapshot = snapshotPath( path );
+   struct stat target;
+   if( !memoryPath.empty() &&
+       rename( memoryPath.c_str(), rotatedMemoryPath.c_str() ) == 0 ) {
+      unlink( path.c_str() ); // may get ENOENT, but we don't care
+      unlink( staged.c_str() ); // may get ENOENT, but we don't care
+      symlink( rotatedMemoryPath.c_str(), staged.c_str() );
+   } else if( stat( path.c_str(), &target ) != 0 &&
+              rename( snapshot.c_str(), staged.c_str() ) == 0 ) {
+      // The memory file path linked to is gone, with a reboot, and what
+      // was persisted of it is all that is left
+      unlink( path.c_str() ); // may get ENOENT, but we don't care
+   } else {
+      rename( path.c_str(), staged.c_str() ); // may get ENOENT, but we don't care
+   }
+   // Older than the memory file, if any is left
+   unlink( snapshot.c_str() ); // may get ENOENT, but we don't care
+   rotateGenerations( path, policy );
+   FileRotations::Job job = { path, policy, rotatedFiles( path, policy ) };
+   queueFileRotation( r, lock, std::move( job ) );
+}
+
+
+// The memory-only TraceFiles (see setMemoryOnlyTraceFiles()), which the
+// crash handler persists. A slot is in use when its fd is set, which is
+// done last, and the handler reads the slots without the mutex.
+//
+// The state is never destroyed, as the handler may still run while the
+// process exits.
+struct MemoryTraceFiles {
+   static constexpr int maxFiles = 64;
+   struct File {
+      // The descriptor of the memory file, -1 when the slot is free
+      int fd = -1;
+      // Where the memory file is copied to, see snapshotPath()
+      char path[ PATH_MAX ];
+      char tmpPath[ PATH_MAX ];
+   };
+   static constexpr int crashSignals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE,
+                                           SIGABRT };
+   static constexpr int numCrashSignals = sizeof( crashSignals ) / sizeof( int );
+   std::mutex mutex;
+   // Where the memory files go, empty when the TraceFiles are on disk
+   std::string dir;
+   bool persistOnCrash = false;
+   bool handlerInstalled = false;
+   // The actions the crash handler replaced, in the order of crashSignals
+   struct sigaction previous[ numCrashSignals ];
+   File files[ maxFiles ];
+};
+
+static MemoryTraceFiles &
+memoryTraceFiles() noexcept {
+   static MemoryTraceFiles * files = new MemoryTraceFiles;
+   return *files;
+}
+
+void
+setMemoryOnlyTraceFiles( char const * dir, bool persistOnCrash ) noexcept {
+   MemoryTraceFiles & m = memoryTraceFiles();
+   std::lock_guard< std::mutex > lock( m.mutex );
+   m.dir = dir ? dir : "";
+   m.persistOnCrash = persistOnCrash;
+}
+
+// The memory file of the trace file at path, empty when the TraceFiles
+// are on disk. Named after the absolute path of the trace file, so that
+// the next process to create the trace file finds it.
+static std::string
+memoryFilePath( std::string const & path ) noexcept {
+   MemoryTraceFiles & m = memoryTraceFiles();
+   std::lock_guard< std::mutex > lock( m.mutex );
+   if( m.dir.empty() ) {
+      return std::string();
+   }
+   std::string absolute = path;
+   char cwd[ PATH_MAX ];
+   if( path[ 0 ] != '/' && getcwd( cwd, sizeof( cwd ) ) ) {
+      absolute = std::string( cwd ) + "/" + path;
+   }
+   // FNV-1a, which unlike std::hash is the same in every process
+   uint64_t hash = 14695981039346656037ull;
+   for( char c : absolute ) {
+      hash = ( hash ^ uint8_t( c ) ) * 1099511628211ull;
+   }
+   char suffix[ 24 ];
+   snprintf( suffix, sizeof( suffix ), "-%016" PRIx64, hash );
+   std::string::size_type slash = path.rfind( '/' );
+   return m.dir + "/quicktrace-" +
+          path.substr( slash == std::string::npos ? 0 : slash + 1 ) + suffix;
+}
+
+static void
+persistOnCrash( int sig, siginfo_t * info, void * context ) noexcept {
+   MemoryTraceFiles & m = memoryTraceFiles();
+   int savedErrno = errno;
+   for( MemoryTraceFiles::File & f : m.files ) {
+      int fd = __atomic_load_n( &f.fd, __ATOMIC_ACQUIRE );
+      if( fd >= 0 ) {
+         persistMemoryFile( fd, f.path, f.tmpPath );
+      }
+   }
+   errno = savedErrno;
+   struct sigaction const * previous = nullptr;
+   for( int i = 0; i < MemoryTraceFiles::numCrashSignals; ++i ) {
+      if( MemoryTraceFiles::crashSignals[ i ] == sig ) {
+         previous = &m.previous[ i ];
+      }
+   }
+   if( !previous ) {
+      return;
+   }
+   // Chain to the handler we replaced, with the siginfo of the signal
+   if( previous->sa_flags & SA_SIGINFO ) {
+      previous->sa_sigaction( sig, info, context );
+      return;
+   }
+   if( previous->sa_handler != SIG_DFL && previous->sa_handler != SIG_IGN ) {
+      previous->sa_handler( sig );
+      return;
+   }
+   // Otherwise let the default action deal with the signal. A fault
+   // happens again once the handler returns, with its own siginfo, a
+   // signal sent by a process has to be sent again.
+   sigaction( sig, previous, nullptr );
+   if( info->si_code <= 0 ) {
+      raise( sig );
+   }
+}
+
+
+// Links path to the memory file of a TraceFile, and registers it with
+// the crash handler. Returns the slot of the file, -1 if none is free.
+static int
+registerMemoryFile( int fd, std::string const & memoryPath,
+                    std::string const & path ) noexcept {
+   std::string link = path + ".link";
+   unlink( link.c_str() ); // may get ENOENT, but we don't care
+   if( symlink( memoryPath.c_str(), link.c_str() ) != 0 ||
+       rename( link.c_str(), path.c_str() ) != 0 ) {
+      std::cerr << "QuickTrace failed to link " << path << " to " << memoryPath
+                << ": " << strerror( errno ) << std::endl;
+   }
+   MemoryTraceFiles & m = memoryTraceFiles();
+   std::lock_guard< std::mutex > lock( m.mutex );
+   if( m.persistOnCrash && !m.handlerInstalled ) {
+      struct sigaction sa = {};
+      sa.sa_sigaction = persistOnCrash;
+      sa.sa_flags = SA_SIGINFO;
+      sigemptyset( &sa.sa_mask );
+      for( int i = 0; i < MemoryTraceFiles::numCrashSignals; ++i ) {
+         sigaction( MemoryTraceFiles::crashSignals[ i ], &sa, &m.previous[ i ] );
+      }
+      m.handlerInstalled = true;
+   }
+   std::string snapshot = snapshotPath( path );
+   std::string tmpPath = snapshot + ".tmp";
+   for( int i = 0; i < MemoryTraceFiles::maxFiles; ++i ) {
+      MemoryTraceFiles::File & f = m.files[ i ];
+      if( f.fd >= 0 ) {
+         continue;
+      }
+      if( snapshot.size() >= sizeof( f.path ) ||
+          tmpPath.size() >= sizeof( f.tmpPath ) ) {
+         return -1;
+      }
+      strcpy( f.path, snapshot.c_str() );
+      strcpy( f.tmpPath, tmpPath.c_str() );
+      __atomic_store_n( &f.fd, fd, __ATOMIC_RELEASE );
+      return i;
+   }
+   std::cerr << "QuickTrace cannot persist " << path << " on a crash, more than "
+             << MemoryTraceFiles::maxFiles << " memory-only files" << std::endl;
+   return -1;
+}
+
+// Frees the slot of the memory file fd, unless a forked child freed it
+// and reused it since
+static void
+unregisterMemoryFile( int slot, int fd ) noexcept {
+   MemoryTraceFiles & m = memoryTraceFiles();
+   std::lock_guard< std::mutex > lock( m.mutex );
+   if( m.files[ slot ].fd == fd ) {
+      __atomic_store_n( &m.files[ slot ].fd, -1, __ATOMIC_RELEASE );
+   }
+}
+
+void
+TraceFile::persist() noexcept {
+   if( memoryFile_ < 0 ) {
+      return;
+   }
+   MemoryTraceFiles::File & f = memoryTraceFiles().files[ memoryFile_ ];
+   if( !persistMemoryFile( fd_, f.path, f.tmpPath ) ) {
+      std::cerr << "QuickTrace failed to persist " << fileName_ << ": "
+                << strerror( errno ) << std::endl;
+   }
+}
+
+void
+persistTraceFiles() noexcept {
+   MemoryTraceFiles & m = memoryTraceFiles();
+   std::lock_guard< std::mutex > lock( m.mutex );
+   for( MemoryTraceFiles::File & f : m.files ) {
+      if( f.fd >= 0 && !persistMemoryFile( f.fd, f.path, f.tmpPath ) ) {
+         std::cerr << "QuickTrace failed to persist " << f.path << ": "
+                   << strerror( errno ) << std::endl;
+      }
+   }
+}
+
+// Set by setIncrementalForeverLog()
+static bool incrementalForeverLog;
+
+void
+setIncrementalForeverLog() noexcept {
+   __atomic_store_n( &incrementalForeverLog, true, __ATOMIC_RELAXED );
+}
+
+struct RingBufHeader {
+   uint32_t tailPtr;
+};
+
+class IoEngine;
+
+// The incremental forever log archive of a TraceFile, see
+// TraceFile::archiveLevel(), or the copy of the file its full forever log
+// backups are taken from, see TraceFile::backupLevel(). Only used by the
+// forever log backup thread, and by the TraceFile when it goes away.
+struct ForeverLogArchive {
+   // The process the TraceFile belongs to, a child process leaves the
+   // archive alone
+   pid_t pid = getpid();
+   // The archive, or the copy of the file
+   int fd = -1;
+   uint64_t size = 0;
+   // File offset up to which the message descriptors have been archived
+   off_t dictEnd = 0;
+   // The last TraceFileHeader archived
+   TraceFileHeader header = {};
+   std::vector< char > buf;
+   // How far each level was archived: up to offset in the ring, in the
+   // lap the writer started after wrapping lap times, having committed
+   // bytes bytes in the laps before, see RingSequence
+   struct Level {
+      uint64_t lap = 0;
+      uint64_t bytes = 0;
+      uint32_t offset = sizeof( RingBufHeader );
+      // Bytes the writer overwrote before they were archived
+      uint64_t lost = 0;
+   } levels[ TraceFile::NumTraceLevels ];
+   // The records copied from the rings, which go to the archive as the
+   // chunks of lap lap of level, at offset in the ring, see copyLevel()
+   struct Chunk {
+      int level;
+      uint64_t lap;
+      uint32_t offset;
+      uint32_t size;
+      size_t pos;
+   };
+   std::vector< Chunk > chunks;
+   std::vector< char > batch;
+   // Where the chunks go, when they are not written right away
+   IoEngine * io = nullptr;
+};
+
+// Size from which the next chunk goes to a new archive
+static constexpr uint64_t maxArchiveSize = 64 * 1024 * 1024;
+
+// The forever log backups of a TraceFile, see maybeBackupBuffer()
+struct ForeverLogBackup {
+   // The backups queued for the TraceFile, counted by the traces, and
+   // those the thread is done with, counted under
+   // ForeverLogBackups::mutex
+   uint32_t queued = 0;
+   uint32_t done = 0;
+};
+
+// Forever-log backups are copied by a background thread, so that the
+// trace that completes a quarter of a ring only pays for queueing a job.
+// The jobs live in a fixed array of slots, as queueing must not allocate,
+// and are handed over without a lock: a trace claims a position in the
+// queue by moving tail, fills in the slot and publishes it through the
+// slot's sequence number, and posts the semaphore, all of which can be
+// done from any thread, or a signal handler. A TraceFile waits for its
+// pending backups before it goes away, so that they can point at it.
+// When the array is full, the job is dropped and counted, and the thread
+// reports the count: the next job of the ring copies what the dropped one
+// would have, and the records the writer overwrote before then are
+// reported as lost.
+//
+// The state is never destroyed, as the thread may still be running while
+// the process exits.
+struct ForeverLogBackups {
+   static constexpr uint32_t maxJobs = 64;
+   struct Job {
+      TraceFile * traceFile;
+      ForeverLogBackup * backup;
+      // The ring to copy, to the incremental forever log or not
+      int level;
+      bool incremental;
+   };
+   // Holds the job of position pos in the queue once seq is pos + 1, and
+   // is free for position pos + maxJobs once seq is that
+   struct Slot {
+      uint32_t seq;
+      Job job;
+   };
+   ForeverLogBackups() noexcept {
+      reset();
+   }
+   void reset() noexcept {
+      for( uint32_t i = 0; i < maxJobs; ++i ) {
+         slots[ i ].seq = i;
+      }
+      head = tail = done = dropped = 0;
+      sem_init( &queued, 0, 0 );
+   }
+   Slot slots[ maxJobs ];
+   // The next position the thread takes, and the next one a trace claims
+   uint32_t head;
+   uint32_t tail;
+   // Posted for every job queued
+   sem_t queued;
+   // Guards done, and ForeverLogBackup::done, for those waiting for
+   // backups
+   std::mutex mutex;
+   // Signalled when a job is done
+   std::condition_variable copied;
+   // The jobs the thread is done with, tail once it caught up
+   uint32_t done;
+   // The jobs dropped since the thread last reported them
+   uint32_t dropped;
+   bool threadRunning = false;
+   bool atExitRegistered = false;
+};
+
+static ForeverLogBackups &
+foreverLogBackups() noexcept {
+   static ForeverLogBackups * backups = new ForeverLogBackups;
+   return *backups;
+}
+
+// Queues job for the thread, unless the queue is full
+static bool
+queueForeverLogBackup( ForeverLogBackups & b,
+                       ForeverLogBackups::Job const & job ) noexcept {
+   uint32_t pos = __atomic_load_n( &b.tail, __ATOMIC_RELAXED );
+   ForeverLogBackups::Slot * slot;
+   for( ;; ) {
+      slot = &b.slots[ pos % ForeverLogBackups::maxJobs ];
+      uint32_t seq = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE );
+      int32_t diff = ( int32_t )( seq - pos );
+      if( diff < 0 ) {
+         // The thread has yet to take the job maxJobs positions back
+         return false;
+      }
+      if( diff == 0 &&
+          __atomic_compare_exchange_n( &b.tail, &pos, pos + 1, true,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED ) ) {
+         break;
+      }
+      if( diff > 0 ) {
+         // Another trace claimed pos
+         pos = __atomic_load_n( &b.tail, __ATOMIC_RELAXED );
+      }
+   }
+   slot->job = job;
+   __atomic_store_n( &slot->seq, pos + 1, __ATOMIC_RELEASE );
+   sem_post( &b.queued );
+   return true;
+}
+
+// Called by the thread once it is done with job
+static void
+foreverLogBackupDone( ForeverLogBackups & b,
+                      ForeverLogBackups::Job const & job ) noexcept {
+   std::lock_guard< std::mutex > lock( b.mutex );
+   ++job.backup->done;
+   ++b.done;
+   b.copied.notify_all();
+}
+
+static void
+runForeverLogBackup( ForeverLogBackups::Job const & job ) noexcept {
+   if( job.incremental ) {
+      job.traceFile->archiveLevel( job.level );
+   } else {
+      job.traceFile->backupLevel( job.level );
+   }
+}
+
+static void *
+foreverLogBackupThread( void * ) noexcept {
+   ForeverLogBackups & b = foreverLogBackups();
+   for( ;; ) {
+      while( sem_wait( &b.queued ) < 0 && errno == EINTR ) {
+      }
+      // The job of a later position may have been published first,
+      // wait for the one at head
+      ForeverLogBackups::Slot & slot =
+         b.slots[ b.head % ForeverLogBackups::maxJobs ];
+      for( int spins = 0;
+           __atomic_load_n( &slot.seq, __ATOMIC_ACQUIRE ) != b.head + 1; ++spins ) {
+         cpuRelax( spins );
+      }
+      ForeverLogBackups::Job job = slot.job;
+      __atomic_store_n( &slot.seq, b.head + ForeverLogBackups::maxJobs,
+                        __ATOMIC_RELEASE );
+      ++b.head;
+      uint32_t dropped = __atomic_exchange_n( &b.dropped, 0, __ATOMIC_RELAXED );
+      if( dropped ) {
+         std::cerr << "QuickTrace dropped " << dropped << " forever log "
+                   << "backup jobs, the backup thread is not keeping up"
+                   << std::endl;
+      }
+      runForeverLogBackup( job );
+      foreverLogBackupDone( b, job );
+   }
+   return nullptr;
+}
+
+// Waits until the thread has copied the backups queued for backup, or
+// all of them if backup is null
+static void
+waitForForeverLogBackups( ForeverLogBackup * backup ) noexcept {
+   ForeverLogBackups & b = foreverLogBackups();
+   std::unique_lock< std::mutex > lock( b.mutex );
+   b.copied.wait( lock, [ &b, backup ] {
+      if( backup ) {
+         return backup->done == __atomic_load_n( &backup->queued, __ATOMIC_ACQUIRE );
+      }
+      return b.done == __atomic_load_n( &b.tail, __ATOMIC_ACQUIRE );
+   } );
+}
+
+void
+waitForForeverLogBackups() noexcept {
+   waitForForeverLogBackups( nullptr );
+}
+
+// The backups queued when the process exits are still copied
+static void
+waitForForeverLogBackupsAtExit() noexcept {
+   waitForForeverLogBackups( nullptr );
+}
+
+// Starts the backup thread unless it is already running. Called with
+// the mutex held.
+static void
+maybeStartForeverLogBackupThread( ForeverLogBackups & b ) noexcept {
+   if( b.threadRunning ) {
+      return;
+   }
+   if( !b.atExitRegistered ) {
+      b.atExitRegistered = true;
+      atexit( waitForForeverLogBackupsAtExit );
+   }
+   pthread_t thread;
+   pthread_attr_t attr;
+   pthread_attr_init( &attr );
+   pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+   int err = pthread_create( &thread, &attr, foreverLogBackupThread, nullptr );
+   pthread_attr_destroy( &attr );
+   if( err ) {
+      // The rings are then copied by the trace that queues the job
+      std::cerr << "QuickTrace failed to start the forever log backup thread ("
+                << err << "): " << strerror( err ) << std::endl;
+      return;
+   }
+   __atomic_store_n( &b.threadRunning, true, __ATOMIC_RELEASE );
+}
+
+void
+TraceFile::maybeBackupBuffer( RingBuf * rb ) noexcept {
+   if( !traceHandle_->foreverLog() ) {
+      return;
+   }
+
+   const std::string &foreverLogPath = traceHandle_->foreverLogPath();
+   if( foreverLogPath.empty() ) {
+      return;
+   }
+
+   if( foreverLogPath.find( "null" ) != std::string::npos ) {
+      std::cerr << "EventMon Buffer Full.  Backups Disabled. Rolling Over";
+      return;
+   }
+
+   if( !archive_ || rb < log_ || rb >= log_ + NumTraceLevels ) {
+      return;
+   }
+   // The thread copies the records committed up to when it gets to it
+   ForeverLogBackups & b = foreverLogBackups();
+   ForeverLogBackups::Job job = { this, backup_, int( rb - log_ ),
+                                  traceHandle_->foreverLogIncremental() };
+   bool running = __atomic_load_n( &b.threadRunning, __ATOMIC_ACQUIRE );
+   if( QUICKTRACE_UNLIKELY( !running ) ) {
+      // Started along with the TraceHandle, but not in a child process
+      std::lock_guard< std::mutex > lock( b.mutex );
+      maybeStartForeverLogBackupThread( b );
+   }
+   if( !__atomic_load_n( &b.threadRunning, __ATOMIC_ACQUIRE ) ) {
+      // The thread could not be started
+      runForeverLogBackup( job );
+   } else {
+      __atomic_add_fetch( &backup_->queued, 1, __ATOMIC_RELEASE );
+      if( !queueForeverLogBackup( b, job ) ) {
+         // The disk is not keeping up, the next job of the ring does it
+         __atomic_sub_fetch( &backup_->queued, 1, __ATOMIC_RELEASE );
+         __atomic_add_fetch( &b.dropped, 1, __ATOMIC_RELAXED );
+      }
+   }
+}
+
+static bool
+pwriteAll( int fd, void const * data, size_t len, off_t offset ) noexcept {
+   char const * p = ( char const * )data;
+   while( len ) {
+      ssize_t n = pwrite( fd, p, len, offset );
+      if( n < 0 && errno == EINTR ) {
+         continue;
+      }
+      if( n <= 0 ) {
+         return false;
+      }
+      p += n;
+      len -= n;
+      offset += n;
+   }
+   return true;
+}
+
+// Batches the writes of the stream thread, so that it does not make a
+// system call per write, or even per TraceFile. The data is queued in a
+// buffer registered with io_uring, and flush() submits the whole queue
+// with a single io_uring_enter() per ring full of operations, then the
+// syncs of the segments sealed meanwhile, whose writes are all done by
+// then. The syncs are not waited for: they complete while the thread
+// goes on, and are reaped by the next flush(). Without io_uring, as the
+// kernel is too old or does not allow it, or it was not asked for,
+// flush() writes the queue with pwrite() instead, and syncSealed() syncs
+// the segments once the thread is done with the TraceFiles.
+class IoEngine {
+ public:
+   explicit IoEngine( bool ioUring ) noexcept;
+   ~IoEngine() noexcept;
+   // Room for size bytes to be written to fd at offset, null when the
+   // buffer cannot hold them even once flushed
+   char * append( int fd, uint64_t offset, size_t size ) noexcept;
+   // Syncs fd once the writes queued before are done, and closes it
+   void seal( int fd ) noexcept;
+   // Carries out the writes queued, and waits for them
+   void flush() noexcept;
+   // Syncs and closes the segments sealed that flush() did not hand to
+   // io_uring, which takes a while
+   void syncSealed() noexcept;
+   // Whether a write to fd failed since the last call, and the offset of
+   // the first one that did, which is where a chunk starts
+   bool failed( int fd, uint64_t & offset ) noexcept;
+   bool ioUring() const noexcept;
+
+ private:
+   struct Op {
+      int fd;
+      // Sync and close fd rather than write to it
+      bool seal;
+      bool done;
+      uint64_t offset;
+      size_t pos;
+      size_t size;
+   };
+   static constexpr size_t bufSize = 4 * 1024 * 1024;
+   void finish( Op & op, int res ) noexcept;
+   void cutFailed( int fd ) noexcept;
+   void closeSealed( int fd, int res ) noexcept;
+   void flushSync( size_t from ) noexcept;
+   std::vector< Op > ops_;
+   char * buf_;
+   size_t used_ = 0;
+   // The segments sealed whose sync has not been submitted yet
+   std::vector< int > sealed_;
+   // The fds whose writes failed, with the offset of the first that did
+   std::vector< std::pair< int, uint64_t > > failed_;
+#ifdef QUICKTRACE_IO_URING
+   static constexpr unsigned ringEntries = 64;
+   // Marks the user_data of a sync, the rest of which is the fd, rather
+   // than the index of a write in ops_
+   static constexpr uint64_t syncTag = 1ULL << 63;
+   bool setUpRing() noexcept;
+   void tearDownRing() noexcept;
+   bool flushRing() noexcept;
+   io_uring_sqe * sqe( unsigned tail, unsigned n ) noexcept;
+   bool submit( unsigned tail, unsigned n, bool wait ) noexcept;
+   void reap() noexcept;
+   void drainRing() noexcept;
+   int ringFd_ = -1;
+   // buf_ is registered with the ring
+   bool fixed_ = false;
+   void * sqRing_ = MAP_FAILED;
+   size_t sqRingSize_ = 0;
+   void * cqRing_ = MAP_FAILED;
+   size_t cqRingSize_ = 0;
+   io_uring_sqe * sqes_ = ( io_uring_sqe * )MAP_FAILED;
+   size_t sqesSize_ = 0;
+   unsigned sqEntries_ = 0;
+   unsigned cqEntries_ = 0;
+   unsigned * sqTail_ = nullptr;
+   unsigned sqMask_ = 0;
+   unsigned * sqArray_ = nullptr;
+   unsigned * cqHead_ = nullptr;
+   unsigned * cqTail_ = nullptr;
+   unsigned cqMask_ = 0;
+   io_uring_cqe * cqes_ = nullptr;
+   // The writes submitted and not completed yet
+   unsigned writing_ = 0;
+   // The fds whose sync was submitted and has not completed yet
+   std::vector< int > syncing_;
+#endif
+};
+
+IoEngine::IoEngine( bool ioUring ) noexcept {
+   void * m = mmap( 0, bufSize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+   buf_ = m == MAP_FAILED ? nullptr : ( char * )m;
+#ifdef QUICKTRACE_IO_URING
+   if( ioUring && buf_ && !setUpRing() ) {
+      tearDownRing();
+   }
+#endif
+}
+
+IoEngine::~IoEngine() noexcept {
+   flush();
+#ifdef QUICKTRACE_IO_URING
+   drainRing();
+   tearDownRing();
+#endif
+   syncSealed();
+   if( buf_ ) {
+      munmap( buf_, bufSize );
+   }
+}
+
+char *
+IoEngine::append( int fd, uint64_t offset, size_t size ) noexcept {
+   if( !buf_ || size > bufSize ) {
+      return nullptr;
+   }
+   if( used_ + size > bufSize ) {
+      flush();
+   }
+   char * p = buf_ + used_;
+   Op * last = ops_.empty() ? nullptr : &ops_.back();
+   if( last && last->fd == fd && !last->seal &&
+       last->offset + last->size == offset && last->pos + last->size == used_ ) {
+      last->size += size;
+   } else {
+      ops_.push_back( { fd, false, false, offset, used_, size } );
+   }
+   used_ += size;
+   return p;
+}
+
+void
+IoEngine::seal( int fd ) noexcept {
+   ops_.push_back( { fd, true, false, 0, 0, 0 } );
+}
+
+bool
+IoEngine::failed( int fd, uint64_t & offset ) noexcept {
+   for( auto i = failed_.begin(); i != failed_.end(); ++i ) {
+      if( i->first == fd ) {
+         offset = i->second;
+         failed_.erase( i );
+         return true;
+      }
+   }
+   return false;
+}
+
+bool
+IoEngine::ioUring() const noexcept {
+#ifdef QUICKTRACE_IO_URING
+   return ringFd_ >= 0;
+#else
+   return false;
+#endif
+}
+
+// Completes the write op, whose result, as returned by the kernel, is
+// res. A write that failed or was cut short is done over with pwrite().
+// Once a write to the fd failed, the ones after it are not made, see
+// failed().
+void
+IoEngine::finish( Op & op, int res ) noexcept {
+   op.done = true;
+   for( auto const & f : failed_ ) {
+      if( f.first == op.fd ) {
+         return;
+      }
+   }
+   size_t written = res > 0 ? res : 0;
+   if( written < op.size &&
+       !pwriteAll( op.fd, buf_ + op.pos + written, op.size - written,
+                   op.offset + written ) ) {
+      std::cerr << "QuickTrace failed to write the streaming log: "
+                << strerror( errno ) << std::endl;
+      failed_.emplace_back( op.fd, op.offset );
+   }
+}
+
+// Cuts the segment fd, sealed and so done with, back to the chunks
+// before its first write that failed, like archiveFailed(). That also
+// forgets the failure, which must not be blamed on the next segment to
+// get the same fd.
+void
+IoEngine::cutFailed( int fd ) noexcept {
+   uint64_t offset;
+   if( failed( fd, offset ) && ftruncate( fd, offset ) != 0 ) {
+      std::cerr << "QuickTrace failed to truncate the streaming log: "
+                << strerror( errno ) << std::endl;
+   }
+}
+
+// Closes the segment fd once its sync, whose result is res, is done
+void
+IoEngine::closeSealed( int fd, int res ) noexcept {
+   if( res < 0 ) {
+      std::cerr << "QuickTrace failed to sync the streaming log: "
+                << strerror( -res ) << std::endl;
+   }
+   ::close( fd );
+}
+
+// Carries out the writes from ops_[ from ] on that are not done yet, one
+// system call at a time, and leaves the syncs of the seals to
+// syncSealed()
+void
+IoEngine::flushSync( size_t from ) noexcept {
+   for( size_t i = from; i < ops_.size(); ++i ) {
+      Op & op = ops_[ i ];
+      if( op.done ) {
+         continue;
+      }
+      if( op.seal ) {
+         op.done = true;
+         sealed_.push_back( op.fd );
+      } else {
+         finish( op, 0 );
+      }
+   }
+}
+
+void
+IoEngine::flush() noexcept {
+#ifdef QUICKTRACE_IO_URING
+   if( ringFd_ >= 0 && flushRing() ) {
+      ops_.clear();
+      used_ = 0;
+      return;
+   }
+#endif
+   flushSync( 0 );
+   ops_.clear();
+   used_ = 0;
+}
+
+void
+IoEngine::syncSealed() noexcept {
+#ifdef QUICKTRACE_IO_URING
+   if( ringFd_ >= 0 ) {
+      // Submitted by flush()
+      return;
+   }
+#endif
+   for( int fd : sealed_ ) {
+      cutFailed( fd );
+      closeSealed( fd, fdatasync( fd ) ? -errno : 0 );
+   }
+   sealed_.clear();
+}
+
+#ifdef QUICKTRACE_IO_URING
+// Maps the rings of a new io_uring instance, and registers buf_ with it.
+// Fails where the kernel does not support io_uring, or a seccomp filter
+// or the io_uring_disabled sysctl keeps processes from using it.
+bool
+IoEngine::setUpRing() noexcept {
+   io_uring_params p = {};
+   ringFd_ = syscall( __NR_io_uring_setup, ringEntries, &p );
+   if( ringFd_ < 0 ) {
+      return false;
+   }
+   sqEntries_ = p.sq_entries;
+   cqEntries_ = p.cq_entries;
+   sqRingSize_ = p.sq_off.array + p.sq_entries * sizeof( unsigned );
+   cqRingSize_ = p.cq_off.cqes + p.cq_entries * sizeof( io_uring_cqe );
+   bool singleMmap = p.features & IORING_FEAT_SINGLE_MMAP;
+   if( singleMmap ) {
+      sqRingSize_ = cqRingSize_ = std::max( sqRingSize_, cqRingSize_ );
+   }
+   sqRing_ = mmap( 0, sqRingSize_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING );
+   if( sqRing_ == MAP_FAILED ) {
+      return false;
+   }
+   if( singleMmap ) {
+      cqRing_ = sqRing_;
+   } else {
+      cqRing_ = mmap( 0, cqRingSize_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_CQ_RING );
+      if( cqRing_ == MAP_FAILED ) {
+         return false;
+      }
+   }
+   sqesSize_ = p.sq_entries * sizeof( io_uring_sqe );
+   sqes_ = ( io_uring_sqe * )mmap( 0, sqesSize_, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, ringFd_,
+                                   IORING_OFF_SQES );
+   if( sqes_ == MAP_FAILED ) {
+      return false;
+   }
+   char * sq = ( char * )sqRing_;
+   sqTail_ = ( unsigned * )( sq + p.sq_off.tail );
+   sqMask_ = *( unsigned * )( sq + p.sq_off.ring_mask );
+   sqArray_ = ( unsigned * )( sq + p.sq_off.array );
+   char * cq = ( char * )cqRing_;
+   cqHead_ = ( unsigned * )( cq + p.cq_off.head );
+   cqTail_ = ( unsigned * )( cq + p.cq_off.tail );
+   cqMask_ = *( unsigned * )( cq + p.cq_off.ring_mask );
+   cqes_ = ( io_uring_cqe * )( cq + p.cq_off.cqes );
+   // The pages of a registered buffer are pinned once rather than for
+   // every write. That counts against RLIMIT_MEMLOCK on older kernels,
+   // and the writes then copy from the buffer like write() does.
+   struct iovec iov = { buf_, bufSize };
+   fixed_ = syscall( __NR_io_uring_register, ringFd_, IORING_REGISTER_BUFFERS,
+                     &iov, 1 ) == 0;
+   return true;
+}
+
+void
+IoEngine::tearDownRing() noexcept {
+   if( sqes_ != MAP_FAILED ) {
+      munmap( sqes_, sqesSize_ );
+      sqes_ = ( io_uring_sqe * )MAP_FAILED;
+   }
+   if( cqRing_ != MAP_FAILED && cqRing_ != sqRing_ ) {
+      munmap( cqRing_, cqRingSize_ );
+   }
+   cqRing_ = MAP_FAILED;
+   if( sqRing_ != MAP_FAILED ) {
+      munmap( sqRing_, sqRingSize_ );
+      sqRing_ = MAP_FAILED;
+   }
+   if( ringFd_ >= 0 ) {
+      ::close( ringFd_ );
+      ringFd_ = -1;
+   }
+}
+
+// The n'th entry of the submission queue from tail, cleared
+io_uring_sqe *
+IoEngine::sqe( unsigned tail, unsigned n ) noexcept {
+   unsigned index = ( tail + n ) & sqMask_;
+   sqArray_[ index ] = index;
+   io_uring_sqe * e = &sqes_[ index ];
+   memset( e, 0, sizeof( *e ) );
+   return e;
+}
+
+// Submits the n entries from tail, and if wait is set, waits for the
+// writes in flight. Gives up on the ring if the kernel refuses it, once
+// the operations it already took are done, as they use buf_ and the fds.
+bool
+IoEngine::submit( unsigned tail, unsigned n, bool wait ) noexcept {
+   __atomic_store_n( sqTail_, tail + n, __ATOMIC_RELEASE );
+   while( n || ( wait && writing_ ) ) {
+      int r = syscall( __NR_io_uring_enter, ringFd_, n, wait && writing_ ? 1 : 0,
+                       IORING_ENTER_GETEVENTS, nullptr, 0 );
+      if( r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY ) {
+         std::cerr << "QuickTrace failed to submit the streaming log writes ("
+                   << errno << "): " << strerror( errno ) << std::endl;
+         drainRing();
+         tearDownRing();
+         return false;
+      }
+      if( r > 0 ) {
+         n -= r;
+      }
+      reap();
+   }
+   return true;
+}
+
+// Completes the operations the kernel is done with
+void
+IoEngine::reap() noexcept {
+   unsigned head = *cqHead_;
+   unsigned cqTail = __atomic_load_n( cqTail_, __ATOMIC_ACQUIRE );
+   for( ; head != cqTail; ++head ) {
+      io_uring_cqe const & cqe = cqes_[ head & cqMask_ ];
+      if( cqe.user_data & syncTag ) {
+         int fd = ( int )( cqe.user_data & ~syncTag );
+         syncing_.erase( std::find( syncing_.begin(), syncing_.end(), fd ) );
+         closeSealed( fd, cqe.res );
+      } else {
+         --writing_;
+         finish( ops_[ cqe.user_data ], cqe.res );
+      }
+   }
+   __atomic_store_n( cqHead_, head, __ATOMIC_RELEASE );
+}
+
+// Waits for the operations in flight. Should even that fail, buf_ is
+// left to the kernel, which may still be reading it, and the writes
+// queued go on in a copy of it. The fds are closed, the kernel holding
+// on to the files of the syncs.
+void
+IoEngine::drainRing() noexcept {
+   while( ringFd_ >= 0 && ( writing_ || !syncing_.empty() ) ) {
+      int r = syscall( __NR_io_uring_enter, ringFd_, 0, 1, IORING_ENTER_GETEVENTS,
+                       nullptr, 0 );
+      if( r < 0 && errno != EINTR ) {
+         if( writing_ ) {
+            void * m = mmap( 0, bufSize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+            if( m != MAP_FAILED ) {
+               memcpy( m, buf_, used_ );
+               buf_ = ( char * )m;
+            }
+            writing_ = 0;
+         }
+         for( int fd : syncing_ ) {
+            ::close( fd );
+         }
+         syncing_.clear();
+         return;
+      }
+      reap();
+   }
+}
+
+// Submits the writes queued, as many at a time as the ring holds, and
+// waits for them, then the syncs of the segments sealed, which only
+// follow their own writes rather than drain the ring, and are reaped by
+// a later call. Leaves the operations to flushSync() if the kernel
+// refuses the ring.
+bool
+IoEngine::flushRing() noexcept {
+   reap();
+   for( size_t next = 0; next < ops_.size(); ) {
+      unsigned tail = *sqTail_;
+      unsigned n = 0;
+      for( ; next < ops_.size() && n < sqEntries_; ++next ) {
+         Op & op = ops_[ next ];
+         if( op.seal ) {
+            op.done = true;
+            sealed_.push_back( op.fd );
+            continue;
+         }
+         io_uring_sqe * e = sqe( tail, n++ );
+         e->opcode = fixed_ ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+         e->fd = op.fd;
+         e->addr = ( uint64_t )( buf_ + op.pos );
+         e->len = op.size;
+         e->off = op.offset;
+         e->user_data = next;
+      }
+      writing_ += n;
+      if( !submit( tail, n, true ) ) {
+         return false;
+      }
+   }
+   // The completion queue holds those of a ring full of writes, and
+   // of the syncs in flight
+   while( !sealed_.empty() && syncing_.size() + sqEntries_ < cqEntries_ ) {
+      unsigned tail = *sqTail_;
+      unsigned n = 0;
+      while( !sealed_.empty() && n < sqEntries_ &&
+             syncing_.size() + sqEntries_ < cqEntries_ ) {
+         int fd = sealed_.back();
+         sealed_.pop_back();
+         // The writes to it are done
+         cutFailed( fd );
+         io_uring_sqe * e = sqe( tail, n++ );
+         e->opcode = IORING_OP_FSYNC;
+         e->fd = fd;
+         e->fsync_flags = IORING_FSYNC_DATASYNC;
+         e->user_data = syncTag | ( uint64_t )fd;
+         syncing_.push_back( fd );
+      }
+      if( !submit( tail, n, false ) ) {
+         return false;
+      }
+   }
+   return true;
+}
+#endif
+
+// Whether the IoEngine of the archive failed to write to it. The archive
+// is then cut back to the chunks before the first write that failed, so
+// that it has no hole, and closed, for the next chunk to start another
+// one.
+static bool
+archiveFailed( ForeverLogArchive & a ) noexcept {
+   uint64_t offset;
+   if( a.fd < 0 || !a.io || !a.io->failed( a.fd, offset ) ) {
+      return false;
+   }
+   if( ftruncate( a.fd, offset ) != 0 ) {
+      std::cerr << "QuickTrace failed to truncate the archive: "
+                << strerror( errno ) << std::endl;
+   }
+   ::close( a.fd );
+   a.fd = -1;
+   return true;
+}
+
+// Appends headSize bytes from head and size bytes from data to the
+// archive, through the IoEngine of the stream thread if it has one, in a
+// single write so that the writes start at a chunk, see archiveFailed()
+static bool
+archiveWrite( ForeverLogArchive & a, void const * head, size_t headSize,
+              void const * data = nullptr, size_t size = 0 ) noexcept {
+   if( a.io ) {
+      if( char * p = a.io->append( a.fd, a.size, headSize + size ) ) {
+         memcpy( p, head, headSize );
+         if( size ) {
+            memcpy( p + headSize, data, size );
+         }
+         a.size += headSize + size;
+         return true;
+      }
+      // Too large for the buffer, written after what is queued
+      a.io->flush();
+      if( archiveFailed( a ) ) {
+         return false;
+      }
+   }
+   if( !pwriteAll( a.fd, head, headSize, a.size ) ||
+       ( size && !pwriteAll( a.fd, data, size, a.size + headSize ) ) ) {
+      return false;
+   }
+   a.size += headSize + size;
+   return true;
+}
+
+// Appends a chunk to the archive, which is closed if that fails
+static void
+archiveChunk( ForeverLogArchive & a, ArchiveChunkType type, uint32_t level,
+              void const * data, uint64_t size ) noexcept {
+   if( a.fd < 0 ) {
+      return;
+   }
+   ArchiveChunkHeader hdr = { type, level, size };
+   if( !archiveWrite( a, &hdr, sizeof( hdr ), data, size ) && a.fd >= 0 ) {
+      std::cerr << "QuickTrace failed to write the archive: "
+                << strerror( errno ) << std::endl;
+      ::close( a.fd );
+      a.fd = -1;
+   }
+}
+
+// Starts the archive at path, which gets the whole dictionary first.
+// The archive is left closed if that fails.
+static bool
+openArchive( ForeverLogArchive & a, char const * path,
+             TraceFileHeader const * hdr ) noexcept {
+   a.fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+   if( a.fd < 0 ) {
+      std::cerr << "QuickTrace failed to create the archive " << path << ": "
+                << strerror( errno ) << std::endl;
+      return false;
+   }
+   a.size = 0;
+   if( !archiveWrite( a, ArchiveMagic, sizeof( ArchiveMagic ) ) ) {
+      ::close( a.fd );
+      a.fd = -1;
+      return false;
+   }
+   a.dictEnd = hdr->fileSize + hdr->fileTrailerSize;
+   return true;
+}
+
+// Appends the TraceFileHeader, if it changed since it was last archived
+// or the archive is new, and the message descriptors added to the file
+// fd since, to the archive. The calibration that moves along and the
+// positions of the writers in the rings, which readers of archives have
+// no use for, do not count as changes.
+static void
+archiveDictionary( ForeverLogArchive & a, TraceFileHeader const * hdr, int fd,
+                   bool newArchive ) noexcept {
+   TraceFileHeader header;
+   memcpy( &header, hdr, sizeof( header ) );
+   TraceFileHeader unchanged = header;
+   unchanged.tsc1 = a.header.tsc1;
+   unchanged.monotime1 = a.header.monotime1;
+   unchanged.utc1 = a.header.utc1;
+   memcpy( unchanged.commitOffsets, a.header.commitOffsets,
+           sizeof( unchanged.commitOffsets ) );
+   memcpy( unchanged.ringSequences, a.header.ringSequences,
+           sizeof( unchanged.ringSequences ) );
+   memcpy( unchanged.ringReaders, a.header.ringReaders,
+           sizeof( unchanged.ringReaders ) );
+   if( newArchive || memcmp( &unchanged, &a.header, sizeof( header ) ) ) {
+      // Along with the TSC offsets of the CPUs that follow it, which are
+      // in place once the flags that were copied say so
+      __atomic_thread_fence( __ATOMIC_ACQUIRE );
+      char const * start = ( char const * )hdr;
+      a.buf.assign( start, start + header.firstMsgOffset );
+      memcpy( a.buf.data(), &header, sizeof( header ) );
+      archiveChunk( a, ArchiveChunkFileHeader, 0, a.buf.data(), a.buf.size() );
+      a.header = header;
+   }
+
+   struct stat st;
+   if( fstat( fd, &st ) == 0 && st.st_size > a.dictEnd ) {
+      a.buf.resize( st.st_size - a.dictEnd );
+      ssize_t n = pread( fd, a.buf.data(), a.buf.size(), a.dictEnd );
+      if( n > 0 ) {
+         archiveChunk( a, ArchiveChunkDictionary, 0, a.buf.data(), n );
+         a.dictEnd += n;
+      }
+   }
+}
+
+// Where the writer of a ring is, as of a single point in time: the number
+// of times it wrapped, the bytes it committed before it last did, and its
+// commit offset in the lap it is in
+static void
+ringPosition( uint32_t const * commitOffset, RingSequence const * sequence,
+              uint64_t & wraps, uint64_t & bytes, uint32_t & commit ) noexcept {
+   for( ;; ) {
+      wraps = __atomic_load_n( &sequence->wraps, __ATOMIC_ACQUIRE );
+      bytes = __atomic_load_n( &sequence->wrapBytes[ wraps % 2 ], __ATOMIC_RELAXED );
+      commit = __atomic_load_n( commitOffset, __ATOMIC_ACQUIRE );
+      __atomic_thread_fence( __ATOMIC_ACQUIRE );
+      if( __atomic_load_n( &sequence->wraps, __ATOMIC_RELAXED ) == wraps ) {
+         return;
+      }
+   }
+}
+
+// Copies the records of a ring from offset up to end, in lap lap
+static void
+copyRecords( ForeverLogArchive & a, int level, uint64_t lap, char const * ring,
+             uint32_t offset, uint64_t end ) noexcept {
+   if( end <= offset ) {
+      return;
+   }
+   uint32_t size = end - offset;
+   size_t pos = a.batch.size();
+   a.batch.insert( a.batch.end(), ring + offset, ring + offset + size );
+   a.chunks.push_back( { level, lap, offset, size, pos } );
+}
+
+// Copies the records of the ring of level committed since it was last
+// archived to the chunks of a. The writer goes on meanwhile, so the copy
+// is only kept if the writer cannot have overwritten it by the time it
+// is done: it is in the same lap, or in the next one but further behind
+// the copy than the longest record in progress, which is half of the
+// ring without its trailer, see RingBuf::maxBlobLen(), or the trailer
+// for a record without a blob. The records of a shared ring are copied
+// by their writers before they are committed, at most that far ahead of
+// the commit offset, see RingBuf::waitForRoomShared(), and into the next
+// lap before the wrap is counted. When the copies fall behind by more
+// than a lap, the records overwritten are counted as lost.
+static void
+copyLevel( ForeverLogArchive & a, int level, char const * ring, uint32_t ringSize,
+           uint32_t const * commitOffset, RingSequence const * sequence,
+           bool shared ) noexcept {
+   ForeverLogArchive::Level & l = a.levels[ level ];
+   uint32_t start = sizeof( RingBufHeader );
+   uint64_t wraps, bytes;
+   uint32_t commit;
+   ringPosition( commitOffset, sequence, wraps, bytes, commit );
+   size_t first = a.chunks.size();
+   if( wraps == l.lap ) {
+      // The writer publishes the start of the ring before it counts a
+      // wrap, which then reads as a commit offset behind ours
+      copyRecords( a, level, wraps, ring, l.offset, commit );
+      l.offset = std::max( l.offset, commit );
+   } else {
+      if( wraps == l.lap + 1 ) {
+         // The records of the lap before end where the writer wrapped
+         copyRecords( a, level, l.lap, ring, l.offset,
+                      std::min< uint64_t >( start + bytes - l.bytes, ringSize ) );
+      } else {
+         l.lost += bytes - ( l.bytes + l.offset - start );
+      }
+      copyRecords( a, level, wraps, ring, start, commit );
+      l = { wraps, bytes, commit, l.lost };
+   }
+   if( a.chunks.size() == first ) {
+      return;
+   }
+
+   // Keep the copies the writer cannot have overwritten
+   __atomic_thread_fence( __ATOMIC_ACQUIRE );
+   ringPosition( commitOffset, sequence, wraps, bytes, commit );
+   // The record in progress, and the zero tsc written after it
+   uint32_t margin = std::max< uint32_t >(
+      ( ringSize - RingBuf::TrailerSize - start ) / 2, RingBuf::TrailerSize ) +
+      sizeof( uint64_t );
+   size_t kept = first;
+   for( size_t i = first; i < a.chunks.size(); ++i ) {
+      ForeverLogArchive::Chunk const & c = a.chunks[ i ];
+      bool intact;
+      // A commit offset at the start of the ring may be that of the lap
+      // after the one counted
+      if( wraps == c.lap ) {
+         intact = !shared || c.offset >= start + margin ||
+                  ( commit > start &&
+                    c.offset + ringSize >= start + commit + margin );
+      } else {
+         intact = wraps == c.lap + 1 && commit > start &&
+                  commit + margin <= c.offset;
+      }
+      if( intact ) {
+         a.chunks[ kept++ ] = c;
+      } else {
+         l.lost += c.size;
+      }
+   }
+   a.chunks.resize( kept );
+}
+
+// Copies the records committed to the ring of level since they were last
+// copied to the chunks of a, see copyLevel(), and reports those lost
+static void
+copyForeverLogLevel( ForeverLogArchive & a, TraceFileHeader const * hdr,
+                     int level, char const * ring, uint32_t ringSize,
+                     bool shared, std::string const & fileName ) noexcept {
+   a.chunks.clear();
+   a.batch.clear();
+   uint64_t lostBefore = a.levels[ level ].lost;
+   copyLevel( a, level, ring, ringSize, &hdr->commitOffsets[ level ],
+              &hdr->ringSequences[ level ], shared );
+   uint64_t lost = a.levels[ level ].lost - lostBefore;
+   if( lost ) {
+      std::cerr << "QuickTrace lost " << lost << " bytes of records of level "
+                << level << " of " << fileName << " in its forever log, "
+                << "the backup thread is not keeping up" << std::endl;
+   }
+}
+
+// Appends the records committed to the ring of level since the last
+// call to the archive. Calls are queued when the writer gets to the end
+// of each quarter of the ring, so that the records of the quarter just
+// completed are copied well before the writer gets back to them, and
+// each record is archived once. The records the writer overwrote before they
+// were copied are reported. The message descriptors added since the
+// last chunk, and the TraceFileHeader if it changed, go first.
+void
+TraceFile::archiveLevel( int level ) noexcept {
+   ForeverLogArchive * a = archive_;
+   if( !a || !buf_ || a->pid != getpid() ) {
+      return;
+   }
+   TraceFileHeader const * hdr = ( TraceFileHeader const * )buf_;
+   uint32_t ringSize = hdr->logSizes.sz[ level ] * 1024;
+   if( !ringSize ) {
+      return;
+   }
+   char const * ring = ( char const * )buf_ + hdr->fileHeaderSize;
+   for( int i = 0; i < level; ++i ) {
+      ring += hdr->logSizes.sz[ i ] * 1024;
    }
 
-   if( old_is_gz ) {
-      // Remove the old compressed file (.1.gz)
-      unlink( old ); // may get ENOENT, but we don't care
-      old[ old_len - 3 ] = '\0';
+   // Take the records before the dictionary, so that the dictionary
+   // describes all of their messages
+   copyForeverLogLevel( *a, hdr, level, ring, ringSize,
+                        multiThreading_ == MultiThreading::shared, fileName_ );
+   if( a->chunks.empty() ) {
+      return;
    }
 
-   rename( path, old );         // may get ENOENT, but we don't care
+   if( a->fd >= 0 && a->size >= maxArchiveSize ) {
+      ::close( a->fd );
+      a->fd = -1;
+   }
+   bool newArchive = a->fd < 0;
+   if( newArchive ) {
+      char path[ 256 ];
+      snprintf( path, sizeof( path ), "%s.%d.qta",
+                traceHandle_->foreverLogPath().c_str(),
+                traceHandle_->foreverLogIndex() );
+      traceHandle_->foreverLogIndexInc( 1 );
+      if( !openArchive( *a, path, hdr ) ) {
+         return;
+      }
+   }
+   archiveDictionary( *a, hdr, fd_, newArchive );
+   for( ForeverLogArchive::Chunk const & c : a->chunks ) {
+      archiveChunk( *a, ArchiveChunkRecords, c.level, a->batch.data() + c.pos,
+                    c.size );
+   }
 }
 
+// Starts the copy of the file fd that the full forever log backups of
+// foreverLogPath are taken from, see TraceFile::backupLevel(), with what
+// the file holds now. The copy is an unlinked file next to the backups,
+// so that they can share its blocks. It is left closed if that fails.
+static bool
+openBackupCopy( ForeverLogArchive & a, std::string const & foreverLogPath,
+                int fd ) noexcept {
+   std::string path = foreverLogPath + ".XXXXXX";
+   a.fd = mkstemp( &path[ 0 ] );
+   if( a.fd < 0 ) {
+      std::cerr << "QuickTrace failed to create a copy of the file for "
+                << foreverLogPath << ": " << strerror( errno ) << std::endl;
+      return false;
+   }
+   unlink( path.c_str() );
+   struct stat st;
+   if( fstat( fd, &st ) != 0 || !copyFileData( fd, a.fd, st.st_size ) ) {
+      std::cerr << "QuickTrace failed to copy the file for " << foreverLogPath
+                << ": " << strerror( errno ) << std::endl;
+      ::close( a.fd );
+      a.fd = -1;
+      return false;
+   }
+   return true;
+}
 
+// Copies the records committed to the ring of level since the last call
+// to the copy of the file that the forever log backups are taken from,
+// where they go at the same offset as in the file, and backs the file up
+// when the ring wrapped since. Calls are queued when the writer gets to
+// the end of each quarter of the ring, like for archiveLevel(), so that
+// the records of a lap are in the copy before the writer gets back to
+// them, and the backup holds the whole lap however far the writer got
+// into the next one by the time the thread gets to it.
 void
-TraceFile::maybeBackupBuffer() noexcept {
-   if( !traceHandle_->foreverLog() ) {
+TraceFile::backupLevel( int level ) noexcept {
+   ForeverLogArchive * a = archive_;
+   if( !a || !buf_ || a->pid != getpid() ) {
       return;
    }
-
-   const std::string &foreverLogPath = traceHandle_->foreverLogPath();
-   if( foreverLogPath.empty() ) {
+   TraceFileHeader const * hdr = ( TraceFileHeader const * )buf_;
+   uint32_t ringSize = hdr->logSizes.sz[ level ] * 1024;
+   if( !ringSize ) {
       return;
    }
-
-   if( foreverLogPath.find( "null" ) != std::string::npos ) {
-      std::cerr << "EventMon Buffer Full.  Backups Disabled. Rolling Over";
+   uint32_t ringOffset = hdr->fileHeaderSize;
+   for( int i = 0; i < level; ++i ) {
+      ringOffset += hdr->logSizes.sz[ i ] * 1024;
+   }
+   if( a->fd < 0 &&
+       !openBackupCopy( *a, traceHandle_->foreverLogPath(), fd_ ) ) {
       return;
    }
+
+   ForeverLogArchive::Level before = a->levels[ level ];
+   copyForeverLogLevel( *a, hdr, level, ( char const * )buf_ + ringOffset,
+                        ringSize, multiThreading_ == MultiThreading::shared,
+                        fileName_ );
+   ForeverLogArchive::Level const & l = a->levels[ level ];
+   // The lap before is backed up once its records are in the copy, and
+   // before those of the next lap are. A lap the writer went through
+   // before the thread got to the ring is lost, and reported as such.
+   uint32_t start = sizeof( RingBufHeader );
+   bool wrapped = l.lap == before.lap + 1;
+   uint32_t tail = start + l.bytes - before.bytes;
+   bool ok = true;
+   for( ForeverLogArchive::Chunk const & c : a->chunks ) {
+      if( wrapped && c.lap == l.lap ) {
+         backupBuffer( level, ringOffset, tail );
+         wrapped = false;
+      }
+      ok = ok && pwriteAll( a->fd, a->batch.data() + c.pos, c.size,
+                            ringOffset + c.offset );
+   }
+   if( wrapped ) {
+      backupBuffer( level, ringOffset, tail );
+   }
+   // The zero tsc after the last record, as the writer leaves it
+   uint64_t zero = 0;
+   if( ok && l.offset > start ) {
+      ok = pwriteAll( a->fd, &zero, sizeof( zero ), ringOffset + l.offset );
+   }
+   if( !ok ) {
+      // Started over by the next call
+      std::cerr << "QuickTrace failed to write the copy of " << fileName_
+                << " for its forever log: " << strerror( errno ) << std::endl;
+      ::close( a->fd );
+      a->fd = -1;
+   }
+}
+
+// Backs the file up to <foreverLogPath>.<index>, from the copy kept by
+// backupLevel(), as it was when the writer of the ring of level, at
+// ringOffset in the file, got to tail and wrapped: the ring holds the
+// whole lap up to the wrap, and the other rings the records copied from
+// them so far, which are those committed as of the end of the last
+// quarter they completed. The message descriptors are taken as they are
+// now. The backup shares its blocks with the copy when the filesystem
+// supports reflinks. The copy then goes on with the wrap.
+void
+TraceFile::backupBuffer( int level, uint32_t ringOffset,
+                         uint32_t tail ) noexcept {
+   ForeverLogArchive & a = *archive_;
+   TraceFileHeader const * hdr = ( TraceFileHeader const * )buf_;
+   int index = traceHandle_->foreverLogIndex();
+   traceHandle_->foreverLogIndexInc( 1 );
+   const std::string &foreverLogPath = traceHandle_->foreverLogPath();
    std::cerr << "BACKING UP BUFFER to " << foreverLogPath << " " <<
-      traceHandle_->foreverLogIndex() << std::endl;
+      index << std::endl;
    char newPath[256];
-   snprintf( newPath, sizeof( newPath ), "%s.%d", foreverLogPath.c_str(),
-             traceHandle_->foreverLogIndex() );
-
-   // copy the file to new location
-   errno = 0;
-   int srcFd = open( fileName_.c_str(), O_RDONLY, 0 );
-   if ( srcFd == -1 ) {
-     // failed to open file - log error and continue
-      std::cerr << __PRETTY_FUNCTION__ <<  "open failed for " << 
-         fileName_.c_str() << " error " << strerror( errno ) << std::endl;
-      return;
+   snprintf( newPath, sizeof( newPath ), "%s.%d", foreverLogPath.c_str(), index );
+
+   // The header with the positions of the writers as of the copy, the
+   // one of level at the end of the lap it completed, and no consumer
+   uint32_t start = sizeof( RingBufHeader );
+   ForeverLogArchive::Level levels[ NumTraceLevels ];
+   std::copy( a.levels, a.levels + NumTraceLevels, levels );
+   levels[ level ] = { levels[ level ].lap - 1,
+                       levels[ level ].bytes - ( tail - start ), tail };
+   TraceFileHeader header;
+   memcpy( &header, hdr, sizeof( header ) );
+   for( int i = 0; i < NumTraceLevels; ++i ) {
+      ForeverLogArchive::Level const & l = levels[ i ];
+      RingSequence & s = header.ringSequences[ i ];
+      uint64_t wraps = s.wraps;
+      uint64_t records = s.wrapRecords[ l.lap % 2 ];
+      s = {};
+      s.wraps = l.lap;
+      s.wrapBytes[ l.lap % 2 ] = l.bytes;
+      if( wraps - l.lap < 2 ) {
+         // The slot of lap l.lap is still that of the file
+         s.wrapRecords[ l.lap % 2 ] = records;
+      }
+      header.commitOffsets[ i ] = l.offset;
+      header.ringReaders[ i ] = {};
    }
-
-   // determine size of source file
-   struct stat statSrc;
-   if ( fstat( srcFd, &statSrc ) == -1 ) {
-      // failed to determine file status - clean up, log error, and continue
-      ::close( srcFd );
-      std::cerr << __PRETTY_FUNCTION__ << "fstat failed for " << fileName_.c_str() <<
-         " error " << strerror( errno ) << std::endl;
+   uint64_t zero = 0;
+   struct stat st;
+   if( fstat( fd_, &st ) != 0 ||
+       !copyFileData( fd_, a.fd, header.fileHeaderSize, sizeof( header ) ) ||
+       !copyFileData( fd_, a.fd, st.st_size, header.fileSize ) ||
+       !pwriteAll( a.fd, &header, sizeof( header ), 0 ) ||
+       !pwriteAll( a.fd, &zero, sizeof( zero ), ringOffset + tail ) ) {
+      std::cerr << __PRETTY_FUNCTION__ << " copy failed for " <<
+              fileName_.c_str() << " error " << strerror( errno ) << std::endl;
       return;
    }
 
    // get file descriptor for destination file - create if doesn't exist, open as
-   // write-only
-   int destFd = open( newPath, O_WRONLY | O_CREAT, 0644 );
+   // write-only. A rotated file of the same name is replaced rather than
+   // truncated, so that the file rotation thread, which checks the inode,
+   // leaves the backup alone
+   int destFd;
+   {
+      FileRotations & r = fileRotations();
+      std::lock_guard< std::mutex > lock( r.mutex );
+      unlink( newPath ); // may get ENOENT, but we don't care
+      destFd = open( newPath, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+   }
    if ( destFd == -1 ) {
-      // failed to open file - clean up, log error, and continue
-      ::close( srcFd );
+      // failed to open file - log error and continue
       std::cerr << __PRETTY_FUNCTION__ <<  "open failed for " << 
          newPath << " error " << strerror( errno ) << std::endl;
       return;
    }
 
-   // copy source to destination
-   if ( sendfile( destFd, srcFd, 0, statSrc.st_size ) == -1 ) {
-      // failed to copy file - throw exception
-      ::close( srcFd );
-      ::close( destFd );
+   // copy the copy to the destination, with a reflink if possible, then
+   // within the kernel
+   if( fstat( a.fd, &st ) != 0 ||
+       ( ioctl( destFd, FICLONE, a.fd ) != 0 &&
+         !copyFileData( a.fd, destFd, st.st_size ) ) ) {
       // log error and give up
-      std::cerr << __PRETTY_FUNCTION__ <<  " sendfile failed for " <<
+      std::cerr << __PRETTY_FUNCTION__ <<  " copy failed for " <<
               fileName_.c_str() << " error " << strerror( errno ) << std::endl;
-      return;
    }
-   ::close( srcFd );
    ::close( destFd );
 
-   traceHandle_->foreverLogIndexInc( 1 );
+   // What RingBuf::doWrap() leaves, for the next backup
+   RingBufHeader ringHeader = { tail };
+   uint64_t trailer = ~uint64_t( 0 );
+   if( !pwriteAll( a.fd, &ringHeader, sizeof( ringHeader ), ringOffset ) ||
+       !pwriteAll( a.fd, &trailer, sizeof( trailer ), ringOffset + tail ) ) {
+      std::cerr << __PRETTY_FUNCTION__ << " copy failed for " <<
+              fileName_.c_str() << " error " << strerror( errno ) << std::endl;
+   }
+}
+
+// Set by setStreamingLog(), 0 when the TraceFiles created are not streamed
+static uint64_t streamingLogSegmentBytes;
+// Whether the stream thread writes through io_uring, see IoEngine
+static bool streamingLogIoUring = true;
+// Whether it does, as of its last round
+static bool streamingLogIoUringUsed;
+
+void
+setStreamingLog( uint64_t segmentBytes, bool ioUring ) noexcept {
+   __atomic_store_n( &streamingLogIoUring, ioUring, __ATOMIC_RELAXED );
+   __atomic_store_n( &streamingLogSegmentBytes, segmentBytes, __ATOMIC_RELAXED );
+}
+
+bool
+streamingLogUsesIoUring() noexcept {
+   return __atomic_load_n( &streamingLogIoUringUsed, __ATOMIC_RELAXED );
+}
+
+// The streaming log of a TraceFile, see setStreamingLog(). Only used by
+// the stream thread, and by the TraceFile when it goes away.
+struct StreamingLog {
+   StreamingLog( std::string const & fileName, uint64_t segmentBytes ) noexcept
+         : fileName( fileName ), segmentBytes( segmentBytes ) {
+      // Go on after the segments of the previous processes
+      while( access( segmentPath().c_str(), F_OK ) == 0 ) {
+         ++segment;
+      }
+   }
+   std::string segmentPath() const noexcept {
+      return fileName + ".stream." + std::to_string( segment ) + ".qta";
+   }
+   ForeverLogArchive archive;
+   std::string fileName;
+   uint64_t segmentBytes;
+   uint32_t segment = 0;
+};
+
+// How often the stream thread looks for new records
+static constexpr double streamingLogPeriod = 0.01;
+
+// The TraceFiles that are streamed. The thread streams all of them
+// without holding the mutex, then flushes its IoEngine, and a TraceFile
+// waits for the thread to be done with that round before it goes away.
+//
+// The state is never destroyed, as the thread may still be running while
+// the process exits.
+struct StreamingLogs {
+   std::mutex mutex;
+   // Signalled when the thread is done with a TraceFile
+   std::condition_variable streamed;
+   std::vector< TraceFile * > traceFiles;
+   // The thread is streaming the TraceFiles
+   bool streaming = false;
+   bool threadRunning = false;
+   bool atExitRegistered = false;
+   // The process is exiting, the TraceFiles stream themselves from then on
+   bool exiting = false;
+};
+
+static StreamingLogs &
+streamingLogs() noexcept {
+   static StreamingLogs * logs = new StreamingLogs;
+   return *logs;
+}
+
+// Appends what was committed to the rings since the last call to the
+// streaming log, in a new segment once the current one gets to its size.
+// The records are copied before the dictionary is read, so that the
+// dictionary describes all of their messages. The writes are queued to
+// io, if given, and the segments sealed are synced, otherwise they are
+// made right away. A segment io failed to write to in the last round
+// is closed there, and the records go on in the next one.
+void
+TraceFile::stream( IoEngine * io ) noexcept {
+   StreamingLog * s = stream_;
+   if( !s || !buf_ || s->archive.pid != getpid() ) {
+      return;
+   }
+   TraceFileHeader const * hdr = ( TraceFileHeader const * )buf_;
+   ForeverLogArchive & a = s->archive;
+   a.io = io;
+   archiveFailed( a );
+   a.chunks.clear();
+   a.batch.clear();
+   uint64_t lost = 0;
+   char const * ring = ( char const * )buf_ + hdr->fileHeaderSize;
+   for( int i = 0; i < NumTraceLevels; ++i ) {
+      uint32_t ringSize = hdr->logSizes.sz[ i ] * 1024;
+      uint64_t lostBefore = a.levels[ i ].lost;
+      if( ringSize ) {
+         copyLevel( a, i, ring, ringSize, &hdr->commitOffsets[ i ],
+                    &hdr->ringSequences[ i ],
+                    multiThreading_ == MultiThreading::shared );
+      }
+      lost += a.levels[ i ].lost - lostBefore;
+      ring += ringSize;
+   }
+   if( lost ) {
+      std::cerr << "QuickTrace lost " << lost << " bytes of records of "
+                << fileName_ << " in its streaming log, the stream thread is "
+                << "not keeping up" << std::endl;
+   }
+   if( a.chunks.empty() ) {
+      return;
+   }
+
+   // The first segment goes on until it got the header of the calibrated
+   // file, which qttail needs to print it
+   if( a.fd >= 0 && a.size >= s->segmentBytes &&
+       ( a.header.flags & TraceFileFlagCalibrated ) ) {
+      if( io ) {
+         io->seal( a.fd );
+      } else {
+         ::close( a.fd );
+      }
+      a.fd = -1;
+   }
+   bool newArchive = a.fd < 0;
+   if( newArchive ) {
+      std::string path = s->segmentPath();
+      ++s->segment;
+      if( !openArchive( a, path.c_str(), hdr ) ) {
+         return;
+      }
+   }
+   archiveDictionary( a, hdr, fd_, newArchive );
+   for( ForeverLogArchive::Chunk const & c : a.chunks ) {
+      archiveChunk( a, ArchiveChunkRecords, c.level, a.batch.data() + c.pos,
+                    c.size );
+   }
+}
+
+static void *
+streamingLogThread( void * ) noexcept {
+   StreamingLogs & s = streamingLogs();
+   IoEngine io( __atomic_load_n( &streamingLogIoUring, __ATOMIC_RELAXED ) );
+   std::vector< TraceFile * > traceFiles;
+   std::unique_lock< std::mutex > lock( s.mutex );
+   while( !s.exiting ) {
+      traceFiles = s.traceFiles;
+      s.streaming = true;
+      lock.unlock();
+      for( TraceFile * traceFile : traceFiles ) {
+         traceFile->stream( &io );
+      }
+      io.flush();
+      __atomic_store_n( &streamingLogIoUringUsed, io.ioUring(), __ATOMIC_RELAXED );
+      lock.lock();
+      s.streaming = false;
+      s.streamed.notify_all();
+      lock.unlock();
+      // Without io_uring, the segments completed are synced here, where no
+      // TraceFile waits for it
+      io.syncSealed();
+      sleepFor( streamingLogPeriod );
+      lock.lock();
+   }
+   return nullptr;
+}
+
+// The records committed before the process exits are still streamed
+static void
+streamAtExit() noexcept {
+   StreamingLogs & s = streamingLogs();
+   std::unique_lock< std::mutex > lock( s.mutex );
+   s.streamed.wait( lock, [ &s ] { return !s.streaming; } );
+   s.exiting = true;
+   for( TraceFile * traceFile : s.traceFiles ) {
+      traceFile->stream();
+   }
+}
+
+// Hands traceFile to the stream thread, which is started unless it is
+// already running
+static void
+startStreaming( TraceFile * traceFile ) noexcept {
+   StreamingLogs & s = streamingLogs();
+   std::lock_guard< std::mutex > lock( s.mutex );
+   s.traceFiles.push_back( traceFile );
+   if( s.threadRunning ) {
+      return;
+   }
+   if( !s.atExitRegistered ) {
+      s.atExitRegistered = true;
+      atexit( streamAtExit );
+   }
+   pthread_t thread;
+   pthread_attr_t attr;
+   pthread_attr_init( &attr );
+   pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+   int err = pthread_create( &thread, &attr, streamingLogThread, nullptr );
+   pthread_attr_destroy( &attr );
+   if( err ) {
+      // The TraceFiles are then only streamed when they go away
+      std::cerr << "QuickTrace failed to start the stream thread (" << err
+                << "): " << strerror( err ) << std::endl;
+      return;
+   }
+   s.threadRunning = true;
+}
+
+// Takes traceFile back from the stream thread
+static void
+stopStreaming( TraceFile * traceFile ) noexcept {
+   StreamingLogs & s = streamingLogs();
+   std::unique_lock< std::mutex > lock( s.mutex );
+   s.streamed.wait( lock, [ &s ] { return !s.streaming; } );
+   auto it = std::find( s.traceFiles.begin(), s.traceFiles.end(), traceFile );
+   if( it != s.traceFiles.end() ) {
+      s.traceFiles.erase( it );
+   }
 }
 
 
@@ -377,7 +2997,9 @@ bool
 initialize( char const * filename, SizeSpec * sizesInKilobytes, 
             char const *foreverLogPath, int foreverLogIndex,
             int maxStringLen, MultiThreading multiThreading,
-            bool rotateLogFile, uint32_t numMsgCounters ) noexcept {
+            bool rotateLogFile, uint32_t numMsgCounters,
+            MsgCounterLayout msgCounterLayout, ClockSource clockSource,
+            RotationPolicy const * rotationPolicy ) noexcept {
    if( !filename || filename[0] == '\0' ) return false;
 
    // We don't expect the filename to be just .qt in single thread case
@@ -412,7 +3034,10 @@ initialize( char const * filename, SizeSpec * sizesInKilobytes,
                                                  multiThreading,
                                                  rotateLogFile,
                                                  numMsgCounters,
-                                                 true );
+                                                 true,
+                                                 msgCounterLayout,
+                                                 clockSource,
+                                                 rotationPolicy );
       if( !defaultQuickTraceHandle->isInitialized() ) {
          close();
          return false;
@@ -431,9 +3056,14 @@ close() noexcept {
 
 TraceHandle *initialize_handle( char const *filename, SizeSpec *sizesInKilobytes,
                                 char const *foreverLogPath, int foreverLogIndex,
-                                MultiThreading multiThreading ) noexcept {
+                                MultiThreading multiThreading,
+                                ClockSource clockSource,
+                                RotationPolicy const * rotationPolicy ) noexcept {
    TraceHandle *th = new TraceHandle( filename, sizesInKilobytes, foreverLogPath,
-                                      foreverLogIndex, multiThreading );
+                                      foreverLogIndex, multiThreading, true,
+                                      DEFAULT_NUM_MSG_COUNTERS, false,
+                                      MsgCounterLayout::packed, clockSource,
+                                      rotationPolicy );
    // We could check if isInitialized() is false and delete the
    // TraceHandle returning NULL but there are QuickTrace users
    // (PolicyMap...) that assume they always get back a non-NULL
@@ -531,15 +3161,15 @@ TraceHandle::adjustSizeSpec( bool limit ) noexcept{
    if ( limit && sz > maxSize ) {
       sz = scaleDownSizes( &sizeSpec_, ( maxSize * 1.0 ) / sz );
    }
-   sz = sz * 1024 + sizeof( TraceFileHeader ) +
-        ( numMsgCounters_ * sizeof( MsgCounter ) );
+   sz = sz * 1024 + msgCountersOffset( msgCounterLayout_ ) +
+        numMsgCounters_ * msgCounterStride( msgCounterLayout_ );
    mappedTraceFileSize_ = sz;
 }
 
 bool
 TraceHandle::resize( const SizeSpec &newSizeSpecInKilobytes ) noexcept{
    // make sure resize is called only on a single threaded process
-   if( multiThreading_ == MultiThreading::enabled ) {
+   if( multiThreading_ != MultiThreading::disabled ) {
       std::cerr << "Resizing multi-thread quicktrace not supported" << std::endl;
       return false;
    }
@@ -576,10 +3206,25 @@ TraceHandle::resize( const SizeSpec &newSizeSpecInKilobytes ) noexcept{
 TraceFile::TraceFile( TraceHandle * traceHandle, bool rotateLogFile,
                       uint32_t numMsgCounters ) noexcept
       : traceHandle_( traceHandle ),
-        numMsgCounters_( numMsgCounters ),
+        msgCounters_(),
+        countersFd_( -1 ),
+        mappedSize_( 0 ),
+        msgIdBitmap_( nullptr ),
         buf_( 0 ),
+        backup_( nullptr ),
+        archive_( nullptr ),
+        stream_( nullptr ),
+        memoryFile_( -1 ),
         initialized_( false ) {
    multiThreading_ = traceHandle_->multiThreading_;
+   if( traceHandle_->foreverLog() ) {
+      backup_ = new ForeverLogBackup;
+   }
+   if( traceHandle_->foreverLog() &&
+       traceHandle_->foreverLogPath().find( "null" ) == std::string::npos ) {
+      archive_ = new ForeverLogArchive;
+   }
+   clockSource_ = traceHandle_->clockSource();
    fileName_ = traceHandle_->qtdir();
    if( fileName_ != "" ) {
       fileName_ += "/";
@@ -601,15 +3246,44 @@ TraceFile::TraceFile( TraceHandle * traceHandle, bool rotateLogFile,
       assert( fileName_ != otherTraceFile->fileName_ );
    }
 
+   // The rings of a memory-only file live in a memory file, which the
+   // trace file links to
+   std::string memoryPath = memoryFilePath( fileName_ );
+
    // Rename the old .qt file.
    if( rotateLogFile ) {
-      saveOldFiles( fileName_.c_str() );
+      rotateFile( fileName_, traceHandle_->rotationPolicy(), memoryPath );
    }
 
+   // CPU ids are only of use to compensate for TSC skew
+   bool cpuId = __atomic_load_n( &recordCpuId, __ATOMIC_RELAXED ) &&
+                clockSource_ == ClockSourceTsc;
+   // The TSC offsets of the CPUs only take room in the files that record
+   // CPU ids, between the header and the MsgCounters
+   MsgCounterLayout layout = traceHandle_->msgCounterLayout();
+   uint32_t tscOffsetsStart = ( sizeof( TraceFileHeader ) + 7 ) & ~7;
+   uint32_t numTscOffsets = cpuId ? tscOffsetCpus() : 0;
+   uint32_t countersStart = msgCountersOffset(
+      layout, tscOffsetsStart + numTscOffsets * sizeof( int64_t ) );
+   msgCounters_.count = numMsgCounters;
+   msgCounters_.stride = msgCounterStride( layout );
+   uint32_t countersEnd = countersStart + numMsgCounters * msgCounters_.stride;
+
+   // That of the file that was rotated out of the way, if any
+   countersPath_ = ( memoryPath.empty() ? fileName_ : memoryPath ) +
+                   MsgCountersFileSuffix;
+   unlink( countersPath_.c_str() ); // may get ENOENT, but we don't care
+
    // Open file and memory map
-   uint32_t mappedSize = traceHandle_->mappedTraceFileSize();
-   fd_ = getfile( fileName_.c_str(), mappedSize );
+   uint32_t mappedSize = traceHandle_->mappedTraceFileSize() + countersStart -
+                         msgCountersOffset( layout );
+   mappedSize_ = mappedSize;
+   fd_ = getfile( memoryPath.empty() ? fileName_.c_str() : memoryPath.c_str(),
+                  mappedSize );
    if( fd_ < 0 ) return;
+   if( !memoryPath.empty() ) {
+      memoryFile_ = registerMemoryFile( fd_, memoryPath, fileName_ );
+   }
    void * m = mmap( 0, mappedSize, PROT_WRITE, MAP_SHARED, fd_, 0 );
    if( m == MAP_FAILED ) {
       std::cerr << "mmap " << fileName_ << ": "
@@ -619,108 +3293,730 @@ TraceFile::TraceFile( TraceHandle * traceHandle, bool rotateLogFile,
    }
    int r = madvise( m, mappedSize, MADV_DONTDUMP ); // Don't include qt files in core
    assert( r == 0 && "madvise() MADV_DONTDUMP failed" );
-   memset( m, 0, mappedSize ); // is this necessary?
+   // The file was just truncated and reserved, so it already reads as
+   // zeroes. Fault in the reserved pages now with a single call rather
+   // than one page fault at a time as the rings are first written.
+   // Kernels older than 5.14 reject MADV_POPULATE_WRITE, and then the
+   // pages are simply faulted in on first use.
+#ifdef MADV_POPULATE_WRITE
+   madvise( m, mappedSize, MADV_POPULATE_WRITE );
+#endif
    buf_ = m;
 
    TraceFileHeader* sfh = (TraceFileHeader*) m;
-   sfh->version = 5;
+   sfh->version = 6;
    sfh->fileSize = mappedSize;
-   sfh->fileHeaderSize = 
-      sizeof( TraceFileHeader ) + ( numMsgCounters_ * sizeof( MsgCounter ) );
+   sfh->fileHeaderSize = countersEnd;
    sfh->fileTrailerSize = FileTrailerSize;
-   sfh->firstMsgOffset = sizeof( TraceFileHeader );
+   sfh->firstMsgOffset = countersStart;
    sfh->logCount = NumTraceLevels;
+   sfh->extraMsgCounters = 0;
+   sfh->msgCounterStride = msgCounters_.stride;
    SizeSpec sizeSpec = traceHandle_->sizeSpec();
    sfh->logSizes = sizeSpec;
+   sfh->flags = TraceFileFlagCalibrationPoints | TraceFileFlagCommitOffsets |
+                TraceFileFlagRingSequences;
+   if( multiThreading_ != MultiThreading::shared ) {
+      sfh->flags |= TraceFileFlagRingReaders;
+   }
+   if( multiThreading_ == MultiThreading::shared ) {
+      sfh->flags |= TraceFileFlagSharedRing;
+   }
+   sfh->clockSource = clockSource_;
+   sfh->flags |= TraceFileFlagClockSource;
+   static std::atomic< uint32_t > filesCreated;
+   sfh->fileId = uint64_t( getpid() ) << 32 | filesCreated++;
+   sfh->flags |= TraceFileFlagFileId;
+   if( cpuId ) {
+      sfh->flags |= TraceFileFlagCpuId;
+      sfh->tscOffsetsStart = tscOffsetsStart;
+      sfh->numTscOffsets = numTscOffsets;
+   }
 
-   MsgCounter * msgCounters = ( MsgCounter * )( sfh + 1 );
-   char * logStart = ( ( char * )m ) + sizeof( TraceFileHeader ) + 
-                     ( numMsgCounters_ * sizeof( MsgCounter ) );
+   msgCounters_.base = ( char * )m + countersStart;
+   char * logStart = ( ( char * )m ) + countersEnd;
    for( int i=0; i<NumTraceLevels; ++i ) {
       int levelOffset = addLevelSizes( &sizeSpec, i ) * 1024;
+      log_[i].archiveQuartersIs( archive_ != nullptr );
+      log_[i].commitOffsetIs( &sfh->commitOffsets[ i ] );
+      log_[i].sequenceIs( &sfh->ringSequences[ i ] );
       log_[i].bufIs( logStart + levelOffset, sizeSpec.sz[ i ] * 1024 );
       log_[i].qtFileIs( this );
-      log_[i].msgCounterIs( msgCounters );
-      log_[i].numMsgCountersIs( numMsgCounters_ );
+      log_[i].msgCountersIs( &msgCounters_ );
+      log_[i].recordCpuIdIs( cpuId );
+      log_[i].clockSourceIs( clockSource_ );
+      if( multiThreading_ == MultiThreading::shared ) {
+         log_[i].sharedIs();
+      }
+   }
+
+   // Insert TraceFile into the set maintained by the TraceHandle
+   traceHandle_->traceFiles_.insert( this );
+   initialized_ = true;
+
+   uint64_t segmentBytes =
+      __atomic_load_n( &streamingLogSegmentBytes, __ATOMIC_RELAXED );
+   if( segmentBytes ) {
+      stream_ = new StreamingLog( fileName_, segmentBytes );
+      startStreaming( this );
+   }
+
+   TscCalibration & calibration = tscCalibration();
+   TscCalibrationStart calibrationStart;
+   bool sampled = !__atomic_load_n( &calibration.started, __ATOMIC_ACQUIRE );
+   if( sampled ) {
+      calibrationStart = sampleTscCalibrationStart();
+   }
+   std::lock_guard< std::mutex > calibrationLock( calibration.mutex );
+   maybeStartTscCalibration( calibration, sampled ? &calibrationStart : nullptr );
+   CalibrationPoint start = calibrationPoint( calibration.start, clockSource_ );
+   sfh->tsc0 = start.tsc;
+   sfh->monotime0 = start.monotime;
+   if( clockSource_ != ClockSourceTsc ) {
+      sfh->tscFrequency = 1000000000;
+      sfh->tscFrequencySource = TscFrequencyNanoseconds;
+      sfh->flags |= TraceFileFlagTscFrequency;
+   } else if( calibration.frequency.first ) {
+      sfh->tscFrequency = calibration.frequency.first;
+      sfh->tscFrequencySource = calibration.frequency.second;
+      sfh->flags |= TraceFileFlagTscFrequency;
+   }
+   if( calibration.offsetsMeasured ) {
+      tscOffsetsIs( calibration.refCpu, calibration.offsets );
+   }
+   calibration.traceFiles.push_back( this );
+   if( calibration.done ) {
+      calibrate( calibrationPoint( calibration.last, clockSource_ ),
+                 calibrationPoint( sampleClocks(), clockSource_ ) );
+   } else {
+      calibrateProvisionally(
+         calibrationPoint( calibration.provisional, clockSource_ ) );
+   }
+}
+
+TraceFile::~TraceFile() noexcept {
+   // Takes the rings back from the spill drain thread
+   for( int i = 0; i < NumTraceLevels; ++i ) {
+      if( log_[ i ].spill_ != nullptr ) {
+         log_[ i ].overrunPolicyIs( nullptr, OverrunOverwrite, 0 );
+      }
+   }
+   if( backup_ ) {
+      waitForForeverLogBackups( backup_ );
+   }
+   if( archive_ ) {
+      // Archive what was committed since the rings were last archived,
+      // or back up the laps completed since, whose jobs were dropped
+      for( int i = 0; i < NumTraceLevels; ++i ) {
+         if( traceHandle_->foreverLogIncremental() ) {
+            archiveLevel( i );
+         } else {
+            backupLevel( i );
+         }
+      }
+      if( archive_->fd >= 0 ) {
+         ::close( archive_->fd );
+      }
+      delete archive_;
+   }
+   if( initialized_ ) {
+      TscCalibration & calibration = tscCalibration();
+      std::lock_guard< std::mutex > lock( calibration.mutex );
+      auto & traceFiles = calibration.traceFiles;
+      auto it = std::find( traceFiles.begin(), traceFiles.end(), this );
+      if( it != traceFiles.end() ) {
+         traceFiles.erase( it );
+         if( !calibration.done ) {
+            calibrate( calibrationPoint( calibration.start, clockSource_ ),
+                       calibrationPoint( sampleClocks(), clockSource_ ) );
+         }
+      }
+   }
+   if( stream_ ) {
+      // Stream what the rings hold since the thread last did, once
+      // the file is calibrated
+      stopStreaming( this );
+      stream();
+      if( stream_->archive.fd >= 0 ) {
+         ::close( stream_->archive.fd );
+      }
+      delete stream_;
+   }
+   if( buf_ ){
+      munmap( buf_, mappedSize_ );
+   }
+   for( int s = 0; s < MsgCounters::MaxSegments; ++s ) {
+      if( msgCounters_.segments[ s ] ) {
+         uint32_t n = MsgCounters::segmentStart( s + 1 ) -
+                      MsgCounters::segmentStart( s );
+         munmap( msgCounters_.segments[ s ], ( size_t )n * msgCounters_.stride );
+      }
+   }
+   if( countersFd_ >= 0 ) {
+      ::close( countersFd_ );
+   }
+
+   // Close the associated file descriptor
+   closeIfNeeded();
+
+   // Remove TraceFile from the set maintained by the TraceHandle
+   traceHandle_->traceFiles_.erase( this );
+   delete backup_;
+   for( MsgIdBitmap * bitmap : retiredMsgIdBitmaps_ ) {
+      free( bitmap );
+   }
+   free( msgIdBitmap_ );
+}
+
+void TraceFile::closeIfNeeded() noexcept {
+   if( memoryFile_ >= 0 ) {
+      unregisterMemoryFile( memoryFile_, fd_ );
+      memoryFile_ = -1;
+   }
+   if( fd_ < 0 ) return;
+   int rc = ::close( fd_ );
+   assert( rc == 0 );
+   fd_ = -1;
+}
+
+void
+TraceFile::sync() noexcept {
+   msync( buf_, mappedSize_, MS_SYNC );
+}
+
+void
+TraceFile::overrunPolicyIs( int level, OverrunPolicy policy,
+                            uint32_t spillBytes ) noexcept {
+   if( !buf_ ) {
+      return;
+   }
+   if( multiThreading_ == MultiThreading::shared ) {
+      // The writers of a shared ring reserve space before they know where
+      // the lap they write in starts, see commitShared()
+      std::cerr << "QuickTrace can not keep the messages of a shared "
+                << "TraceFile for a consumer" << std::endl;
+      return;
+   }
+   TraceFileHeader * sfh = ( TraceFileHeader * )buf_;
+   log_[ level ].overrunPolicyIs(
+      policy == OverrunOverwrite ? nullptr : &sfh->ringReaders[ level ],
+      policy, spillBytes );
+}
+
+void 
+TraceFile::takeTimestamp() noexcept {
+   // Leave tsc1/monotime1 to the calibration until it is done
+   if( !__atomic_load_n( &tscCalibration().done, __ATOMIC_ACQUIRE ) ) {
+      return;
+   }
+   TraceFileHeader* sfh = (TraceFileHeader*) buf_;
+   uint64_t tsc = timestamp();
+   // Only take a new timestamp every 1 million cycles It's pointless
+   // to go much faster and this way we guarantee that we don't spend
+   // a lot of time monotime() and in gettimeofday(), which each take
+   // around a microsecond.
+   if( tsc - sfh->tsc1 > 1000000 ) {
+      sfh->tsc1 = tsc;
+      sfh->monotime1 = monotime();
+      sfh->utc1 = utc();
+   }
+}
+
+void
+TraceFile::calibrate( CalibrationPoint const & since,
+                      CalibrationPoint const & now ) noexcept {
+   TraceFileHeader* sfh = (TraceFileHeader*) buf_;
+   sfh->tsc1 = now.tsc;
+   sfh->monotime1 = now.monotime;
+   sfh->utc1 = now.utc;
+   addCalibrationPoint( since );
+   addCalibrationPoint( now );
+   __atomic_or_fetch( &sfh->flags, TraceFileFlagCalibrated, __ATOMIC_RELEASE );
+}
+
+void
+TraceFile::calibrateProvisionally( CalibrationPoint const & sample ) noexcept {
+   TraceFileHeader* sfh = (TraceFileHeader*) buf_;
+   sfh->tsc1 = sample.tsc;
+   sfh->utc1 = sample.utc;
+   // Published last, see TraceFileFlagCalibrated
+   __atomic_store( &sfh->monotime1, &sample.monotime, __ATOMIC_RELEASE );
+}
+
+void
+TraceFile::tscOffsetsIs( uint32_t refCpu,
+                         std::vector< int64_t > const & offsets ) noexcept {
+   TraceFileHeader* sfh = (TraceFileHeader*) buf_;
+   if( !( sfh->flags & TraceFileFlagCpuId ) ) {
+      return;
+   }
+   sfh->tscOffsetsRefCpu = refCpu;
+   memcpy( ( char * )buf_ + sfh->tscOffsetsStart, offsets.data(),
+           std::min( offsets.size(), ( size_t )sfh->numTscOffsets ) *
+           sizeof( int64_t ) );
+   __atomic_or_fetch( &sfh->flags, TraceFileFlagTscOffsets, __ATOMIC_RELEASE );
+}
+
+void
+TraceFile::addCalibrationPoint( CalibrationPoint const & point ) noexcept {
+   // calibrationCount is odd while the point is written, see
+   // TraceFileHeader::calibrationCount. Readers check that it was even
+   // and did not change while they read the points.
+   TraceFileHeader* sfh = (TraceFileHeader*) buf_;
+   uint32_t count = sfh->calibrationCount;
+   __atomic_store_n( &sfh->calibrationCount, count + 1, __ATOMIC_RELAXED );
+   __atomic_thread_fence( __ATOMIC_RELEASE );
+   sfh->calibrationPoints[ ( count / 2 ) % NumCalibrationPoints ] = point;
+   __atomic_store_n( &sfh->calibrationCount, count + 2, __ATOMIC_RELEASE );
+}
+
+void
+TraceFile::msgIdInitializedIs( MsgId msgId ) noexcept {
+   // Record that the necessary message descriptor information for
+   // this ID has been added to the trace file.
+   if( multiThreading_ == MultiThreading::shared ) {
+      // Called with msgDescMutex_ held, see msgIdBitmap_
+      size_t word = ( size_t )msgId / 64;
+      MsgIdBitmap * bitmap = msgIdBitmap_;
+      if( !bitmap || bitmap->words <= word ) {
+         size_t words = std::max( word + 1, bitmap ? 2 * bitmap->words : 64 );
+         MsgIdBitmap * grown = ( MsgIdBitmap * )calloc(
+            1, sizeof( MsgIdBitmap ) + words * sizeof( uint64_t ) );
+         if( !grown ) {
+            return;
+         }
+         grown->words = words;
+         if( bitmap ) {
+            memcpy( grown->bits, bitmap->bits, bitmap->words * sizeof( uint64_t ) );
+            retiredMsgIdBitmaps_.push_back( bitmap );
+         }
+         __atomic_store_n( &msgIdBitmap_, grown, __ATOMIC_RELEASE );
+         bitmap = grown;
+      }
+      __atomic_or_fetch( &bitmap->bits[ word ], 1ULL << ( msgId % 64 ),
+                         __ATOMIC_RELEASE );
+      return;
+   }
+   if( msgIdInitialized_.size() <= ( size_t )msgId ) {
+      msgIdInitialized_.resize( ( size_t )msgId + 32 );
+   }
+   msgIdInitialized_[ msgId ] = true;
+}
+
+void
+TraceFile::mapMsgCounter( MsgId msgId ) noexcept {
+   if( !buf_ || msgId <= 0 || ( uint32_t )msgId < msgCounters_.count ) {
+      return;
+   }
+   TraceFileHeader * sfh = ( TraceFileHeader * )buf_;
+   uint32_t stride = msgCounters_.stride;
+   int last = MsgCounters::segment( msgId - msgCounters_.count );
+   for( int s = 0; s <= last; ++s ) {
+      if( msgCounters_.segments[ s ] ) {
+         continue;
+      }
+      uint32_t start = MsgCounters::segmentStart( s );
+      uint32_t end = MsgCounters::segmentStart( s + 1 );
+      off_t offset = ( off_t )start * stride;
+      size_t len = ( size_t )( end - start ) * stride;
+      int err = 0;
+      if( countersFd_ < 0 ) {
+         countersFd_ = open( countersPath_.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0666 );
+         err = countersFd_ < 0 ? errno : 0;
+      }
+      if( !err && ftruncate( countersFd_, offset + len ) < 0 ) {
+         err = errno;
+      }
+      if( !err ) {
+         // Like getfile(), so that touching the counters never SIGBUSes
+         err = reserveBlocks( countersFd_, offset, offset + len );
+      }
+      void * m = MAP_FAILED;
+      if( !err ) {
+         m = mmap( 0, len, PROT_READ | PROT_WRITE, MAP_SHARED, countersFd_,
+                   offset );
+         err = m == MAP_FAILED ? errno : 0;
+      }
+      if( err ) {
+         // Most likely the filesystem is full. Keep the counters in
+         // anonymous memory then, they are missing from the counters file.
+         std::cerr << "QuickTrace failed to extend " << countersPath_ << "("
+                   << err << "): " << strerror( err ) << std::endl;
+         m = mmap( 0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1, 0 );
+         if( m == MAP_FAILED ) {
+            // Counted in MsgCounter 0, see MsgCounters::counter()
+            return;
+         }
+      }
+      madvise( m, len, MADV_DONTDUMP );
+      __atomic_store_n( &msgCounters_.segments[ s ], ( char * )m,
+                        __ATOMIC_RELEASE );
+      // Readers only get to see the counters of the file up to the first
+      // segment that is not in it
+      if( !err && sfh->extraMsgCounters == start ) {
+         __atomic_store_n( &sfh->extraMsgCounters, end, __ATOMIC_RELEASE );
+      }
+   }
+}
+
+// The wall-clock timestamp returned by gettimeofday
+struct timeval
+TraceFile::wallClockTimestamp() const noexcept {
+   struct timeval tv;
+   gettimeofday( &tv, 0 );
+   return tv;
+}
+
+// The end of the quarter of the ring that ptr is in, where the writer
+// queues the archiving of that quarter, see TraceFile::archiveLevel()
+char *
+RingBuf::nextArchivePtr( char const * ptr ) const noexcept {
+   char * start = buf_ + sizeof( RingBufHeader );
+   uint32_t quarter = ( bufEnd_ - start ) / 4;
+   if( !archiveQuarters_ || quarter == 0 ) {
+      return bufEnd_;
+   }
+   return std::min( start + ( ( ptr - start ) / quarter + 1 ) * quarter, bufEnd_ );
+}
+
+inline void
+RingBuf::maybeWrap( TraceFile *tf ) noexcept {
+   if( QUICKTRACE_UNLIKELY(ptr_ >= backupPtr_) ) {
+      if( ptr_ >= bufEnd_ ) {
+         countWrap( ptr_ );
+         doWrap();
+         if( archiveQuarters_ ) {
+            // Archived with the first record of the next lap, see doWrap()
+            return;
+         }
+      } else {
+         backupPtr_ = nextArchivePtr( ptr_ );
+      }
+      qtFile_->maybeBackupBuffer( this );
+   }
+}
+
+// Let readers know that the records up to end are complete, see
+// TraceFileHeader::commitOffsets. The release store orders it after the
+// stores of the records and of the zero tsc that follows them. It is a
+// naturally aligned uint32_t so that it is single-copy atomic everywhere,
+// which the unaligned tsc of a record is not on aarch64.
+inline void
+RingBuf::publish( char const * end ) noexcept {
+   if( QUICKTRACE_LIKELY( commitOffset_ != nullptr ) ) {
+      __atomic_store_n( commitOffset_, uint32_t( end - buf_ ), __ATOMIC_RELEASE );
+   }
+}
+
+// Count a wrap of the ring at tail, once the records before it have been
+// committed, see RingSequence
+void
+RingBuf::countWrap( char const * tail ) noexcept {
+   if( sequence_ == nullptr ) {
+      return;
+   }
+   bytes_ += tail - ( buf_ + sizeof( RingBufHeader ) );
+   ++wraps_;
+   __atomic_store_n( &sequence_->wrapRecords[ wraps_ % 2 ], records_,
+                     __ATOMIC_RELAXED );
+   __atomic_store_n( &sequence_->wrapBytes[ wraps_ % 2 ], bytes_, __ATOMIC_RELAXED );
+   // A reader that sees the new count must not pair it with the commit
+   // offset of the lap before, so the start of the ring is published
+   // first. And the records of the new lap must not be seen before the
+   // count, see copyLevel().
+   publish( buf_ + sizeof( RingBufHeader ) );
+   __atomic_store_n( &sequence_->wraps, wraps_, __ATOMIC_RELEASE );
+   __atomic_thread_fence( __ATOMIC_RELEASE );
+}
+
+// Whether the ring holds messages the consumer has not read yet from ptr_
+// up to end, in the lap it is at when the writer wrapped lap times, see
+// RingReader
+bool
+RingBuf::overruns( uint64_t lap, char const * end ) const noexcept {
+   uint64_t cursor = __atomic_load_n( &reader_->cursor, __ATOMIC_ACQUIRE );
+   if( cursor == 0 ) {
+      return false;
    }
+   int32_t behind = int32_t( uint32_t( lap ) - uint32_t( cursor >> 32 ) );
+   return behind > 1 || ( behind == 1 && end > buf_ + uint32_t( cursor ) );
+}
 
-   // Insert TraceFile into the set maintained by the TraceHandle
-   traceHandle_->traceFiles_.insert( this );
-   initialized_ = true;
+// How long OverrunSpin waits for the consumer, in cpuRelax() calls. The
+// first hundred only pause the CPU, the others yield it.
+static constexpr int OverrunSpins = 1000;
 
-   sfh->tsc0 = rdtsc();
-   sfh->monotime0 = monotime();
-   do {
-      takeTimestamp();
-   } while( sfh->monotime1 - sfh->monotime0 < 0.1 );
+// Whether a record may be written from ptr_ up to end, see overruns(),
+// after waiting a little for the consumer with OverrunSpin
+bool
+RingBuf::roomFor( uint64_t lap, char const * end ) noexcept {
+   for( int spins = 0; overruns( lap, end ); ++spins ) {
+      if( overrunPolicy_ != OverrunSpin || spins == OverrunSpins ) {
+         return ( overruns_++ % 1024 ) == 0 && readerGone();
+      }
+      cpuRelax( spins );
+   }
+   return true;
 }
 
-TraceFile::~TraceFile() noexcept {
-   if( buf_ ){
-      munmap( buf_, traceHandle_->mappedTraceFileSize() );
+// Unregister a consumer that died without doing so, so that the ring does
+// not stay stuck. Only checked now and then, as it takes a system call.
+bool
+RingBuf::readerGone() noexcept {
+   uint32_t pid = __atomic_load_n( &reader_->pid, __ATOMIC_RELAXED );
+   if( pid == 0 || kill( pid_t( pid ), 0 ) == 0 || errno != ESRCH ) {
+      return false;
    }
+   uint64_t cursor = __atomic_load_n( &reader_->cursor, __ATOMIC_RELAXED );
+   __atomic_compare_exchange_n( &reader_->cursor, &cursor, 0, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED );
+   return true;
+}
 
-   // Close the associated file descriptor
-   closeIfNeeded();
+// Make room in the ring for the record about to be started at ptr_, for a
+// level with a consumer, see TraceFile::overrunPolicyIs(). While records
+// wait in the overflow area, new ones go there too, so that they reach the
+// ring in order. Returns false when the record is dropped.
+bool
+RingBuf::makeRoom() noexcept {
+   if( spillLen_ != 0 ) {
+      drainSpill();
+   }
+   if( spillLen_ == 0 && roomFor( wraps_, ptr_ + TrailerSize ) ) {
+      return true;
+   }
+   msgStart_ = ptr_;
+   return spill();
+}
 
-   // Remove TraceFile from the set maintained by the TraceHandle
-   traceHandle_->traceFiles_.erase( this );
+// Move the record being written, from msgStart_ to ptr_, to the overflow
+// area, where the rest of it goes too. The record is dropped if the
+// OverrunPolicy is not OverrunSpill or the area is full. Only its first
+// bytes may be in the ring, where they were written over the zero tsc that
+// marks its end, and that is put back.
+bool
+RingBuf::spill() noexcept {
+   uint32_t head = ptr_ - msgStart_;
+   char * rec = spill_ + spillLen_ + sizeof( uint32_t );
+   if( overrunPolicy_ != OverrunSpill ||
+       rec + head + TrailerSize > spill_ + spillSize_ ) {
+      if( head != 0 ) {
+         memset( msgStart_, 0, sizeof( uint64_t ) );
+      }
+      ptr_ = msgStart_;
+      msgStart_ = nullptr;
+      __atomic_store_n( &reader_->dropped, ++dropped_, __ATOMIC_RELAXED );
+      return false;
+   }
+   memcpy( rec, msgStart_, head );
+   if( head != 0 ) {
+      memset( msgStart_, 0, sizeof( uint64_t ) );
+   }
+   ringPtr_ = msgStart_;
+   msgStart_ = rec;
+   ptr_ = rec + head;
+   return true;
 }
 
-void TraceFile::closeIfNeeded() noexcept {
-   if( fd_ < 0 ) return;
-   int rc = ::close( fd_ );
-   assert( rc == 0 );
-   fd_ = -1;
+// Queue the record just written to the overflow area and go back to the
+// ring
+void
+RingBuf::endSpilledMsg() noexcept {
+   uint32_t len = ptr_ - msgStart_;
+   memcpy( msgStart_ - sizeof( len ), &len, sizeof( len ) );
+   spillLen_ = ptr_ - spill_;
+   ptr_ = ringPtr_;
+   ringPtr_ = nullptr;
 }
 
+// Copy as many records of the overflow area to the ring as the consumer
+// made room for, oldest first
 void
-TraceFile::sync() noexcept {
-   msync( buf_, traceHandle_->mappedTraceFileSize(), MS_SYNC );
+RingBuf::drainSpill() noexcept {
+   char * rec = spill_;
+   char * end = spill_ + spillLen_;
+   while( rec < end ) {
+      uint32_t len;
+      memcpy( &len, rec, sizeof( len ) );
+      maybeWrap( qtFile_ );
+      // A record too long for the trailer (one with a blob) goes to the
+      // start of the ring, like in putBlob()
+      bool wrap = ptr_ + len + sizeof( uint64_t ) > bufEnd_ + TrailerSize;
+      char * dst = wrap ? buf_ + sizeof( RingBufHeader ) : ptr_;
+      if( !roomFor( wraps_ + wrap, dst + len + sizeof( uint64_t ) ) ) {
+         break;
+      }
+      if( wrap ) {
+         countWrap( ptr_ );
+         doWrap();
+         if( !archiveQuarters_ ) {
+            qtFile_->maybeBackupBuffer( this );
+         }
+      }
+      memcpy( ptr_, rec + sizeof( len ), len );
+      ptr_ += len;
+      memset( ptr_, 0, sizeof( uint64_t ) );
+      ++records_;
+      publish( ptr_ );
+      rec += sizeof( len ) + len;
+   }
+   spillLen_ = end - rec;
+   memmove( spill_, rec, spillLen_ );
 }
 
-void 
-TraceFile::takeTimestamp() noexcept {
-   TraceFileHeader* sfh = (TraceFileHeader*) buf_;
-   uint64_t tsc = rdtsc();
-   // Only take a new timestamp every 1 million cycles It's pointless
-   // to go much faster and this way we guarantee that we don't spend
-   // a lot of time monotime() and in gettimeofday(), which each take
-   // around a microsecond.
-   if( tsc - sfh->tsc1 > 1000000 ) {
-      sfh->tsc1 = tsc;
-      sfh->monotime1 = monotime();
-      sfh->utc1 = utc();
+// Drop the records of the overflow area
+void
+RingBuf::dropSpill() noexcept {
+   for( uint32_t off = 0; off < spillLen_; ) {
+      uint32_t len;
+      memcpy( &len, spill_ + off, sizeof( len ) );
+      off += sizeof( len ) + len;
+      __atomic_store_n( &reader_->dropped, ++dropped_, __ATOMIC_RELAXED );
    }
+   spillLen_ = 0;
 }
 
+// Who holds RingBuf::spillLock_
+static constexpr uint32_t SpillFree = 0;
+static constexpr uint32_t SpillWriter = 1;
+static constexpr uint32_t SpillDrainer = 2;
+
+// Keep the spill drain thread off the ring while a record is written to
+// it. The writer waits for the thread if it is draining the ring, which
+// only takes a copy of the overflow area. A trace from a signal handler
+// interrupting a record finds the ring taken by its own thread already.
 void
-TraceFile::msgIdInitializedIs( MsgId msgId ) noexcept {
-   // Record that the necessary message descriptor information for
-   // this ID has been added to the trace file.
-   if( msgIdInitialized_.size() <= ( size_t )msgId ) {
-      msgIdInitialized_.resize( ( size_t )msgId + 32 );
+RingBuf::lockSpill() noexcept {
+   for( int spins = 0; ; ++spins ) {
+      uint32_t holder = SpillFree;
+      if( __atomic_compare_exchange_n( &spillLock_, &holder, SpillWriter, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) ||
+          holder == SpillWriter ) {
+         return;
+      }
+      cpuRelax( spins );
    }
-   msgIdInitialized_[ msgId ] = true;
 }
 
-// The wall-clock timestamp returned by gettimeofday
-struct timeval
-TraceFile::wallClockTimestamp() const noexcept {
-   struct timeval tv;
-   gettimeofday( &tv, 0 );
-   return tv;
+inline void
+RingBuf::unlockSpill() noexcept {
+   if( QUICKTRACE_UNLIKELY( __atomic_load_n( &spillLock_, __ATOMIC_RELAXED ) ==
+                            SpillWriter ) ) {
+      __atomic_store_n( &spillLock_, SpillFree, __ATOMIC_RELEASE );
+   }
 }
 
-struct RingBufHeader {
-   uint32_t tailPtr;
+// How often the spill drain thread looks at the overflow areas
+static constexpr double spillDrainPeriod = 0.01;
+
+// The rings with an overflow area (OverrunSpill). The writer moves its
+// records to the ring when it next traces, and this thread does it when
+// the consumer made room for them before then, so that they do not wait
+// for good in the memory of a writer that stopped tracing. The thread
+// holds the mutex while it drains the rings, and skips those a record
+// is being written to.
+//
+// The state is never destroyed, as the thread may still be running while
+// the process exits.
+struct SpillDrains {
+   std::mutex mutex;
+   std::vector< RingBuf * > rings;
+   bool threadRunning = false;
+
+   static void drain( RingBuf & ring ) noexcept {
+      uint32_t holder = SpillFree;
+      if( !__atomic_compare_exchange_n( &ring.spillLock_, &holder, SpillDrainer,
+                                        false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED ) ) {
+         return;
+      }
+      if( ring.spillLen_ != 0 ) {
+         ring.drainSpill();
+      }
+      __atomic_store_n( &ring.spillLock_, SpillFree, __ATOMIC_RELEASE );
+   }
 };
 
-inline void
-RingBuf::maybeWrap( TraceFile *tf ) noexcept {
-   if( QUICKTRACE_UNLIKELY(ptr_ >= bufEnd_) ) {
-      doWrap();
-      qtFile_->maybeBackupBuffer();
+static SpillDrains &
+spillDrains() noexcept {
+   static SpillDrains * drains = new SpillDrains;
+   return *drains;
+}
+
+static void *
+spillDrainThread( void * ) noexcept {
+   SpillDrains & d = spillDrains();
+   for( ;; ) {
+      {
+         std::lock_guard< std::mutex > lock( d.mutex );
+         for( RingBuf * ring : d.rings ) {
+            SpillDrains::drain( *ring );
+         }
+      }
+      sleepFor( spillDrainPeriod );
+   }
+   return nullptr;
+}
+
+// Hands ring to the spill drain thread, which is started unless it is
+// already running
+static void
+startSpillDrain( RingBuf * ring ) noexcept {
+   SpillDrains & d = spillDrains();
+   d.rings.push_back( ring );
+   if( d.threadRunning ) {
+      return;
+   }
+   pthread_t thread;
+   pthread_attr_t attr;
+   pthread_attr_init( &attr );
+   pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+   int err = pthread_create( &thread, &attr, spillDrainThread, nullptr );
+   pthread_attr_destroy( &attr );
+   if( err ) {
+      // The records then only go to the ring when the writer traces
+      std::cerr << "QuickTrace failed to start the spill drain thread (" << err
+                << "): " << strerror( err ) << std::endl;
+      return;
+   }
+   d.threadRunning = true;
+}
+
+// Takes ring back from the spill drain thread, with the mutex held
+static void
+stopSpillDrain( RingBuf * ring ) noexcept {
+   SpillDrains & d = spillDrains();
+   auto it = std::find( d.rings.begin(), d.rings.end(), ring );
+   if( it != d.rings.end() ) {
+      d.rings.erase( it );
+   }
+}
+
+// The records left in the overflow area go to the ring if there is room
+// for them, and are dropped otherwise
+void
+RingBuf::overrunPolicyIs( RingReader * reader, OverrunPolicy policy,
+                          uint32_t spillBytes ) noexcept {
+   std::lock_guard< std::mutex > lock( spillDrains().mutex );
+   if( spill_ != nullptr ) {
+      stopSpillDrain( this );
+   }
+   if( spillLen_ != 0 ) {
+      drainSpill();
+      dropSpill();
+   }
+   free( spill_ );
+   spill_ = nullptr;
+   spillSize_ = 0;
+   if( reader != nullptr && policy == OverrunSpill ) {
+      spill_ = ( char * )malloc( spillBytes );
+      spillSize_ = spill_ ? spillBytes : 0;
+   }
+   reader_ = reader;
+   overrunPolicy_ = policy;
+   if( spill_ != nullptr ) {
+      startSpillDrain( this );
    }
 }
 
@@ -733,14 +4029,21 @@ RingBuf::bufIs( void * buf, int bufSize ) noexcept {
    memset( bufEnd_, -1, TrailerSize );
    ptr_ = buf_;
    doWrap();
+   reserved_ = committed_ = ptr_ - buf_;
    // mark the buffer as empty by writing a zero tsc
    memset( ptr_, 0, sizeof( uint64_t ) );
+   publish( ptr_ );
 }
 
 RingBuf::RingBuf() noexcept {
    memset( this, 0, sizeof( *this ));
 }
 
+RingBuf::~RingBuf() noexcept {
+   free( spill_ );
+   free( slots_ );
+}
+
 
 void
 RingBuf::doWrap() noexcept {
@@ -748,6 +4051,11 @@ RingBuf::doWrap() noexcept {
    RingBufHeader * hdr = (RingBufHeader*) buf_;
    hdr->tailPtr = ptr_ - buf_;  // distance to byte after end of last message
    ptr_ = (char*)(hdr+1);
+   // The last quarter of the lap is archived by the next trace, once the
+   // first record of the new lap is committed: until then the commit
+   // offset is at the start of the ring, which may be that of a lap not
+   // counted yet, see copyLevel()
+   backupPtr_ = archiveQuarters_ ? ptr_ + 1 : bufEnd_;
    if( qtFile_ )
       qtFile_->takeTimestamp();
 
@@ -759,16 +4067,22 @@ RingBuf::qtFileIs( TraceFile * f ) noexcept { qtFile_ = f; }
 #ifndef SUPERFAST
 uint64_t
 RingBuf::startMsg( TraceFile *tf, MsgId id ) noexcept {
+   if( QUICKTRACE_UNLIKELY( sharedRing_ != nullptr ) && busy() ) {
+      return startNestedMsg( id );
+   }
    MsgCounter * mc = msgCounter( id );
    __builtin_prefetch( mc, 1, 1 ); // This seems to make a small difference
+   if( QUICKTRACE_UNLIKELY( spill_ != nullptr ) ) {
+      lockSpill();
+   }
    maybeWrap(tf);
 
-   uint64_t tsc;
-   tsc = rdtsc();
+   uint32_t cpu = 0;
+   uint64_t tsc = timestamp( &cpu );
 
    // Don't touch the message if the 'off' bit is set
    uint32_t off = mc->lastTsc & 0x80000000;
-   if( off ) {
+   if( off || ( QUICKTRACE_UNLIKELY( reader_ != nullptr ) && !makeRoom() ) ) {
       msgStart_ = 0;
    } else {
       msgStart_ = ptr_;
@@ -776,27 +4090,382 @@ RingBuf::startMsg( TraceFile *tf, MsgId id ) noexcept {
       ptr_ += sizeof( uint64_t );
       memcpy( ptr_, &id, sizeof( id ) );
       ptr_ += sizeof( id );
+      if( QUICKTRACE_UNLIKELY( recordCpuId_ ) ) {
+         push( ( uint16_t )cpu );
+      }
    }
 
    mc->lastTsc = updateLastTsc( mc->lastTsc, tsc );
-   mc->count++;
+   if( QUICKTRACE_UNLIKELY( sharedRing_ != nullptr ) ) {
+      // Every thread tracing to the shared ring counts the message
+      __atomic_fetch_add( &mc->count, 1, __ATOMIC_RELAXED );
+   } else {
+      mc->count++;
+   }
 
    return tsc;
 }
 
 void
 RingBuf::endMsg() noexcept {
+   if( QUICKTRACE_UNLIKELY( sharedRing_ != nullptr ) ) {
+      endSharedMsg();
+      return;
+   }
    if ( enabled() ) {
-      *ptr_ = (char) (ptr_-msgStart_);
-      ptr_++;
-      memset( ptr_, 0, sizeof( uint64_t ) );
+      pushLength();
+      if( QUICKTRACE_UNLIKELY( ringPtr_ != nullptr ) ) {
+         endSpilledMsg();
+      } else {
+         memset( ptr_, 0, sizeof( uint64_t ) );
+         ++records_;
+         publish( ptr_ );
+      }
    }
+   unlockSpill();
 }
 #endif
 
+// Terminate the record with its length, see ExtendedRecordLength
+inline void
+RingBuf::pushLength() noexcept {
+   uint32_t len = ptr_ - msgStart_;
+   if( QUICKTRACE_LIKELY( len < ExtendedRecordLength ) ) {
+      *ptr_ = (char) len;
+      ptr_++;
+   } else {
+      push( len );
+      push( ExtendedRecordLength );
+   }
+}
+
+// The longest blob that still fits in the record being written. A
+// record may take up to half of its ring: it has to fit at the start of
+// the ring when it gets moved there, and a shared ring only lets a
+// writer reserve half of it (see waitForRoomShared()). The arguments
+// after the blob and the record length get a trailer's worth of room.
+uint32_t
+RingBuf::maxBlobLen() const noexcept {
+   RingBuf const * ring = sharedRing_ ? sharedRing_ : this;
+   uint32_t room = ( ring->bufEnd_ - ring->buf_ - sizeof( RingBufHeader ) ) / 2;
+   if( staging_ ) {
+      room = std::min( room, uint32_t( bufEnd_ - buf_ ) );
+   }
+   if( ringPtr_ != nullptr ) {
+      room = std::min( room, uint32_t( spill_ + spillSize_ - msgStart_ ) );
+   }
+   uint32_t used = ptr_ - msgStart_ + sizeof( uint32_t ) + TrailerSize;
+   return room > used ? room - used : 0;
+}
+
+void
+RingBuf::putBlob( void const * data, uint32_t len ) noexcept {
+   len = std::min( len, maxBlobLen() );
+   bool inRing = !staging_ && ringPtr_ == nullptr;
+   if( QUICKTRACE_UNLIKELY( reader_ != nullptr ) && inRing ) {
+      // startMsg() only made room for a record that fits in the trailer
+      bool wrap = ptr_ + sizeof( len ) + len > bufEnd_;
+      char * end = ( wrap ? buf_ + sizeof( RingBufHeader ) : msgStart_ ) +
+                   ( ptr_ - msgStart_ ) + sizeof( len ) + len + TrailerSize;
+      if( !roomFor( wraps_ + wrap, end ) ) {
+         if( !spill() ) {
+            return;
+         }
+         len = std::min( len, maxBlobLen() );
+         inRing = false;
+      }
+   }
+   if( QUICKTRACE_UNLIKELY( inRing && ptr_ + sizeof( len ) + len > bufEnd_ ) ) {
+      // The blob would run into the trailer, so wrap now and move the
+      // part of the record written so far to the start of the ring.
+      // doWrap() marks the end of the ring where the record started
+      // (qttail wraps when it gets there), clobbering its timestamp.
+      uint32_t head = ptr_ - msgStart_;
+      char * rec = msgStart_;
+      uint64_t tsc;
+      memcpy( &tsc, rec, sizeof( tsc ) );
+      ptr_ = rec;
+      countWrap( ptr_ );
+      doWrap();
+      memmove( ptr_ + sizeof( tsc ), rec + sizeof( tsc ), head - sizeof( tsc ) );
+      memcpy( ptr_, &tsc, sizeof( tsc ) );
+      msgStart_ = ptr_;
+      ptr_ += head;
+      qtFile_->maybeBackupBuffer( this );
+   }
+   push( len );
+   memcpy( ptr_, data, len );
+   ptr_ += len;
+}
+
+// Records written to a shared TraceFile are tagged with a small
+// number identifying the thread that wrote them. Tags are handed out
+// in the order in which threads first trace, and 0 is never used.
+static std::atomic< uint16_t > nextThreadTag;
+static thread_local uint16_t threadTag;
+
+static uint16_t
+sharedRingThreadTag() noexcept {
+   if( QUICKTRACE_UNLIKELY( threadTag == 0 ) ) {
+      do {
+         threadTag = ++nextThreadTag;
+      } while( threadTag == 0 );
+   }
+   return threadTag;
+}
+
+// A shared TraceFile hands out a thread-local staging ring for each
+// trace. The record is assembled there exactly as it would be in a
+// regular ring, and endMsg() copies it into the shared ring in one go,
+// so that the time during which a writer holds space in the shared ring
+// without having published it is as short as possible.
+RingBuf &
+TraceFile::stagingLog( int i ) noexcept {
+   // Big enough for a record with a multi-kilobyte blob, see
+   // RingBuf::maxBlobLen(). The discard ring only has to hold something.
+   static constexpr int stagingBufSize = 16 * 1024;
+   static constexpr int discardBufSize = 4096;
+   static thread_local char stagingBuf[ stagingBufSize ];
+   static thread_local RingBuf staging;
+   static thread_local char discardBuf[ discardBufSize ];
+   static thread_local RingBuf discard;
+
+   RingBuf & shared = log_[ i ];
+   RingBuf * rb = &staging;
+   char * buf = stagingBuf;
+   int bufSize = stagingBufSize;
+   if( QUICKTRACE_UNLIKELY( staging.busy() ) ) {
+      if( staging.sharedRing_ == &shared ) {
+         // The C API looks the ring up again for every argument. A trace
+         // from a signal handler is dropped, see startNestedMsg().
+         return staging;
+      }
+      // This thread is in the middle of a trace to another ring, and
+      // this one comes from a signal handler or from evaluating one of
+      // its arguments. Let it write into a scratch ring that is never
+      // committed rather than corrupting the record in progress, or
+      // waiting for its commit.
+      rb = &discard;
+      buf = discardBuf;
+      bufSize = discardBufSize;
+   }
+   rb->buf_ = buf;
+   rb->ptr_ = buf;
+   rb->bufEnd_ = buf + bufSize;
+   rb->backupPtr_ = rb->bufEnd_;
+   rb->staging_ = true;
+   rb->msgCounters_ = shared.msgCounters_;
+   rb->recordCpuId_ = shared.recordCpuId_;
+   rb->clockSource_ = shared.clockSource_;
+   rb->qtFile_ = this;
+   rb->sharedRing_ = ( rb == &staging ) ? &shared : nullptr;
+   return *rb;
+}
+
+// A trace started in a staging ring from a signal handler that
+// interrupted the thread while the ring held a record, which may already
+// have reserved its space in the shared ring and be copying it from the
+// staging ring. The nested record has nowhere else to be assembled, see
+// commitShared(), so it is counted but dropped: the ring is disabled
+// until endSharedMsg() hands the interrupted record back. A signal that
+// interrupts that handover drops the interrupted record too.
+uint64_t
+RingBuf::startNestedMsg( MsgId id ) noexcept {
+   if( nested_++ == 0 ) {
+      nestedMsgStart_ = msgStart_;
+   }
+   msgStart_ = nullptr;
+   uint32_t cpu = 0;
+   uint64_t tsc = timestamp( &cpu );
+   MsgCounter * mc = msgCounter( id );
+   mc->lastTsc = updateLastTsc( mc->lastTsc, tsc );
+   __atomic_fetch_add( &mc->count, 1, __ATOMIC_RELAXED );
+   return tsc;
+}
+
+void
+RingBuf::endSharedMsg() noexcept {
+   if( QUICKTRACE_UNLIKELY( nested_ != 0 ) ) {
+      if( nested_ == 1 ) {
+         msgStart_ = nestedMsgStart_;
+      }
+      --nested_;
+      return;
+   }
+   if( !enabled() ) {
+      return;
+   }
+   push( sharedRingThreadTag() );
+   pushLength();
+   sharedRing_->commitShared( msgStart_, ptr_ - msgStart_ );
+   // Mark the staging ring as idle, see TraceFile::stagingLog()
+   msgStart_ = nullptr;
+   ptr_ = buf_;
+}
+
+// The records a shared ring can have reserved but not committed in
+// order yet, see advanceShared()
+static constexpr uint32_t SharedSlots = 256;
+
+// The commit marker of a record reserved in a shared ring. The tsc of
+// the record is not aligned, so it can not be the marker itself, see
+// publish(). stamp is set to the number of the record plus one, with a
+// release store, once the record is written, its tsc last.
+struct RingBuf::SharedSlot {
+   uint32_t stamp;
+   // Where the record was reserved, and where it went: the start of the
+   // ring when it did not fit before the end
+   uint32_t from;
+   uint32_t start;
+   uint32_t end;
+};
+
+void
+RingBuf::sharedIs() noexcept {
+   slots_ = ( SharedSlot * )calloc( SharedSlots, sizeof( SharedSlot ) );
+}
+
+// Writers must not get a full lap ahead of the oldest record that has
+// not been committed in order yet, or they would overwrite it while it
+// is being copied, nor take the commit marker it still holds. This only
+// happens with many writers and a tiny ring, or when the writer of that
+// record is preempted, in which case we wait like for a full ring.
+// Returns the reservation to start from.
+uint64_t
+RingBuf::waitForRoomShared( uint32_t len ) noexcept {
+   uint32_t start = sizeof( RingBufHeader );
+   uint32_t end = bufEnd_ - buf_;
+   uint32_t room = ( end - start ) / 2;
+   for( int spins = 0; ; ++spins ) {
+      uint64_t committed = __atomic_load_n( &committed_, __ATOMIC_ACQUIRE );
+      uint64_t reserved = __atomic_load_n( &reserved_, __ATOMIC_RELAXED );
+      uint32_t done = uint32_t( committed );
+      uint32_t cur = uint32_t( reserved );
+      uint32_t pending;
+      if( cur >= done ) {
+         pending = cur - done;
+      } else {
+         // the reservations have wrapped but the commits have not yet
+         pending = ( end + TrailerSize - done ) + ( cur - start );
+      }
+      uint32_t records = uint32_t( reserved >> 32 ) - uint32_t( committed >> 32 );
+      if( pending + len <= room && records < SharedSlots ) {
+         return reserved;
+      }
+      cpuRelax( spins );
+   }
+}
+
+// Writers reserve space by advancing reserved_ with a CAS, copy their
+// records in parallel, and mark each record committed on its own once it
+// is written, see SharedSlot. None of them waits for another, unless the
+// ring is full, see waitForRoomShared(). The tsc is taken between loading
+// and swapping reserved_, so the records in the ring are in timestamp
+// order just like in a ring with a single writer.
+void
+RingBuf::commitShared( char const * rec, uint32_t len ) noexcept {
+   if( QUICKTRACE_UNLIKELY( slots_ == nullptr ) ) {
+      return;
+   }
+   uint32_t start = sizeof( RingBufHeader );
+   uint32_t end = bufEnd_ - buf_;
+   uint64_t reserved;
+   uint32_t cur;
+   uint32_t dst;
+   uint64_t tsc;
+   uint32_t cpu = 0;
+   do {
+      reserved = waitForRoomShared( len );
+      cur = uint32_t( reserved );
+      tsc = timestamp( &cpu );
+      // Wrap at the end of the ring, or before it for a record too long
+      // for the trailer (one with a blob)
+      dst = ( cur >= end ||
+              cur + len + sizeof( uint64_t ) > end + TrailerSize ) ? start : cur;
+   } while( !__atomic_compare_exchange_n( &reserved_, &reserved,
+                                          ( ( reserved >> 32 ) + 1 ) << 32 |
+                                             ( dst + len ),
+                                          false, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED ) );
+
+   char * p = buf_ + dst;
+   memcpy( p + sizeof( tsc ), rec + sizeof( tsc ), len - sizeof( tsc ) );
+   if( QUICKTRACE_UNLIKELY( recordCpuId_ ) ) {
+      // Replace the CPU the staging ring's tsc was read on with that of
+      // the tsc the record is published with
+      uint16_t cpu16 = cpu;
+      memcpy( p + sizeof( tsc ) + sizeof( MsgId ), &cpu16, sizeof( cpu16 ) );
+   }
+   memcpy( p, &tsc, sizeof( tsc ) );
+   uint32_t seq = uint32_t( reserved >> 32 );
+   SharedSlot & slot = slots_[ seq % SharedSlots ];
+   slot.from = cur;
+   slot.start = dst;
+   slot.end = dst + len;
+   __atomic_store_n( &slot.stamp, seq + 1, __ATOMIC_RELEASE );
+   advanceShared();
+}
+
+// Move the commit offset past the records committed in reservation order,
+// up to the first one that is not, doing for each what doWrap() and
+// endMsg() do in a ring with a single writer. One writer at a time does it
+// for everyone, and the others leave their records to it rather than
+// wait. The fences make sure that either a writer sees the ring free
+// after setting its marker, or the writer letting go of the ring sees the
+// marker, so that no record is left behind.
+void
+RingBuf::advanceShared() noexcept {
+   __atomic_thread_fence( __ATOMIC_SEQ_CST );
+   for( ;; ) {
+      uint32_t busy = 0;
+      if( !__atomic_compare_exchange_n( &advancing_, &busy, 1, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) ) {
+         return;
+      }
+      uint64_t committed = __atomic_load_n( &committed_, __ATOMIC_RELAXED );
+      uint32_t seq = uint32_t( committed >> 32 );
+      for( ;; ++seq ) {
+         SharedSlot const & slot = slots_[ seq % SharedSlots ];
+         if( __atomic_load_n( &slot.stamp, __ATOMIC_ACQUIRE ) != seq + 1 ) {
+            break;
+         }
+         bool wrapped = slot.start != slot.from;
+         if( wrapped ) {
+            // First record after the wrap
+            countWrap( buf_ + slot.from );
+            memset( buf_ + slot.from, -1, sizeof( uint64_t ) );
+            RingBufHeader * hdr = (RingBufHeader*) buf_;
+            hdr->tailPtr = slot.from;
+            qtFile_->takeTimestamp();
+         }
+         ++records_;
+         publish( buf_ + slot.end );
+         __atomic_store_n( &committed_, uint64_t( seq + 1 ) << 32 | slot.end,
+                           __ATOMIC_RELEASE );
+         if( QUICKTRACE_UNLIKELY( wrapped ) ) {
+            // Once the first record of the lap is committed, see
+            // RingBuf::doWrap()
+            qtFile_->maybeBackupBuffer( this );
+         } else if( QUICKTRACE_UNLIKELY( archiveQuarters_ ) ) {
+            // The record that fills a quarter of the ring, see maybeWrap()
+            char * quarter = nextArchivePtr( buf_ + slot.start );
+            if( quarter < bufEnd_ && buf_ + slot.end >= quarter ) {
+               qtFile_->maybeBackupBuffer( this );
+            }
+         }
+      }
+      __atomic_store_n( &advancing_, 0, __ATOMIC_RELEASE );
+      __atomic_thread_fence( __ATOMIC_SEQ_CST );
+      if( __atomic_load_n( &slots_[ seq % SharedSlots ].stamp, __ATOMIC_ACQUIRE ) !=
+          seq + 1 ) {
+         return;
+      }
+   }
+}
+
 BlockTimer::~BlockTimer() noexcept {
    if( QUICKTRACE_LIKELY( qtFile_ != 0 ) ) {
-      uint64_t now = rdtsc();
+      uint64_t now = qtFile_->timestamp();
       uint64_t delta = now - tsc_;
       MsgCounter * mc = qtFile_->msgCounter( msgId_ );
       mc->tscCount += delta;
@@ -806,7 +4475,7 @@ BlockTimer::~BlockTimer() noexcept {
 
 BlockTimerMsg::~BlockTimerMsg() noexcept {
    if( QUICKTRACE_LIKELY( qtFile_ != 0 ) ) {
-      uint64_t now = rdtsc();
+      uint64_t now = qtFile_->timestamp();
       uint64_t delta = now - tsc_;
       MsgCounter * mc = qtFile_->msgCounter( msgId_ );
       mc->tscCount += delta;
@@ -814,7 +4483,7 @@ BlockTimerMsg::~BlockTimerMsg() noexcept {
 }
 
 BlockTimerSelf::BlockTimerSelf( TraceFile * sf, MsgId mid ) noexcept :
-      qtFile_( sf ), msgId_( mid ), tsc_( rdtsc() ) {
+      qtFile_( sf ), msgId_( mid ), tsc_( sf ? sf->timestamp() : 0 ) {
    if ( qtFile_ != 0 ) {
      threadSubFuncStack.push_back( 0 );
    }
@@ -822,7 +4491,7 @@ BlockTimerSelf::BlockTimerSelf( TraceFile * sf, MsgId mid ) noexcept :
 
 BlockTimerSelf::~BlockTimerSelf() noexcept {
    if( QUICKTRACE_LIKELY( qtFile_ != 0 ) ) {
-      uint64_t now = rdtsc();
+      uint64_t now = qtFile_->timestamp();
       uint64_t delta = now - tsc_;
       MsgCounter * mc = qtFile_->msgCounter( msgId_ );
       mc->lastTsc = updateLastTsc( mc->lastTsc, now );
@@ -845,7 +4514,7 @@ BlockTimerSelfMsg::BlockTimerSelfMsg( TraceFile * sf, MsgId mid,
 
 BlockTimerSelfMsg::~BlockTimerSelfMsg() noexcept {
    if( QUICKTRACE_LIKELY( qtFile_ != 0 ) ) {
-      uint64_t now = rdtsc();
+      uint64_t now = qtFile_->timestamp();
       uint64_t delta = now - tsc_;
       MsgCounter * mc = qtFile_->msgCounter( msgId_ );
       mc->tscCount += delta;
@@ -857,24 +4526,205 @@ BlockTimerSelfMsg::~BlockTimerSelfMsg() noexcept {
 }
 void put( RingBuf * log,
           char const * x ) noexcept __attribute__ ( ( optimize( 3 ) ) );
+void put( RingBuf * log,
+          std::string_view x ) noexcept __attribute__ ( ( optimize( 3 ) ) );
+
+// Length of the string x, but at most maxLen, looking at 16 bytes at a
+// time. The loads are aligned to 16 bytes, so even when they go past
+// the end of the string they never cross into the next page, which
+// may not be mapped. The bytes before x in the first load are ignored.
+// The over-read is invisible to the program but not to AddressSanitizer.
+__attribute__( ( always_inline, no_sanitize_address ) )
+static inline unsigned int
+stringLength( char const * x, unsigned int maxLen ) noexcept {
+#if defined( __SSE2__ )
+   uintptr_t misalign = ( uintptr_t )x & 15;
+   __m128i const * p = ( __m128i const * )( x - misalign );
+   __m128i const zero = _mm_setzero_si128();
+   uint32_t nulls = _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_load_si128( p ),
+                                                       zero ) ) >> misalign;
+   unsigned int len = 0;
+   for( ;; ) {
+      if( nulls ) {
+         len += __builtin_ctz( nulls );
+         return len < maxLen ? len : maxLen;
+      }
+      len += len ? 16 : 16 - misalign;
+      if( len >= maxLen ) {
+         return maxLen;
+      }
+      nulls = _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_load_si128( ++p ),
+                                                 zero ) );
+   }
+#elif defined( __ARM_NEON )
+   // NEON has no movemask, so narrow the comparison to 4 bits per byte
+   uintptr_t misalign = ( uintptr_t )x & 15;
+   uint8_t const * p = ( uint8_t const * )( x - misalign );
+   auto nullMask = []( uint8_t const * q ) {
+      uint8x16_t eq = vceqzq_u8( vld1q_u8( q ) );
+      return vget_lane_u64( vreinterpret_u64_u8(
+                               vshrn_n_u16( vreinterpretq_u16_u8( eq ), 4 ) ), 0 );
+   };
+   uint64_t nulls = nullMask( p ) >> ( misalign * 4 );
+   unsigned int len = 0;
+   for( ;; ) {
+      if( nulls ) {
+         len += __builtin_ctzll( nulls ) / 4;
+         return len < maxLen ? len : maxLen;
+      }
+      len += len ? 16 : 16 - misalign;
+      if( len >= maxLen ) {
+         return maxLen;
+      }
+      p += 16;
+      nulls = nullMask( p );
+   }
+#else
+   return strnlen( x, maxLen );
+#endif
+}
+
+// Copy exactly len bytes, without a call to memcpy for the short
+// strings that make up most arguments. Each size class is covered by
+// two fixed size copies that overlap in the middle.
+__attribute__( ( always_inline ) )
+static inline void
+copyString( char * dst, char const * src, unsigned int len ) noexcept {
+   if( len >= 16 ) {
+      unsigned int i = 0;
+      for( ; i + 16 < len; i += 16 ) {
+         memcpy( dst + i, src + i, 16 );
+      }
+      memcpy( dst + len - 16, src + len - 16, 16 );
+   } else if( len >= 8 ) {
+      memcpy( dst, src, 8 );
+      memcpy( dst + len - 8, src + len - 8, 8 );
+   } else if( len >= 4 ) {
+      memcpy( dst, src, 4 );
+      memcpy( dst + len - 4, src + len - 4, 4 );
+   } else {
+      for( unsigned int i = 0; i < len; ++i ) {
+         dst[ i ] = src[ i ];
+      }
+   }
+}
+
+#ifdef QT_STRING_AVX2
+// Whether the CPU, and the kernel, support AVX2, for put() to look at 32
+// bytes at a time. The traces before the static initializers ran use
+// the SSE2 versions.
+static bool stringAvx2 = [] {
+   __builtin_cpu_init();
+   return __builtin_cpu_supports( "avx2" ) != 0;
+}();
+
+// stringLength(), 32 bytes at a time. The loads are aligned to 32 bytes,
+// and so never cross into the next page either.
+__attribute__( ( always_inline, no_sanitize_address, target( "avx2" ) ) )
+static inline unsigned int
+stringLengthAvx2( char const * x, unsigned int maxLen ) noexcept {
+   uintptr_t misalign = ( uintptr_t )x & 31;
+   __m256i const * p = ( __m256i const * )( x - misalign );
+   __m256i const zero = _mm256_setzero_si256();
+   uint32_t nulls = ( uint32_t )_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8( _mm256_load_si256( p ), zero ) ) >> misalign;
+   unsigned int len = 0;
+   for( ;; ) {
+      if( nulls ) {
+         len += __builtin_ctz( nulls );
+         return len < maxLen ? len : maxLen;
+      }
+      len += len ? 32 : 32 - misalign;
+      if( len >= maxLen ) {
+         return maxLen;
+      }
+      nulls = ( uint32_t )_mm256_movemask_epi8(
+         _mm256_cmpeq_epi8( _mm256_load_si256( ++p ), zero ) );
+   }
+}
+
+// copyString(), with 32 byte copies for the long strings
+__attribute__( ( always_inline, target( "avx2" ) ) )
+static inline void
+copyStringAvx2( char * dst, char const * src, unsigned int len ) noexcept {
+   if( len >= 32 ) {
+      unsigned int i = 0;
+      for( ; i + 32 < len; i += 32 ) {
+         memcpy( dst + i, src + i, 32 );
+      }
+      memcpy( dst + len - 32, src + len - 32, 32 );
+   } else {
+      copyString( dst, src, len );
+   }
+}
+
+// putWithMaxLen() with the AVX2 versions. Not inlined, as put() itself
+// has to run on the CPUs without AVX2.
+__attribute__( ( noinline, optimize( 3 ), target( "avx2" ) ) )
+static void
+putWithMaxLenAvx2( RingBuf * log, char const * x, unsigned int maxLen ) noexcept {
+   char * ptr = ((char*) log->ptr());
+   unsigned int len = stringLengthAvx2( x, maxLen );
+   *ptr = len;
+   copyStringAvx2( ptr + 1, x, len );
+   log->ptrIs( ptr + 1 + len );
+}
 
-// Common code for put() and putLongString()
+__attribute__( ( noinline, optimize( 3 ), target( "avx2" ) ) )
 static void
+putWithMaxLenAvx2( RingBuf * log, std::string_view x,
+                   unsigned int maxLen ) noexcept {
+   char * ptr = ((char*) log->ptr());
+   unsigned int len = x.size() < maxLen ? x.size() : maxLen;
+   *ptr = len;
+   copyStringAvx2( ptr + 1, x.data(), len );
+   log->ptrIs( ptr + 1 + len );
+}
+#endif
+
+// Common code for put() and putLongString(), inlined so that it gets
+// their optimization level
+__attribute__( ( always_inline ) )
+static inline void
 putWithMaxLen( RingBuf * log, char const * x, unsigned int maxLen ) noexcept {
    // pascal-style string: len byte followed by data
    char * ptr = ((char*) log->ptr());
-   char * ptr1 = ptr + 1;
-   unsigned int i;
-   for( i = 0 ; i < maxLen ; ++i ) {
-      if( !x[i] ) { break; }
-      ptr1[i] = x[i];
-   }
-   *ptr = i;
-   log->ptrIs( ptr1 + i );
+   unsigned int len = stringLength( x, maxLen );
+   *ptr = len;
+   copyString( ptr + 1, x, len );
+   log->ptrIs( ptr + 1 + len );
 }
 
 void
 put( RingBuf * log, char const * x ) noexcept {
+#ifdef QT_STRING_AVX2
+   if( stringAvx2 ) {
+      putWithMaxLenAvx2( log, x, qtMaxStringLen );
+      return;
+   }
+#endif
+   putWithMaxLen( log, x, qtMaxStringLen );
+}
+
+// Common code for the std::string_view put() and putLongString()
+__attribute__( ( always_inline ) )
+static inline void
+putWithMaxLen( RingBuf * log, std::string_view x, unsigned int maxLen ) noexcept {
+   char * ptr = ((char*) log->ptr());
+   unsigned int len = x.size() < maxLen ? x.size() : maxLen;
+   *ptr = len;
+   copyString( ptr + 1, x.data(), len );
+   log->ptrIs( ptr + 1 + len );
+}
+
+void
+put( RingBuf * log, std::string_view x ) noexcept {
+#ifdef QT_STRING_AVX2
+   if( stringAvx2 ) {
+      putWithMaxLenAvx2( log, x, qtMaxStringLen );
+      return;
+   }
+#endif
    putWithMaxLen( log, x, qtMaxStringLen );
 }
 
@@ -882,6 +4732,23 @@ put( RingBuf * log, char const * x ) noexcept {
 #define LONGSTRING_LIMIT 240
 void
 putLongString( RingBuf * log, char const * x ) noexcept {
+#ifdef QT_STRING_AVX2
+   if( stringAvx2 ) {
+      putWithMaxLenAvx2( log, x, LONGSTRING_LIMIT );
+      return;
+   }
+#endif
+   putWithMaxLen( log, x, LONGSTRING_LIMIT );
+}
+
+void
+putLongString( RingBuf * log, std::string_view x ) noexcept {
+#ifdef QT_STRING_AVX2
+   if( stringAvx2 ) {
+      putWithMaxLenAvx2( log, x, LONGSTRING_LIMIT );
+      return;
+   }
+#endif
    putWithMaxLen( log, x, LONGSTRING_LIMIT );
 }
 
@@ -910,11 +4777,24 @@ static void
 processForkPrepare() noexcept {
    // Block TraceHandle or TraceFile creation while we are forking
    traceHandleMutex.lock();
+   tscCalibration().mutex.lock();
+   // Before the backups, which the spill drain thread may queue
+   spillDrains().mutex.lock();
+   foreverLogBackups().mutex.lock();
+   streamingLogs().mutex.lock();
+   fileRotations().mutex.lock();
+   memoryTraceFiles().mutex.lock();
 }
 
 static void
 processForkParent() noexcept {
-   // Release the lock acquired in processForkPrepare()
+   // Release the locks acquired in processForkPrepare()
+   memoryTraceFiles().mutex.unlock();
+   fileRotations().mutex.unlock();
+   streamingLogs().mutex.unlock();
+   foreverLogBackups().mutex.unlock();
+   spillDrains().mutex.unlock();
+   tscCalibration().mutex.unlock();
    traceHandleMutex.unlock();
 }
 
@@ -926,6 +4806,57 @@ processForkChild() noexcept {
    // in its place.
    traceHandleMutex.~mutex();
    new ( &traceHandleMutex ) std::mutex();
+   // The calibration thread did not make it into the child, and the
+   // files it calibrates belong to the parent. Forget them, the next
+   // TraceFile created starts a new thread.
+   TscCalibration & calibration = tscCalibration();
+   calibration.mutex.~mutex();
+   new ( &calibration.mutex ) std::mutex();
+   new ( &calibration.wake ) std::condition_variable();
+   calibration.threadRunning = false;
+   calibration.traceFiles.clear();
+   // Same for the forever log backup thread, the backups it was yet to
+   // copy are the parent's
+   ForeverLogBackups & backups = foreverLogBackups();
+   backups.mutex.~mutex();
+   new ( &backups.mutex ) std::mutex();
+   // The condition variables are not destroyed first: the thread may
+   // have been waiting on one, and destroying a condition variable with
+   // waiters blocks for good in the child
+   new ( &backups.copied ) std::condition_variable();
+   backups.reset();
+   backups.threadRunning = false;
+   // And for the stream thread, the TraceFiles it streams are the
+   // parent's
+   StreamingLogs & streams = streamingLogs();
+   streams.mutex.~mutex();
+   new ( &streams.mutex ) std::mutex();
+   new ( &streams.streamed ) std::condition_variable();
+   streams.traceFiles.clear();
+   streams.streaming = false;
+   streams.threadRunning = false;
+   // And for the spill drain thread. It held the mutex while draining,
+   // so no ring was left half drained, and the rings it drained are
+   // taken back as their TraceFiles go away below.
+   SpillDrains & drains = spillDrains();
+   drains.mutex.~mutex();
+   new ( &drains.mutex ) std::mutex();
+   drains.threadRunning = false;
+   // And for the file rotation thread, the parent prunes and compresses
+   // the files it rotated
+   FileRotations & rotations = fileRotations();
+   rotations.mutex.~mutex();
+   new ( &rotations.mutex ) std::mutex();
+   new ( &rotations.queued ) std::condition_variable();
+   rotations.jobs.clear();
+   rotations.threadRunning = false;
+   // The memory files are the parent's to persist on a crash
+   MemoryTraceFiles & memoryFiles = memoryTraceFiles();
+   memoryFiles.mutex.~mutex();
+   new ( &memoryFiles.mutex ) std::mutex();
+   for( MemoryTraceFiles::File & f : memoryFiles.files ) {
+      f.fd = -1;
+   }
    // At this point we are the only thread in the new child process.
    if( deleteTraceHandlesOnFork ) {
       while ( !traceHandleMap.empty() ) {
@@ -972,23 +4903,38 @@ TraceHandle::TraceHandle( char const * fileNameFormat,
                           MultiThreading multiThreading,
                           bool rotateLogFile,
                           uint32_t numMsgCounters,
-                          bool defaultHandle ) noexcept
+                          bool defaultHandle,
+                          MsgCounterLayout msgCounterLayout,
+                          ClockSource clockSource,
+                          RotationPolicy const * rotationPolicy ) noexcept
       : multiThreading_( multiThreading ),
         traceFilesClosed_( false ),
         numMsgCounters_( numMsgCounters ),
+        msgCounterLayout_( msgCounterLayout ),
+        clockSource_( clockSource ),
+        rotationPolicy_( rotationPolicy ? *rotationPolicy : RotationPolicy() ),
         nonMtTraceFile_( NULL ),
         traceFileThreadLocalKey_( invalidPthreadKey ),
         foreverLogIndex_( foreverLogIndex ),
         foreverLog_( false ),
+        foreverLogIncremental_(
+           __atomic_load_n( &incrementalForeverLog, __ATOMIC_RELAXED ) ),
         initialized_( false ) {
    std::lock_guard< std::mutex > lock( traceHandleMutex );
    registerPostForkCleanup();
+   if( clockSource_ != ClockSourceTsc ) {
+      __atomic_store_n( &qt_nonTscClock, 1, __ATOMIC_RELAXED );
+   }
    if( foreverLogPath && strlen( foreverLogPath ) != 0 ) {
       // Support for backup of thread specific files and management of
       // the index has not been added.
-      assert( multiThreading_ == MultiThreading::disabled );
+      assert( multiThreading_ != MultiThreading::enabled );
       foreverLogPath_ = foreverLogPath;
       foreverLog_ = true;
+      // Rather than when the first ring wraps
+      ForeverLogBackups & backups = foreverLogBackups();
+      std::lock_guard< std::mutex > backupsLock( backups.mutex );
+      maybeStartForeverLogBackupThread( backups );
    }
 
    nextMsgId_ = 1;
@@ -1121,7 +5067,7 @@ TraceHandle::mtTraceFile() noexcept {
 
 inline void
 TraceHandle::allocateMsgId( MsgId * msgIdPtr ) noexcept {
-   if ( multiThreading_ == MultiThreading::enabled ) {
+   if ( multiThreading_ != MultiThreading::disabled ) {
       msgIdAllocMutex.lock();
    } else {
       // This is not an optimisation for non-MT clients. It is a
@@ -1132,7 +5078,7 @@ TraceHandle::allocateMsgId( MsgId * msgIdPtr ) noexcept {
       // QuickTrace file.
    }
    if( 0 != *msgIdPtr ) {
-      if ( multiThreading_ == MultiThreading::enabled ) {
+      if ( multiThreading_ != MultiThreading::disabled ) {
          msgIdAllocMutex.unlock();
       }
       return;
@@ -1143,7 +5089,7 @@ TraceHandle::allocateMsgId( MsgId * msgIdPtr ) noexcept {
    // Allocate new ID and store return value
    *msgIdPtr = nextMsgId_++;
 
-   if ( multiThreading_ == MultiThreading::enabled ) {
+   if ( multiThreading_ != MultiThreading::disabled ) {
       msgIdAllocMutex.unlock();
    }
 }
@@ -45,7 +45,6 @@
     is ok, but crashing is bad.
   - Tests
   - Robustness
-  - Align message counters to cache lines
 */
 #include <stdint.h>
 #include <iomanip>
@@ -56,6 +55,7 @@
 #include <QuickTrace/QuickTraceFormatString.h>
 #include <QuickTrace/QuickTraceFormatStringUtils.h>
 #include <QuickTrace/QuickTraceOptFormatter.h>
+#include <QuickTrace/QuickTraceBlob.h>
 
 /*
  * This is a marker to indicate that <QuickTrace/QuickTrace.h> has been included.
@@ -71,6 +71,14 @@
  */
 #define QUICKTRACE_HEADER_INCLUDED_MARKER
 
+// MsgCounters are indexed directly by MsgId, so each message has its
+// own counter. DEFAULT_NUM_MSG_COUNTERS of them follow the header of the
+// trace file. Those of the MsgIds after them are in the counters file that
+// goes with it (see MsgCountersFileSuffix), which grows as MsgIds get
+// allocated, without limit, in segments that double in size. If the
+// counters file can not be extended, they are kept in anonymous memory
+// instead, where qtctl and qtclear can not get at them. MsgIds without a
+// counter of their own, should that fail too, share MsgCounter 0.
 #define DEFAULT_NUM_MSG_COUNTERS 512
 
 namespace QuickTrace {
@@ -157,6 +165,13 @@ class MsgDesc {
    const char * ptr() const noexcept { return ptr_; }
 
  private:
+   // Locked from construction until finish() when the TraceFile is
+   // shared by all threads (MultiThreading::shared), as the descriptor
+   // is assembled in buffers owned by the TraceFile.  A plain pointer
+   // rather than a std::unique_lock, because the C API copies a
+   // MsgDesc into raw memory.
+   std::mutex * sharedMutex_;
+   MsgId * msgIdPtr_;
    TraceFile * tf_;
    char * buf_;
    char *ptr_, *end_;
@@ -165,12 +180,48 @@ class MsgDesc {
    MsgId id_;
 };
 
+// disabled: a single TraceFile, which only one thread may write to.
+// enabled:  a separate TraceFile (and .qt file) per thread.
+// shared:   a single TraceFile whose ring buffers are written by all
+//           threads. Writers reserve space in a ring atomically and
+//           every record is tagged with a small per-thread number.
+//           Each record is committed on its own once it is written,
+//           and readers see the records up to the first one that is not
+//           committed yet. A writer only waits for the others when the
+//           ring is full.
 enum class MultiThreading {
    disabled,
    enabled,
+   shared,
+};
+
+// How a TraceFile rotates the file it replaces, along with the ones
+// that file replaced. The most recent one is moved to <file>.1, and the
+// older ones one generation up. The renames and removals are done by a
+// background thread, which also compresses the rotated files when
+// setRotatedFileCompression() asks for it. The defaults keep the
+// behaviour of <file>.1 and <file>.2, the latter holding the oldest.
+struct RotationPolicy {
+   // The number of rotated files kept, 0 for none
+   uint32_t generations = 2;
+   // Once all generations exist, keep the oldest and drop the one before
+   // it, so that the file of the first of a series of crashes survives
+   // the restarts that follow
+   bool keepOldest = true;
+   // Remove the oldest rotated files until they use at most that many
+   // bytes of disk, 0 for no limit. Applies to the oldest kept with
+   // keepOldest too.
+   uint64_t maxTotalBytes = 0;
+   // Remove the rotated files last written to more than that many
+   // seconds ago, 0 for no limit
+   uint32_t maxAgeSeconds = 0;
 };
 
 class TraceHandle;
+struct ForeverLogBackup;
+struct ForeverLogArchive;
+struct StreamingLog;
+class IoEngine;
 
 // The TraceFile class manages a single QuickTrace file. For
 // multi-threaded processes, a separate TraceFile is created by the
@@ -183,21 +234,60 @@ class TraceFile {
    ~TraceFile() noexcept;
    bool initialized() noexcept { return initialized_; }
    void sync() noexcept;
+   // Copies the rings of a memory-only TraceFile to the snapshot next to
+   // the trace file, see setMemoryOnlyTraceFiles()
+   void persist() noexcept;
    int fd() const noexcept { return fd_; }
    RingBuf & log( int i ) noexcept {
+      if( QUICKTRACE_UNLIKELY( multiThreading_ == MultiThreading::shared ) ) {
+         return stagingLog( i );
+      }
       return log_[i];
    }
    void takeTimestamp() noexcept;
+   // Keep the messages of a level that a consumer such as qttail --lossless
+   // has not read yet, see RingReader, rather than overwrite them. policy
+   // says what happens to the records that find no room, spillBytes is the
+   // size of the overflow area of OverrunSpill, which a background thread
+   // drains. Call it from the thread that writes to the file. Not
+   // supported by shared TraceFiles.
+   void overrunPolicyIs( int level, OverrunPolicy policy,
+                         uint32_t spillBytes = 64 * 1024 ) noexcept;
+   ClockSource clockSource() const noexcept { return clockSource_; }
+   // Read the clock the file's timestamps come from, see ClockSource
+   uint64_t timestamp() const noexcept { return readClock( clockSource_ ); }
+   // Fill in the second TSC calibration sample, now, and flag the file
+   // as calibrated, see TscCalibration. since is the calibration point
+   // before now.
+   void calibrate( CalibrationPoint const & since,
+                   CalibrationPoint const & now ) noexcept;
+   // Fill in a provisional second sample, until the file is calibrated
+   void calibrateProvisionally( CalibrationPoint const & sample ) noexcept;
+   void addCalibrationPoint( CalibrationPoint const & point ) noexcept;
+   // Store the TSC offsets of the CPUs relative to refCpu, see
+   // measureTscOffsets(). Ignored unless the file records CPU ids.
+   void tscOffsetsIs( uint32_t refCpu,
+                      std::vector< int64_t > const & offsets ) noexcept;
+   // See MsgCounters::counter()
    MsgCounter * msgCounter( int msgId ) noexcept{
-      TraceFileHeader* sfh = (TraceFileHeader*) buf_;
-      MsgCounter * m = (MsgCounter*) (sfh+1);
-      return &(m[msgId % numMsgCounters_]);
+      return msgCounters_.counter( msgId );
    }
    char const * fileName() noexcept { return fileName_.c_str(); }
    void closeIfNeeded() noexcept;
    static int const FileTrailerSize = 1024;
    bool msgIdInitialized( MsgId msgId_ ) noexcept{
       size_t msgId = ( size_t )msgId_;
+      if( multiThreading_ == MultiThreading::shared ) {
+         // Every thread writes to this TraceFile, and MsgDesc only sets
+         // the MsgId's bit once the descriptor is in the file. The
+         // MsgId itself may have been allocated for another TraceFile.
+         MsgIdBitmap * bitmap =
+            __atomic_load_n( &msgIdBitmap_, __ATOMIC_ACQUIRE );
+         size_t word = msgId / 64;
+         return bitmap && word < bitmap->words &&
+                ( __atomic_load_n( &bitmap->bits[ word ], __ATOMIC_ACQUIRE ) &
+                  ( 1ULL << ( msgId % 64 ) ) );
+      }
       // When the msgId is non-zero, it means that we have allocated
       // an ID for this trace. However, if the ID was allocated by a
       // different thread or a previous instance of the TraceFile, and
@@ -208,7 +298,17 @@ class TraceFile {
                   msgIdInitialized_[ msgId ] ) );
    }
    void msgIdInitializedIs( MsgId msgId ) noexcept;
-   void maybeBackupBuffer() noexcept;
+   // Queues the copy of the records committed to the ring to the forever
+   // log, if the TraceHandle keeps one, see backupLevel(), or to its
+   // incremental forever log, see archiveLevel()
+   void maybeBackupBuffer( RingBuf * rb ) noexcept;
+   void backupLevel( int level ) noexcept;
+   void backupBuffer( int level, uint32_t ringOffset, uint32_t tail ) noexcept;
+   void archiveLevel( int level ) noexcept;
+   // Appends the records committed since the last call to the streaming
+   // log, see setStreamingLog(), through io if given, which batches the
+   // writes with those of other TraceFiles until it is flushed
+   void stream( IoEngine * io = nullptr ) noexcept;
    enum {
       NumTraceLevels = 10
    };
@@ -216,9 +316,21 @@ class TraceFile {
 
  private:
    friend class MsgDesc;
+   // The calling thread's staging ring for level i of a shared TraceFile
+   RingBuf & stagingLog( int i ) noexcept;
+   // Make sure the MsgCounter of msgId is mapped before it is used
+   void mapMsgCounter( MsgId msgId ) noexcept;
    MultiThreading multiThreading_;
+   ClockSource clockSource_;
    TraceHandle * traceHandle_;
-   uint32_t numMsgCounters_;
+   MsgCounters msgCounters_;
+   // The counters file, see MsgCountersFileSuffix, and its descriptor,
+   // -1 until the MsgIds outgrow the counters in the trace file
+   std::string countersPath_;
+   int countersFd_;
+   // The mapped size of the TraceHandle, along with the TSC offsets of
+   // the CPUs if the file records CPU ids
+   uint32_t mappedSize_;
 
    // Thread specific buffers to support operations during message
    // initialisation
@@ -228,10 +340,31 @@ class TraceFile {
    // Vector of booleans indicating if a specific messageId has been
    // used against this TraceFile.
    std::vector< uint8_t >msgIdInitialized_;
+   // The same for a shared TraceFile, as a bitmap that other threads
+   // read while it is updated. It is grown by copying it, under
+   // msgDescMutex_, and the bitmaps it replaced are kept until the
+   // TraceFile goes, as threads may still be reading them.
+   struct MsgIdBitmap {
+      size_t words;
+      uint64_t bits[ 0 ];
+   };
+   MsgIdBitmap * msgIdBitmap_;
+   std::vector< MsgIdBitmap * > retiredMsgIdBitmaps_;
+   // Serializes MsgDesc creation when the TraceFile is shared
+   std::mutex msgDescMutex_;
    RingBuf log_[NumTraceLevels];
    void * buf_;
    int fd_;
    std::string fileName_;
+   // See maybeBackupBuffer()
+   ForeverLogBackup * backup_;
+   // See backupLevel() and archiveLevel()
+   ForeverLogArchive * archive_;
+   // See stream()
+   StreamingLog * stream_;
+   // The slot of a memory-only TraceFile with the crash handler, -1 when
+   // the TraceFile is on disk
+   int memoryFile_;
    bool initialized_;
 };
 
@@ -240,7 +373,8 @@ class TraceFile {
 // non multi-threaded processes, a single TraceFile is created for
 // each TraceHandle. For multi-threaded processes, a per-thread
 // TraceFile will be created by the TraceHandle for each thread
-// issuing traces.
+// issuing traces, unless the handle is in MultiThreading::shared
+// mode, in which case all threads trace into its single TraceFile.
 class TraceHandle {
  public:
    TraceHandle( char const * fileNameFormat,
@@ -250,7 +384,11 @@ class TraceHandle {
                 MultiThreading multiThreading = MultiThreading::disabled,
                 bool rotateLogFile = true,
                 uint32_t numMsgCounters = DEFAULT_NUM_MSG_COUNTERS,
-                bool defaultHandle = false ) noexcept;
+                bool defaultHandle = false,
+                MsgCounterLayout msgCounterLayout =
+                   MsgCounterLayout::packed,
+                ClockSource clockSource = ClockSourceTsc,
+                RotationPolicy const * rotationPolicy = nullptr ) noexcept;
    ~TraceHandle() noexcept;
 
    std::string qtdir() const noexcept { return qtdir_; }
@@ -258,6 +396,13 @@ class TraceHandle {
    std::string fileNameSuffix() const noexcept { return fileNameSuffix_; }
    uint32_t mappedTraceFileSize() const noexcept { return mappedTraceFileSize_; }
    SizeSpec sizeSpec() const noexcept { return sizeSpec_; }
+   MsgCounterLayout msgCounterLayout() const noexcept {
+      return msgCounterLayout_;
+   }
+   ClockSource clockSource() const noexcept { return clockSource_; }
+   RotationPolicy const & rotationPolicy() const noexcept {
+      return rotationPolicy_;
+   }
    bool resize( const SizeSpec &newSizeSpecInKilobytes ) noexcept;
    static std::optional< std::string > getQtDir(
       MultiThreading & multiThreading, std::string & fileNameFormat ) noexcept;
@@ -269,7 +414,7 @@ class TraceHandle {
 
    // Obtain the thread specific TraceFile
    inline TraceFile * traceFile() noexcept {
-      if( multiThreading_ == MultiThreading::disabled ) {
+      if( multiThreading_ != MultiThreading::enabled ) {
          return nonMtTraceFile_;
       }
       return mtTraceFile();
@@ -281,6 +426,7 @@ class TraceHandle {
    void foreverLogIndexInc( int delta ) noexcept { foreverLogIndex_ += delta; }
    int foreverLogIndex() noexcept { return foreverLogIndex_; }
    bool foreverLog() noexcept { return foreverLog_; }
+   bool foreverLogIncremental() noexcept { return foreverLogIncremental_; }
 
    inline bool isInitialized() noexcept {
       return initialized_ && !traceFilesClosed_;
@@ -291,6 +437,9 @@ class TraceHandle {
    MultiThreading multiThreading_;
    bool traceFilesClosed_;
    uint32_t numMsgCounters_;
+   MsgCounterLayout msgCounterLayout_;
+   ClockSource clockSource_;
+   RotationPolicy rotationPolicy_;
 
    TraceFile * newTraceFile(
          bool rotateLogFile = true,
@@ -309,12 +458,12 @@ class TraceHandle {
 
    MsgId nextMsgId_;
 
-   // When not multiThreaded we use this single TraceFile for
-   // efficiency
+   // When not multiThreaded, or when all threads share one file, we
+   // use this single TraceFile for efficiency
    TraceFile * nonMtTraceFile_;
 
    // Set of all the active TraceFiles. Only includes the
-   // nonMtTraceFile_ in the non-MT case.
+   // nonMtTraceFile_ in the non-MT and shared cases.
    std::unordered_set< TraceFile * >traceFiles_;
 
    // When multiThreaded we use thread local storage to keep track of
@@ -322,7 +471,8 @@ class TraceHandle {
    pthread_key_t traceFileThreadLocalKey_;
 
    // The size of the trace file without any message descriptors.
-   // Incudes the TraceFileHeader, MsgCounters and RingBufs.
+   // Incudes the TraceFileHeader, MsgCounters and RingBufs, but not the
+   // TSC offsets of the files that record CPU ids, see TraceFile::mappedSize_
    uint32_t mappedTraceFileSize_;
 
    std::string fileNameFormat_;
@@ -331,6 +481,7 @@ class TraceHandle {
    int foreverLogIndex_;
    std::string foreverLogPath_;
    bool foreverLog_;
+   bool foreverLogIncremental_;
    SizeSpec sizeSpec_;
    bool initialized_;
 };
@@ -349,7 +500,7 @@ bool traceHandleExists( const std::string & filenameSuffix ) noexcept;
 class BlockTimer {
  public:
    BlockTimer( TraceFile * sf, MsgId mid ) noexcept
-         : qtFile_( sf ), msgId_( mid ), tsc_( rdtsc() ) {}
+         : qtFile_( sf ), msgId_( mid ), tsc_( sf ? sf->timestamp() : 0 ) {}
    ~BlockTimer() noexcept;
  private:
    TraceFile * qtFile_;
@@ -433,15 +584,92 @@ extern int qtMaxStringLen;
 // the process forks.
 void setDeleteTraceHandlesOnFork() noexcept;
 
+// Request that the TraceHandles created from now on that keep a forever
+// log archive the ring of a level whenever it wraps, along with the
+// message descriptors added since, rather than copy the whole file. The
+// archive goes to <foreverLogPath>.<index>.qta, a new one being started
+// with the next index once it gets large, and qttail -c prints it as
+// one timeline. The rings are also archived when the TraceFile is
+// closed, so that the archive ends where the file does.
+void setIncrementalForeverLog() noexcept;
+// Waits until the backup thread has copied the forever log backups, and
+// archived the rings, queued so far by the traces that wrapped a ring.
+// For testing purposes.
+void waitForForeverLogBackups() noexcept;
+
+// Request that the TraceFiles created from now on, those of
+// multi-threaded and shared TraceHandles included, stream their records
+// to disk, so that none is lost when a ring wraps. A background thread
+// follows the commit offset of every ring and appends the records
+// committed since it last looked, along with the message descriptors
+// added since, to <trace file>.stream.<n>.qta, starting the next
+// segment once one reaches segmentBytes. Each segment can be read on its
+// own, and qttail -c prints them as one timeline. The records the thread
+// did not get to before the writer overwrote them are reported as lost.
+// 0 stops streaming the TraceFiles created from then on. The thread
+// submits the writes of all TraceFiles, and the syncs of the segments
+// it completes, in batches through io_uring where the kernel allows it
+// and ioUring is set when it starts, and makes them one at a time
+// otherwise.
+void setStreamingLog( uint64_t segmentBytes = 64 * 1024 * 1024,
+                      bool ioUring = true ) noexcept;
+// Whether the stream thread writes through io_uring, as of the last time
+// it looked for new records. For testing purposes.
+bool streamingLogUsesIoUring() noexcept;
+
+// Request that the .1, .2, ... files a TraceFile rotates its old files to
+// (see RotationPolicy) are gzipped, at the given level from 1 (fastest)
+// to 9 (smallest), into .1.gz, .2.gz, ... 0, the default, keeps them
+// uncompressed. The rotation thread, at idle I/O priority, does the
+// compression, the uncompressed file being removed once it is done.
+// qttail -c reads the compressed files.
+void setRotatedFileCompression( int level ) noexcept;
+
+// Request that the TraceFiles created from now on keep their rings in a
+// file under dir, which should be a tmpfs such as /dev/shm, so that the
+// kernel does not keep writing them back to storage. The trace file is a
+// symbolic link to that memory file, through which qttail reads the live
+// rings. The rings are only copied to disk by persistTraceFiles() or
+// TraceFile::persist(), and with persistOnCrash, when the process gets a
+// fatal signal, to a snapshot next to the trace file (<trace file>.snapshot),
+// the link staying in place, and by the rotation that replaces the trace
+// file, which finds the memory file of the previous process, or its
+// snapshot once the memory file is gone. The crash handler then calls the
+// handler it replaced.
+// Call it before creating the first TraceFile, and again with a null dir
+// to go back to files on disk.
+void setMemoryOnlyTraceFiles( char const * dir = "/dev/shm",
+                              bool persistOnCrash = true ) noexcept;
+
+// Copies the rings of all memory-only TraceFiles to the snapshots next
+// to their trace files, see setMemoryOnlyTraceFiles(). The rings go on
+// in memory, and the trace files still link to them.
+void persistTraceFiles() noexcept;
+
+// Request that the TraceFiles created from now on record, in every
+// message, the id of the CPU its timestamp was taken on. QuickTrace then
+// also measures how far the TSC of each CPU is off from that of the
+// others, so that qttail can compensate for it. The timestamps of
+// messages written on different CPUs are only comparable without this
+// on machines whose TSCs are synchronized. Costs 2 bytes per message
+// and rdtscp rather than rdtsc. Call it before creating the first
+// TraceFile, so that the offsets are known before it is calibrated.
+void setRecordCpuId() noexcept;
+
 // Existing and new agents that would like to have a single trace log file can
 // continue using the initialize() function, which creates a global instance 
-// of TraceFile.
+// of TraceFile. clockSource picks the clock the timestamps come from, see
+// ClockSource.
 bool initialize( char const * prefix, SizeSpec * sizesInKilobytes=0,
                  char const *foreverLogPath=NULL, int foreverLogIndex=0,
                  int maxStringLen=24,
                  MultiThreading multiThreading=MultiThreading::disabled,
                  bool rotateLogFile=true,
-                 uint32_t numMsgCounters = DEFAULT_NUM_MSG_COUNTERS ) noexcept;
+                 uint32_t numMsgCounters = DEFAULT_NUM_MSG_COUNTERS,
+                 MsgCounterLayout msgCounterLayout =
+                    MsgCounterLayout::packed,
+                 ClockSource clockSource = ClockSourceTsc,
+                 RotationPolicy const * rotationPolicy = nullptr ) noexcept;
 static inline bool
 initializeMt( char const * prefix, SizeSpec * sizesInKilobytes=0,
               char const *foreverLogPath=NULL, int foreverLogIndex=0,
@@ -450,6 +678,16 @@ initializeMt( char const * prefix, SizeSpec * sizesInKilobytes=0,
    return initialize( prefix, sizesInKilobytes, foreverLogPath, foreverLogIndex,
                       maxStringLen, MultiThreading::enabled, true, numMsgCounters );
 }
+// Like initializeMt(), but all threads write into a single trace file
+// instead of one file per thread. See MultiThreading::shared.
+static inline bool
+initializeShared( char const * prefix, SizeSpec * sizesInKilobytes=0,
+                  char const *foreverLogPath=NULL, int foreverLogIndex=0,
+                  int maxStringLen=24,
+                  uint32_t numMsgCounters = DEFAULT_NUM_MSG_COUNTERS ) noexcept {
+   return initialize( prefix, sizesInKilobytes, foreverLogPath, foreverLogIndex,
+                      maxStringLen, MultiThreading::shared, true, numMsgCounters );
+}
 void close() noexcept;
 
 TraceHandle * traceHandle( const std::string & traceFilename ) noexcept;
@@ -462,8 +700,9 @@ TraceHandle * traceHandle( const std::string & traceFilename ) noexcept;
 TraceHandle *
 initialize_handle( char const * prefix, SizeSpec * ss=0,
                    char const *foreverLogPath=NULL, int foreverLogIndex=0,
-                   MultiThreading multiThreading = MultiThreading::disabled
-   ) noexcept;
+                   MultiThreading multiThreading = MultiThreading::disabled,
+                   ClockSource clockSource = ClockSourceTsc,
+                   RotationPolicy const * rotationPolicy = nullptr ) noexcept;
 static inline TraceHandle *
 initializeHandleMt( char const * prefix, SizeSpec * ss=0,
                     char const *foreverLogPath = NULL,
@@ -471,6 +710,13 @@ initializeHandleMt( char const * prefix, SizeSpec * ss=0,
    return initialize_handle( prefix, ss, foreverLogPath, foreverLogIndex,
                              MultiThreading::enabled );
 }
+static inline TraceHandle *
+initializeHandleShared( char const * prefix, SizeSpec * ss=0,
+                        char const *foreverLogPath = NULL,
+                        int foreverLogIndex = 0 ) noexcept {
+   return initialize_handle( prefix, ss, foreverLogPath, foreverLogIndex,
+                             MultiThreading::shared );
+}
 
 static inline uint32_t updateLastTsc( uint32_t lastTscValue, uint64_t tsc) {
    uint32_t off = lastTscValue & 0x80000000;
@@ -534,19 +780,21 @@ static inline uint32_t updateLastTsc( uint32_t lastTscValue, uint64_t tsc) {
 #define QTRACE_H_MSGID( _qtf, _msgId, _n, _x, _y )      \
    QTRACE_H_MSGID_VAR( _qtf, _msgId, qtvar(_rb), _n, _x, _y )
 
-#define QTRACE_H_MSGID_INIT_BASIC( _qtf, _msgId, _x )                                 \
-   if( QUICKTRACE_UNLIKELY( !!( _qtf ) && !( _qtf )->msgIdInitialized( _msgId ) ) ) { \
-      QuickTrace::MsgDesc _qtmd( _qtf, &_msgId, __FILE__, __LINE__ );                 \
-      _qtmd << _x;                                                                    \
-      _qtmd.finish();                                                                 \
+#define QTRACE_H_MSGID_INIT_BASIC( _qtf, _msgId, _x )                   \
+   if( QUICKTRACE_UNLIKELY( !!( _qtf ) &&                               \
+                            !( _qtf )->msgIdInitialized( _msgId ) ) ) { \
+      QuickTrace::MsgDesc _qtmd( _qtf, &_msgId, __FILE__, __LINE__ );   \
+      _qtmd << _x;                                                      \
+      _qtmd.finish();                                                   \
    }
 
-#define QTRACE_H_MSGID_INIT_FMT( _qtf, _msgId, _x, _y )                               \
-   if( QUICKTRACE_UNLIKELY( !!( _qtf ) && !( _qtf )->msgIdInitialized( _msgId ) ) ) { \
-      QuickTrace::MsgDesc _qtmd( _qtf, &_msgId, __FILE__, __LINE__ );                 \
-      _qtmd.formatString() << _y;                                                     \
-      _qtmd << _x;                                                                    \
-      _qtmd.finish();                                                                 \
+#define QTRACE_H_MSGID_INIT_FMT( _qtf, _msgId, _x, _y )                 \
+   if( QUICKTRACE_UNLIKELY( !!( _qtf ) &&                               \
+                            !( _qtf )->msgIdInitialized( _msgId ) ) ) { \
+      QuickTrace::MsgDesc _qtmd( _qtf, &_msgId, __FILE__, __LINE__ );   \
+      _qtmd.formatString() << _y;                                       \
+      _qtmd << _x;                                                      \
+      _qtmd.finish();                                                   \
    }
 
 #define QTRACE_H_MSGID_VAR( _qtf, _msgId, _rb, _n, _x, _y )             \
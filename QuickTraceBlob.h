@@ -0,0 +1,61 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+#ifndef QUICKTRACE_QUICKTRACEBLOB_H
+#define QUICKTRACE_QUICKTRACEBLOB_H
+
+#include <cstddef>
+#include <span>
+
+#include <QuickTrace/QuickTraceFormatStringTraits.h>
+#include <QuickTrace/QuickTraceRingBuf.h>
+
+namespace QuickTrace {
+
+// A blob is an arbitrary sequence of bytes, such as a packet, a TLV buffer
+// or a register dump, traced as a std::span< const std::byte >. It is
+// stored as a uint32_t length followed by the bytes, which qttail prints
+// as a hex string. Unlike strings a blob is not truncated to
+// maxStringLen: it can take up most of its ring buffer.
+inline std::span< const std::byte >
+blob( void const * data, size_t len ) noexcept {
+   return std::span< const std::byte >( static_cast< const std::byte * >( data ),
+                                        len );
+}
+
+inline void
+put( RingBuf * log, std::span< const std::byte > x ) noexcept {
+   log->putBlob( x.data(), x.size() );
+}
+
+inline char const *
+formatString( const MsgFormatStringAdlTag *, std::span< const std::byte > ) {
+   return "B";
+}
+
+} // namespace QuickTrace
+
+#endif // QUICKTRACE_QUICKTRACEBLOB_H
@@ -32,6 +32,10 @@
 #include <alloca.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#ifdef __aarch64__
+#include <sched.h>
+#endif
 
 #ifdef QT_RDTSC_MOCK
 extern uint64_t qt_rdtsc_mocker;
@@ -69,6 +73,60 @@ static inline uint64_t rdtsc( void )
 #endif
 }
 
+// Like rdtsc(), but also return the CPU that the counter was read on,
+// so that readers can compensate for the counters of different CPUs not
+// being in sync. rdtscp waits for the preceding instructions, which
+// makes it a little slower. On Linux the low 12 bits of TSC_AUX hold
+// the CPU number. aarch64 has no equivalent instruction, so there the
+// CPU comes from sched_getcpu(), which glibc answers from rseq.
+static inline uint64_t rdtscp( uint32_t * cpu )
+#ifdef __cplusplus
+   noexcept
+#endif // __cplusplus
+{
+#ifdef QT_RDTSC_MOCK
+   *cpu = 0;
+   return ++qt_rdtsc_mocker;
+#elif defined( __x86_64__ ) || defined( __i386__ )
+   uint32_t a, d, c;
+   __asm__ __volatile__( "rdtscp" : "=a"( a ), "=d"( d ), "=c"( c ) );
+   *cpu = c & 0xfff;
+   return ( ( uint64_t )d << 32 ) | ( uint64_t )a;
+#elif defined( __aarch64__ )
+   int c = sched_getcpu();
+   *cpu = c < 0 ? 0 : ( uint32_t )c;
+   return rdtsc();
+#else
+#error "Add rdtscp() equivalent for your arch"
+#endif
+}
+
+// CLOCK_MONOTONIC_RAW in nanoseconds. clock_gettime() answers it from
+// the vDSO without entering the kernel, unless the kernel does not trust
+// the TSC, in which case it is a system call.
+static inline uint64_t monotonicRawNs( void )
+#ifdef __cplusplus
+   noexcept
+#endif // __cplusplus
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC_RAW, &ts );
+   return ( uint64_t )ts.tv_sec * 1000000000 + ( uint64_t )ts.tv_nsec;
+}
+
+// CLOCK_MONOTONIC_COARSE in nanoseconds: CLOCK_MONOTONIC as of the last
+// timer tick, so it only advances every 1 to 10 milliseconds, but the
+// vDSO reads it without touching any clock hardware.
+static inline uint64_t monotonicCoarseNs( void )
+#ifdef __cplusplus
+   noexcept
+#endif // __cplusplus
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC_COARSE, &ts );
+   return ( uint64_t )ts.tv_sec * 1000000000 + ( uint64_t )ts.tv_nsec;
+}
+
 typedef struct qtprof_t_ {
   void *th;
   int mid;                                                           
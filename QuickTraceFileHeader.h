@@ -50,6 +50,153 @@ struct SizeSpec {
    }
 };
 
+// Bits in TraceFileHeader::flags, present from file version 6 onwards.
+enum TraceFileFlags : uint32_t {
+   // The ring buffers are written by all the threads of the process
+   // (MultiThreading::shared) and every record carries a 2 byte thread
+   // tag immediately before its length byte.
+   TraceFileFlagSharedRing = 0x1,
+   // tsc1, monotime1 and utc1 hold the second TSC calibration sample,
+   // which may only be filled in some time after the file was created.
+   // Until then they hold a provisional sample, extrapolated from the
+   // exact TSC frequency or from a short measurement, and monotime1 is
+   // written last, so that the file can be read as soon as it is
+   // non-zero. Files written before this flag existed were calibrated
+   // once monotime1 was 0.1s past monotime0.
+   TraceFileFlagCalibrated = 0x2,
+   // The header ends with calibrationCount and calibrationPoints
+   TraceFileFlagCalibrationPoints = 0x4,
+   // tscFrequency holds the exact TSC frequency
+   TraceFileFlagTscFrequency = 0x8,
+   // Every record carries the 2 byte id of the CPU its tsc was read on,
+   // right after its MsgId and before the parameter data
+   TraceFileFlagCpuId = 0x10,
+   // tscOffsets have been measured
+   TraceFileFlagTscOffsets = 0x20,
+   // clockSource is set, see ClockSource
+   TraceFileFlagClockSource = 0x40,
+   // commitOffsets are kept up to date, see TraceFileHeader
+   TraceFileFlagCommitOffsets = 0x80,
+   // ringSequences are kept up to date, see RingSequence
+   TraceFileFlagRingSequences = 0x100,
+   // Writers honour the cursors of ringReaders, see RingReader
+   TraceFileFlagRingReaders = 0x200,
+   // fileId is set
+   TraceFileFlagFileId = 0x400,
+};
+
+// The clock a TraceFile takes its timestamps from. The "tsc" of the
+// records, of tsc0/tsc1 and of the calibration points are readings of
+// that clock, and so are the message counters' lastTsc and the QPROF
+// durations. The QPROF_EVT macros take whatever the caller measured with.
+enum ClockSource : uint32_t {
+   // rdtsc(): the TSC, or cntvct_el0 on aarch64
+   ClockSourceTsc = 0,
+   // monotonicRawNs(): nanoseconds, for when the TSC can not be trusted
+   ClockSourceMonotonicRaw = 1,
+   // monotonicCoarseNs(): nanoseconds, but only as precise as the kernel's
+   // timer tick, for the hottest trace points
+   ClockSourceMonotonicCoarse = 2,
+};
+
+// Every record in a ring buffer ends with its length, counted from its
+// timestamp up to the length itself, in a single byte. From file
+// version 6, a record of ExtendedRecordLength bytes or more (which blob
+// arguments make easy to get to) instead ends with a uint32_t length
+// followed by one ExtendedRecordLength byte, so that the records can
+// still be walked backwards from the end.
+static constexpr uint8_t ExtendedRecordLength = 0xff;
+
+// Where TraceFileHeader::tscFrequency came from
+enum TscFrequencySource : uint32_t {
+   // CPUID leaf 0x15: crystal clock frequency times the TSC/crystal ratio
+   TscFrequencyCpuidTsc = 1,
+   // CPUID leaf 0x16: processor base frequency, rounded to the MHz. Only
+   // written by earlier versions, readers ignore it as it is not exact.
+   TscFrequencyCpuidBase = 2,
+   // CPUID leaf 0x40000010: TSC frequency reported by the hypervisor
+   TscFrequencyHypervisor = 3,
+   // cntfrq_el0: frequency of the aarch64 generic timer, cntvct_el0
+   TscFrequencyCntfrq = 4,
+   // The clock source counts nanoseconds, see ClockSource
+   TscFrequencyNanoseconds = 5,
+};
+
+// A sample of the TSC together with the monotonic clock and the wall
+// clock, in seconds.
+struct CalibrationPoint {
+   uint64_t tsc;
+   double monotime;
+   double utc;
+};
+
+static constexpr uint32_t NumCalibrationPoints = 32;
+
+// Line number of the message descriptors of WCQT messages that only
+// record the TSC, which readers convert to wall clock time like that of
+// any other message. WCQT messages that record the result of
+// gettimeofday() as their first two parameters, see WallClockQt.h, use
+// line number 0.
+static constexpr uint32_t WallClockLineNo = UINT32_MAX;
+
+// How much has been written to the ring buffer of a level, so that readers
+// can tell how many messages and bytes they missed. wraps counts the times
+// the writer went back to the start of the ring. Before it stores wraps, with
+// release semantics, it stores the number of records and bytes committed to
+// the ring up to then in slot wraps % 2 of wrapRecords and wrapBytes. The
+// slot of the previous value of wraps is left alone, so a reader that loads
+// wraps, then a slot, and then finds wraps less than 2 past what it loaded
+// first has read the slot of what it loaded first.
+struct RingSequence {
+   uint64_t wraps;
+   uint64_t wrapRecords[ 2 ];
+   uint64_t wrapBytes[ 2 ];
+};
+
+// What the writer of a level does with a record that would overwrite
+// messages the consumer registered in its RingReader has not read yet
+enum OverrunPolicy : uint32_t {
+   // Overwrite them, the consumer being ignored
+   OverrunOverwrite = 0,
+   // Drop the record
+   OverrunDrop = 1,
+   // Wait a little for the consumer to read them, then drop the record
+   OverrunSpin = 2,
+   // Keep the record, and the ones after it, in an overflow area in the
+   // memory of the writer, from which they go to the ring in order once the
+   // consumer made room for them: when the writer next traces, or within
+   // about 10ms from a background thread. Until then the consumer can not
+   // see them, and they are lost if the process dies. Records that do not
+   // fit there are dropped.
+   OverrunSpill = 3,
+};
+
+// A consumer that must not miss any message of a level (qttail --lossless)
+// registers by storing its pid, and then its cursor, which it keeps moving
+// past the messages it read. The cursor holds the number of times the
+// writer had wrapped (see RingSequence) when it wrote the next message to
+// read in its upper 32 bits, and the offset of that message from the start
+// of the ring buffer in its lower 32 bits. It is stored with release
+// semantics, and 0 means that there is no consumer. Unless its OverrunPolicy
+// is OverrunOverwrite, the writer does not overwrite what is past the
+// cursor, and counts the records it dropped instead in dropped. It forgets
+// about a consumer it finds gone, which a consumer that exits unregisters
+// itself from.
+struct RingReader {
+   uint32_t pid;
+   uint32_t reserved;
+   uint64_t cursor;
+   uint64_t dropped;
+};
+
+// The counters file of a trace file holds the MsgCounters that do not fit
+// after its header. Its path is that of the trace file, once symbolic links
+// are resolved, followed by MsgCountersFileSuffix. It is created as the
+// MsgIds of a process outgrow the counters in the trace file, and only
+// belongs to the trace file it was created with: rotated and persisted
+// copies of a trace file go without it.
+static constexpr char MsgCountersFileSuffix[] = ".counters";
+
 struct TraceFileHeader {
    uint32_t version;
    uint32_t fileSize;
@@ -63,6 +210,97 @@ struct TraceFileHeader {
    double monotime1;
    double utc1;
    SizeSpec logSizes;
+   uint32_t flags;              // TraceFileFlags, file version >= 6
+   // Number of MsgCounters in the counters file of the trace file, see
+   // MsgCountersFileSuffix (file version >= 6). They are those of the
+   // MsgIds past the ( fileHeaderSize - firstMsgOffset ) / msgCounterStride
+   // ones that follow the header, in order. It only grows, as MsgIds get
+   // allocated, and is stored with release semantics once they are in
+   // place.
+   uint32_t extraMsgCounters;
+   // Bytes from one MsgCounter to the next, file version >= 6. Earlier
+   // versions pack them, at sizeof( MsgCounter ).
+   uint32_t msgCounterStride;
+   // With TraceFileFlagCalibrationPoints, the calibration points taken
+   // over the life of the file, so that readers can convert the TSCs of
+   // old messages piecewise rather than with only tsc0/monotime0 and the
+   // latest tsc1/monotime1/utc1. A point is added whenever the TSC rate
+   // drifts, or the wall clock is stepped, noticeably. calibrationCount
+   // is twice the number of points ever added, the latest one is at
+   // calibrationPoints[ ( calibrationCount / 2 - 1 ) % NumCalibrationPoints ].
+   // It is odd while a point is being written, which may be the oldest
+   // one: readers retry when it is odd, or changed while they read.
+   uint32_t calibrationCount;
+   CalibrationPoint calibrationPoints[ NumCalibrationPoints ];
+   // With TraceFileFlagTscFrequency, the TSC frequency in Hz as reported
+   // by the hardware, which readers prefer over the rate measured between
+   // calibration points, and how it was obtained
+   uint64_t tscFrequency;
+   TscFrequencySource tscFrequencySource;
+   // With TraceFileFlagCpuId, the file has a table of numTscOffsets
+   // int64_t at offset tscOffsetsStart, between the header and the
+   // MsgCounters, sized to the CPUs of the machine. With
+   // TraceFileFlagTscOffsets, entry cpu of the table holds how many ticks
+   // the TSC of that CPU is ahead of that of tscOffsetsRefCpu. Readers
+   // subtract the offset of the CPU of a record from its tsc before
+   // comparing it with others. CPUs the process may not run on are left
+   // at 0.
+   uint32_t tscOffsetsRefCpu;
+   uint32_t tscOffsetsStart;
+   uint32_t numTscOffsets;
+   // With TraceFileFlagClockSource, the clock the timestamps come from.
+   // Files without the flag use the TSC.
+   ClockSource clockSource;
+   // With TraceFileFlagCommitOffsets, the offset of the end of the last
+   // complete record of each level from the start of its ring buffer
+   // (its RingBufHeader). Writers store it with release semantics once a
+   // record, and the zero tsc after it, are in place, so a reader that
+   // loads it with acquire semantics can read every record up to it
+   // without checking for a record that is still being written. Files
+   // without the flag have to be read by looking at the tsc of the
+   // records, which a reader can catch half written.
+   uint32_t commitOffsets[ 10 ];
+   // With TraceFileFlagRingSequences, how much has been written to the ring
+   // buffer of each level
+   RingSequence ringSequences[ 10 ];
+   // With TraceFileFlagRingReaders, the consumer of each level, if any
+   RingReader ringReaders[ 10 ];
+   // With TraceFileFlagFileId, tells the file apart from the others the
+   // process created, tsc0 being the same for all of them: the pid of the
+   // process in the upper 32 bits, and the number of files it created
+   // before in the lower ones. Copies of the file, such as its forever log
+   // backups, have the same tsc0 and fileId.
+   uint64_t fileId;
+};
+
+// An incremental forever log archive, see setIncrementalForeverLog(), or
+// a segment of a streaming log, see setStreamingLog(), starts with
+// ArchiveMagic, followed by chunks that each start with an
+// ArchiveChunkHeader and hold the size bytes that follow it. The first
+// chunk of an archive is an ArchiveChunkFileHeader, and the first
+// ArchiveChunkDictionary holds the whole dictionary, so that an archive
+// can be read on its own.
+static constexpr char ArchiveMagic[ 8 ] = { 'Q', 'T', 'A', 'R', 'C', 'H', '0', '1' };
+
+enum ArchiveChunkType : uint32_t {
+   // The TraceFileHeader of the file, whenever it changes other than in
+   // tsc1, monotime1, utc1, commitOffsets, ringSequences and ringReaders,
+   // followed by the TSC offsets of the CPUs if the file has them, up to
+   // firstMsgOffset. Readers use the last one.
+   ArchiveChunkFileHeader = 1,
+   // Message descriptors appended to the file since the last
+   // ArchiveChunkDictionary
+   ArchiveChunkDictionary = 2,
+   // Records of a level, as they are laid out in its ring buffer, from
+   // where the previous chunk of the level ended. A record is never split
+   // across chunks.
+   ArchiveChunkRecords = 3,
+};
+
+struct ArchiveChunkHeader {
+   ArchiveChunkType type;
+   uint32_t level;
+   uint64_t size;
 };
 
 } // namespace QuickTrace
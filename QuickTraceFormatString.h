@@ -28,6 +28,7 @@
 #define QUICKTRACE_QUICKTRACEFORMATSTRING_H
 
 #include <stdint.h>
+#include <string_view>
 
 namespace QuickTrace {
 
@@ -51,6 +52,8 @@ inline char const * formatString( unsigned long x ) noexcept { return "i"; }
 inline char const * formatString( float ) noexcept { return "f"; }
 inline char const * formatString( double ) noexcept { return "d"; }
 inline char const * formatString( char const * ) noexcept { return "p"; }
+// Also covers std::string, which is stored like a char const *
+inline char const * formatString( std::string_view ) noexcept { return "p"; }
 inline char const * formatString( bool ) noexcept { return "b"; }
 inline char const * formatString( void const * ) noexcept {
    return sizeof( void * ) == sizeof( uint64_t ) ? "q" : "i";
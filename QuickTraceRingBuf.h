@@ -32,12 +32,27 @@
        Please refer to README, Section ##: QuickTrace Header Ordering
 #endif // QUICKTRACE_HEADER_INCLUDED_MARKER
 
+#include <string_view>
 #include <QuickTrace/QuickTraceCommon.h>
+#include <QuickTrace/QuickTraceFileHeader.h>
 #include <QuickTrace/QuickTraceFormatStringTraits.h>
 
 namespace QuickTrace {
 
+// Read the clock a TraceFile takes its timestamps from
+static inline uint64_t
+readClock( ClockSource source ) noexcept {
+   if( QUICKTRACE_LIKELY( source == ClockSourceTsc ) ) {
+      return rdtsc();
+   }
+   return source == ClockSourceMonotonicRaw ? monotonicRawNs() :
+                                              monotonicCoarseNs();
+}
+
 class TraceFile;
+class RingBuf;
+
+void put( RingBuf * log, std::string_view x ) noexcept;
 
 typedef int MsgId;
 
@@ -48,15 +63,68 @@ struct MsgCounter {
    uint64_t tscSelfCount;
 };
 
+// How the MsgCounters are laid out in the trace file. Packed counters
+// share cache lines, two or three to a line, so threads hitting
+// neighbouring messages bounce those lines between their cores.
+// cacheLineAligned gives every counter a cache line of its own, at the
+// cost of more than twice the space.
+enum class MsgCounterLayout {
+   packed,
+   cacheLineAligned,
+};
+static constexpr uint32_t MsgCounterCacheLineSize = 64;
+
+// The MsgCounters of a TraceFile, indexed by MsgId. The first count of
+// them follow the TraceFileHeader, those of the MsgIds after them are in
+// the counters file (see MsgCountersFileSuffix), which grows in segments
+// that each have a mapping of their own so that a counter never moves.
+// Segment s holds the ( 1 << FirstSegmentShift ) << s counters that
+// follow those of the segments before it, and is published once mapped.
+struct MsgCounters {
+   static constexpr uint32_t FirstSegmentShift = 9;
+   // Enough for every positive MsgId
+   static constexpr int MaxSegments = 22;
+   char * base;
+   uint32_t count;
+   uint32_t stride;
+   char * segments[ MaxSegments ];
+
+   // The segment of the counters file that holds its index-th counter
+   static int segment( uint32_t index ) noexcept {
+      return 31 - __builtin_clz( ( index >> FirstSegmentShift ) + 1 );
+   }
+   // The index of the first counter of segment s in the counters file
+   static uint32_t segmentStart( int s ) noexcept {
+      return ( ( 1u << s ) - 1 ) << FirstSegmentShift;
+   }
+   // MsgIds without a counter of their own, whose segment could not be
+   // mapped, share MsgCounter 0, which no message has as MsgId 0 is never
+   // allocated
+   MsgCounter * counter( MsgId id ) noexcept {
+      if( QUICKTRACE_LIKELY( ( uint32_t )id < count ) ) {
+         return ( MsgCounter * )( base + id * stride );
+      }
+      uint32_t index = id - count;
+      int s = segment( index );
+      char * seg = id > 0 && s < MaxSegments ?
+         __atomic_load_n( &segments[ s ], __ATOMIC_ACQUIRE ) : nullptr;
+      if( !seg ) {
+         return ( MsgCounter * )base;
+      }
+      return ( MsgCounter * )( seg + ( index - segmentStart( s ) ) * stride );
+   }
+};
+
 struct QNull {};                // placeholder for no argument
 
 class RingBuf {
  public:
    RingBuf() noexcept;
+   ~RingBuf() noexcept;
    void bufIs( void * buf, int bufSize ) noexcept;
    void qtFileIs( TraceFile * ) noexcept;
-   void msgCounterIs( MsgCounter * m ) noexcept {
-      msgCounter_ = m;
+   void msgCountersIs( MsgCounters * m ) noexcept {
+      msgCounters_ = m;
    }
    inline void maybeWrap( TraceFile * ) noexcept;
    void doWrap() noexcept;
@@ -74,17 +142,43 @@ class RingBuf {
       }
       return *this;
    }
+   // A char array would otherwise decay to a char const *, losing its
+   // size. The string in it may still be shorter than the array.
+   template < size_t N >
+   RingBuf & operator<<( char const ( &t )[ N ] ) noexcept {
+      if ( QUICKTRACE_LIKELY( enabled() ) ) {
+         put( this, std::string_view( t, strnlen( t, N ) ) );
+      }
+      return *this;
+   }
+   // A char buf[ N ] binds to this exactly. Without it, only the partial
+   // ordering of the templates keeps it from the generic operator<<(),
+   // which would decay it.
+   template < size_t N >
+   RingBuf & operator<<( char ( &t )[ N ] ) noexcept {
+      return *this << ( char const ( & )[ N ] )t;
+   }
    template < class T >
-   void putLongStr( T t ) noexcept {
+   void putLongStr( T && t ) noexcept {
       if ( QUICKTRACE_LIKELY( enabled() ) ) {
-         putLongString( this, t );
+         putLongString( this, std::forward< T >( t ) );
       }
    }
+   // See TraceFile::msgCounter()
    MsgCounter * msgCounter( MsgId id ) noexcept {
-      return &(msgCounter_[ id % numMsgCounters_ ]);
+      return msgCounters_->counter( id );
    }
+   // Store a blob argument: a uint32_t length followed by the bytes
+   void putBlob( void const * data, uint32_t len ) noexcept;
    uint64_t startMsg( TraceFile *th, MsgId id ) noexcept;
    void endMsg() noexcept;
+   // Append a complete record, assembled in a thread's staging ring,
+   // to this ring. Only used for the rings of a MultiThreading::shared
+   // TraceFile, which all the threads of the process write into.
+   void commitShared( char const * rec, uint32_t len ) noexcept;
+   // Make this the ring of a MultiThreading::shared TraceFile. Call
+   // after bufIs().
+   void sharedIs() noexcept;
    template< class T >
    void push( T x ) noexcept {
       memcpy( ptr_, &x, sizeof( x ) );
@@ -93,19 +187,118 @@ class RingBuf {
    void * ptr() noexcept { return ptr_; }
    void ptrInc( int n ) noexcept { ptr_ += n; }
    void ptrIs( void * p ) noexcept { ptr_ = ( char * )p; }
-   void numMsgCountersIs( int n ) noexcept { numMsgCounters_ = n; }
+   void recordCpuIdIs( bool b ) noexcept { recordCpuId_ = b; }
+   void clockSourceIs( ClockSource c ) noexcept { clockSource_ = c; }
+   // Call before bufIs()
+   void archiveQuartersIs( bool b ) noexcept { archiveQuarters_ = b; }
+   // Where to publish the end of the last complete record, see
+   // TraceFileHeader::commitOffsets. Call before bufIs().
+   void commitOffsetIs( uint32_t * p ) noexcept { commitOffset_ = p; }
+   // Where to count the wraps of the ring, see RingSequence
+   void sequenceIs( RingSequence * s ) noexcept { sequence_ = s; }
+   // See TraceFile::overrunPolicyIs()
+   void overrunPolicyIs( RingReader * reader, OverrunPolicy policy,
+                         uint32_t spillBytes ) noexcept;
+   // Timestamp for the next record, and the CPU it was taken on if the
+   // records carry one
+   uint64_t timestamp( uint32_t * cpu ) const noexcept {
+      if( QUICKTRACE_UNLIKELY( clockSource_ != ClockSourceTsc ) ) {
+         return readClock( clockSource_ );
+      }
+      return QUICKTRACE_UNLIKELY( recordCpuId_ ) ? rdtscp( cpu ) : rdtsc();
+   }
    bool enabled() const noexcept { return msgStart_; }
+   // The end of the ring, where a record that fits in it may spill over
+   static int const TrailerSize = 256;
 
  private:
-   static int const TrailerSize = 256;
    friend class TraceFile;
-   uint32_t numMsgCounters_;
+   friend struct SpillDrains;
+   bool busy() const noexcept { return msgStart_ || nested_; }
+   uint64_t startNestedMsg( MsgId id ) noexcept;
+   void endSharedMsg() noexcept;
+   void pushLength() noexcept;
+   inline void publish( char const * end ) noexcept;
+   void countWrap( char const * tail ) noexcept;
+   bool overruns( uint64_t lap, char const * end ) const noexcept;
+   bool roomFor( uint64_t lap, char const * end ) noexcept;
+   bool readerGone() noexcept;
+   bool makeRoom() noexcept;
+   bool spill() noexcept;
+   void endSpilledMsg() noexcept;
+   void drainSpill() noexcept;
+   void dropSpill() noexcept;
+   void lockSpill() noexcept;
+   void unlockSpill() noexcept;
+   uint32_t maxBlobLen() const noexcept;
+   struct SharedSlot;
+   uint64_t waitForRoomShared( uint32_t len ) noexcept;
+   void advanceShared() noexcept;
+   char * nextArchivePtr( char const * ptr ) const noexcept;
    char * ptr_;
    char * msgStart_;
    char * bufEnd_;
+   // Where the next trace backs the ring up (TraceFile::maybeBackupBuffer),
+   // even if it does not wrap: bufEnd_, or the end of the current quarter
+   // of a ring that is archived in quarters, see nextArchivePtr()
+   char * backupPtr_;
    char * buf_;
-   MsgCounter * msgCounter_;
+   MsgCounters * msgCounters_;
    TraceFile * qtFile_;
+   // Set in a staging ring to the shared ring its records are committed to
+   RingBuf * sharedRing_;
+   // Traces started in a staging ring while its record was still being
+   // written or committed, by a signal handler, and the record they
+   // interrupted, see startNestedMsg()
+   uint32_t nested_;
+   char * nestedMsgStart_;
+   // The space reserved in a shared ring, and the records committed to
+   // it in reservation order, each as the number of records before their
+   // end in the upper 32 bits and the offset of the end in the lower ones,
+   // see commitShared()
+   uint64_t reserved_;
+   uint64_t committed_;
+   // The commit markers of the records reserved in a shared ring, and
+   // whether a writer is moving committed_ past them, see advanceShared()
+   SharedSlot * slots_;
+   uint32_t advancing_;
+   // TraceFileHeader::commitOffsets entry of the ring, if any
+   uint32_t * commitOffset_;
+   // Records committed to the ring, and bytes committed to it before it
+   // last wrapped, for the TraceFileHeader::ringSequences entry of the ring
+   uint64_t records_;
+   uint64_t bytes_;
+   uint64_t wraps_;
+   RingSequence * sequence_;
+   // TraceFileHeader::ringReaders entry of a level whose OverrunPolicy is
+   // not OverrunOverwrite, see TraceFile::overrunPolicyIs()
+   RingReader * reader_;
+   OverrunPolicy overrunPolicy_;
+   // Records that found no room, to check now and then that the consumer
+   // is still there, see readerGone()
+   uint32_t overruns_;
+   uint64_t dropped_;
+   // The overflow area of OverrunSpill, which holds spillLen_ bytes of
+   // records, each after its length as a uint32_t
+   char * spill_;
+   uint32_t spillSize_;
+   uint32_t spillLen_;
+   // Where the record written to the overflow area would have gone in the
+   // ring, null when records go to the ring
+   char * ringPtr_;
+   // Who is writing to the ring, when it has an overflow area: the writer
+   // from startMsg() to endMsg(), or the spill drain thread, see lockSpill()
+   uint32_t spillLock_;
+   // Set in the thread-local rings a shared TraceFile hands out, which
+   // have no trailer and never wrap
+   bool staging_;
+   // Records carry the id of the CPU their tsc was read on, see
+   // setRecordCpuId()
+   bool recordCpuId_;
+   // Each quarter of the ring is archived to the incremental forever log
+   // once it is written, see TraceFile::archiveLevel()
+   bool archiveQuarters_;
+   ClockSource clockSource_;
 };
 
 inline void put( RingBuf * log, char x ) noexcept { log->push( x ); }
@@ -133,12 +326,16 @@ inline void put( RingBuf * log, float x ) noexcept { log->push( x ); }
 inline void put( RingBuf * log, double x ) noexcept { log->push( x ); }
 inline void put( RingBuf * log, QNull x ) noexcept {}
 void put( RingBuf * log, char const * x ) noexcept;
+// put( RingBuf *, std::string_view ), declared above, is also used for
+// std::string. The known length saves looking for the NUL, and the
+// string is stored exactly like a char const *.
 inline void put( RingBuf * log, void const * x ) noexcept {
    log->push( ( uintptr_t )x );
 }
 
 // Special case for long strings only
 void putLongString( RingBuf * log, char const * x ) noexcept;
+void putLongString( RingBuf * log, std::string_view x ) noexcept;
 } // namespace QuickTrace 
 
 #endif // QUICKTRACE_RINGBUF_H
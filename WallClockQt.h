@@ -29,6 +29,29 @@
 
 #include <QuickTrace/QuickTrace.h>
 
+// Define QT_WALL_CLOCK_TSC before including this file for wall-clock
+// messages that cost the same as QTRACE_H. WC_QTRACE_H then marks them by
+// giving their descriptor the line number QuickTrace::WallClockLineNo, and
+// they only record the TSC, like any other message. Readers turn that into
+// wall clock time with the file's calibration points, which follow steps of
+// the wall clock, so only readers that know about WallClockLineNo print
+// them with their wall clock time, which is only as good as the file's
+// calibration.
+#ifdef QT_WALL_CLOCK_TSC
+#define WC_QTRACE_H( _qtf, _n, _x, _y )                                             \
+   do {                                                                             \
+      static QuickTrace::MsgId _msgId;                                              \
+      if ( QUICKTRACE_LIKELY( !!( _qtf ) ) ) {                                      \
+         WC_QTRACE_H_MSGID_VAR_LINE( _qtf,                                          \
+                                     _msgId,                                        \
+                                     qtvar( _rb ),                                  \
+                                     _n,                                            \
+                                     _x,                                            \
+                                     _y,                                            \
+                                     ( int )QuickTrace::WallClockLineNo );          \
+      }                                                                             \
+   } while ( 0 )
+#else
 // This macro is identical to QTRACE_H, except it prepends wallClockTimestamp in
 // RingBuf data.
 // Note that the wall-clock timestamp is stored in in RingBuf in two separate
@@ -48,6 +71,7 @@
             ( uint64_t )_tv.tv_sec << ( uint64_t )_tv.tv_usec << _y );              \
       }                                                                             \
    } while ( 0 )
+#endif
 
 // The goal of the _VAR macros below is to make sure that we only
 // invoke qtvar() a single time for each variable. This seems to be
@@ -57,7 +81,10 @@
    WC_QTRACE_H_MSGID_VAR( _qtf, _msgId, qtvar( _rb ), _n, _x, _y )
 
 #define WC_QTRACE_H_MSGID_VAR( _qtf, _msgId, _rb, _n, _x, _y )                      \
-   WC_QTRACE_H_MSGID_INIT_FMT( _qtf, _msgId, _x, _y );                              \
+   WC_QTRACE_H_MSGID_VAR_LINE( _qtf, _msgId, _rb, _n, _x, _y, 0 )
+
+#define WC_QTRACE_H_MSGID_VAR_LINE( _qtf, _msgId, _rb, _n, _x, _y, _line )          \
+   WC_QTRACE_H_MSGID_INIT_FMT_LINE( _qtf, _msgId, _x, _y, _line );                  \
    QuickTrace::RingBuf & _rb = ( _qtf )->log( _n );                                 \
    _rb.startMsg( _qtf, _msgId );                                                    \
    _rb << _y;                                                                       \
@@ -68,9 +95,14 @@
 // messages with wall-clock timestamp from the other regular messages without
 // wall-clock timestamp.
 // Note: The other alternative is to modify MsgDesc to identify this condition.
+// The _LINE variant takes the line number to use instead, which is how
+// WC_QTRACE_H marks its messages with QuickTrace::WallClockLineNo.
 #define WC_QTRACE_H_MSGID_INIT_FMT( _qtf, _msgId, _x, _y )                                     \
+   WC_QTRACE_H_MSGID_INIT_FMT_LINE( _qtf, _msgId, _x, _y, 0 )
+
+#define WC_QTRACE_H_MSGID_INIT_FMT_LINE( _qtf, _msgId, _x, _y, _line )                         \
    if ( QUICKTRACE_UNLIKELY( !!( _qtf ) && !( _qtf )->msgIdInitialized( _msgId ) ) ) {         \
-      QuickTrace::MsgDesc _qtmd( _qtf, &_msgId, __FILE__, 0 );                                 \
+      QuickTrace::MsgDesc _qtmd( _qtf, &_msgId, __FILE__, _line );                             \
       _qtmd.formatString() << _y;                                                              \
       _qtmd << _x;                                                                             \
       _qtmd.finish();                                                                          \
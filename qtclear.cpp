@@ -24,7 +24,9 @@
 // ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
 // SUCH DAMAGE.
 
+#include <algorithm>
 #include <iostream>
+#include <string>
 #include <QuickTrace/QuickTrace.h>
 #include <stdlib.h>
 #include <sys/mman.h>
@@ -36,9 +38,40 @@
 
 // This program clears all of the QuickTrace message counters in one
 // or more quicktrace output files.  It simply opens the file, mmaps
-// enough of it to include all of the counters, and then clears them.
+// enough of it to include all of the counters, and then clears them,
+// along with those in the counters file that goes with it.
 
 using namespace QuickTrace;
+
+// Clears the first size bytes of the counters file of the trace file, see
+// MsgCountersFileSuffix, if it is there
+static void
+clearExtraMsgCounters( char const * filename, size_t size ) {
+   char * path = realpath( filename, nullptr );
+   if( !path ) {
+      return;
+   }
+   std::string countersPath = std::string( path ) + MsgCountersFileSuffix;
+   free( path );
+   int fd = open( countersPath.c_str(), O_RDWR );
+   if( fd < 0 ) {
+      return;
+   }
+   struct stat buf;
+   if( fstat( fd, &buf ) < 0 ) {
+      close( fd );
+      return;
+   }
+   size = std::min( size, ( size_t )buf.st_size );
+   void * m = size ? mmap( 0, size, PROT_WRITE, MAP_SHARED, fd, 0 ) : MAP_FAILED;
+   if( m != MAP_FAILED ) {
+      memset( m, 0, size );
+      msync( m, size, MS_ASYNC );
+      munmap( m, size );
+   }
+   close( fd );
+}
+
 int main( int argc, char const ** argv ) {
    if( argc < 2 ) {
       std::cerr << "usage: qtclear <file> ..." << std::endl;
@@ -84,6 +117,10 @@ int main( int argc, char const ** argv ) {
       }
       memset( (char*)m + (tf->firstMsgOffset), 0,
               tf->fileHeaderSize - tf->firstMsgOffset );
+      if( tf->version >= 6 && tf->extraMsgCounters ) {
+         clearExtraMsgCounters( filename, tf->extraMsgCounters *
+                                          tf->msgCounterStride );
+      }
       // Call msync to update the file modification time.
       msync( m, size, MS_ASYNC );
       munmap( m, size );
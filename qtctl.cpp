@@ -24,6 +24,7 @@
 // ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
 // SUCH DAMAGE.
 
+#include <algorithm>
 #include <iostream>
 #include <stdlib.h>
 #include <sys/mman.h>
@@ -35,6 +36,7 @@
 #include <getopt.h>
 #include <unistd.h>
 #include <memory>
+#include <string>
 #include <QuickTrace/MessageParser.h>
 #include <QuickTrace/QuickTrace.h>
 
@@ -64,12 +66,45 @@ void ferror( char const * what, char const * filename ) {
 }
 
 static int numMsgCounters;
+static uint32_t msgCounterStride;
+// From file version 6 on MsgCounters are indexed by MsgId, those of the
+// MsgIds past numMsgCounters being in the counters file, see
+// MsgCountersFileSuffix
+static bool msgCountersById;
+static char * extraMsgCounters;
+static uint32_t numExtraMsgCounters;
+
+char * msgCounters( void * fp ) {
+   TraceFileHeader * tfh = (TraceFileHeader*) fp;
+   msgCountersById = tfh->version >= 6;
+   msgCounterStride = tfh->version >= 6 ? tfh->msgCounterStride :
+                                          sizeof( MsgCounter );
+   numMsgCounters = ( tfh->fileHeaderSize - tfh->firstMsgOffset ) /
+                         msgCounterStride;
+   return (char*) fp + tfh->firstMsgOffset;
+}
 
-MsgCounter* msgCounters( void * fp ) {
+// Maps the counters file of the trace file, if it has one
+void mapExtraMsgCounters( void * fp, char const * filename ) {
    TraceFileHeader * tfh = (TraceFileHeader*) fp;
-   numMsgCounters = ( tfh->fileHeaderSize - sizeof( TraceFileHeader ) ) /
-                         sizeof( MsgCounter );
-   return (MsgCounter*) ((char*)fp + tfh->firstMsgOffset);
+   extraMsgCounters = nullptr;
+   numExtraMsgCounters = 0;
+   uint32_t n = tfh->version >= 6 ?
+      __atomic_load_n( &tfh->extraMsgCounters, __ATOMIC_ACQUIRE ) : 0;
+   char * path = n ? realpath( filename, nullptr ) : nullptr;
+   if( !path ) return;
+   std::string countersPath = std::string( path ) + MsgCountersFileSuffix;
+   free( path );
+   int fd = open( countersPath.c_str(), O_RDWR );
+   if( fd < 0 ) return;
+   off_t size = lseek( fd, 0, SEEK_END );
+   n = std::min< off_t >( n, size / msgCounterStride );
+   void * m = n ? mmap( 0, ( size_t )n * msgCounterStride, PROT_WRITE,
+                        MAP_SHARED, fd, 0 ) : MAP_FAILED;
+   close( fd );
+   if( m == MAP_FAILED ) return;
+   extraMsgCounters = (char*) m;
+   numExtraMsgCounters = n;
 }
 
 void usage() {
@@ -126,20 +161,36 @@ int main( int argc, char * const * argv ) {
       void * m = mmap( 0, size, PROT_WRITE, MAP_SHARED, fd, 0 );
       if( m == MAP_FAILED ) { ferror( "mmap", filename ); }
       MessageIterator mi( m, fd );
-      MsgCounter * mc  = msgCounters( m );
+      char * counters = msgCounters( m );
+      mapExtraMsgCounters( m, filename );
       while( auto msg = mi.next() ) {
          bool match = !pattern || regexp->PartialMatch( msg->msg() )
             || regexp->PartialMatch( msg->filename() );
          match = match && (msgIndex == -1 || msgIndex == (int)msg->msgId() );
          if( !match ) continue;
          uint32_t counterIndex = msg->msgId() % numMsgCounters;
-         bool wasOff = mc[ counterIndex ].lastTsc & 0x80000000;
+         char * counter = counters + counterIndex * msgCounterStride;
+         if( msgCountersById && msg->msgId() >= ( uint32_t )numMsgCounters ) {
+            uint32_t extraIndex = msg->msgId() - numMsgCounters;
+            if( extraIndex < numExtraMsgCounters ) {
+               counter = extraMsgCounters + extraIndex * msgCounterStride;
+            } else if( !show ) {
+               std::cerr << msg->msgId() << " has no MsgCounter of its own, "
+                         << "it can not be turned " << ( on ? "on" : "off" )
+                         << std::endl;
+               continue;
+            } else {
+               counter = counters;
+            }
+         }
+         MsgCounter * mc = ( MsgCounter * )counter;
+         bool wasOff = mc->lastTsc & 0x80000000;
          bool isOff;
          if( !show ) {
             if( on ) {
-               mc[ counterIndex ].lastTsc &= 0x7fffffff;
+               mc->lastTsc &= 0x7fffffff;
             } else {
-               mc[ counterIndex ].lastTsc |= 0x80000000;
+               mc->lastTsc |= 0x80000000;
             }
             isOff = !on;
          } else {
@@ -153,6 +204,10 @@ int main( int argc, char * const * argv ) {
          }
 
       }
+      if( extraMsgCounters ) {
+         munmap( extraMsgCounters,
+                 ( size_t )numExtraMsgCounters * msgCounterStride );
+      }
       close( fd );
    }
 }
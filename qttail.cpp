@@ -24,18 +24,28 @@
 // ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
 // SUCH DAMAGE.
 
+#include <algorithm>
 #include <array>
+#include <climits>
+#include <cmath>
 #include <map>
 #include <cstdarg>
 #include <getopt.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <sched.h>
 #include <unistd.h>
 #include <sys/fcntl.h>
 #include <sys/inotify.h>
 #include <sys/mman.h>
 #include <iostream>
 #include <list>
+#include <memory>
+#include <sstream>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <zlib.h>
 #include <QuickTrace/QuickTrace.h>
 #include <QuickTrace/MessageParser.h>
 #include <QuickTrace/MessageFormatter.h>
@@ -51,7 +61,7 @@ constexpr uint32_t minimumVersionSupported = 2;
 
 // This should be updated every time a new file version is added
 // Emit a warning if a newer file version is found
-constexpr uint32_t mostRecentVersionSupported = 5;
+constexpr uint32_t mostRecentVersionSupported = 6;
 
 void pabort( const std::string & message ) {
    if ( errno == 0 ) {
@@ -91,6 +101,7 @@ public:
 
    void initialize( const void * fpp, int fd ) {
       messages_.clear();
+      blobs_ = false;
       parser_.initialize( fpp, fd );
    }
 
@@ -98,30 +109,40 @@ public:
       parser_.recheck();
       while ( parser_.more() ) {
          Message msg = parser_.parse();
-         messages_.try_emplace( msg.msgId(),
-                                msg.msgId(),
-                                msg.filename(),
-                                msg.lineno(),
-                                msg.msg(),
-                                msg.fmt() );
+         auto i = messages_.try_emplace( msg.msgId(),
+                                         msg.msgId(),
+                                         msg.filename(),
+                                         msg.lineno(),
+                                         msg.msg(),
+                                         msg.fmt() ).first;
+         blobs_ = blobs_ || i->second.hasBlobs();
       };
    }
 
+   // whether any of the messages has a blob, which makes for long records
+   bool hasBlobs() const {
+      return blobs_;
+   }
+
 private:
   std::unordered_map< uint32_t, MessageFormatter > messages_;
   MessageParser parser_;
+  bool blobs_ = false;
 };
 
 // formats timestamps in tsc ticks to human-readable time
 class TimestampFormatter {
 public:
    TimestampFormatter() :
-         tsc0_( 0 ), ticksPerSecond_( 0 ), utc0_( 0 ) {
+         tsc0_( 0 ), ticksPerSecond_( 0 ), tscFrequency_( 0 ), utc0_( 0 ),
+         calibrationCount_( 0 ) {
    }
 
    // format timestamp to os
    void format( uint64_t ts, std::ostream & os ) {
-      double t = utc0_ + ( ts - tsc0_ ) / ticksPerSecond_;
+      double sec, frac;
+      utc( ts, &sec, &frac );
+      double t = sec + frac;
       if ( lastT_ != static_cast< time_t >( t ) ) {
          nextSecond_ = true;
          lastT_ = static_cast< time_t >( t );
@@ -135,20 +156,131 @@ public:
       os << lastTbuf_ << usec;
    }
 
+   // timestamp in nanoseconds since the epoch
+   uint64_t nanoseconds( uint64_t ts ) const {
+      double sec, frac;
+      utc( ts, &sec, &frac );
+      return static_cast< uint64_t >( sec ) * 1000000000 +
+             llround( frac * 1000000000 );
+   }
+
    void initialize( const QuickTrace::TraceFileHeader & hdr ) {
       tsc0_ = hdr.tsc0;
       uint64_t tscDelta = hdr.tsc1 - hdr.tsc0;
       double timeDelta = hdr.monotime1 - hdr.monotime0;
-      ticksPerSecond_ = tscDelta / timeDelta;
-      utc0_ = hdr.utc1 - timeDelta;
+      // prefer the frequency reported by the hardware over the estimate,
+      // unless it is only the rounded base frequency of CPUID leaf 0x16,
+      // which earlier versions recorded
+      bool exact = hdr.version >= 6 &&
+                   ( hdr.flags & QuickTrace::TraceFileFlagTscFrequency ) &&
+                   hdr.tscFrequencySource != QuickTrace::TscFrequencyCpuidBase;
+      tscFrequency_ = exact ? hdr.tscFrequency : 0;
+      ticksPerSecond_ = exact ? tscFrequency_ : tscDelta / timeDelta;
+      utc0_ = hdr.utc1 - tscDelta / ticksPerSecond_;
+      readCalibrationPoints( hdr );
+   }
+
+   // whether calibration points have been added since initialize()
+   bool calibrationChanged( const QuickTrace::TraceFileHeader & hdr ) const {
+      return hasCalibrationPoints( hdr ) &&
+             __atomic_load_n( &hdr.calibrationCount, __ATOMIC_ACQUIRE ) !=
+                   calibrationCount_;
    }
 
    static bool nextSecond_; // time has wrapped to the next second
 
 private:
+   static bool hasCalibrationPoints( const QuickTrace::TraceFileHeader & hdr ) {
+      return hdr.version >= 6 &&
+             ( hdr.flags & QuickTrace::TraceFileFlagCalibrationPoints );
+   }
+
+   // Copy the calibration points out of the header, followed by the
+   // latest tsc1/monotime1/utc1, leaving out any that do not move the TSC
+   // forward. They are added while we read them: calibrationCount is odd
+   // while one is written, so try again if it was odd or changed
+   // meanwhile. The points are left out if that keeps happening, and
+   // calibrationChanged() has them read again later.
+   void readCalibrationPoints( const QuickTrace::TraceFileHeader & hdr ) {
+      points_.clear();
+      if ( !hasCalibrationPoints( hdr ) ) {
+         return;
+      }
+      bool consistent = false;
+      for ( int tries = 0; tries < 1000 && !consistent; ++tries ) {
+         points_.clear();
+         uint32_t count = __atomic_load_n( &hdr.calibrationCount, __ATOMIC_ACQUIRE );
+         if ( count % 2 != 0 ) {
+            sched_yield();
+            continue;
+         }
+         uint32_t n = std::min( count / 2, QuickTrace::NumCalibrationPoints );
+         for ( uint32_t i = count / 2 - n; i != count / 2; ++i ) {
+            uint32_t slot = i % QuickTrace::NumCalibrationPoints;
+            addPoint( hdr.calibrationPoints[ slot ] );
+         }
+         __atomic_thread_fence( __ATOMIC_ACQUIRE );
+         if ( __atomic_load_n( &hdr.calibrationCount, __ATOMIC_RELAXED ) == count ) {
+            calibrationCount_ = count;
+            consistent = true;
+         }
+      }
+      if ( !consistent ) {
+         points_.clear();
+      }
+      addPoint( { hdr.tsc1, hdr.monotime1, hdr.utc1 } );
+   }
+
+   void addPoint( const QuickTrace::CalibrationPoint & point ) {
+      if ( points_.empty() || point.tsc > points_.back().tsc ) {
+         points_.push_back( point );
+      }
+   }
+
+   // Convert ts to seconds since the epoch, as sec, a whole number, plus
+   // frac, so that the sum does not lose the nanoseconds. With
+   // calibration points, the monotonic time is interpolated within the
+   // segment around ts, or extrapolated from the first or last point, at
+   // the exact frequency if there is one and at the rate of the first or
+   // last segment otherwise. The wall clock is offset from it as of the
+   // latest point at or before ts. Without calibration points, tsc0 and
+   // the latest tsc1 are all we have.
+   void utc( uint64_t ts, double * sec, double * frac ) const {
+      if ( points_.size() < 2 ) {
+         *sec = floor( utc0_ );
+         *frac = utc0_ - *sec + ( ts - tsc0_ ) / ticksPerSecond_;
+         return;
+      }
+      auto next = std::upper_bound(
+            points_.begin() + 1, points_.end() - 1, ts,
+            []( uint64_t t, const QuickTrace::CalibrationPoint & p ) {
+               return t < p.tsc;
+            } );
+      const QuickTrace::CalibrationPoint & p = *( next - 1 );
+      const QuickTrace::CalibrationPoint & q = *next;
+      const QuickTrace::CalibrationPoint & ref = ts >= q.tsc ? q : p;
+      double monotime;
+      if ( tscFrequency_ && ( ts < p.tsc || ts >= q.tsc ) ) {
+         monotime = ref.monotime +
+                    static_cast< double >( static_cast< int64_t >( ts - ref.tsc ) ) /
+                          tscFrequency_;
+      } else {
+         monotime = p.monotime +
+                    static_cast< double >( static_cast< int64_t >( ts - p.tsc ) ) *
+                          ( q.monotime - p.monotime ) /
+                          static_cast< double >( q.tsc - p.tsc );
+      }
+      *sec = floor( ref.utc );
+      *frac = ref.utc - *sec + monotime - ref.monotime;
+   }
+
    uint64_t tsc0_; // counter in ticks when qt file was created
    double ticksPerSecond_; // how many ticks are in one second
+   double tscFrequency_; // exact ticks per second from the header, or 0
    double utc0_; // utc time when qt file was created
+   // calibration points in TSC order, see TraceFileHeader::calibrationPoints
+   std::vector< QuickTrace::CalibrationPoint > points_;
+   uint32_t calibrationCount_; // calibrationCount when points_ were read
    static time_t lastT_; // last timestamp formatted (entire seconds, unix time)
    static char lastTbuf_[ 24 ]; // formatted string representation of lastT_
 };
@@ -157,6 +289,104 @@ bool TimestampFormatter::nextSecond_ = false;
 time_t TimestampFormatter::lastT_;
 char TimestampFormatter::lastTbuf_[ 24 ];
 
+// writes the blob parameters of the messages to a pcapng file as ethernet
+// packets, each with the timestamp of its message and the formatted message
+// as a comment
+class PcapWriter {
+public:
+   explicit PcapWriter( const char * filename ) {
+      file_ = fopen( filename, "w" );
+      if ( file_ == nullptr ) {
+         pexit( std::string( "fopen(" ) + filename + ")" );
+      }
+      // section header block: byte-order magic, version 1.0, unknown length
+      block( 0x0a0d0d0a, 16 );
+      put32( 0x1a2b3c4d );
+      put16( 1 );
+      put16( 0 );
+      put32( UINT32_MAX );
+      put32( UINT32_MAX );
+      put32( 28 );
+      // interface description block: ethernet, no snaplen, nanosecond timestamps
+      block( 1, 20 );
+      put16( 1 ); // LINKTYPE_ETHERNET
+      put16( 0 );
+      put32( 0 );
+      option( 9, "\x09", 1 ); // if_tsresol
+      put32( 0 ); // opt_endofopt
+      put32( 32 );
+   }
+
+   ~PcapWriter() {
+      fclose( file_ );
+   }
+
+   PcapWriter( const PcapWriter & ) = delete;
+   PcapWriter & operator=( const PcapWriter & ) = delete;
+
+   void packet( uint64_t ns, const unsigned char * data, uint32_t len,
+                const std::string & comment ) {
+      // enhanced packet block, an option is limited to 64k
+      uint16_t commentLen = std::min< size_t >( comment.size(), 0xfff0 );
+      uint32_t size = 12 + 20 + pad( len ) + 4 + pad( commentLen ) + 4;
+      block( 6, size - 12 );
+      put32( 0 ); // interface id
+      put32( ns >> 32 );
+      put32( ns );
+      put32( len ); // captured length
+      put32( len ); // original length
+      write( data, len );
+      option( 1, comment.data(), commentLen ); // opt_comment
+      put32( 0 ); // opt_endofopt
+      put32( size );
+   }
+
+   void flush() {
+      if ( fflush( file_ ) != 0 ) {
+         pexit( "---------- error writing pcap file, aborting" );
+      }
+   }
+
+private:
+   static uint32_t pad( uint32_t len ) {
+      return ( len + 3 ) & ~3U;
+   }
+
+   void write( const void * data, uint32_t len ) {
+      static const char zeros[ 4 ] = {};
+      if ( fwrite( data, 1, len, file_ ) != len ||
+           fwrite( zeros, 1, pad( len ) - len, file_ ) != pad( len ) - len ) {
+         pexit( "---------- error writing pcap file, aborting" );
+      }
+   }
+
+   void put16( uint16_t val ) {
+      if ( fwrite( &val, 1, sizeof( val ), file_ ) != sizeof( val ) ) {
+         pexit( "---------- error writing pcap file, aborting" );
+      }
+   }
+
+   void put32( uint32_t val ) {
+      write( &val, sizeof( val ) );
+   }
+
+   // start a block with the given type and length of its body
+   void block( uint32_t type, uint32_t bodyLen ) {
+      put32( type );
+      put32( bodyLen + 12 );
+   }
+
+   void option( uint16_t code, const char * value, uint16_t len ) {
+      put16( code );
+      put16( len );
+      write( value, len );
+   }
+
+   FILE * file_;
+};
+
+PcapWriter * pcapWriter = nullptr; // set by --pcap
+
 class CorruptionError : public std::exception {
 public:
    CorruptionError( Messages & messages, uint32_t msgId, const char * fmt, ... ) {
@@ -210,7 +440,10 @@ struct Options {
       PRINT_FILE_LINE = 0x4000,
       PRINT_QT_FILE_NAME = 0x8000,
       PRINT_QT_FILE_EVENTS = 0x10000,
-      PRINT_WALL_CLOCK_TIME = 0x20000
+      PRINT_WALL_CLOCK_TIME = 0x20000,
+      UNIQUE = 0x40000,
+      PRINT_LOST = 0x80000,
+      LOSSLESS = 0x100000
    };
 };
 
@@ -218,16 +451,285 @@ struct Options {
 class RingBuffer {
 public:
    RingBuffer() : corruption_( 0 ), level_( 0 ), start_( nullptr ), end_( nullptr ),
-                  cur_( nullptr ), lastTsc_( 0 ) {}
+                  cur_( nullptr ), lastTsc_( 0 ), tagSize_( 0 ),
+                  paramOffset_( 12 ), extendedLength_( 0 ), cpuIdHdr_( nullptr ),
+                  commit_( nullptr ), sequence_( nullptr ), gen_( 0 ), seq_( 0 ),
+                  bytesBase_( 0 ), lapCommit_( 0 ), lostRecords_( 0 ),
+                  lostBytes_( 0 ), reader_( nullptr ), droppedSeen_( 0 ) {}
 
    RingBuffer( unsigned level, const unsigned char * start,
-               const unsigned char * end ) {
+               const unsigned char * end, unsigned tagSize, unsigned paramOffset,
+               int extendedLength, const QuickTrace::TraceFileHeader * cpuIdHdr,
+               const uint32_t * commit, const QuickTrace::RingSequence * sequence ) {
       corruption_ = 0;
       level_ = level;
       start_ = start + sizeof( uint32_t ); // skip the end pointer
       end_ = end - 256; // exclude the trailer
       cur_ = start_;
       lastTsc_ = 0;
+      tagSize_ = tagSize;
+      paramOffset_ = paramOffset;
+      extendedLength_ = extendedLength;
+      cpuIdHdr_ = cpuIdHdr;
+      commit_ = commit;
+      sequence_ = sequence;
+      gen_ = 0;
+      seq_ = 0;
+      bytesBase_ = 0;
+      lapCommit_ = 0;
+      lostRecords_ = 0;
+      lostBytes_ = 0;
+      reader_ = nullptr;
+      droppedSeen_ = 0;
+      if ( sequence_ != nullptr ) {
+         // the start of the ring buffer is where the writer last wrapped to
+         gen_ = wrapSequence( seq_, bytesBase_ );
+      }
+   }
+
+   // end of the messages the writer has completed, when it publishes it (see
+   // QuickTrace::TraceFileHeader::commitOffsets). the acquire load makes the
+   // messages before it safe to read
+   const unsigned char * committed() const {
+      return start_ - sizeof( uint32_t ) +
+             __atomic_load_n( commit_, __ATOMIC_ACQUIRE );
+   }
+
+   // number of times a message may fail to decode before it is deemed corrupt.
+   // a message before the commit offset is complete, so it only fails to
+   // decode if it really is corrupt, or has been overwritten, which passed()
+   // tells when the writer counts its wraps
+   unsigned threshold() const {
+      return sequence_ != nullptr ? 0 : corruptionThreshold_;
+   }
+
+   // the number of times the writer wrapped, with its commit offset in the
+   // lap it is in, as of a single point in time
+   uint64_t position( uint32_t & commit ) const {
+      for ( ;; ) {
+         uint64_t wraps = __atomic_load_n( &sequence_->wraps, __ATOMIC_ACQUIRE );
+         commit = __atomic_load_n( commit_, __ATOMIC_ACQUIRE );
+         __atomic_thread_fence( __ATOMIC_ACQUIRE );
+         if ( __atomic_load_n( &sequence_->wraps, __ATOMIC_RELAXED ) == wraps ) {
+            return wraps;
+         }
+      }
+   }
+
+   // how far past its commit offset the writer may be writing: the longest
+   // record in progress, which is half of the ring buffer without its
+   // trailer with a blob (see QuickTrace::RingBuf::maxBlobLen()) or the
+   // trailer otherwise, and the zero tsc after it. the writers of a shared
+   // ring buffer copy their records that far ahead of the commit offset (see
+   // QuickTrace::RingBuf::waitForRoomShared()). only when tailing are the
+   // messages read while they are written, otherwise the file is taken as is
+   uint32_t inFlight( Messages & msgs, int options ) const {
+      if ( ( options & Options::TAIL ) == 0 ) {
+         return sizeof( uint64_t );
+      }
+      uint32_t record = 256;
+      if ( tagSize_ != 0 || msgs.hasBlobs() ) {
+         record = std::max< uint32_t >( ( end_ - start_ ) / 2, record );
+      }
+      return record + sizeof( uint64_t );
+   }
+
+   // whether the writer may have started overwriting the current message by
+   // the time it was read, seqlock style: the position of the writer is
+   // read after the message, and compared with it like copyLevel() in
+   // QuickTrace.cpp does for the records it archives. the message is intact
+   // when the writer is in the same lap, or in the next one but more than
+   // margin behind the message, see inFlight(). a registered consumer is
+   // never overwritten
+   bool passed( uint32_t margin, uint64_t & wraps ) {
+      if ( sequence_ == nullptr || reader_ != nullptr ) {
+         return false;
+      }
+      __atomic_thread_fence( __ATOMIC_ACQUIRE );
+      uint32_t commit;
+      wraps = position( commit );
+      uint32_t start = sizeof( uint32_t );
+      uint32_t offset = cur_ - start_ + start;
+      if ( wraps == gen_ ) {
+         // the writers of a shared ring buffer copy their records into the
+         // next lap before they count the wrap. a commit offset at the start
+         // of the ring buffer may be that of the lap after the one counted
+         uint32_t ringSize = bufferEnd() - start_ + start;
+         return tagSize_ != 0 && offset < start + margin &&
+                ( commit == start || offset + ringSize < start + commit + margin );
+      }
+      if ( wraps != gen_ + 1 ) {
+         return true;
+      }
+      if ( commit == start ) {
+         // the writer just wrapped to the next lap, or already went through
+         // it and is about to count the wrap after, when it was seen in it
+         return lapCommit_ > start || offset < start + margin;
+      }
+      lapCommit_ = commit;
+      return commit + margin > offset;
+   }
+
+   // drop the current message when the writer may have overwritten it, and
+   // go to where the writer wrapped to once it counted the wrap, counting
+   // the messages in between as lost rather than corrupt
+   bool dropIfPassed( Messages & msgs, int options ) {
+      uint64_t wraps;
+      if ( !passed( inFlight( msgs, options ), wraps ) ) {
+         return false;
+      }
+      if ( wraps > gen_ ) {
+         resync();
+      }
+      corruption_ = 0;
+      return true;
+   }
+
+   // whether the current message, having failed to decode, is corrupt. it
+   // is not when the writer overwrote it, see dropIfPassed()
+   bool corrupt( Messages & msgs, int options ) {
+      return !dropIfPassed( msgs, options ) && corruption_ >= threshold();
+   }
+
+   // the number of times the writer wrapped, with the records and bytes it
+   // committed before it last did (see QuickTrace::RingSequence)
+   uint64_t wrapSequence( uint64_t & records, uint64_t & bytes ) const {
+      for ( ;; ) {
+         uint64_t wraps = __atomic_load_n( &sequence_->wraps, __ATOMIC_ACQUIRE );
+         records = __atomic_load_n( &sequence_->wrapRecords[ wraps % 2 ],
+                                    __ATOMIC_RELAXED );
+         bytes = __atomic_load_n( &sequence_->wrapBytes[ wraps % 2 ],
+                                  __ATOMIC_RELAXED );
+         __atomic_thread_fence( __ATOMIC_ACQUIRE );
+         if ( __atomic_load_n( &sequence_->wraps, __ATOMIC_RELAXED ) < wraps + 2 ) {
+            return wraps;
+         }
+      }
+   }
+
+   // go to the start of the ring buffer as the writer last wrapped to it,
+   // counting the messages between the current position and there as lost
+   void resync() {
+      uint64_t records, bytes;
+      uint64_t wraps = wrapSequence( records, bytes );
+      uint64_t pos = bytesBase_ + ( cur_ - start_ );
+      if ( records > seq_ && bytes > pos ) {
+         lostRecords_ += records - seq_;
+         lostBytes_ += bytes - pos;
+      }
+      gen_ = wraps;
+      seq_ = records;
+      bytesBase_ = bytes;
+      lapCommit_ = 0;
+      cur_ = start_;
+      consumed();
+   }
+
+   // the messages and bytes lost since the last call, when the writer keeps
+   // count of them
+   bool takeLost( uint64_t & records, uint64_t & bytes ) {
+      records = lostRecords_;
+      bytes = lostBytes_;
+      lostRecords_ = lostBytes_ = 0;
+      return records != 0;
+   }
+
+   // register as the consumer of the ring buffer, through the writable
+   // mapping of its QuickTrace::RingReader, so that the writer does not
+   // overwrite the messages not printed yet. needs the writer's counts
+   void readerIs( QuickTrace::RingReader * reader ) {
+      reader_ = reader;
+      if ( reader_ != nullptr ) {
+         droppedSeen_ = __atomic_load_n( &reader_->dropped, __ATOMIC_RELAXED );
+         __atomic_store_n( &reader_->pid, uint32_t( getpid() ), __ATOMIC_RELAXED );
+         consumed();
+      }
+   }
+
+   // let the writer overwrite the ring buffer again
+   void unregister() {
+      if ( reader_ != nullptr ) {
+         __atomic_store_n( &reader_->cursor, 0, __ATOMIC_RELEASE );
+         __atomic_store_n( &reader_->pid, 0, __ATOMIC_RELAXED );
+         reader_ = nullptr;
+      }
+   }
+
+   // tell the writer that the messages before the current one have been
+   // read, see QuickTrace::RingReader
+   void consumed() {
+      if ( reader_ != nullptr ) {
+         uint64_t offset = cur_ - start_ + sizeof( uint32_t );
+         __atomic_store_n( &reader_->cursor, ( gen_ << 32 ) | offset,
+                           __ATOMIC_RELEASE );
+      }
+   }
+
+   // the messages the writer dropped rather than overwrite unread ones since
+   // the last call, when registered as the consumer
+   uint64_t takeDropped() {
+      if ( reader_ == nullptr ) {
+         return 0;
+      }
+      uint64_t dropped = __atomic_load_n( &reader_->dropped, __ATOMIC_RELAXED );
+      uint64_t n = dropped - droppedSeen_;
+      droppedSeen_ = dropped;
+      return n;
+   }
+
+   // offset of the length of the current message, given the length of its
+   // parameter data
+   int lenOffset( int n ) const {
+      return paramOffset_ + n + tagSize_;
+   }
+
+   // load the tsc of the message at p, on the time base of the reference CPU
+   // when the messages carry the id of their CPU and the writer measured the
+   // TSC offsets of the CPUs (see QuickTrace::setRecordCpuId)
+   uint64_t loadTsc( const unsigned char * p ) const {
+      uint64_t tsc;
+      LOAD_TSC( tsc, p );
+      if ( cpuIdHdr_ == nullptr || tsc == 0 || tsc == UINT64_MAX ||
+           !( __atomic_load_n( &cpuIdHdr_->flags, __ATOMIC_ACQUIRE ) &
+              QuickTrace::TraceFileFlagTscOffsets ) ) {
+         return tsc;
+      }
+      uint16_t cpu;
+      memcpy( &cpu, p + 12, sizeof( cpu ) );
+      if ( cpu >= cpuIdHdr_->numTscOffsets ) {
+         // not written yet, the message is incomplete
+         return tsc;
+      }
+      int64_t offset;
+      memcpy( &offset, reinterpret_cast< const char * >( cpuIdHdr_ ) +
+                       cpuIdHdr_->tscOffsetsStart + cpu * sizeof( offset ),
+              sizeof( offset ) );
+      return tsc - offset;
+   }
+
+   // size of the current message, including its length, which takes more
+   // than a byte for long messages (see QuickTrace::ExtendedRecordLength)
+   int recordSize( int n ) const {
+      int l = lenOffset( n );
+      if ( l < extendedLength_ ) {
+         return l + 1;
+      }
+      return l + sizeof( uint32_t ) + 1;
+   }
+
+   // length of the current message according to the writer, -1 if the
+   // length is missing
+   int storedLength( int n ) const {
+      int l = lenOffset( n );
+      if ( l < extendedLength_ ) {
+         return cur_[ l ];
+      }
+      if ( cur_[ l + sizeof( uint32_t ) ] != QuickTrace::ExtendedRecordLength ) {
+         return -1;
+      }
+      uint32_t len;
+      memcpy( &len, cur_ + l, sizeof( len ) );
+      return len;
    }
 
    // dump the current message and advance to next one
@@ -247,8 +749,9 @@ public:
          }
          MessageFormatter * formatter = msgs.get( msgId );
          if ( ( options & Options::PRINT_WALL_CLOCK_TIME ) != 0 &&
-              formatter->lineno() != 0 ) {
-            // Message with wall-clock timestamp are using 0 as line number.
+              !formatter->wallClock() ) {
+            // Message with wall-clock timestamp are using 0 or
+            // QuickTrace::WallClockLineNo as line number.
             // Skip printing other messages without wall-clock timestamp.
             // Even if we skip printing output, we still need to advance the
             // cur_ pointer in RingBuf as per the formatter data.
@@ -256,57 +759,106 @@ public:
             // which indicates logical error on i/o operation.
             std::cout.setstate( std::ios::failbit );
          }
-         if ( formatter->lineno() == 0 &&
+         // the line goes to the pcap file as well when the message has packets,
+         // and is only printed once the writer is known not to have
+         // overwritten the message meanwhile, when that can be told
+         std::ostringstream line;
+         bool pcap = pcapWriter != nullptr && formatter->hasBlobs() && std::cout;
+         std::ostream & os = pcap || sequence_ != nullptr ? line : std::cout;
+         if ( formatter->hasWallClockFields() &&
               ( options & Options::PRINT_WALL_CLOCK_TIME ) != 0 ) {
             // If the line number is 0, the first two fields in RingBuf data
             // contains wall-clock timestamp (tv_sec & tv_usec).
             // If wallClock option is enabled, use those fields to replace
-            // message timestamp. Otherwise ignore those fields.
-            formatter->formatWallClock( cur_ + 12, std::cout );
+            // message timestamp. Otherwise ignore those fields. Messages
+            // with line number QuickTrace::WallClockLineNo only record the
+            // tsc, which the calibration points turn into wall clock time.
+            formatter->formatWallClock( cur_ + paramOffset_, os );
          } else {
-            tsf.format( tsc, std::cout );
+            tsf.format( tsc, os );
+         }
+         os << ' ' << level_;
+         if ( tagSize_ != 0 ) {
+            // thread tag of a shared ring buffer, after the parameter data
+            uint16_t tag;
+            int n = formatter->length( cur_ + paramOffset_, bufferEnd() );
+            memcpy( &tag, cur_ + lenOffset( n ) - tagSize_, sizeof( tag ) );
+            os << " t" << tag;
+         }
+         if ( cpuIdHdr_ != nullptr ) {
+            uint16_t cpu;
+            memcpy( &cpu, cur_ + 12, sizeof( cpu ) );
+            os << " c" << cpu;
          }
-         std::cout << ' ' << level_;
          if ( ( options & Options::DEBUG ) != 0 ) {
-            std::cout << " 0x" << std::hex << std::setfill( '0' ) << std::setw( 16 )
-                      << orderTsc << std::dec;
+            os << " 0x" << std::hex << std::setfill( '0' ) << std::setw( 16 )
+               << orderTsc << std::dec;
          }
          if ( ( options & Options::PRINT_TSC ) != 0 ) {
-            std::cout << " 0x" << std::hex << std::setfill( '0' ) << std::setw( 16 )
-                      << tsc << std::dec;
+            os << " 0x" << std::hex << std::setfill( '0' ) << std::setw( 16 )
+               << tsc << std::dec;
          }
          if ( ( options & Options::PRINT_QT_FILE_NAME ) != 0 ) {
-            std::cout << ' ' << qtName;
+            os << ' ' << qtName;
          }
-         std::cout << " +" << ( tsc - lastPrintedTsc_ ) << ' ';
+         os << " +" << ( tsc - lastPrintedTsc_ ) << ' ';
          if ( ( options & Options::PRINT_FILE_LINE ) != 0 ) {
-            std::cout << formatter->filename() << ':' << formatter->lineno() << ' ';
+            os << formatter->filename() << ':'
+               << ( formatter->wallClock() ? 0 : formatter->lineno() ) << ' ';
+         }
+         os << '"';
+         int n = formatter->format( cur_ + paramOffset_, os, bufferEnd() );
+         if ( dropIfPassed( msgs, options ) ) {
+            // overwritten while it was formatted, the line is not printed
+            if ( ( options & Options::PRINT_WALL_CLOCK_TIME ) != 0 &&
+                 !formatter->wallClock() ) {
+               std::cout.clear();
+            }
+            return true;
          }
-         std::cout << '"';
-         int n = formatter->format( cur_ + 12, std::cout );
          if ( n < 0 ) {
             // corruption even after message has been validated already;
             // fail right away
             throw CorruptionError(
                      msgs, msgId, "failed to dump message after successful decode" );
          }
-         std::cout << "\"\n";
-         int expectedLength = cur_[ n + 12 ]; // what the writer thinks
-         if ( n + 12 != expectedLength ) {
-            // invalid length
+         os << '"';
+         int expectedLength = storedLength( n ); // what the writer thinks
+         if ( lenOffset( n ) != expectedLength ) {
+            // invalid length, found before the line and its packets go where
+            // they cannot be taken back from, such as the pcap file
+            if ( &os == &std::cout ) {
+               std::cout << '\n';
+            }
             throw CorruptionError( msgs, msgId,
                                    "invalid length after dump: %d (expected: %d)",
-                                   static_cast< int >( expectedLength ), n + 12 );
+                                   static_cast< int >( expectedLength ),
+                                   lenOffset( n ) );
          }
-         cur_ += 13 + n;
-         if ( cur_ >= end_ ) {
-            // need to wrap
+         if ( pcap ) {
+            std::cout << line.str() << '\n';
+            auto blobs = formatter->blobs( cur_ + paramOffset_, bufferEnd() );
+            for ( auto & blob : blobs ) {
+               pcapWriter->packet( tsf.nanoseconds( tsc ), blob.first, blob.second,
+                                   line.str() );
+            }
+         } else if ( sequence_ != nullptr ) {
+            std::cout << line.str() << '\n';
+         } else {
+            std::cout << '\n';
+         }
+         cur_ += recordSize( n );
+         seq_++;
+         if ( cur_ >= end_ && commit_ == nullptr ) {
+            // need to wrap. with a commit offset, nextTsc() wraps once the writer
+            // did
             cur_ = start_;
          }
+         consumed();
          lastTsc_ = tsc;
          corruption_ = 0;
          if ( ( options & Options::PRINT_WALL_CLOCK_TIME ) != 0 &&
-              formatter->lineno() != 0 ) {
+              !formatter->wallClock() ) {
             // Clear the failbit error so that the next message gets printed.
             std::cout.clear();
          } else {
@@ -323,7 +875,7 @@ public:
    // move to the end of the current buffer
    void fastforward( Messages & msgs, int options ) {
       while ( skip( msgs, options ) ) {}
-      if ( cur_ >= end_ ) {
+      if ( cur_ >= end_ && commit_ == nullptr ) {
          // need to wrap
          cur_ = start_;
       }
@@ -336,7 +888,11 @@ public:
          return false;
       }
       corruption_ = 0;
-      cur_ = start_;
+      if ( sequence_ != nullptr ) {
+         resync();
+      } else {
+         cur_ = start_;
+      }
       lastTsc_ += 1; // ensure last message is not dumped again
       return true;
    }
@@ -357,12 +913,12 @@ public:
             while ( cur_ < end_ &&
                     ( tsc = next( msgs, UINT64_MAX, options, msgId ) ) != 0 ) {
                MessageFormatter * formatter = msgs.get( msgId );
-               int n = formatter->length( cur_ + 12 );
+               int n = formatter->length( cur_ + paramOffset_, bufferEnd() );
                if ( n < 0 ) {
                   // failed to decode message; give up immediately
                   return false;
                }
-               cur_ += 13 + n;
+               cur_ += recordSize( n );
                lastTsc_ = tsc;
             }
          } catch ( const CorruptionError & ) {
@@ -371,6 +927,7 @@ public:
          }
          const unsigned char * splitPoint = cur_ + 8;
          const unsigned char * p = start_ - sizeof( uint32_t ) + e;
+         uint32_t movedBackNumMsgs = 0;
          if ( p <= splitPoint ) {
             // there is no split point, just take all the messages from the
             // start of the buffer
@@ -381,11 +938,16 @@ public:
             // cond should be 'p >= splitPoint' but keep 'p > splitPoint' for
             // compatibility with qtcat. because of this, qtcat might not
             // recognize the first valid message
-            uint32_t movedBackNumMsgs = 0;
             while ( p > splitPoint ) {
                movedBackNumMsgs++;
                cur_ = p;
-               p -= 1 + p[ -1 ];
+               if ( p[ -1 ] == extendedLength_ ) {
+                  uint32_t len;
+                  memcpy( &len, p - 1 - sizeof( len ), sizeof( len ) );
+                  p -= 1 + sizeof( len ) + len;
+               } else {
+                  p -= 1 + p[ -1 ];
+               }
             }
             if ( p < splitPoint && movedBackNumMsgs == 1 ) {
                // moved back one message but then found that it already went before
@@ -394,20 +956,54 @@ public:
                cur_ = start_;
             }
          }
+         if ( sequence_ != nullptr ) {
+            // the first message is the one the writer wrote after the last
+            // wrap, or movedBackNumMsgs - 1 messages before the tail of the
+            // previous lap (e past the start of the ring buffer)
+            uint64_t records, bytes;
+            uint64_t wraps = wrapSequence( records, bytes );
+            lapCommit_ = 0;
+            if ( cur_ == start_ ) {
+               gen_ = wraps;
+               seq_ = records;
+               bytesBase_ = bytes;
+            } else {
+               gen_ = wraps - 1;
+               seq_ = records - ( movedBackNumMsgs - 1 );
+               bytesBase_ = bytes - ( e - sizeof( uint32_t ) );
+            }
+         }
       }
       // initialize lastTsc so that the tsc delta of the first message is zero
-      LOAD_TSC( lastTsc_, cur_ );
+      lastTsc_ = loadTsc( cur_ );
       corruption_ = 0;
       return true;
    }
 
+   // the offset of the current message from the start of the ring buffer
+   uint32_t offset() const {
+      return cur_ - start_;
+   }
+
+   // the bytes of the current message, from its tsc to its length, empty if it
+   // can not be decoded
+   std::string_view record( Messages & msgs, int options ) {
+      uint32_t msgId;
+      if ( next( msgs, UINT64_MAX, options, msgId ) == 0 ) {
+         return {};
+      }
+      int n = msgs.get( msgId )->length( cur_ + paramOffset_, bufferEnd() );
+      return std::string_view( reinterpret_cast< const char * >( cur_ ),
+                               recordSize( n ) );
+   }
+
    // skip the current message and advance to next one
    bool skip( Messages & msgs, int options ) {
       uint32_t msgId;
       uint64_t tsc = next( msgs, UINT64_MAX, options, msgId );
       if ( tsc != 0 ) {
          MessageFormatter * formatter = msgs.get( msgId );
-         int n = formatter->length( cur_ + 12 );
+         int n = formatter->length( cur_ + paramOffset_, bufferEnd() );
          if ( n < 0 ) {
             // corruption; give up immediately
             // as 'skip' is only used in tailing mode, just return to the caller and
@@ -415,7 +1011,9 @@ public:
             // deal with it
             return false;
          }
-         cur_ += 13 + n;
+         cur_ += recordSize( n );
+         seq_++;
+         consumed();
          lastTsc_ = tsc;
          return true;
       } else {
@@ -426,7 +1024,7 @@ public:
    // get information about next message
    // return: 0 if there is no next message
    uint64_t next( Messages & msgs, uint64_t curTsc, int options,
-                  uint32_t & msgId ) const {
+                  uint32_t & msgId ) {
       // check if valid message is there
       uint64_t tsc = nextTsc();
       if ( tsc == 0 ) {
@@ -434,9 +1032,10 @@ public:
          // it is simply an indicator that there is no message yet
          return 0;
       }
-      if ( !isValidTsc( tsc, curTsc ) ) {
+      // a completed message may well be more recent than the current tsc
+      if ( !isValidTsc( tsc, commit_ != nullptr ? UINT64_MAX : curTsc ) ) {
          // not a valid timestamp
-         if ( corruption_ >= corruptionThreshold_ ) {
+         if ( corrupt( msgs, options ) ) {
             throw CorruptionError( msgs, 0,
                                    "invalid tsc: %" PRIu64 " (last: %" PRIu64 ")",
                                    tsc, lastTsc_ );
@@ -447,34 +1046,50 @@ public:
       MessageFormatter * formatter = msgs.get( msgId );
       if ( formatter == nullptr ) {
          // not a valid message id
-         if ( corruption_ >= corruptionThreshold_ ) {
+         if ( corrupt( msgs, options ) ) {
             throw CorruptionError( msgs, msgId, "invalid message id: %" PRIu32,
                                    msgId );
          }
          return 0;
       }
-      int length = formatter->length( cur_ + 12 );
+      int length = formatter->length( cur_ + paramOffset_, bufferEnd() );
       if ( length < 0 ) {
          // corrupt parameter data, could be temporary due to concurrent write
-         if ( corruption_ >= corruptionThreshold_ ) {
+         if ( corrupt( msgs, options ) ) {
             throw CorruptionError( msgs, msgId, "invalid parameter data" );
          }
          return 0;
       }
-      int expectedLength = cur_[ length + 12 ]; // what the writer thinks
-      if ( length + 12 != expectedLength ) {
+      if ( cur_ + recordSize( length ) + sizeof( uint64_t ) > end_ + 256 ) {
+         // parameter data too long to be valid, could be temporary due to
+         // concurrent write
+         if ( corrupt( msgs, options ) ) {
+            throw CorruptionError( msgs, msgId, "invalid parameter length: %d",
+                                   length );
+         }
+         return 0;
+      }
+      int expectedLength = storedLength( length ); // what the writer thinks
+      if ( lenOffset( length ) != expectedLength ) {
          // mismatching length
-         if ( corruption_ >= corruptionThreshold_ ) {
+         if ( corrupt( msgs, options ) ) {
             throw CorruptionError( msgs, msgId, "invalid length: %d (expected: %d)",
-                                   expectedLength, length + 12 );
+                                   expectedLength, lenOffset( length ) );
          }
          return 0;
       }
-      uint64_t nextTsc;
-      LOAD_TSC( nextTsc, cur_ + 13 + length );
-      if ( nextTsc != 0 && cur_ + 13 + length >= end_ ) {
-         // got a non-zero next timestamp when the message extends into the trailer.
-         // do additional checks
+      if ( commit_ != nullptr ) {
+         // the message is before the commit offset, so it is complete and
+         // there is no need to look at what follows it, unless the writer
+         // went on to overwrite it
+         return dropIfPassed( msgs, options ) ? 0 : tsc;
+      }
+      uint64_t nextTsc = loadTsc( cur_ + recordSize( length ) );
+      if ( nextTsc == UINT64_MAX ||
+           ( nextTsc != 0 && cur_ + recordSize( length ) >= end_ ) ) {
+         // got a non-zero next timestamp when the message extends into the trailer,
+         // or an all-one timestamp where the writer wrapped early to make room
+         // for a long message. do additional checks
          if ( nextTsc == UINT64_MAX ) {
             // got an all-one timestamp
             if ( ( options & Options::TAIL ) != 0 ) {
@@ -482,7 +1097,7 @@ public:
                // the message is incomplete or the buffer has already wrapped.
                // therefore check if there is a new timestamp at the start of
                // the buffer to find out
-               LOAD_TSC( nextTsc, start_ );
+               nextTsc = loadTsc( start_ );
             } else {
                // in qtcat mode this means the buffer has rolled over, so just accept
                // the message (we can not check the timestamp at the start of the
@@ -492,7 +1107,7 @@ public:
          } else {
             // got a non-zero timestamp in the trailer that is not all-one
             // this could be corruption if persistent
-            if ( corruption_ >= corruptionThreshold_ ) {
+            if ( corrupt( msgs, options ) ) {
                throw CorruptionError( msgs, msgId, "invalid next tsc: %" PRIu64
                                       " (tsc: %" PRIu64 ")", nextTsc, tsc );
             }
@@ -501,7 +1116,7 @@ public:
       }
       if ( nextTsc != 0 && ( nextTsc < tsc || nextTsc > curTsc ) ) {
          // not a valid next timestamp
-         if ( corruption_ >= corruptionThreshold_ ) {
+         if ( corrupt( msgs, options ) ) {
             throw CorruptionError( msgs, msgId, "invalid next tsc: %" PRIu64
                                    " (tsc: %" PRIu64 ")", nextTsc, tsc );
          }
@@ -510,12 +1125,46 @@ public:
       return tsc;
    }
 
+   // start over, after the ring buffer got replaced by another copy of it
+   void restart() {
+      corruption_ = 0;
+      cur_ = start_;
+      lastTsc_ = 0;
+   }
+
    // return the next tsc only, without validating if the message is complete
    // for quickly determining the next buffer to look at
-   uint64_t nextTsc() const {
+   uint64_t nextTsc() {
+      if ( commit_ != nullptr ) {
+         if ( sequence_ != nullptr && lapped() ) {
+            resync();
+            return 0;
+         }
+         // there is no message yet at the commit offset. compare with it before
+         // wrapping, the writer has not necessarily completed a message at the
+         // start of the ring buffer when it marked the end with an all-one tsc
+         // the writer publishes the start of the ring buffer before it counts
+         // a wrap, so at the start the commit offset may be that of the next
+         // lap, the whole current lap being complete
+         const unsigned char * committed = this->committed();
+         if ( cur_ == committed &&
+              !( cur_ == start_ && sequence_ != nullptr &&
+                 __atomic_load_n( &sequence_->wraps, __ATOMIC_ACQUIRE ) > gen_ ) ) {
+            return 0;
+         }
+         if ( cur_ >= end_ ) {
+            // the last message went into the trailer, and the writer wrapped
+            wrapped();
+         }
+      }
       // read the tsc from the current position
-      uint64_t tsc;
-      LOAD_TSC( tsc, cur_ );
+      uint64_t tsc = loadTsc( cur_ );
+      if ( tsc == UINT64_MAX && cur_ != start_ ) {
+         // the writer wrapped before reaching the end of the ring buffer, as
+         // the next message would not have fit in the trailer
+         wrapped();
+         tsc = loadTsc( cur_ );
+      }
       if ( cur_ == start_ && tsc < lastTsc_ ) {
          // ignore timestamp being less than last when at the beginning of a ring
          // buffer, because qttail could have gone there after a corruption, but
@@ -526,6 +1175,43 @@ public:
       return tsc;
    }
 
+   // whether the writer has overwritten the current message: it wrapped
+   // twice since it wrote it, or it wrapped once and then committed
+   // messages up to it, the zero tsc after them replacing its tsc. a commit
+   // offset at the start of the ring buffer may be that of the lap after the
+   // one counted, see dropIfPassed() for the messages being written
+   bool lapped() const {
+      uint32_t commit;
+      uint64_t wraps = position( commit );
+      return wraps > gen_ + 1 ||
+             ( wraps > gen_ && commit > sizeof( uint32_t ) &&
+               start_ - sizeof( uint32_t ) + commit >= cur_ );
+   }
+
+   // follow the writer to the start of the ring buffer
+   void wrapped() {
+      gen_++;
+      lapCommit_ = 0;
+      bytesBase_ += cur_ - start_;
+      cur_ = start_;
+      consumed();
+   }
+
+   // the messages and bytes the writer had overwritten before the first
+   // message, after rewind()
+   std::pair< uint64_t, uint64_t > overwritten() const {
+      return std::make_pair( seq_, bytesBase_ + ( cur_ - start_ ) );
+   }
+
+   bool hasSequence() const {
+      return sequence_ != nullptr;
+   }
+
+   // a message can not extend beyond the trailer
+   const unsigned char * bufferEnd() const {
+      return end_ + 256;
+   }
+
    bool isValidTsc( uint64_t tsc, uint64_t curTsc ) const {
       // the tsc can not go backwards or into the future. if the tsc is less than the
       // tsc of the last message, or larger than the current tsc from the CPU, then
@@ -545,12 +1231,198 @@ private:
    const unsigned char * end_; // one past the end of usable area in ring buffer
    const unsigned char * cur_; // current position in ring buffer
    uint64_t lastTsc_; // timestamp of last message from this ring buffer
+   unsigned tagSize_; // size of the thread tag in each message (shared rings)
+   unsigned paramOffset_; // offset of the parameter data in each message
+   int extendedLength_; // message length from which it takes more than a byte
+   // header of the file when each message carries the id of its CPU
+   const QuickTrace::TraceFileHeader * cpuIdHdr_;
+   // commit offset of the ring buffer, when the writer publishes it
+   const uint32_t * commit_;
+   // how much the writer wrote to the ring buffer, when it keeps count
+   const QuickTrace::RingSequence * sequence_;
+   uint64_t gen_; // times the writer wrapped before writing the current message
+   uint64_t seq_; // messages the writer committed before the current message
+   uint64_t bytesBase_; // bytes the writer committed before wrapping for the
+                        // gen_'th time
+   uint32_t lapCommit_; // commit offset last seen in the lap after gen_'s
+   uint64_t lostRecords_; // messages lost since takeLost()
+   uint64_t lostBytes_; // bytes lost since takeLost()
+   // consumer registration of the ring buffer, in the writable mapping of
+   // the file header, with --lossless
+   QuickTrace::RingReader * reader_;
+   uint64_t droppedSeen_; // RingReader::dropped as of takeDropped()
    static uint64_t lastPrintedTsc_; // timestamp of last printed message across
                                     // all ring buffers
 };
 
 uint64_t RingBuffer::lastPrintedTsc_ = 0;
 
+// a rotated trace file gzipped by QuickTrace (see
+// QuickTrace::setRotatedFileCompression) or by hand, is inflated into a memfd,
+// which is then read like the file itself. returns the memfd and its size.
+static bool
+isGzipped( const void * data, off_t size ) {
+   auto bytes = static_cast< const unsigned char * >( data );
+   return size >= 2 && bytes[ 0 ] == 0x1f && bytes[ 1 ] == 0x8b;
+}
+
+static int
+inflateFile( const void * data, off_t size, const std::string & filename,
+             off_t * imageSize ) {
+   int fd = memfd_create( "qttail-inflated", MFD_CLOEXEC );
+   if ( fd < 0 ) {
+      pabort( "memfd_create" );
+   }
+   z_stream zs = {};
+   // 32 lets zlib detect the gzip header
+   if ( inflateInit2( &zs, 15 + 32 ) != Z_OK ) {
+      pabort( "inflateInit2" );
+   }
+   zs.next_in = static_cast< Bytef * >( const_cast< void * >( data ) );
+   zs.avail_in = size;
+   std::vector< unsigned char > buf( 1024 * 1024 );
+   *imageSize = 0;
+   int ret = Z_OK;
+   while ( ret != Z_STREAM_END || zs.avail_in > 0 ) {
+      if ( ret == Z_STREAM_END ) {
+         // gzip allows several members one after the other
+         inflateReset( &zs );
+      }
+      zs.next_out = buf.data();
+      zs.avail_out = buf.size();
+      ret = inflate( &zs, Z_NO_FLUSH );
+      if ( ret != Z_OK && ret != Z_STREAM_END ) {
+         std::cerr << filename << " could not be decompressed"
+                   << ( zs.msg ? std::string( ": " ) + zs.msg : "" )
+                   << std::endl;
+         exit( EXIT_FAILURE );
+      }
+      size_t n = buf.size() - zs.avail_out;
+      if ( write( fd, buf.data(), n ) != ( ssize_t )n ) {
+         pabort( "write(inflated image)" );
+      }
+      *imageSize += n;
+      if ( ret == Z_OK && n == 0 && zs.avail_in == 0 ) {
+         std::cerr << filename << " is truncated" << std::endl;
+         exit( EXIT_FAILURE );
+      }
+   }
+   inflateEnd( &zs );
+   return fd;
+}
+
+// an incremental forever log archive (see QuickTrace::setIncrementalForeverLog)
+// or a segment of a streaming log (see QuickTrace::setStreamingLog), replayed
+// through an image of the file it was taken from. the image holds the last
+// archived TraceFileHeader and all of the message descriptors, and Tail copies
+// the archived rings, or records, of a level into it one after the other.
+class Archive {
+public:
+   Archive( const unsigned char * data, size_t mapped, size_t size,
+            const std::string & filename ) {
+      data_ = data;
+      mapped_ = mapped;
+      const QuickTrace::TraceFileHeader * hdr = nullptr;
+      size_t hdrSize = 0;
+      std::vector< const QuickTrace::ArchiveChunkHeader * > dictionary;
+      size_t dictionarySize = 0;
+      size_t pos = sizeof( QuickTrace::ArchiveMagic );
+      while ( pos + sizeof( QuickTrace::ArchiveChunkHeader ) <= size ) {
+         using ChunkHeader = QuickTrace::ArchiveChunkHeader;
+         auto chunk = reinterpret_cast< const ChunkHeader * >( data + pos );
+         pos += sizeof( *chunk );
+         if ( chunk->size > size - pos ) {
+            // the writer did not get to finish the chunk
+            break;
+         }
+         switch ( chunk->type ) {
+          case QuickTrace::ArchiveChunkFileHeader:
+            // followed by the TSC offsets of the CPUs, if the file has them
+            if ( chunk->size >= sizeof( QuickTrace::TraceFileHeader ) ) {
+               hdr = reinterpret_cast< const QuickTrace::TraceFileHeader * >(
+                     data + pos );
+               hdrSize = chunk->size;
+            }
+            break;
+          case QuickTrace::ArchiveChunkDictionary:
+            dictionary.push_back( chunk );
+            dictionarySize += chunk->size;
+            break;
+          case QuickTrace::ArchiveChunkRecords:
+            if ( chunk->level < QuickTrace::TraceFile::NumTraceLevels ) {
+               levels_[ chunk->level ].push_back( chunk );
+            }
+            break;
+         }
+         pos += chunk->size;
+      }
+      if ( hdr == nullptr ) {
+         std::cerr << filename << " is an archive without a file header"
+                   << std::endl;
+         exit( EXIT_FAILURE );
+      }
+      // the rings of the image start out empty, zeroed by ftruncate
+      fd_ = memfd_create( "qttail-archive", MFD_CLOEXEC );
+      if ( fd_ < 0 ) {
+         pabort( "memfd_create" );
+      }
+      off_t dictionaryStart = hdr->fileSize + hdr->fileTrailerSize;
+      imageSize_ = dictionaryStart + dictionarySize;
+      if ( ftruncate( fd_, imageSize_ ) != 0 ||
+           pwrite( fd_, hdr, hdrSize, 0 ) != ( ssize_t )hdrSize ) {
+         pabort( "archive image" );
+      }
+      for ( const QuickTrace::ArchiveChunkHeader * chunk : dictionary ) {
+         if ( pwrite( fd_, chunk + 1, chunk->size, dictionaryStart ) !=
+              ( ssize_t )chunk->size ) {
+            pabort( "archive image" );
+         }
+         dictionaryStart += chunk->size;
+      }
+      void * m = mmap( 0, imageSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0 );
+      if ( m == MAP_FAILED ) {
+         pabort( "mmap(archive image)" );
+      }
+      image_ = static_cast< unsigned char * >( m );
+   }
+
+   ~Archive() {
+      munmap( const_cast< unsigned char * >( data_ ), mapped_ );
+   }
+
+   // the image and its file descriptor, which the Tail takes over
+   unsigned char * image() const {
+      return image_;
+   }
+
+   off_t imageSize() const {
+      return imageSize_;
+   }
+
+   int fd() const {
+      return fd_;
+   }
+
+   // the next archived copy of the ring buffer of a level, nullptr when there
+   // are no more
+   const QuickTrace::ArchiveChunkHeader * nextLevel( unsigned level ) {
+      if ( next_[ level ] >= levels_[ level ].size() ) {
+         return nullptr;
+      }
+      return levels_[ level ][ next_[ level ]++ ];
+   }
+
+private:
+   const unsigned char * data_; // the archive file
+   size_t mapped_;
+   int fd_; // the image
+   unsigned char * image_;
+   off_t imageSize_;
+   std::array< std::vector< const QuickTrace::ArchiveChunkHeader * >,
+               QuickTrace::TraceFile::NumTraceLevels > levels_;
+   std::array< size_t, QuickTrace::TraceFile::NumTraceLevels > next_ = {};
+};
+
 // tails a single file
 class Tail {
 public:
@@ -612,20 +1484,25 @@ public:
       qtname_ = filename_;
       qtname_.erase( 0, qtname_.rfind( '/' ) + 1 );
       status_ = REINIT_READY;
+      clockSource_ = QuickTrace::ClockSourceTsc;
       initialize( true, skipToEnd );
    }
 
    Tail( Tail && rhs ) :
          fd_( rhs.fd_ ), filename_( std::move( rhs.filename_ ) ),
          msgs_( std::move( rhs.msgs_ ) ), options_( rhs.options_ ),
+         skipToEnd_( rhs.skipToEnd_ ), openEvent_( std::move( rhs.openEvent_ ) ),
          next_( rhs.next_ ), qtname_( std::move( rhs.qtname_ ) ), rbs_( rhs.rbs_ ),
          size_( rhs.size_ ), status_( rhs.status_ ), tfh_( rhs.tfh_ ),
-         tsc1_( rhs.tsc1_ ), tsf_( rhs.tsf_ ) {
+         tsc1_( rhs.tsc1_ ), tsf_( rhs.tsf_ ), clockSource_( rhs.clockSource_ ),
+         archive_( std::move( rhs.archive_ ) ), readers_( rhs.readers_ ) {
       rhs.fd_ = -1;
       rhs.tfh_ = nullptr;
+      rhs.readers_ = nullptr;
    }
 
    ~Tail() {
+      unregisterReaders();
       if ( tfh_ != nullptr ) {
          munmap( const_cast< QuickTrace::TraceFileHeader * >( tfh_ ), size_ );
       }
@@ -635,6 +1512,7 @@ public:
    }
 
    void cleanup() {
+      unregisterReaders();
       if ( tfh_ != nullptr ) {
          if ( munmap( const_cast< QuickTrace::TraceFileHeader * >( tfh_ ),
                       size_ ) != 0 ) {
@@ -650,6 +1528,8 @@ public:
 
    bool initialize( bool initial, bool skipToEnd ) {
       statusIs( INITIALIZING );
+      // kept for when the file is not initialized yet, see nextTsc()
+      skipToEnd_ = skipToEnd;
       if ( fd_ < 0 ) {
          fd_ = open( filename_.c_str(), O_RDONLY );
          if ( fd_ < 0 ) {
@@ -666,19 +1546,66 @@ public:
             std::cerr << "Empty file not supported by qttail" << std::endl;
             exit( EXIT_FAILURE );
          }
+         off_t fileSize = size_;
          size_ += 128 * 1024;
          const void * m = mmap( 0, size_, PROT_READ, MAP_SHARED, fd_, 0 );
          if ( m == MAP_FAILED ) {
             pabort( ( "mmap(" + filename_ + ")" ).c_str() );
          }
+         if ( isGzipped( m, fileSize ) ) {
+            if ( ( options_ & Options::TAIL ) != 0 ) {
+               std::cerr << filename_ << " is compressed, use -c to print it"
+                         << std::endl;
+               exit( EXIT_FAILURE );
+            }
+            // read the decompressed file instead
+            int fd = inflateFile( m, fileSize, filename_, &fileSize );
+            munmap( const_cast< void * >( m ), size_ );
+            ::close( fd_ );
+            fd_ = fd;
+            size_ = fileSize;
+            if ( size_ == 0 ) {
+               std::cerr << "Empty file not supported by qttail" << std::endl;
+               exit( EXIT_FAILURE );
+            }
+            m = mmap( 0, size_, PROT_READ, MAP_SHARED, fd_, 0 );
+            if ( m == MAP_FAILED ) {
+               pabort( "mmap(inflated image)" );
+            }
+         }
+         if ( fileSize >= ( off_t )sizeof( QuickTrace::ArchiveMagic ) &&
+              memcmp( m, QuickTrace::ArchiveMagic,
+                      sizeof( QuickTrace::ArchiveMagic ) ) == 0 ) {
+            if ( ( options_ & Options::TAIL ) != 0 ) {
+               std::cerr << filename_ << " is an archive, use -c to print it"
+                         << std::endl;
+               exit( EXIT_FAILURE );
+            }
+            // read the archive through an image of the file instead
+            archive_ = std::make_unique< Archive >(
+                  static_cast< const unsigned char * >( m ), size_, fileSize,
+                  filename_ );
+            ::close( fd_ );
+            fd_ = archive_->fd();
+            size_ = archive_->imageSize();
+            m = archive_->image();
+         }
          tfh_ = static_cast< const QuickTrace::TraceFileHeader * >( m );
          if ( ( options_ & Options::PRINT_QT_FILE_EVENTS ) != 0 ) {
-            std::cerr << "--- " << ( initial ? "" : "re-" ) << "opened " << filename_
-                      << std::endl;
+            // reported once the header can be read
+            openEvent_ = initial ? "opened" : "re-opened";
          }
       }
-      // wait for qt file to be fully initialized
-      if ( tfh_->monotime1 - tfh_->monotime0 < 0.1 ) {
+      // wait for qt file to be fully initialized. From version 6 on the
+      // writer fills in a provisional second calibration sample right
+      // away, see TraceFileFlagCalibrated, and monotime1 comes last.
+      if ( tfh_->version >= 6 ) {
+         double monotime1;
+         __atomic_load( &tfh_->monotime1, &monotime1, __ATOMIC_ACQUIRE );
+         if ( monotime1 == 0 ) {
+            return false;
+         }
+      } else if ( tfh_->monotime1 - tfh_->monotime0 < 0.1 ) {
          return false;
       }
       // check the file version version after ensuring that the qt file is fully
@@ -705,9 +1632,28 @@ public:
       assert( QuickTrace::TraceFile::NumTraceLevels >= tfh_->logCount );
       const unsigned char * logStart =
             reinterpret_cast< const unsigned char * >( tfh_ ) + tfh_->fileHeaderSize;
+      uint32_t flags = tfh_->version >= 6 ? tfh_->flags : 0;
+      clockSource_ = ( flags & QuickTrace::TraceFileFlagClockSource ) ?
+                     tfh_->clockSource : QuickTrace::ClockSourceTsc;
+      unsigned tagSize =
+            ( flags & QuickTrace::TraceFileFlagSharedRing ) ? sizeof( uint16_t ) : 0;
+      // before version 6 the length of a message was always a single byte
+      int extendedLength = tfh_->version >= 6 ? QuickTrace::ExtendedRecordLength :
+                                                INT_MAX;
+      // the CPU id comes right after the message id
+      bool cpuId = flags & QuickTrace::TraceFileFlagCpuId;
+      unsigned paramOffset = cpuId ? 12 + sizeof( uint16_t ) : 12;
+      // the commit offsets of an archive are those of the file when the header
+      // was archived, not those of the archived ring buffers
+      bool commit = ( flags & QuickTrace::TraceFileFlagCommitOffsets ) && !archive_;
+      bool sequence = commit && ( flags & QuickTrace::TraceFileFlagRingSequences );
       for ( unsigned i = 0; i < tfh_->logCount; ++i ) {
          unsigned logSize = tfh_->logSizes.sz[ i ] * 1024;
-         rbs_[ i ] = RingBuffer( i, logStart, logStart + logSize );
+         rbs_[ i ] = RingBuffer( i, logStart, logStart + logSize, tagSize,
+                                 paramOffset, extendedLength,
+                                 cpuId ? tfh_ : nullptr,
+                                 commit ? &tfh_->commitOffsets[ i ] : nullptr,
+                                 sequence ? &tfh_->ringSequences[ i ] : nullptr );
          logStart += logSize;
       }
       if ( skipToEnd ) {
@@ -725,9 +1671,29 @@ public:
                  errno = 0;
                  pexit( "File changed while reading, try again" );
               }
+              if ( ( options_ & Options::PRINT_LOST ) != 0 &&
+                   rbs_[ i ].hasSequence() ) {
+                 auto overwritten = rbs_[ i ].overwritten();
+                 printLost( i, overwritten.first, overwritten.second );
+              }
             }
          }
       }
+      if ( ( options_ & Options::LOSSLESS ) != 0 && sequence &&
+           ( flags & QuickTrace::TraceFileFlagRingReaders ) ) {
+         registerReaders();
+      }
+      if ( !openEvent_.empty() ) {
+         std::cerr << "--- " << openEvent_ << ' ' << filename_;
+         if ( tfh_->version >= 6 &&
+              !( __atomic_load_n( &tfh_->flags, __ATOMIC_ACQUIRE ) &
+                 QuickTrace::TraceFileFlagCalibrated ) ) {
+            // the writer is still calibrating, or went away before it was done
+            std::cerr << " (provisionally calibrated)";
+         }
+         std::cerr << std::endl;
+         openEvent_.clear();
+      }
       // initialize formatter
       tsc1_ = tfh_->tsc1;
       tsf_.initialize( *tfh_ );
@@ -739,7 +1705,7 @@ public:
       if ( next_.second >= 0 ) {
          return next_;
       }
-      if ( status_ == INITIALIZING && !initialize( false, false ) ) {
+      if ( status_ == INITIALIZING && !initialize( false, skipToEnd_ ) ) {
          // already opened and memory-mapped the file. Just waiting for monotime
          // to become usable, which is still not the case.
          // Therefore return next_ which atm means 'no message available'
@@ -760,7 +1726,7 @@ public:
          next_ = std::make_pair( UINT64_MAX, -1 );
          for ( unsigned i = 0; i < tfh_->logCount; i++ ) {
             if ( levelEnabled( i ) ) {
-               uint64_t tsc = rbs_[ i ].nextTsc();
+               uint64_t tsc = levelTsc( i );
                if ( tsc != 0 && tsc < next_.first ) {
                   // found a candidate
                   next_.first = tsc;
@@ -783,9 +1749,10 @@ public:
          if ( status_ == DELETE_PENDING || status_ == REINIT_PENDING ||
               status_ == REINIT_READY ) {
             cleanup();
-         } else if ( tsc1_ != tfh_->tsc1 ) {
+         } else if ( tsc1_ != tfh_->tsc1 || tsf_.calibrationChanged( *tfh_ ) ) {
             // re-initialize timestamp formatter as the timestamps in the header
-            // have been updated after a buffer has wrapped
+            // have been updated after a buffer has wrapped, or a calibration
+            // point has been added
             tsc1_ = tfh_->tsc1;
             tsf_.initialize( *tfh_ );
          }
@@ -797,6 +1764,23 @@ public:
       return status_;
    }
 
+   QuickTrace::ClockSource clockSource() const {
+      return clockSource_;
+   }
+
+   // a timestamp later than any complete message, from the clock the file's
+   // timestamps come from. a coarse clock may not have ticked since the last
+   // message was written, hence the + 1.
+   uint64_t now() const {
+      return QuickTrace::readClock( clockSource_ ) + 1;
+   }
+
+   // timestamp in nanoseconds since the epoch, to order the messages of
+   // files with different clock sources
+   uint64_t nanoseconds( uint64_t tsc ) const {
+      return tsf_.nanoseconds( tsc );
+   }
+
    void statusIs( Status status ) {
       if ( status != status_ ) {
          switch ( status ) {
@@ -846,6 +1830,43 @@ public:
       }
    }
 
+   // identifies the next message of ring buffer bufNum, and the copies of it
+   // in other snapshots of the same file, by the file's tsc0 and fileId, the
+   // level, the offset of the message in the ring buffer and its bytes. empty
+   // if the message can not be decoded
+   std::string recordKey( int bufNum ) {
+      std::string_view record;
+      try {
+         record = rbs_[ bufNum ].record( msgs_, options_ );
+      } catch ( const CorruptionError & ) {
+         // left to tailBuffer() to report
+      }
+      if ( record.empty() ) {
+         return {};
+      }
+      std::string key( reinterpret_cast< const char * >( &tfh_->tsc0 ),
+                       sizeof( tfh_->tsc0 ) );
+      if ( tfh_->flags & QuickTrace::TraceFileFlagFileId ) {
+         key.append( reinterpret_cast< const char * >( &tfh_->fileId ),
+                     sizeof( tfh_->fileId ) );
+      }
+      key += static_cast< char >( bufNum );
+      uint32_t offset = rbs_[ bufNum ].offset();
+      key.append( reinterpret_cast< const char * >( &offset ), sizeof( offset ) );
+      key += record;
+      return key;
+   }
+
+   // skip the next message of ring buffer bufNum, return false if it can not
+   // be decoded
+   bool skipBuffer( int bufNum ) {
+      if ( !rbs_[ bufNum ].skip( msgs_, options_ ) ) {
+         return false;
+      }
+      next_ = std::make_pair( UINT64_MAX, -1 );
+      return true;
+   }
+
    bool tailBuffer( uint64_t tsc, uint64_t curTsc, int bufNum ) {
       // dump next message available in ring buffer bufNum
       // return true if a message has been consumed, or false if it as not been
@@ -871,6 +1892,7 @@ public:
          if ( ( options_ & Options::TAIL ) != 0 ) {
             // when tailing mode, go back to the start of the buffer
             if ( rbs_[ bufNum ].reset() ) {
+               reportLost( bufNum );
                std::cout << "---------- resetting log buffer " << bufNum << " of "
                          << qtname_ << " due to corruption - potential message loss"
                          << std::endl;
@@ -885,6 +1907,107 @@ public:
    }
 
 private:
+   // the tsc of the next message of a level, 0 if there is none. the messages
+   // of an archive come from the archived records of the level, one chunk
+   // after the other
+   uint64_t levelTsc( unsigned level ) {
+      uint64_t tsc = rbs_[ level ].nextTsc();
+      reportLost( level );
+      if ( archive_ ) {
+         while ( tsc == 0 ) {
+            if ( !loadArchivedLevel( level ) ) {
+               return 0;
+            }
+            tsc = rbs_[ level ].nextTsc();
+         }
+      }
+      return tsc;
+   }
+
+   // copy the next archived records of a level into the image
+   bool loadArchivedLevel( unsigned level ) {
+      unsigned char * ring = archive_->image() + tfh_->fileHeaderSize;
+      for ( unsigned i = 0; i < level; i++ ) {
+         ring += tfh_->logSizes.sz[ i ] * 1024;
+      }
+      uint32_t ringSize = tfh_->logSizes.sz[ level ] * 1024;
+      while ( const QuickTrace::ArchiveChunkHeader * chunk =
+                    archive_->nextLevel( level ) ) {
+         RingBuffer & rb = rbs_[ level ];
+         // the records go to the start of a ring buffer that never
+         // wrapped, followed by a zero tsc. they came from a ring buffer
+         // of the same size, so they fit
+         if ( chunk->size + sizeof( uint32_t ) + sizeof( uint64_t ) > ringSize ) {
+            continue;
+         }
+         memset( ring, 0, sizeof( uint32_t ) );
+         memcpy( ring + sizeof( uint32_t ), chunk + 1, chunk->size );
+         memset( ring + sizeof( uint32_t ) + chunk->size, 0, sizeof( uint64_t ) );
+         rb.restart();
+         if ( !rb.rewind( msgs_, options_ ) ) {
+            continue;
+         }
+         return true;
+      }
+      return false;
+   }
+
+   void printLost( unsigned level, uint64_t records, uint64_t bytes ) {
+      if ( records != 0 ) {
+         std::cout << "--- " << records << " messages (" << bytes
+                   << " bytes) lost on level " << level << " of " << qtname_
+                   << std::endl;
+      }
+   }
+
+   // report the messages of a level that the writer overwrote before they
+   // could be printed, when it keeps count of them
+   void reportLost( unsigned level ) {
+      uint64_t records, bytes;
+      if ( rbs_[ level ].takeLost( records, bytes ) ) {
+         printLost( level, records, bytes );
+      }
+      uint64_t dropped = rbs_[ level ].takeDropped();
+      if ( dropped != 0 ) {
+         std::cout << "--- " << dropped << " messages dropped on level " << level
+                   << " of " << qtname_ << std::endl;
+      }
+   }
+
+   // register as the consumer of the levels to print, see
+   // QuickTrace::RingReader, through a writable mapping of the file header
+   void registerReaders() {
+      unregisterReaders();
+      int fd = open( filename_.c_str(), O_RDWR );
+      void * m = fd < 0 ? MAP_FAILED :
+                 mmap( 0, sizeof( QuickTrace::TraceFileHeader ),
+                       PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+      if ( m == MAP_FAILED ) {
+         std::cerr << "--- can not register as the consumer of " << qtname_
+                   << ": " << strerror( errno ) << std::endl;
+      } else {
+         readers_ = static_cast< QuickTrace::TraceFileHeader * >( m );
+         for ( unsigned i = 0; i < tfh_->logCount; i++ ) {
+            if ( levelEnabled( i ) ) {
+               rbs_[ i ].readerIs( &readers_->ringReaders[ i ] );
+            }
+         }
+      }
+      if ( fd >= 0 ) {
+         ::close( fd );
+      }
+   }
+
+   void unregisterReaders() {
+      if ( readers_ != nullptr ) {
+         for ( auto & rb : rbs_ ) {
+            rb.unregister();
+         }
+         munmap( readers_, sizeof( QuickTrace::TraceFileHeader ) );
+         readers_ = nullptr;
+      }
+   }
+
    inline bool levelEnabled( unsigned level ) const {
       return ( options_ & Options::CHECK_LEVEL ) == 0 ||
              ( options_ & ( 1 << level ) ) != 0;
@@ -894,6 +2017,8 @@ private:
    std::string filename_; // full file name as passed from the command line
    Messages msgs_;
    int options_;
+   bool skipToEnd_; // skip the messages already in the file once initialized
+   std::string openEvent_; // file event to print once the file is initialized
    std::pair< uint64_t, int > next_;
    std::string qtname_; // short file name (without path)
    std::array<RingBuffer, QuickTrace::TraceFile::NumTraceLevels> rbs_;
@@ -902,6 +2027,10 @@ private:
    const QuickTrace::TraceFileHeader * tfh_;
    uint64_t tsc1_;
    TimestampFormatter tsf_;
+   QuickTrace::ClockSource clockSource_;
+   std::unique_ptr< Archive > archive_; // when the file is an archive
+   // writable mapping of the file header, with --lossless
+   QuickTrace::TraceFileHeader * readers_ = nullptr;
 };
 
 // Watches a directory for modifications and maintains a list of tailed qt files
@@ -1014,6 +2143,9 @@ private:
       Tail & file = *files_.begin();
       while ( file.tail( UINT64_MAX ) ) {}
       std::cout << std::flush;
+      if ( pcapWriter != nullptr ) {
+         pcapWriter->flush();
+      }
    }
 
    void catMany() {
@@ -1023,7 +2155,10 @@ private:
          Tail * tail = file->second.tail;
          uint64_t tsc = file->first.tsc;
          int bufNum = file->second.bufNum;
-         tail->tailBuffer( tsc, UINT64_MAX, bufNum );
+         if ( ( options_ & Options::UNIQUE ) == 0 ||
+              !isDuplicate( *tail, tsc, bufNum ) || !tail->skipBuffer( bufNum ) ) {
+            tail->tailBuffer( tsc, UINT64_MAX, bufNum );
+         }
          std::tie( tsc, bufNum ) = tail->nextTsc( UINT64_MAX );
          if ( bufNum < 0 ) {
             // all messages from this file have been dumped,
@@ -1036,31 +2171,74 @@ private:
                uint64_t nextFileTsc;
                std::tie( nextFileTsc, std::ignore ) =
                      nextFile->second.tail->nextTsc( UINT64_MAX );
-               if ( nextFileTsc < tsc ) {
+               uint64_t order = orderKey( *tail, tsc );
+               if ( orderKey( *nextFile->second.tail, nextFileTsc ) < order ) {
                   // the next file in line has a tsc that is before the current file
                   // therefore dequeue the current file and re-queue it
-                  QueueKey key( tsc, file->first.fileNum );
+                  QueueKey key( order, tsc, file->first.fileNum );
                   QueueEntry entry( tail, bufNum );
                   fileQueue_.erase( file );
                   fileQueue_.insert( std::make_pair( key, entry ) );
                } else {
                   // update the tsc in the key. does not change order, but correct
                   // tsc is needed for subsequent dump
+                  const_cast< QueueKey & >( file->first ).order = order;
                   const_cast< QueueKey & >( file->first ).tsc = tsc;
                   file->second.bufNum = bufNum;
                }
             } else {
                // update the tsc in the key. does not change order, but correct
                // tsc is needed for subsequent dump
-               const_cast< QueueKey & >( file->first ).tsc = tsc;
+               QueueKey & key = const_cast< QueueKey & >( file->first );
+               key.order = orderKey( *tail, tsc );
+               key.tsc = tsc;
                file->second.bufNum = bufNum;
             }
          }
       }
       std::cout << std::flush;
+      if ( pcapWriter != nullptr ) {
+         pcapWriter->flush();
+      }
+   }
+
+   // whether the next message of ring buffer bufNum of the file is a copy of one
+   // that has already been printed, from another snapshot of the same file. all
+   // the copies of a message have the same tsc, so they are merged one after the
+   // other, and only the messages with the current tsc need to be remembered.
+   // a message is a copy if no more of the same key have been seen in this
+   // snapshot than were printed, so that messages that can not be told apart
+   // are printed as many times as the snapshot holding the most of them has.
+   bool isDuplicate( Tail & tail, uint64_t tsc, int bufNum ) {
+      if ( tsc != uniqueTsc_ ) {
+         uniqueTsc_ = tsc;
+         uniquePrinted_.clear();
+         uniqueSeen_.clear();
+      }
+      std::string key = tail.recordKey( bufNum );
+      if ( key.empty() ) {
+         return false;
+      }
+      uint32_t & printed = uniquePrinted_[ key ];
+      uint32_t seen = ++uniqueSeen_[ std::make_pair( &tail, std::move( key ) ) ];
+      if ( seen <= printed ) {
+         return true;
+      }
+      printed = seen;
+      return false;
+   }
+
+   // the timestamps of files with the same clock source compare as they are,
+   // otherwise they are converted to nanoseconds first
+   uint64_t orderKey( const Tail & tail, uint64_t tsc ) const {
+      return mixedClocks_ ? tail.nanoseconds( tsc ) : tsc;
    }
 
    void populateQueue() {
+      mixedClocks_ = false;
+      for ( const Tail & file : files_ ) {
+         mixedClocks_ |= file.clockSource() != files_.front().clockSource();
+      }
       uint32_t fileNum = 0;
       for ( auto end = files_.end(), file = files_.begin(); file != end; ) {
          uint64_t tsc;
@@ -1070,7 +2248,7 @@ private:
             // file is empty
             file = files_.erase( file );
          } else {
-            QueueKey key( tsc, fileNum++ );
+            QueueKey key( orderKey( *file, tsc ), tsc, fileNum++ );
             QueueEntry entry( &*file, bufNum );
             fileQueue_.insert( std::make_pair( key, entry ) );
             ++file;
@@ -1079,15 +2257,16 @@ private:
    }
 
    struct QueueKey {
+      uint64_t order; // see orderKey()
       uint64_t tsc;
       uint32_t fileNum;
 
-      QueueKey( uint64_t tsc, uint32_t fileNum ) :
-         tsc( tsc ), fileNum( fileNum ) {}
+      QueueKey( uint64_t order, uint64_t tsc, uint32_t fileNum ) :
+         order( order ), tsc( tsc ), fileNum( fileNum ) {}
 
       bool operator<( const QueueKey & rhs ) const {
-         if ( tsc != rhs.tsc ) {
-            return tsc < rhs.tsc;
+         if ( order != rhs.order ) {
+            return order < rhs.order;
          } else {
             return fileNum < rhs.fileNum;
          }
@@ -1103,6 +2282,12 @@ private:
    };
 
    std::map< QueueKey, QueueEntry > fileQueue_; // ordered file queue
+   // how many of the messages with tsc uniqueTsc_ were printed, and seen in
+   // each file, by key, see isDuplicate()
+   uint64_t uniqueTsc_ = 0;
+   std::unordered_map< std::string, uint32_t > uniquePrinted_;
+   std::map< std::pair< const Tail *, std::string >, uint32_t > uniqueSeen_;
+   bool mixedClocks_; // whether the files have different clock sources
    int nFiles_; // number of files to tail
    int options_; // output options
    std::list< Tail > files_; // files to print
@@ -1165,7 +2350,7 @@ private:
    void tailOne() {
       Tail & tail = watches_.begin()->second.tails().begin()->second;
       for ( ;; ) {
-         if ( tail.tail( rdtsc() ) ) {
+         if ( tail.tail( tail.now() ) ) {
             if ( TimestampFormatter::nextSecond_ ) {
                // check files every second at least
                TimestampFormatter::nextSecond_ = false;
@@ -1178,6 +2363,9 @@ private:
             if ( !std::cout ) {
                pexit( "---------- error writing to stdout, aborting" );
             }
+            if ( pcapWriter != nullptr ) {
+               pcapWriter->flush();
+            }
             if ( tail.status() == Tail::DELETE_PENDING ) {
                // file has been deleted and all messages have been emitted
                break;
@@ -1190,20 +2378,41 @@ private:
    void tailMany() {
       for ( ;; ) {
          bool allFilesDeleted = true;
-         uint64_t curTsc = rdtsc();
+         // the timestamps of files with the same clock source compare as they
+         // are, otherwise they are converted to nanoseconds first
+         constexpr int numClockSources = QuickTrace::ClockSourceMonotonicCoarse + 1;
+         std::array< uint64_t, numClockSources > curTscs{};
+         bool mixedClocks = false;
+         int clockSource = -1;
+         for ( auto & watch : watches_ ) {
+            for ( auto & tail : watch.second.tails() ) {
+               QuickTrace::ClockSource c = tail.second.clockSource();
+               mixedClocks |= clockSource >= 0 && ( int )c != clockSource;
+               clockSource = c;
+               if ( curTscs[ c ] == 0 ) {
+                  curTscs[ c ] = tail.second.now();
+               }
+            }
+         }
          Tail * minTail = nullptr;
-         uint64_t minTsc = UINT64_MAX;
+         uint64_t minKey = UINT64_MAX;
+         uint64_t minTsc = 0;
          int minBufNum = -1;
          for ( auto & watch : watches_ ) {
             for ( auto & tail : watch.second.tails() ) {
                uint64_t tsc;
                int bufNum;
-               std::tie( tsc, bufNum ) = tail.second.nextTsc( curTsc );
+               std::tie( tsc, bufNum ) =
+                     tail.second.nextTsc( curTscs[ tail.second.clockSource() ] );
                if ( bufNum < 0 ) {
                   if ( tail.second.status() != Tail::DELETE_PENDING ) {
                      allFilesDeleted = false;
                   }
-               } else if ( tsc < minTsc ) {
+                  continue;
+               }
+               uint64_t key = mixedClocks ? tail.second.nanoseconds( tsc ) : tsc;
+               if ( key < minKey ) {
+                  minKey = key;
                   minTsc = tsc;
                   minTail = &tail.second;
                   minBufNum = bufNum;
@@ -1211,6 +2420,7 @@ private:
             }
          }
          if ( minTail != nullptr ) {
+            uint64_t curTsc = curTscs[ minTail->clockSource() ];
             if ( !minTail->tailBuffer( minTsc, curTsc, minBufNum ) ||
                  TimestampFormatter::nextSecond_ ) {
                // check files when either:
@@ -1227,6 +2437,9 @@ private:
             if ( !std::cout ) {
                pexit( "---------- error writing to stdout, aborting" );
             }
+            if ( pcapWriter != nullptr ) {
+               pcapWriter->flush();
+            }
             if ( allFilesDeleted ) {
                // all files have been deleted and all messages have been emitted
                return;
@@ -1293,10 +2506,26 @@ void usage( const char * msg = nullptr, int ec = EXIT_FAILURE ) {
          << "  -f, --files           print file and line number for trace "
             "statements\n"
          << "  -l, --levels <levels> list of levels to output\n"
+         << "  --lossless            register as the consumer of the levels to "
+            "output, so that\n"
+         << "                        writers with an overrun policy keep the "
+            "messages not\n"
+         << "                        printed yet\n"
+         << "  --lost                also report the messages that had been "
+            "overwritten\n"
+         << "                        before the oldest one of each level\n"
+         << "  -p, --pcap <file>     also write blob arguments to a pcapng file, "
+            "as ethernet\n"
+         << "                        packets commented with their message\n"
          << "  --tsc                 print timestamp counter values\n"
+         << "  -u, --unique          with -c, print the messages found in several "
+            "snapshots\n"
+         << "                        of the same file, such as forever log "
+            "backups, once\n"
          << "  -x                    print quicktrace file events\n"
          << "  -w, --wallClock       print only those messages which have "
             "wall-clock timestamp\n"
+         << "                        (traced with the WCQT macros)\n"
          << std::endl;
    }
    exit( ec );
@@ -1364,15 +2593,22 @@ int main( int argc, char * const * argv ) {
       { "files", no_argument, nullptr, 'f' },
       { "help", no_argument, nullptr, 'h' },
       { "levels", required_argument, nullptr, 'l' },
+      { "lossless", no_argument, nullptr, 0 },
+      { "lost", no_argument, nullptr, 0 },
+      { "pcap", required_argument, nullptr, 'p' },
       { "tsc", no_argument, nullptr, 0 },
+      { "unique", no_argument, nullptr, 'u' },
       { "wallClock", no_argument, nullptr, 'w' },
       { nullptr, 0, nullptr, 0 }
    };
-   static constexpr int tscOption = 4; // index into longOptions
+   // indices into longOptions
+   static constexpr int losslessOption = 4;
+   static constexpr int lostOption = 5;
+   static constexpr int tscOption = 7;
 
    int opt, longOptIdx = 0;
    while ( ( opt = getopt_long(
-                argc, argv, "cdfhl:xw", longOptions, &longOptIdx ) ) >= 0 ) {
+                argc, argv, "cdfhl:p:uxw", longOptions, &longOptIdx ) ) >= 0 ) {
       switch ( opt ) {
        case 0: // a long option
          switch ( longOptIdx ) {
@@ -1381,6 +2617,17 @@ int main( int argc, char * const * argv ) {
                            "incorrect index for option --tsc" );
             options |= Options::PRINT_TSC;
             break;
+          case lostOption: // --lost
+            static_assert( strcmp( longOptions[ lostOption ].name, "lost" ) == 0,
+                           "incorrect index for option --lost" );
+            options |= Options::PRINT_LOST;
+            break;
+          case losslessOption: // --lossless
+            static_assert( strcmp( longOptions[ losslessOption ].name,
+                                   "lossless" ) == 0,
+                           "incorrect index for option --lossless" );
+            options |= Options::LOSSLESS;
+            break;
          }
          break;
        case 'c':
@@ -1398,6 +2645,13 @@ int main( int argc, char * const * argv ) {
        case 'l':
          options |= parseLevels( optarg );
          break;
+       case 'p':
+         delete pcapWriter;
+         pcapWriter = new PcapWriter( optarg );
+         break;
+       case 'u':
+         options |= Options::UNIQUE;
+         break;
        case 'x':
          options |= Options::PRINT_QT_FILE_EVENTS;
          break;
@@ -1425,5 +2679,6 @@ int main( int argc, char * const * argv ) {
       CatControl cc( argv + optind, argc - optind, options );
       cc.cat();
    }
+   delete pcapWriter;
    return EXIT_SUCCESS;
 }
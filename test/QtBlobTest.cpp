@@ -0,0 +1,74 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <QuickTrace/QuickTrace.h>
+
+// Trace blob arguments, including ones much longer than a record length
+// byte allows and ones that make the ring wrap. Run with "shared" to use
+// a shared trace file. QuickTrace file output validated in QtBlobTest.py
+
+char const * outfile = getenv( "QTFILE" ) ?: "QtBlobTest.qt";
+
+int main( int argc, char const ** argv ) {
+   QuickTrace::SizeSpec sizes = { 64, 8, 1, 1, 1, 1, 1, 1, 1, 1 };
+   bool ok;
+   if( argc > 1 && !strcmp( argv[ 1 ], "shared" ) ) {
+      ok = QuickTrace::initializeShared( outfile, &sizes );
+   } else {
+      ok = QuickTrace::initialize( outfile, &sizes );
+   }
+   assert( ok );
+
+   uint8_t small[] = { 0xde, 0xad, 0xbe, 0xef };
+   QTRACE0( "small blob " << QVAR, QuickTrace::blob( small, sizeof( small ) ) );
+   QTRACE0( "empty blob " << QVAR << " after", QuickTrace::blob( small, 0 ) );
+
+   std::vector< uint8_t > packet( 3000 );
+   for( size_t i = 0; i < packet.size(); ++i ) {
+      packet[ i ] = i;
+   }
+   std::span< const std::byte > span = std::as_bytes( std::span( packet ) );
+   QTRACE0( "packet " << QVAR << " len " << QVAR, span << packet.size() );
+
+   // Level 1 only holds a few of these, so they keep wrapping
+   for( int i = 0; i < 100; ++i ) {
+      packet[ 0 ] = i;
+      QTRACE1( "wrap " << QVAR << " " << QVAR,
+               i << QuickTrace::blob( packet.data(), 1500 ) );
+   }
+   // Longer than the ring, so only the part that fits gets traced
+   std::vector< uint8_t > huge( 20000, 0x5a );
+   QTRACE1( "huge " << QVAR, QuickTrace::blob( huge.data(), huge.size() ) );
+   QTRACE1( "after huge", QNULL );
+
+   QuickTrace::close();
+   return 0;
+}
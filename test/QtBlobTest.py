@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+# Copyright (c) 2026, Arista Networks, Inc.
+# All rights reserved.
+
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+
+# 	* Redistributions of source code must retain the above copyright notice,
+#  	  this list of conditions and the following disclaimer.
+# 	* Redistributions in binary form must reproduce the above copyright notice,
+# 	  this list of conditions and the following disclaimer in the documentation
+# 	  and/or other materials provided with the distribution.
+# 	* Neither the name of Arista Networks nor the names of its contributors may
+# 	  be used to endorse or promote products derived from this software without
+# 	  specific prior written permission.
+
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+# PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+# BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+# ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+from __future__ import absolute_import, division, print_function
+import os, re, struct, subprocess, unittest
+
+QTFILE = '/tmp/QtBlobTest.qt'
+packet = bytes( i & 0xff for i in range( 3000 ) )
+
+class QtBlobTest( unittest.TestCase ):
+   def tearDown( self ):
+      os.remove( QTFILE )
+
+   def runTest( self, *args ):
+      subprocess.check_call( [ './QtBlobTest' ] + list( args ),
+                             env={ 'QTFILE': QTFILE } )
+      output = subprocess.check_output( [ '/usr/bin/qttail', '-c', QTFILE ],
+                                        universal_newlines=True )
+      # <date> <time> <level> [t<tag>] +<delta> "<message>"
+      lineRe = re.compile( r'^\S+ \S+ (\d) (?:t\d+ )?\+\d+ "(.*)"$' )
+      messages = { '0': [], '1': [] }
+      for line in output.splitlines(): # pylint: disable=E1103
+         m = lineRe.match( line )
+         self.assertTrue( m, 'unexpected line: %s' % line[ : 200 ] )
+         messages[ m.group( 1 ) ].append( m.group( 2 ) )
+
+      self.assertEqual( messages[ '0' ], [
+         'small blob deadbeef',
+         'empty blob  after',
+         'packet %s len 3000' % packet.hex() ] )
+
+      # the last few wrap messages survive, in order, followed by the huge
+      # one, which got cut down to fit in the 8k ring
+      wraps = messages[ '1' ][ : -2 ]
+      self.assertTrue( wraps )
+      first = int( wraps[ 0 ].split()[ 1 ] )
+      for i, msg in enumerate( wraps, first ):
+         blob = bytes( [ i ] ) + packet[ 1 : 1500 ]
+         self.assertEqual( msg, 'wrap %d %s' % ( i, blob.hex() ) )
+      self.assertEqual( first + len( wraps ), 100 )
+      huge = messages[ '1' ][ -2 ].split()
+      self.assertEqual( huge[ 0 ], 'huge' )
+      self.assertTrue( 1500 * 2 < len( huge[ 1 ] ) < 8 * 1024 * 2 )
+      self.assertEqual( huge[ 1 ], '5a' * ( len( huge[ 1 ] ) // 2 ) )
+      self.assertEqual( messages[ '1' ][ -1 ], 'after huge' )
+
+   def testPcap( self ):
+      subprocess.check_call( [ './QtBlobTest' ], env={ 'QTFILE': QTFILE } )
+      pcapFile = QTFILE + '.pcapng'
+      output = subprocess.check_output( [ '/usr/bin/qttail', '-c', '-l', '0',
+                                          '-p', pcapFile, QTFILE ],
+                                        universal_newlines=True )
+      with open( pcapFile, 'rb' ) as f:
+         data = f.read()
+      os.remove( pcapFile )
+      blocks = []
+      while data:
+         blockType, length = struct.unpack_from( '<II', data )
+         self.assertEqual( struct.unpack_from( '<I', data, length - 4 )[ 0 ],
+                           length )
+         blocks.append( ( blockType, data[ 8 : length - 4 ] ) )
+         data = data[ length : ]
+      # section header, interface description, then a packet for each of the
+      # three blobs in level 0
+      self.assertEqual( [ b[ 0 ] for b in blocks ], [ 0x0a0d0d0a, 1, 6, 6, 6 ] )
+      lines = output.splitlines() # pylint: disable=E1103
+      for ( _, body ), line, pkt in zip( blocks[ 2 : ], lines,
+                                         [ b'\xde\xad\xbe\xef', b'', packet ] ):
+         caplen, origlen = struct.unpack_from( '<II', body, 12 )
+         self.assertEqual( ( caplen, origlen ), ( len( pkt ), len( pkt ) ) )
+         self.assertEqual( body[ 20 : 20 + caplen ], pkt )
+         options = body[ 20 + ( ( caplen + 3 ) & ~3 ) : ]
+         code, length = struct.unpack_from( '<HH', options )
+         self.assertEqual( code, 1 )
+         self.assertEqual( options[ 4 : 4 + length ].decode(), line )
+
+   def testRing( self ):
+      self.runTest()
+
+   def testSharedRing( self ):
+      self.runTest( 'shared' )
+
+if __name__ == '__main__':
+   unittest.main()
@@ -0,0 +1,127 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <QuickTrace/QuickTrace.h>
+
+// Trace a message, add a calibration point as if the wall clock had been
+// stepped forward by an hour, and trace another message. Run with
+// "frequency" to instead trace two messages about 100ms apart and then
+// claim, in the file header, an exact TSC frequency of twice the measured
+// one. The last message holds the microseconds between the two, as the
+// sleep in between may take longer on a loaded machine.
+// QuickTrace file output validated in QtCalibrationTest.py
+
+char const * outfile = getenv( "QTFILE" ) ?: "QtCalibrationTest.qt";
+
+static uint64_t
+monotonicUs() {
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+// Waits, for up to 10s, for the calibration thread to calibrate the file
+static void
+waitForCalibration() {
+   int fd = open( outfile, O_RDONLY );
+   assert( fd >= 0 );
+   void * m = mmap( 0, sizeof( QuickTrace::TraceFileHeader ), PROT_READ,
+                    MAP_SHARED, fd, 0 );
+   assert( m != MAP_FAILED );
+   auto hdr = ( QuickTrace::TraceFileHeader const * )m;
+   uint64_t deadline = monotonicUs() + 10000000;
+   while( !( __atomic_load_n( &hdr->flags, __ATOMIC_ACQUIRE ) &
+             QuickTrace::TraceFileFlagCalibrated ) ) {
+      assert( monotonicUs() < deadline );
+      usleep( 1000 );
+   }
+   munmap( m, sizeof( QuickTrace::TraceFileHeader ) );
+   close( fd );
+}
+
+static void
+steppedWallClock() {
+   struct timeval tv;
+   gettimeofday( &tv, 0 );
+   uint64_t start = monotonicUs();
+   QTRACE0( "before " << QVAR, ( uint64_t )tv.tv_sec );
+   usleep( 10000 );
+
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   gettimeofday( &tv, 0 );
+   QuickTrace::CalibrationPoint stepped = {
+      rdtsc(), ts.tv_sec + ts.tv_nsec / 1e9,
+      tv.tv_sec + tv.tv_usec / 1e6 + 3600 };
+   QuickTrace::defaultQuickTraceFile()->addCalibrationPoint( stepped );
+   QTRACE0( "after " << QVAR, monotonicUs() - start );
+}
+
+static void
+doubleTscFrequency() {
+   int fd = open( outfile, O_RDWR );
+   assert( fd >= 0 );
+   void * m = mmap( 0, sizeof( QuickTrace::TraceFileHeader ),
+                    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+   assert( m != MAP_FAILED );
+   auto hdr = ( QuickTrace::TraceFileHeader * )m;
+   hdr->tscFrequency = 2 * ( hdr->tsc1 - hdr->tsc0 ) /
+                       ( hdr->monotime1 - hdr->monotime0 );
+   hdr->tscFrequencySource = QuickTrace::TscFrequencyHypervisor;
+   hdr->flags |= QuickTrace::TraceFileFlagTscFrequency;
+   munmap( m, sizeof( QuickTrace::TraceFileHeader ) );
+   close( fd );
+}
+
+int main( int argc, char const ** argv ) {
+   bool frequency = argc > 1 && !strcmp( argv[ 1 ], "frequency" );
+   bool ok = QuickTrace::initialize( outfile );
+   assert( ok );
+   waitForCalibration();
+
+   if( frequency ) {
+      uint64_t start = monotonicUs();
+      QTRACE0( "first", QNULL );
+      usleep( 100000 );
+      QTRACE0( "second " << QVAR, monotonicUs() - start );
+   } else {
+      steppedWallClock();
+   }
+
+   QuickTrace::close();
+   if( frequency ) {
+      doubleTscFrequency();
+   }
+   return 0;
+}
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+# Copyright (c) 2026, Arista Networks, Inc.
+# All rights reserved.
+
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+
+# 	* Redistributions of source code must retain the above copyright notice,
+#  	  this list of conditions and the following disclaimer.
+# 	* Redistributions in binary form must reproduce the above copyright notice,
+# 	  this list of conditions and the following disclaimer in the documentation
+# 	  and/or other materials provided with the distribution.
+# 	* Neither the name of Arista Networks nor the names of its contributors may
+# 	  be used to endorse or promote products derived from this software without
+# 	  specific prior written permission.
+
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+# PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+# BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+# ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+from __future__ import absolute_import, division, print_function
+import os, re, subprocess, time, unittest
+
+QTFILE = '/tmp/QtCalibrationTest.qt'
+
+class QtCalibrationTest( unittest.TestCase ):
+   def tearDown( self ):
+      os.remove( QTFILE )
+
+   def runTest( self, *args ):
+      subprocess.check_call( [ './QtCalibrationTest' ] + list( args ),
+                             env={ 'QTFILE': QTFILE } )
+      output = subprocess.check_output( [ '/usr/bin/qttail', '-c', QTFILE ],
+                                        universal_newlines=True )
+      # <date> <time> <level> +<delta> "<message>"
+      lineRe = re.compile( r'^(\S+ \S+) 0 \+\d+ "(.*)"$' )
+      times = []
+      messages = []
+      for line in output.splitlines(): # pylint: disable=E1103
+         m = lineRe.match( line )
+         self.assertTrue( m, 'unexpected line: %s' % line )
+         t = time.mktime( time.strptime( m.group( 1 )[ : 19 ], '%Y-%m-%d %H:%M:%S' ) )
+         times.append( t + float( '0.' + m.group( 1 )[ 20 : ] ) )
+         messages.append( m.group( 2 ) )
+      self.assertEqual( len( messages ), 2 )
+      return times, messages
+
+   def testSteppedWallClock( self ):
+      times, messages = self.runTest()
+      before = messages[ 0 ].split()
+      after = messages[ 1 ].split()
+      self.assertEqual( before[ 0 ], 'before' )
+      self.assertEqual( after[ 0 ], 'after' )
+      # the message before the step keeps its time, the one after it moves
+      # with the wall clock
+      self.assertLess( abs( times[ 0 ] - int( before[ 1 ] ) ), 2 )
+      elapsed = int( after[ 1 ] ) / 1e6
+      self.assertLess( abs( times[ 1 ] - times[ 0 ] - 3600 - elapsed ), 0.005 )
+
+   def testExactFrequency( self ):
+      times, messages = self.runTest( 'frequency' )
+      second = messages[ 1 ].split()
+      self.assertEqual( [ messages[ 0 ], second[ 0 ] ], [ 'first', 'second' ] )
+      # both messages come after the last calibration point, so the time
+      # between them goes by the exact frequency rather than the measured
+      # one, which makes the 100ms look like 50ms
+      elapsed = int( second[ 1 ] ) / 1e6
+      self.assertLess( abs( times[ 1 ] - times[ 0 ] - elapsed / 2 ), 0.01 )
+
+if __name__ == '__main__':
+   unittest.main()
@@ -0,0 +1,106 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+// Measures the cost of a trace with each of the clock sources a
+// TraceHandle can take its timestamps from, along with the cost of just
+// reading each clock. Each clock source gets a trace file of its own,
+// <prefix>-<clock source>.qt.
+//
+// Usage: QtClockSourceBenchmark [iterations]
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <QuickTrace/QuickTrace.h>
+
+char const * prefix = getenv( "QTFILE" ) ?: "QtClockSourceBenchmark";
+
+static double
+nowNs() {
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double
+timeClock( long iterations, QuickTrace::ClockSource source ) {
+   uint64_t sum = 0;
+   double begin = nowNs();
+   for( long i = 0; i < iterations; ++i ) {
+      sum += QuickTrace::readClock( source );
+   }
+   asm volatile( "" :: "r"( sum ) );
+   return ( nowNs() - begin ) / iterations;
+}
+
+static double
+timeTraces( long iterations, QuickTrace::TraceHandle * th ) {
+   double begin = nowNs();
+   for( long i = 0; i < iterations; ++i ) {
+      QTRACE0_F( th, "iteration " << QVAR, i );
+   }
+   return ( nowNs() - begin ) / iterations;
+}
+
+int main( int argc, char const ** argv ) {
+   long iterations = argc > 1 ? atol( argv[ 1 ] ) : 10000000;
+   struct {
+      QuickTrace::ClockSource source;
+      char const * name;
+   } const clocks[] = {
+      { QuickTrace::ClockSourceTsc, "tsc" },
+      { QuickTrace::ClockSourceMonotonicRaw, "monotonic-raw" },
+      { QuickTrace::ClockSourceMonotonicCoarse, "monotonic-coarse" },
+   };
+   printf( "%-18s %12s %12s\n", "clock source", "read ns", "trace ns" );
+   for( auto & clock : clocks ) {
+      std::string filename = std::string( prefix ) + "-" + clock.name + ".qt";
+      QuickTrace::TraceHandle * th = QuickTrace::initialize_handle(
+         filename.c_str(), nullptr, nullptr, 0, QuickTrace::MultiThreading::disabled,
+         clock.source );
+      assert( th->isInitialized() );
+      QuickTrace::TraceFile * tf = th->getFile();
+      assert( tf->clockSource() == clock.source );
+      int fd = open( tf->fileName(), O_RDONLY );
+      assert( fd >= 0 );
+      QuickTrace::TraceFileHeader hdr;
+      ssize_t n = pread( fd, &hdr, sizeof( hdr ), 0 );
+      assert( n == sizeof( hdr ) );
+      assert( hdr.flags & QuickTrace::TraceFileFlagClockSource );
+      assert( hdr.clockSource == clock.source );
+      close( fd );
+
+      double read = timeClock( iterations, clock.source );
+      double trace = timeTraces( iterations, th );
+      printf( "%-18s %12.2f %12.2f\n", clock.name, read, trace );
+      delete th;
+   }
+   return 0;
+}
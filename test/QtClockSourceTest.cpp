@@ -0,0 +1,75 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/time.h>
+#include <unistd.h>
+#include <QuickTrace/QuickTrace.h>
+
+// Trace to a file per clock source, taking turns 10ms apart, each message
+// carrying the wall clock time in milliseconds. The files are
+// <prefix>-<clock source>.qt.
+// QuickTrace file output validated in QtClockSourceTest.py
+
+char const * prefix = getenv( "QTFILE" ) ?: "QtClockSourceTest";
+
+static constexpr int messageCount = 10;
+
+int main( int argc, char const ** argv ) {
+   struct {
+      QuickTrace::ClockSource source;
+      char const * name;
+      QuickTrace::TraceHandle * th;
+   } clocks[] = {
+      { QuickTrace::ClockSourceTsc, "tsc", nullptr },
+      { QuickTrace::ClockSourceMonotonicRaw, "monotonic-raw", nullptr },
+      { QuickTrace::ClockSourceMonotonicCoarse, "monotonic-coarse", nullptr },
+   };
+   for( auto & clock : clocks ) {
+      std::string filename = std::string( prefix ) + "-" + clock.name + ".qt";
+      clock.th = QuickTrace::initialize_handle(
+         filename.c_str(), nullptr, nullptr, 0, QuickTrace::MultiThreading::disabled,
+         clock.source );
+      assert( clock.th->isInitialized() );
+   }
+   for( int i = 0; i < messageCount; ++i ) {
+      for( auto & clock : clocks ) {
+         struct timeval tv;
+         gettimeofday( &tv, 0 );
+         uint64_t ms = tv.tv_sec * 1000ULL + tv.tv_usec / 1000;
+         QTRACE0_F( clock.th, QVAR << " " << QVAR << " " << QVAR,
+                    clock.name << i << ms );
+         usleep( 10000 );
+      }
+   }
+   for( auto & clock : clocks ) {
+      delete clock.th;
+   }
+   return 0;
+}
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+# Copyright (c) 2026, Arista Networks, Inc.
+# All rights reserved.
+
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+
+# 	* Redistributions of source code must retain the above copyright notice,
+#  	  this list of conditions and the following disclaimer.
+# 	* Redistributions in binary form must reproduce the above copyright notice,
+# 	  this list of conditions and the following disclaimer in the documentation
+# 	  and/or other materials provided with the distribution.
+# 	* Neither the name of Arista Networks nor the names of its contributors may
+# 	  be used to endorse or promote products derived from this software without
+# 	  specific prior written permission.
+
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+# PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+# BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+# ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+from __future__ import absolute_import, division, print_function
+import os, re, subprocess, time, unittest
+
+PREFIX = '/tmp/QtClockSourceTest'
+clockSources = [ 'tsc', 'monotonic-raw', 'monotonic-coarse' ]
+messageCount = 10
+
+class QtClockSourceTest( unittest.TestCase ):
+   @classmethod
+   def setUpClass( cls ):
+      subprocess.check_call( [ './QtClockSourceTest' ], env={ 'QTFILE': PREFIX } )
+
+   @classmethod
+   def tearDownClass( cls ):
+      for source in clockSources:
+         os.remove( '%s-%s.qt' % ( PREFIX, source ) )
+
+   def qttail( self, *sources ):
+      output = subprocess.check_output(
+         [ '/usr/bin/qttail', '-c' ] +
+         [ '%s-%s.qt' % ( PREFIX, source ) for source in sources ],
+         universal_newlines=True )
+      # <date> <time> <level> [<file>] +<delta> "<message>"
+      lineRe = re.compile( r'^(\S+ \S+) 0 (?:\S+ )?\+\d+ "(\S+) (\d+) (\d+)"$' )
+      messages = []
+      for line in output.splitlines(): # pylint: disable=E1103
+         m = lineRe.match( line )
+         self.assertTrue( m, 'unexpected line: %s' % line )
+         t = time.mktime( time.strptime( m.group( 1 )[ : 19 ], '%Y-%m-%d %H:%M:%S' ) )
+         t += float( '0.' + m.group( 1 )[ 20 : ] )
+         messages.append( ( m.group( 2 ), int( m.group( 3 ) ),
+                            t, int( m.group( 4 ) ) / 1000.0 ) )
+      return messages
+
+   def testTimestamps( self ):
+      for source in clockSources:
+         messages = self.qttail( source )
+         self.assertEqual( [ ( s, i ) for s, i, _, _ in messages ],
+                           [ ( source, i ) for i in range( messageCount ) ] )
+         for _, _, t, wallClock in messages:
+            # the coarse clock ticks every few milliseconds
+            self.assertLess( abs( t - wallClock ), 0.02, source )
+
+   def testMerged( self ):
+      # the files are ordered by their wall clock time, as their clocks
+      # differ
+      messages = self.qttail( *clockSources )
+      self.assertEqual( [ ( s, i ) for s, i, _, _ in messages ],
+                        [ ( source, i ) for i in range( messageCount )
+                          for source in clockSources ] )
+
+if __name__ == '__main__':
+   unittest.main()
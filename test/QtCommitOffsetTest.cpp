@@ -0,0 +1,136 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+// Verifies that the writer publishes the end of each record in the commit
+// offset of its ring buffer, and that qttail, which trusts every record before
+// it, follows a busy writer without ever catching a record half written.
+
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "QuickTraceFormatTest.h"
+
+namespace {
+
+constexpr int numMsgs = 200000;
+// how far the writer may get ahead of qttail, well short of a lap of the 1MB
+// ring buffer
+constexpr int maxAhead = 2000;
+
+std::atomic< int > printed;
+
+uint32_t
+commitOffset( const QuickTrace::TraceFileHeader * tfh ) {
+   return __atomic_load_n( &tfh->commitOffsets[ 0 ], __ATOMIC_ACQUIRE );
+}
+
+bool
+testCommitOffset( const QuickTrace::TraceFileHeader * tfh ) {
+   if ( !( tfh->flags & QuickTrace::TraceFileFlagCommitOffsets ) ) {
+      std::cout << "*** no commit offsets" << std::endl;
+      return false;
+   }
+   for ( int i = 0; i < 10; i++ ) {
+      uint32_t before = commitOffset( tfh );
+      QTRACE0( "commit " << QVAR, i );
+      // tsc, message id, int and length
+      if ( commitOffset( tfh ) != before + 8 + 4 + 4 + 1 ) {
+         std::cout << "*** commit offset went from " << before << " to "
+                   << commitOffset( tfh ) << std::endl;
+         return false;
+      }
+   }
+   return true;
+}
+
+void
+readMsgs( int qtTailFd, bool * ok ) {
+   for ( int i = 0; i < 10; i++ ) {
+      readQtLine( qtTailFd );
+   }
+   for ( int i = 0; i < numMsgs; i++ ) {
+      std::string line = readQtLine( qtTailFd, false );
+      std::string expected = "message number " + std::to_string( i ) + ":";
+      if ( !isdigit( line[ 0 ] ) || line.find( expected ) == std::string::npos ) {
+         std::cout << "*** expected " << expected << " from qttail, got: " << line;
+         *ok = false;
+         return;
+      }
+      printed.store( i + 1, std::memory_order_release );
+   }
+}
+
+// qttail skips the messages that are already there when it gets to the
+// file, so trace until it prints something
+void
+waitForQtTail( int qtTailFd ) {
+   int ready = 0;
+   pollfd fds = { qtTailFd, POLLIN, 0 };
+   do {
+      QTRACE0( "ready " << QVAR, ready++ );
+   } while ( poll( &fds, 1, 10 ) == 0 );
+   std::string last = "\"ready " + std::to_string( ready - 1 ) + "\"";
+   while ( readQtLine( qtTailFd ).find( last ) == std::string::npos ) {
+   }
+}
+
+} // namespace
+
+int
+main( int argc, char ** argv ) {
+   srand48( time( nullptr ) );
+   atexit( &killProcess );
+   std::string qtFileName = initializeQuickTrace( "qttail_commit_test.qt", 1024 );
+   int fd = open( qtFileName.c_str(), O_RDONLY );
+   assert( fd >= 0 );
+   void * m = mmap( nullptr, sizeof( QuickTrace::TraceFileHeader ), PROT_READ,
+                    MAP_SHARED, fd, 0 );
+   assert( m != MAP_FAILED );
+   close( fd );
+   int qtTailFd = runQtTail( qtFileName.c_str() );
+   readQtLine( qtTailFd ); // skip output from -x
+   waitForQtTail( qtTailFd );
+   if ( !testCommitOffset( static_cast< QuickTrace::TraceFileHeader * >( m ) ) ) {
+      return EXIT_FAILURE;
+   }
+
+   bool ok = true;
+   std::thread reader( readMsgs, qtTailFd, &ok );
+   for ( int i = 0; i < numMsgs && ok; i++ ) {
+      while ( i - printed.load( std::memory_order_acquire ) > maxAhead && ok ) {
+         usleep( 100 );
+      }
+      std::string s = randomAsciiString( 0, 200 );
+      QTRACE0( "message number " << QVAR << ": " << QVAR, i << s.c_str() );
+   }
+   reader.join();
+   close( qtTailFd );
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,58 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <QuickTrace/QuickTrace.h>
+
+// Start the trace file a few times, each generation tracing its number,
+// with the rotated files compressed.
+// QuickTrace file output validated in QtCompressTest.py
+
+char const * outfile = getenv( "QTFILE" ) ?: "QtCompressTest.qt";
+
+int main( int argc, char const ** argv ) {
+   int generations = argc > 1 ? atoi( argv[ 1 ] ) : 3;
+   int level = argc > 2 ? atoi( argv[ 2 ] ) : 1;
+   QuickTrace::setRotatedFileCompression( level );
+   for( int i = 0; i < generations; ++i ) {
+      bool ok = QuickTrace::initialize( outfile );
+      assert( ok );
+      QTRACE0( "test compress generation " << QVAR, i );
+      QuickTrace::close();
+   }
+   // The rotated files are compressed in the background
+   for( char const * suffix : { ".1", ".2" } ) {
+      std::string rotated = std::string( outfile ) + suffix;
+      for( int i = 0; i < 1000 && level && access( rotated.c_str(), F_OK ) == 0;
+           ++i ) {
+         usleep( 10000 );
+      }
+   }
+   return 0;
+}
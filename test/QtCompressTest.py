@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+# Copyright (c) 2026, Arista Networks, Inc.
+# All rights reserved.
+
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+
+# 	* Redistributions of source code must retain the above copyright notice,
+#  	  this list of conditions and the following disclaimer.
+# 	* Redistributions in binary form must reproduce the above copyright notice,
+# 	  this list of conditions and the following disclaimer in the documentation
+# 	  and/or other materials provided with the distribution.
+# 	* Neither the name of Arista Networks nor the names of its contributors may
+# 	  be used to endorse or promote products derived from this software without
+# 	  specific prior written permission.
+
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+# PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+# BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+# ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+from __future__ import absolute_import, division, print_function
+import glob, gzip, os, re, subprocess, unittest
+
+QTFILE = '/tmp/QtCompressTest.qt'
+
+class QtCompressTest( unittest.TestCase ):
+   def tearDown( self ):
+      for f in glob.glob( QTFILE + '*' ):
+         os.remove( f )
+
+   def generations( self, fileName ):
+      output = subprocess.check_output( [ '/usr/bin/qttail', '-c', fileName ],
+                                        universal_newlines=True )
+      return [ int( m.group( 1 ) ) for m in
+               re.finditer( r'"test compress generation (\d+)"', output ) ]
+
+   def testRotatedFilesCompressed( self ):
+      subprocess.check_call( [ './QtCompressTest', '3' ], env={ 'QTFILE': QTFILE } )
+      self.assertEqual( sorted( glob.glob( QTFILE + '*' ) ),
+                        [ QTFILE, QTFILE + '.1.gz', QTFILE + '.2.gz' ] )
+      # the first generation is kept in .2, the last in the file itself
+      self.assertEqual( self.generations( QTFILE + '.2.gz' ), [ 0 ] )
+      self.assertEqual( self.generations( QTFILE + '.1.gz' ), [ 1 ] )
+      self.assertEqual( self.generations( QTFILE ), [ 2 ] )
+      # the compressed file is the rotated file as is
+      with gzip.open( QTFILE + '.1.gz' ) as f:
+         self.assertEqual( len( f.read() ), os.path.getsize( QTFILE ) )
+
+   def testUncompressedKeptWhenOff( self ):
+      subprocess.check_call( [ './QtCompressTest', '2', '0' ],
+                             env={ 'QTFILE': QTFILE } )
+      self.assertEqual( sorted( glob.glob( QTFILE + '*' ) ),
+                        [ QTFILE, QTFILE + '.1' ] )
+
+   def testLeftoverCompressed( self ):
+      # files rotated while compression was off are compressed by the next
+      # process that rotates them
+      subprocess.check_call( [ './QtCompressTest', '2', '0' ],
+                             env={ 'QTFILE': QTFILE } )
+      subprocess.check_call( [ './QtCompressTest', '1', '9' ],
+                             env={ 'QTFILE': QTFILE } )
+      self.assertEqual( sorted( glob.glob( QTFILE + '*' ) ),
+                        [ QTFILE, QTFILE + '.1.gz', QTFILE + '.2.gz' ] )
+      self.assertEqual( self.generations( QTFILE + '.2.gz' ), [ 0 ] )
+      self.assertEqual( self.generations( QTFILE + '.1.gz' ), [ 1 ] )
+
+   def testTailRefused( self ):
+      subprocess.check_call( [ './QtCompressTest', '2' ], env={ 'QTFILE': QTFILE } )
+      p = subprocess.run( [ '/usr/bin/qttail', QTFILE + '.1.gz' ],
+                          stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                          universal_newlines=True, timeout=10, check=False )
+      self.assertNotEqual( p.returncode, 0 )
+      self.assertIn( 'is compressed, use -c', p.stderr )
+
+if __name__ == '__main__':
+   unittest.main()
@@ -0,0 +1,86 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <QuickTrace/QuickTrace.h>
+
+// Trace a few messages with CPU ids, or with "shared" into a file whose
+// rings are shared by all the threads. Run
+// with "shift" to instead add 1000 ticks to the TSC offsets of all the
+// CPUs in the header of an existing file.
+// QuickTrace file output validated in QtCpuIdTest.py
+
+char const * outfile = getenv( "QTFILE" ) ?: "QtCpuIdTest.qt";
+
+static void
+shiftTscOffsets() {
+   int fd = open( outfile, O_RDWR );
+   assert( fd >= 0 );
+   QuickTrace::TraceFileHeader hdr;
+   ssize_t n = pread( fd, &hdr, sizeof( hdr ), 0 );
+   assert( n == sizeof( hdr ) );
+   assert( hdr.flags & QuickTrace::TraceFileFlagTscOffsets );
+   assert( hdr.numTscOffsets > 0 );
+   assert( hdr.tscOffsetsStart >= sizeof( hdr ) );
+   assert( hdr.tscOffsetsStart + hdr.numTscOffsets * sizeof( int64_t ) <=
+           hdr.firstMsgOffset );
+   void * m = mmap( 0, hdr.firstMsgOffset, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0 );
+   assert( m != MAP_FAILED );
+   auto offsets = ( int64_t * )( ( char * )m + hdr.tscOffsetsStart );
+   for( unsigned cpu = 0; cpu < hdr.numTscOffsets; ++cpu ) {
+      offsets[ cpu ] += 1000;
+   }
+   munmap( m, hdr.firstMsgOffset );
+   close( fd );
+}
+
+int main( int argc, char const ** argv ) {
+   char const * mode = argc > 1 ? argv[ 1 ] : "";
+   if( !strcmp( mode, "shift" ) ) {
+      shiftTscOffsets();
+      return 0;
+   }
+   QuickTrace::setRecordCpuId();
+   bool ok = QuickTrace::initialize(
+      outfile, NULL, NULL, 0, 24,
+      strcmp( mode, "shared" ) ? QuickTrace::MultiThreading::disabled :
+                                 QuickTrace::MultiThreading::shared );
+   assert( ok );
+   // Wait for the file to be calibrated
+   usleep( 200000 );
+
+   for( int i = 0; i < 3; ++i ) {
+      QTRACE0( "msg " << QVAR, i );
+   }
+   QuickTrace::close();
+   return 0;
+}
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+# Copyright (c) 2026, Arista Networks, Inc.
+# All rights reserved.
+
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+
+# 	* Redistributions of source code must retain the above copyright notice,
+#  	  this list of conditions and the following disclaimer.
+# 	* Redistributions in binary form must reproduce the above copyright notice,
+# 	  this list of conditions and the following disclaimer in the documentation
+# 	  and/or other materials provided with the distribution.
+# 	* Neither the name of Arista Networks nor the names of its contributors may
+# 	  be used to endorse or promote products derived from this software without
+# 	  specific prior written permission.
+
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+# PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+# BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+# ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+from __future__ import absolute_import, division, print_function
+import os, re, subprocess, unittest
+
+QTFILE = '/tmp/QtCpuIdTest.qt'
+
+class QtCpuIdTest( unittest.TestCase ):
+   def tearDown( self ):
+      os.remove( QTFILE )
+
+   def qttail( self ):
+      output = subprocess.check_output( [ '/usr/bin/qttail', '-c', '--tsc', QTFILE ],
+                                        universal_newlines=True )
+      # <date> <time> <level> [t<tag>] c<cpu> 0x<tsc> +<delta> "<message>"
+      lineRe = re.compile( r'^\S+ \S+ 0 (?:t\d+ )?c(\d+) 0x([0-9a-f]+) \+\d+ "(.*)"$' )
+      records = []
+      for line in output.splitlines(): # pylint: disable=E1103
+         m = lineRe.match( line )
+         self.assertTrue( m, 'unexpected line: %s' % line )
+         records.append( ( int( m.group( 1 ) ), int( m.group( 2 ), 16 ),
+                           m.group( 3 ) ) )
+      return records
+
+   def runTest( self, *args ):
+      subprocess.check_call( [ './QtCpuIdTest' ] + list( args ),
+                             env={ 'QTFILE': QTFILE } )
+      records = self.qttail()
+      self.assertEqual( [ r[ 2 ] for r in records ],
+                        [ 'msg 0', 'msg 1', 'msg 2' ] )
+      ncpus = os.cpu_count()
+      for cpu, _, _ in records:
+         self.assertLess( cpu, ncpus )
+      # the timestamps are corrected by the offset of the CPU they were
+      # read on
+      subprocess.check_call( [ './QtCpuIdTest', 'shift' ],
+                             env={ 'QTFILE': QTFILE } )
+      shifted = self.qttail()
+      self.assertEqual( [ r[ 1 ] - 1000 for r in records ],
+                        [ r[ 1 ] for r in shifted ] )
+
+   def testPerThread( self ):
+      self.runTest()
+
+   def testShared( self ):
+      self.runTest( 'shared' )
+
+if __name__ == '__main__':
+   unittest.main()
@@ -0,0 +1,83 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <QuickTrace/QuickTrace.h>
+
+// Trace enough messages for level 9 to wrap a few times, with the file
+// backed up to the forever log every time it does. Run with "incremental"
+// to archive the rings to an incremental forever log instead, with some
+// messages on level 0 as well.
+// QuickTrace file output validated in QtForeverLogTest.py
+
+char const * outfile = getenv( "QTFILE" ) ?: "QtForeverLogTest.qt";
+
+int main( int argc, char const ** argv ) {
+   int numMsgs = argc > 1 ? atoi( argv[ 1 ] ) : 100;
+   bool incremental = argc > 2 && !strcmp( argv[ 2 ], "incremental" );
+   if( incremental ) {
+      QuickTrace::setIncrementalForeverLog();
+   }
+   bool shared = argc > 3 && !strcmp( argv[ 3 ], "shared" );
+   // Every message is traced twice in a row, with a clock coarse enough for
+   // both to usually get the same timestamp
+   bool twice = argc > 2 && !strcmp( argv[ 2 ], "twice" );
+   QuickTrace::SizeSpec sizes = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+   bool ok;
+   if( shared ) {
+      ok = QuickTrace::initializeShared( outfile, &sizes, outfile );
+   } else if( twice ) {
+      ok = QuickTrace::initialize( outfile, &sizes, outfile, 0, 24,
+                                   QuickTrace::MultiThreading::disabled, true,
+                                   DEFAULT_NUM_MSG_COUNTERS,
+                                   QuickTrace::MsgCounterLayout::packed,
+                                   QuickTrace::ClockSourceMonotonicCoarse );
+   } else {
+      ok = QuickTrace::initialize( outfile, &sizes, outfile );
+   }
+   assert( ok );
+   // 10 billion to enforce use of 64 bit
+   uint64_t value = 10000000000;
+   for( int i = 0; i < numMsgs; ++i ) {
+      for( int copy = 0; copy < ( twice ? 2 : 1 ); ++copy ) {
+         QTRACE9( "test forever rollover " << QVAR, value + i );
+      }
+      if( i % 5 == 0 ) {
+         if( incremental ) {
+            QTRACE0( "test forever level0 " << QVAR, i );
+         }
+         // Let the backup thread copy a ring before the messages it holds
+         // get overwritten
+         QuickTrace::waitForForeverLogBackups();
+      }
+   }
+   // Waits for the backups to be copied
+   QuickTrace::close();
+   return 0;
+}
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+# Copyright (c) 2026, Arista Networks, Inc.
+# All rights reserved.
+
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+
+# 	* Redistributions of source code must retain the above copyright notice,
+#  	  this list of conditions and the following disclaimer.
+# 	* Redistributions in binary form must reproduce the above copyright notice,
+# 	  this list of conditions and the following disclaimer in the documentation
+# 	  and/or other materials provided with the distribution.
+# 	* Neither the name of Arista Networks nor the names of its contributors may
+# 	  be used to endorse or promote products derived from this software without
+# 	  specific prior written permission.
+
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+# PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+# BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+# ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+from __future__ import absolute_import, division, print_function
+import collections, glob, os, re, subprocess, unittest
+
+QTFILE = '/tmp/QtForeverLogTest.qt'
+VALUE_BASE = 10000000000
+
+class QtForeverLogTest( unittest.TestCase ):
+   def tearDown( self ):
+      for f in glob.glob( QTFILE + '*' ):
+         os.remove( f )
+
+   def messages( self, *args ):
+      output = subprocess.check_output( [ '/usr/bin/qttail', '-c' ] + list( args ),
+                                        universal_newlines=True )
+      # with several files, the name of the file comes after the level
+      lineRe = re.compile(
+         r'^\S+ \S+ (\d) (?:\S+ )?\+\d+ "test forever (\S+) (\d+)"$' )
+      messages = []
+      for line in output.splitlines(): # pylint: disable=E1103
+         m = lineRe.match( line )
+         self.assertTrue( m, 'unexpected line: %s' % line )
+         messages.append( ( int( m.group( 1 ) ), m.group( 2 ), int( m.group( 3 ) ) ) )
+      return messages
+
+   def values( self, *args ):
+      return [ value - VALUE_BASE for _, _, value in self.messages( *args ) ]
+
+   def testFullCopies( self ):
+      # 100 messages of 21 bytes wrap the 768 usable bytes of level 9 twice
+      subprocess.check_call( [ './QtForeverLogTest', '100' ],
+                             env={ 'QTFILE': QTFILE } )
+      backups = [ QTFILE + '.%d' % i for i in range( 2 ) ]
+      self.assertEqual( sorted( glob.glob( QTFILE + '.*' ) ), backups )
+      last = -1
+      for fileName in backups + [ QTFILE ]:
+         values = self.values( fileName )
+         self.assertTrue( values, fileName )
+         # each backup holds the messages that were in the ring when it
+         # was copied, which are never older than those of the previous one
+         self.assertEqual( values, list( range( values[ 0 ], values[ -1 ] + 1 ) ) )
+         self.assertGreaterEqual( values[ -1 ], last )
+         last = values[ -1 ]
+      self.assertEqual( last, 99 )
+
+   def testUnique( self ):
+      # the backups overlap with each other and with the file
+      subprocess.check_call( [ './QtForeverLogTest', '200' ],
+                             env={ 'QTFILE': QTFILE } )
+      files = sorted( glob.glob( QTFILE + '*' ) )
+      self.assertGreater( len( files ), 2 )
+      values = set()
+      for fileName in files:
+         values.update( self.values( fileName ) )
+      self.assertGreater( len( self.values( *files ) ), len( values ) )
+      # -u prints every message once, in order
+      self.assertEqual( self.values( '-u', *files ), sorted( values ) )
+
+   def testUniqueSameTimestamp( self ):
+      # messages that only differ by where they are in the ring are printed
+      # as many times as they were traced
+      subprocess.check_call( [ './QtForeverLogTest', '100', 'twice' ],
+                             env={ 'QTFILE': QTFILE } )
+      files = sorted( glob.glob( QTFILE + '*' ) )
+      self.assertGreater( len( files ), 2 )
+      counts = collections.Counter()
+      for fileName in files:
+         counts |= collections.Counter( self.values( fileName ) )
+      self.assertEqual( max( counts.values() ), 2 )
+      # the backups hold every lap, so both copies of every message, even
+      # when a lap ends between them, and the messages with the same
+      # timestamp are printed file by file
+      self.assertEqual( sorted( self.values( '-u', *files ) ),
+                        sorted( list( range( 100 ) ) * 2 ) )
+
+   def testIncremental( self, *args ):
+      # level 9 wraps 8 times, level 0 once
+      subprocess.check_call( [ './QtForeverLogTest', '300', 'incremental' ] +
+                             list( args ), env={ 'QTFILE': QTFILE } )
+      archive = QTFILE + '.0.qta'
+      self.assertEqual( sorted( glob.glob( QTFILE + '.*' ) ), [ archive ] )
+      # the archive holds every message once, in order
+      expected = []
+      for i in range( 300 ):
+         expected.append( ( 9, 'rollover', VALUE_BASE + i ) )
+         if i % 5 == 0:
+            expected.append( ( 0, 'level0', i ) )
+      self.assertEqual( self.messages( archive ), expected )
+
+   def testIncrementalShared( self ):
+      # the records of a shared ring, tagged with the thread, are archived
+      # the same way
+      self.testIncremental( 'shared' )
+
+if __name__ == '__main__':
+   unittest.main()
@@ -0,0 +1,137 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+// Verifies that qttail --lossless gets every message of a level whose writer
+// has an overrun policy: while qttail is stopped, the writer keeps the
+// messages it has not printed in the overflow area with OverrunSpill, and
+// drops the new ones with OverrunDrop, which qttail then reports. The
+// writer does not trace once qttail goes on, so the overflow area is drained
+// from the background.
+
+#include <csignal>
+#include <iostream>
+#include <poll.h>
+#include <unistd.h>
+#include "QuickTraceFormatTest.h"
+
+namespace {
+
+// more than the 1k ring buffer holds, and less than the overflow area does
+constexpr int numMsgs = 1000;
+
+// messages printed by qttail, and dropped according to it, in a run
+int printed;
+int dropped;
+
+// check what qttail prints for the messages first..first+numMsgs-1, of
+// which only the last ones may be dropped, until it accounted for all of them
+void
+readMsgs( int qtTailFd, int first, bool * ok ) {
+   int next = first;
+   while ( printed + dropped < numMsgs ) {
+      std::string line = readQtLine( qtTailFd );
+      std::string::size_type pos = line.find( "message number " );
+      if ( pos != std::string::npos ) {
+         int n = std::stoi( line.substr( pos + 15 ) );
+         if ( n != next ) {
+            std::cout << "*** expected message " << next << ", got: " << line;
+            *ok = false;
+            return;
+         }
+         next++;
+         printed++;
+      } else if ( line.find( " messages dropped on level 0" ) !=
+                  std::string::npos ) {
+         dropped += std::stoi( line.substr( 4 ) );
+      } else {
+         std::cout << "*** unexpected line from qttail: " << line;
+         *ok = false;
+         return;
+      }
+   }
+}
+
+// trace numMsgs messages while qttail is stopped, then wait, without
+// tracing, until qttail accounted for all of them: what waits in the
+// overflow area goes to the ring buffer from the spill drain thread
+bool
+testOverrun( int qtTailFd, int first ) {
+   printed = 0;
+   dropped = 0;
+   signalProcess( SIGSTOP );
+   for ( int i = first; i < first + numMsgs; i++ ) {
+      QTRACE0( "message number " << QVAR << ": " << QVAR, i << "abc" );
+   }
+   signalProcess( SIGCONT );
+   bool ok = true;
+   readMsgs( qtTailFd, first, &ok );
+   return ok;
+}
+
+void
+waitForQtTail( int qtTailFd ) {
+   int ready = 0;
+   pollfd fds = { qtTailFd, POLLIN, 0 };
+   do {
+      QTRACE0( "ready " << QVAR, ready++ );
+   } while ( poll( &fds, 1, 10 ) == 0 );
+   std::string last = "\"ready " + std::to_string( ready - 1 ) + "\"";
+   while ( readQtLine( qtTailFd ).find( last ) == std::string::npos ) {
+   }
+}
+
+} // namespace
+
+int
+main( int argc, char ** argv ) {
+   atexit( &killProcess );
+   std::string qtFileName = initializeQuickTrace( "qttail_lossless_test.qt", 1 );
+   QuickTrace::theTraceFile->overrunPolicyIs( 0, QuickTrace::OverrunSpill );
+   const char * qtTailArgv[] = { "qttail", "--lossless", qtFileName.c_str(),
+                                 nullptr };
+   int qtTailFd = runProcess( qtTailArgv[ 0 ], qtTailArgv );
+   waitForQtTail( qtTailFd );
+
+   if ( !testOverrun( qtTailFd, 0 ) ) {
+      return EXIT_FAILURE;
+   }
+   if ( dropped != 0 ) {
+      std::cout << "*** " << dropped << " messages dropped despite the overflow area"
+                << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   QuickTrace::theTraceFile->overrunPolicyIs( 0, QuickTrace::OverrunDrop );
+   if ( !testOverrun( qtTailFd, numMsgs ) ) {
+      return EXIT_FAILURE;
+   }
+   if ( dropped == 0 || printed + dropped != numMsgs ) {
+      std::cout << "*** " << printed << " messages printed and " << dropped
+                << " dropped out of " << numMsgs << std::endl;
+      return EXIT_FAILURE;
+   }
+   close( qtTailFd );
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,84 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+// Verifies that qttail -c --lost reports exactly how many messages, and bytes,
+// the writer overwrote before the oldest message still in the file.
+
+#include <iostream>
+#include <unistd.h>
+#include "QuickTraceFormatTest.h"
+
+namespace {
+
+// every message takes 21 bytes: 8 bytes tsc, 4 bytes message id, 4 bytes
+// integer, 1 byte string length, 3 bytes string and 1 byte message length
+constexpr int msgLength = 21;
+
+// messages are numbered across runs, the number of a message is the number of
+// messages before it
+int msgNum;
+
+bool
+testLost( const std::string & qtFileName, int numMsgs ) {
+   for ( int i = 0; i < numMsgs; i++, msgNum++ ) {
+      QTRACE0( "message number " << QVAR << ": " << QVAR, msgNum << "abc" );
+   }
+   const char * argv[] = { "qttail", "-c", "--lost", qtFileName.c_str(), nullptr };
+   int qtTailFd = runProcess( argv[ 0 ], argv );
+   std::string lost = readQtLine( qtTailFd );
+   std::string first = readQtLine( qtTailFd );
+   // readQtLine() buffers what it read ahead, drain it for the next run
+   while ( !readQtLine( qtTailFd, false ).empty() ) {
+   }
+   close( qtTailFd );
+   // the first message qttail prints is the one after those that were lost
+   std::string::size_type pos = first.find( "message number " );
+   if ( pos == std::string::npos ) {
+      std::cout << "*** unexpected message from qttail: " << first;
+      return false;
+   }
+   int firstMsg = std::stoi( first.substr( pos + 15 ) );
+   std::string expected = "--- " + std::to_string( firstMsg ) + " messages (" +
+                          std::to_string( firstMsg * msgLength ) +
+                          " bytes) lost on level 0";
+   if ( firstMsg == 0 || lost.compare( 0, expected.size(), expected ) != 0 ) {
+      std::cout << "*** expected " << expected << ", got: " << lost;
+      return false;
+   }
+   return true;
+}
+
+} // namespace
+
+int
+main( int argc, char ** argv ) {
+   atexit( &killProcess );
+   std::string qtFileName = initializeQuickTrace( "qttail_lost_test.qt", 1 );
+   // a 1k ring buffer holds 37 of the messages, so the writer wraps twice
+   bool ok = testLost( qtFileName, 100 );
+   // and then some more, splitting the ring buffer at a different point
+   ok = ok && testLost( qtFileName, 50 );
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -25,6 +25,8 @@
 // SUCH DAMAGE.
 
 #include <stdlib.h>
+#include <string>
+#include <string_view>
 #include <QuickTrace/QuickTrace.h>
 
 char const * outfile = getenv( "QTFILE" ) ?: "QtMaxStrLen.out";
@@ -63,4 +65,23 @@ int main( int argc, char const ** argv ) {
    // Now let's write a message and see if anything weird happens
    QTRACE2( "wrap-around test", "Did we have any trouble with wrap-around?" );
 
+   // std::string, std::string_view and char arrays are stored with their
+   // known length, and truncated the same way
+   std::string str( "Clocking in at over 80 characters, this std::string is way "
+                    "over the limit, so it should be truncated" );
+   QTRACE1( "std::string test", str );
+   std::string_view sv( "This string_view stops here, before the rest" );
+   QTRACE1( "string_view test", sv.substr( 0, 27 ) );
+   char array[ 64 ] = "Only part of this array is used";
+   QTRACE1( "char array test", array );
+   // A buffer that the string fills, without a NUL, stops at its end
+   struct {
+      char buf[ 8 ];
+      char after[ 8 ];
+   } full = { { 'F', 'u', 'l', 'l', ' ', 'b', 'u', 'f' }, "after" };
+   QTRACE1( "unterminated buffer test", full.buf );
+   char const constFull[ 4 ] = { 'C', 'o', 'n', 's' };
+   QTRACE1( "unterminated const buffer test", constFull );
+   QTRACE1( "empty std::string check", std::string() );
+
 }
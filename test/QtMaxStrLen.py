@@ -73,3 +73,12 @@ check( False, outputlines, "500 should be 80 test", "Clocking in at over 80 " \
 
 check( True, outputlines, "wrap-around test", "Did we have any trouble with " \
        "wrap-around?" )
+
+# The check below succeeds because we only check the first 80 chars
+check( True, outputlines, "std::string test", "Clocking in at over 80 " \
+       "characters, this std::string is way over the limit, so it)" )
+check( True, outputlines, "string_view test", "(This string_view stops here)" )
+check( True, outputlines, "char array test", "(Only part of this array is used)" )
+check( True, outputlines, "unterminated buffer test", "(Full buf)" )
+check( True, outputlines, "unterminated const buffer test", "(Cons)" )
+check( True, outputlines, "empty std::string check", "()" )
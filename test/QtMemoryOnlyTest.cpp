@@ -0,0 +1,86 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <QuickTrace/QuickTrace.h>
+
+// Trace into a memory-only file. With "wait", wait for a line on stdin
+// before persisting the file and tracing once more, with "crash", abort
+// after tracing.
+// QuickTrace file output validated in QtMemoryOnlyTest.py
+
+char const * outfile = getenv( "QTFILE" ) ?: "QtMemoryOnlyTest.qt";
+char const * memoryDir = getenv( "QTMEMDIR" ) ?: "/dev/shm";
+
+// Installed before QuickTrace's crash handler, which calls it with the
+// siginfo the signal was sent with
+static void
+chainedHandler( int sig, siginfo_t * info, void * ) {
+   printf( "chained %d %d\n", info->si_code == SI_QUEUE, info->si_value.sival_int );
+   fflush( stdout );
+   _exit( 3 );
+}
+
+int main( int argc, char const ** argv ) {
+   char const * mode = argc > 1 ? argv[ 1 ] : "";
+   int run = argc > 2 ? atoi( argv[ 2 ] ) : 0;
+   if( !strcmp( mode, "chain" ) ) {
+      struct sigaction sa = {};
+      sa.sa_sigaction = chainedHandler;
+      sa.sa_flags = SA_SIGINFO;
+      sigemptyset( &sa.sa_mask );
+      sigaction( SIGABRT, &sa, nullptr );
+   }
+   QuickTrace::setMemoryOnlyTraceFiles( memoryDir );
+   bool ok = QuickTrace::initialize( outfile );
+   assert( ok );
+   QTRACE0( "test memory before " << QVAR, run );
+   if( !strcmp( mode, "crash" ) ) {
+      abort();
+   }
+   if( !strcmp( mode, "chain" ) ) {
+      union sigval value;
+      value.sival_int = 42;
+      sigqueue( getpid(), SIGABRT, value );
+   }
+   if( !strcmp( mode, "wait" ) ) {
+      printf( "ready\n" );
+      fflush( stdout );
+      char line[ 16 ];
+      if( !fgets( line, sizeof( line ), stdin ) ) {
+         return 1;
+      }
+      QuickTrace::persistTraceFiles();
+      QTRACE0( "test memory after " << QVAR, run );
+   }
+   QuickTrace::close();
+   return 0;
+}
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+# Copyright (c) 2026, Arista Networks, Inc.
+# All rights reserved.
+
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+
+# 	* Redistributions of source code must retain the above copyright notice,
+#  	  this list of conditions and the following disclaimer.
+# 	* Redistributions in binary form must reproduce the above copyright notice,
+# 	  this list of conditions and the following disclaimer in the documentation
+# 	  and/or other materials provided with the distribution.
+# 	* Neither the name of Arista Networks nor the names of its contributors may
+# 	  be used to endorse or promote products derived from this software without
+# 	  specific prior written permission.
+
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+# PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+# BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+# ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+from __future__ import absolute_import, division, print_function
+import glob, os, re, shutil, signal, subprocess, unittest
+
+QTFILE = '/tmp/QtMemoryOnlyTest.qt'
+QTMEMDIR = '/tmp/QtMemoryOnlyTest.mem'
+SNAPSHOT = QTFILE + '.snapshot'
+ENV = { 'QTFILE': QTFILE, 'QTMEMDIR': QTMEMDIR }
+
+class QtMemoryOnlyTest( unittest.TestCase ):
+   def setUp( self ):
+      self.tearDown()
+      os.mkdir( QTMEMDIR )
+
+   def tearDown( self ):
+      for f in glob.glob( QTFILE + '*' ):
+         os.remove( f )
+      shutil.rmtree( QTMEMDIR, ignore_errors=True )
+
+   def messages( self, fileName ):
+      output = subprocess.check_output( [ '/usr/bin/qttail', '-c', fileName ],
+                                        universal_newlines=True )
+      return re.findall( r'"test memory (\w+ \d+)"', output )
+
+   def memoryFiles( self ):
+      return os.listdir( QTMEMDIR )
+
+   def testLiveAndPersisted( self ):
+      p = subprocess.Popen( [ './QtMemoryOnlyTest', 'wait', '0' ], env=ENV,
+                            stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                            universal_newlines=True )
+      self.assertEqual( p.stdout.readline(), 'ready\n' )
+      # the trace file links to the memory file, the rings are read live
+      self.assertTrue( os.path.islink( QTFILE ) )
+      target = os.readlink( QTFILE )
+      self.assertEqual( os.path.dirname( target ), QTMEMDIR )
+      self.assertEqual( self.messages( QTFILE ), [ 'before 0' ] )
+      p.stdin.write( '\n' )
+      p.stdin.close()
+      self.assertEqual( p.wait(), 0 )
+      p.stdout.close()
+      # persisted as a snapshot, while the rings went on in memory and the
+      # trace file still links to them
+      self.assertTrue( os.path.islink( QTFILE ) )
+      self.assertEqual( self.messages( SNAPSHOT ), [ 'before 0' ] )
+      self.assertEqual( self.messages( QTFILE ), [ 'before 0', 'after 0' ] )
+
+      # the next process persists the memory file on rotation, the snapshot
+      # being older
+      subprocess.check_call( [ './QtMemoryOnlyTest', '', '1' ], env=ENV )
+      self.assertFalse( os.path.islink( QTFILE + '.1' ) )
+      self.assertEqual( self.messages( QTFILE + '.1' ), [ 'before 0', 'after 0' ] )
+      self.assertEqual( self.messages( QTFILE ), [ 'before 1' ] )
+      self.assertFalse( os.path.exists( SNAPSHOT ) )
+      self.assertEqual( self.memoryFiles(), [ os.path.basename( target ) ] )
+
+   def testPersistedOnCrash( self ):
+      ret = subprocess.call( [ './QtMemoryOnlyTest', 'crash', '0' ], env=ENV )
+      self.assertEqual( ret, -signal.SIGABRT )
+      self.assertTrue( os.path.islink( QTFILE ) )
+      self.assertEqual( self.messages( SNAPSHOT ), [ 'before 0' ] )
+
+      # once the memory file is gone, with a reboot, the snapshot is rotated
+      for f in self.memoryFiles():
+         os.remove( os.path.join( QTMEMDIR, f ) )
+      subprocess.check_call( [ './QtMemoryOnlyTest', '', '1' ], env=ENV )
+      self.assertEqual( self.messages( QTFILE + '.1' ), [ 'before 0' ] )
+      self.assertEqual( self.messages( QTFILE ), [ 'before 1' ] )
+      self.assertFalse( os.path.exists( SNAPSHOT ) )
+
+   def testCrashHandlerChained( self ):
+      # the handler that was installed before gets the original siginfo
+      proc = subprocess.run( [ './QtMemoryOnlyTest', 'chain', '0' ], env=ENV,
+                             stdout=subprocess.PIPE, universal_newlines=True )
+      self.assertEqual( proc.returncode, 3 )
+      self.assertEqual( proc.stdout, 'chained 1 42\n' )
+      self.assertEqual( self.messages( SNAPSHOT ), [ 'before 0' ] )
+
+   def testPersistedOnRotation( self ):
+      # a process killed without a chance to persist its file
+      subprocess.check_call( [ './QtMemoryOnlyTest', '', '0' ], env=ENV )
+      self.assertTrue( os.path.islink( QTFILE ) )
+      subprocess.check_call( [ './QtMemoryOnlyTest', '', '1' ], env=ENV )
+      subprocess.check_call( [ './QtMemoryOnlyTest', '', '2' ], env=ENV )
+      self.assertEqual( self.messages( QTFILE + '.2' ), [ 'before 0' ] )
+      self.assertEqual( self.messages( QTFILE + '.1' ), [ 'before 1' ] )
+      self.assertEqual( self.messages( QTFILE ), [ 'before 2' ] )
+      # only the memory file of the live trace file is left
+      self.assertEqual( len( self.memoryFiles() ), 1 )
+
+if __name__ == '__main__':
+   unittest.main()
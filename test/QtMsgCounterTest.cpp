@@ -0,0 +1,170 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+// Test that every trace site gets its own MsgCounter, even when there
+// are many more trace sites than the MsgCounters in the trace file, and
+// that the counters file that holds the others grows as MsgIds get
+// allocated. Both MsgCounter layouts are tested.
+
+#include <cassert>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <QuickTrace/QuickTrace.h>
+
+char const * outfile = getenv( "QTFILE" ) ?: "QtMsgCounterTest.qt";
+
+static constexpr int numSites = 1000;
+
+// Every instantiation is a separate trace site with its own MsgId
+template< int N >
+QuickTrace::MsgId
+site( int count ) {
+   static QuickTrace::MsgId msgId;
+   for( int i = 0; i < count; ++i ) {
+      QTRACE_H_MSGID( QuickTrace::theTraceFile, msgId, 0, "site " << QVAR, N );
+   }
+   return msgId;
+}
+
+// Far beyond the MsgIds that get allocated
+static constexpr QuickTrace::MsgId farMsgId = 100000;
+
+// A trace site with a MsgId of its choosing rather than the next one
+QuickTrace::MsgId
+farSite() {
+   static QuickTrace::MsgId msgId = farMsgId;
+   QTRACE_H_MSGID( QuickTrace::theTraceFile, msgId, 0, "far site", 0 );
+   return msgId;
+}
+
+// Map the header of the trace file, the way the qt tools see it
+QuickTrace::TraceFileHeader const *
+mapHeader( QuickTrace::TraceFile * tf ) {
+   int fd = open( tf->fileName(), O_RDONLY );
+   assert( fd >= 0 );
+   void * m = mmap( 0, sizeof( QuickTrace::TraceFileHeader ), PROT_READ,
+                    MAP_SHARED, fd, 0 );
+   assert( m != MAP_FAILED );
+   close( fd );
+   return ( QuickTrace::TraceFileHeader const * )m;
+}
+
+void
+testLayout( QuickTrace::MsgCounterLayout layout ) {
+   // Only put 16 MsgCounters in the trace file
+   QuickTrace::initialize( outfile, NULL, NULL, 0, 24,
+                           QuickTrace::MultiThreading::disabled, true, 16,
+                           layout );
+   QuickTrace::TraceFile * tf = QuickTrace::theTraceFile;
+   assert( tf );
+   auto const * hdr = mapHeader( tf );
+   uint32_t inFile = ( hdr->fileHeaderSize - hdr->firstMsgOffset ) /
+                     hdr->msgCounterStride;
+   assert( inFile == 16 );
+   assert( hdr->extraMsgCounters == 0 );
+   std::string countersPath =
+      std::string( tf->fileName() ) + QuickTrace::MsgCountersFileSuffix;
+   assert( access( countersPath.c_str(), F_OK ) != 0 );
+   bool aligned = layout == QuickTrace::MsgCounterLayout::cacheLineAligned;
+   assert( hdr->msgCounterStride ==
+           ( aligned ? 64 : sizeof( QuickTrace::MsgCounter ) ) );
+
+   // Trace from site N N+1 times, so each counter has a distinct count
+   QuickTrace::MsgId msgIds[ numSites ];
+   [ & ]< int... N >( std::integer_sequence< int, N... > ) {
+      ( ( msgIds[ N ] = site< N >( N + 1 ) ), ... );
+   }( std::make_integer_sequence< int, numSites >{} );
+
+   for( int i = 0; i < numSites; ++i ) {
+      assert( msgIds[ i ] != 0 );
+      QuickTrace::MsgCounter * mc = tf->msgCounter( msgIds[ i ] );
+      assert( mc->count == ( uint32_t )( i + 1 ) );
+      assert( !aligned || ( uintptr_t )mc % 64 == 0 );
+   }
+   uint32_t extra = hdr->extraMsgCounters;
+   assert( extra > msgIds[ numSites - 1 ] - inFile );
+
+   // The counters past those in the trace file are in the counters file,
+   // the way qtctl and qtclear see them
+   int fd = open( countersPath.c_str(), O_RDONLY );
+   assert( fd >= 0 );
+   struct stat st;
+   assert( fstat( fd, &st ) == 0 );
+   assert( st.st_size >= ( off_t )extra * hdr->msgCounterStride );
+   void * m = mmap( 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+   assert( m != MAP_FAILED );
+   close( fd );
+   for( int i = 0; i < numSites; ++i ) {
+      if( ( uint32_t )msgIds[ i ] < inFile ) {
+         continue;
+      }
+      auto const * mc = ( QuickTrace::MsgCounter const * )(
+         ( char const * )m + ( msgIds[ i ] - inFile ) * hdr->msgCounterStride );
+      assert( mc->count == ( uint32_t )( i + 1 ) );
+   }
+
+   // Turning one message off must not affect any other
+   tf->msgCounter( msgIds[ 0 ] )->lastTsc |= 0x80000000;
+   [ & ]< int... N >( std::integer_sequence< int, N... > ) {
+      ( site< N >( 1 ), ... );
+   }( std::make_integer_sequence< int, numSites >{} );
+   for( int i = 1; i < numSites; ++i ) {
+      assert( tf->msgCounter( msgIds[ i ] )->count == ( uint32_t )( i + 2 ) );
+   }
+
+   // MsgIds whose counters are not mapped share MsgCounter 0, which no
+   // message has, rather than that of another message
+   QuickTrace::MsgId beyond = farMsgId;
+   assert( tf->msgCounter( beyond ) == tf->msgCounter( 0 ) );
+   assert( tf->msgCounter( -beyond ) == tf->msgCounter( 0 ) );
+   for( int i = 0; i < numSites; ++i ) {
+      assert( tf->msgCounter( msgIds[ i ] ) != tf->msgCounter( beyond ) );
+   }
+
+   // Until a message has that MsgId, and the counters file grows to hold
+   // its counter
+   assert( farSite() == farMsgId );
+   assert( tf->msgCounter( farMsgId ) != tf->msgCounter( 0 ) );
+   assert( tf->msgCounter( farMsgId )->count == 1 );
+   assert( hdr->extraMsgCounters > farMsgId - inFile );
+   assert( tf->msgCounter( msgIds[ numSites - 1 ] )->count ==
+           ( uint32_t )numSites + 1 );
+
+   munmap( m, st.st_size );
+   munmap( ( void * )hdr, sizeof( *hdr ) );
+   QuickTrace::close();
+}
+
+int main() {
+   testLayout( QuickTrace::MsgCounterLayout::packed );
+   testLayout( QuickTrace::MsgCounterLayout::cacheLineAligned );
+   return 0;
+}
@@ -0,0 +1,125 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+// Measures the cost of QPROF with one thread and with several threads
+// profiling neighbouring messages in a single trace file, once with
+// packed MsgCounters and once with cache line aligned ones. With
+// packed counters the threads keep bouncing the cache lines holding
+// their counters between cores, which shows up as a higher cost per
+// QPROF as threads are added.
+//
+// Usage: QtProfBenchmark [iterations per thread] [max threads]
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <QuickTrace/QuickTrace.h>
+
+char const * outfile = getenv( "QTFILE" ) ?: "QtProfBenchmark.qt";
+
+static constexpr int maxThreads = 16;
+
+static double
+threadCpuNs() {
+   struct timespec ts;
+   clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Every instantiation is a separate QPROF, so every thread gets its own
+// MsgId and MsgCounter, allocated next to those of the other threads.
+// Returns the average CPU time of a QPROF in this thread, in nanoseconds,
+// so that the numbers are comparable even with more threads than cores.
+template< int N >
+void
+profLoop( long iterations, double * nsPerQprof ) {
+   double start = threadCpuNs();
+   for( long i = 0; i < iterations; ++i ) {
+      QPROF( "profLoop" );
+      asm volatile( "" ::: "memory" );
+   }
+   *nsPerQprof = ( threadCpuNs() - start ) / iterations;
+}
+
+template< int... N >
+constexpr auto
+makeProfLoops( std::integer_sequence< int, N... > ) {
+   return std::array< void ( * )( long, double * ), sizeof...( N ) >{
+      { profLoop< N >... } };
+}
+
+static constexpr auto profLoops =
+   makeProfLoops( std::make_integer_sequence< int, maxThreads >{} );
+
+// Returns the average cost of a QPROF over all the threads
+double
+run( int numThreads, long iterations ) {
+   std::vector< std::thread > threads;
+   double nsPerQprof[ maxThreads ];
+   for( int t = 0; t < numThreads; ++t ) {
+      threads.emplace_back( profLoops[ t ], iterations, &nsPerQprof[ t ] );
+   }
+   for( auto & t : threads ) {
+      t.join();
+   }
+   double sum = 0;
+   for( int t = 0; t < numThreads; ++t ) {
+      sum += nsPerQprof[ t ];
+   }
+   return sum / numThreads;
+}
+
+int main( int argc, char const ** argv ) {
+   long iterations = argc > 1 ? atol( argv[ 1 ] ) : 10000000;
+   int numThreads = argc > 2 ? atoi( argv[ 2 ] ) :
+                               std::thread::hardware_concurrency();
+   numThreads = std::max( 2, std::min( numThreads, maxThreads ) );
+
+   for( auto layout : { QuickTrace::MsgCounterLayout::packed,
+                        QuickTrace::MsgCounterLayout::cacheLineAligned } ) {
+      bool ok = QuickTrace::initialize(
+         outfile, NULL, NULL, 0, 24, QuickTrace::MultiThreading::shared, true,
+         DEFAULT_NUM_MSG_COUNTERS, layout );
+      if( !ok ) {
+         fprintf( stderr, "Failed to initialize %s\n", outfile );
+         return 1;
+      }
+      char const * name = layout == QuickTrace::MsgCounterLayout::packed ?
+                          "packed" : "cacheLineAligned";
+      // Warm up, so MsgIds are allocated outside the measurements
+      run( numThreads, 1 );
+      printf( "%-16s 1 thread: %6.2f ns/QPROF\n", name, run( 1, iterations ) );
+      printf( "%-16s %d threads: %6.2f ns/QPROF\n", name, numThreads,
+              run( numThreads, iterations ) );
+      QuickTrace::close();
+   }
+   return 0;
+}
@@ -0,0 +1,153 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+// Checks that string arguments are captured into a RingBuf exactly as
+// the original byte at a time loop did, for every length and alignment,
+// including strings that end right before an unmapped page. It then
+// measures the cost of capturing strings of various lengths, compared
+// to that byte at a time loop.
+//
+// Usage: QtPutStringBenchmark [iterations per length]
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <QuickTrace/QuickTrace.h>
+
+// The byte at a time loop that put() used to use
+// Built with the same optimize( 3 ) as put() itself
+__attribute__( ( noinline, optimize( 3 ) ) ) void
+referencePut( QuickTrace::RingBuf * log, char const * x, unsigned int maxLen ) {
+   char * ptr = ( char * )log->ptr();
+   char * ptr1 = ptr + 1;
+   unsigned int i;
+   for( i = 0; i < maxLen; ++i ) {
+      if( !x[ i ] ) { break; }
+      ptr1[ i ] = x[ i ];
+   }
+   *ptr = i;
+   log->ptrIs( ptr1 + i );
+}
+
+static constexpr int bufSize = 4096;
+static char expected[ bufSize ];
+static char actual[ bufSize ];
+
+void
+checkPut( char const * x ) {
+   QuickTrace::RingBuf ref;
+   QuickTrace::RingBuf rb;
+   ref.bufIs( expected, bufSize );
+   rb.bufIs( actual, bufSize );
+   referencePut( &ref, x, QuickTrace::qtMaxStringLen );
+   QuickTrace::put( &rb, x );
+   size_t n = ( char * )ref.ptr() - expected;
+   assert( ( size_t )( ( char * )rb.ptr() - actual ) == n );
+   assert( !memcmp( expected, actual, n ) );
+}
+
+void
+checkAll() {
+   long pageSize = sysconf( _SC_PAGESIZE );
+   // Two pages, the second of which is inaccessible
+   char * page = ( char * )mmap( 0, 2 * pageSize, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+   assert( page != MAP_FAILED );
+   int r = mprotect( page + pageSize, pageSize, PROT_NONE );
+   assert( r == 0 );
+   char * end = page + pageSize;
+   for( int maxLen : { 24, 80 } ) {
+      QuickTrace::qtMaxStringLen = maxLen;
+      for( int len = 0; len < 100; ++len ) {
+         // At every alignment of the 32 byte loads, in the middle of the
+         // page
+         for( int align = 0; align < 32; ++align ) {
+            char * x = page + 1024 + align;
+            memset( x, 'a' + align, len );
+            x[ len ] = '\0';
+            checkPut( x );
+         }
+         // Ending right before the inaccessible page, NUL terminated or
+         // not, as long as it is longer than maxLen
+         char * x = end - len - 1;
+         memset( x, 'z', len );
+         x[ len ] = '\0';
+         checkPut( x );
+         if( len > maxLen ) {
+            memset( x, 'y', len + 1 );
+            checkPut( x + 1 );
+         }
+      }
+   }
+   munmap( page, 2 * pageSize );
+}
+
+static double
+nowNs() {
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+template< typename F >
+double
+timePuts( long iterations, F putOne ) {
+   QuickTrace::RingBuf rb;
+   rb.bufIs( actual, bufSize );
+   char * start = ( char * )rb.ptr();
+   double begin = nowNs();
+   for( long i = 0; i < iterations; ++i ) {
+      rb.ptrIs( start );
+      putOne( &rb );
+      asm volatile( "" ::: "memory" );
+   }
+   return ( nowNs() - begin ) / iterations;
+}
+
+int main( int argc, char const ** argv ) {
+   checkAll();
+
+   long iterations = argc > 1 ? atol( argv[ 1 ] ) : 10000000;
+   QuickTrace::qtMaxStringLen = 80;
+   static char str[ 256 ];
+   printf( "%6s %12s %12s\n", "length", "put ns", "bytewise ns" );
+   for( int len : { 0, 4, 8, 16, 24, 32, 48, 64, 80 } ) {
+      memset( str, 'x', len );
+      str[ len ] = '\0';
+      double simd = timePuts( iterations, []( QuickTrace::RingBuf * rb ) {
+         QuickTrace::put( rb, str );
+      } );
+      double bytewise = timePuts( iterations, []( QuickTrace::RingBuf * rb ) {
+         referencePut( rb, str, QuickTrace::qtMaxStringLen );
+      } );
+      printf( "%6d %12.2f %12.2f\n", len, simd, bytewise );
+   }
+   return 0;
+}
@@ -0,0 +1,190 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+// Test the RotationPolicy passed to QuickTrace::initialize(): the number of
+// generations kept, whether the oldest one is kept, and the removal of the
+// generations that are too old or over the disk budget. Rotation renames
+// the files, so each one is followed through its inode.
+
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <QuickTrace/QuickTrace.h>
+
+std::string outfile = "/tmp/QtRotationPolicyTest.qt";
+
+std::string generation( int k ) {
+   return k ? outfile + "." + std::to_string( k ) : outfile;
+}
+
+// The inode of generation k, 0 if it does not exist
+ino_t inode( int k ) {
+   struct stat st;
+   return stat( generation( k ).c_str(), &st ) == 0 ? st.st_ino : 0;
+}
+
+void removeAll() {
+   for( int k = 0; k < 10; ++k ) {
+      unlink( generation( k ).c_str() );
+   }
+   unlink( ( outfile + ".0" ).c_str() );
+}
+
+// Creates a new file, returning its inode
+ino_t createFile( QuickTrace::RotationPolicy const & policy ) {
+   bool ok = QuickTrace::initialize( outfile.c_str(), nullptr, nullptr, 0, 24,
+                                     QuickTrace::MultiThreading::disabled, true,
+                                     DEFAULT_NUM_MSG_COUNTERS,
+                                     QuickTrace::MsgCounterLayout::packed,
+                                     QuickTrace::ClockSourceTsc, &policy );
+   assert( ok );
+   ino_t ino = inode( 0 );
+   QuickTrace::close();
+   return ino;
+}
+
+// The generations are pruned in the background, after they are rotated
+void waitFor( std::function< bool() > done ) {
+   for( int i = 0; i < 1000 && !done(); ++i ) {
+      usleep( 10000 );
+   }
+   assert( done() );
+}
+
+// Checks that generation k is the file created inos.size() - k files ago,
+// for the k that exist
+void checkGenerations( std::vector< ino_t > const & inos, int generations ) {
+   for( int k = 0; k <= generations; ++k ) {
+      assert( inode( k ) == inos[ inos.size() - 1 - k ] );
+   }
+   assert( inode( generations + 1 ) == 0 );
+}
+
+void testGenerations() {
+   removeAll();
+   QuickTrace::RotationPolicy policy;
+   policy.generations = 4;
+   policy.keepOldest = false;
+   std::vector< ino_t > inos;
+   for( int i = 0; i < 7; ++i ) {
+      inos.push_back( createFile( policy ) );
+      checkGenerations( inos, std::min( i, 4 ) );
+   }
+   // Fewer generations remove the ones beyond
+   policy.generations = 1;
+   inos.push_back( createFile( policy ) );
+   waitFor( [] { return inode( 2 ) == 0; } );
+   checkGenerations( inos, 1 );
+}
+
+void testKeepOldest() {
+   removeAll();
+   QuickTrace::RotationPolicy policy;
+   policy.generations = 3;
+   std::vector< ino_t > inos;
+   for( int i = 0; i < 6; ++i ) {
+      inos.push_back( createFile( policy ) );
+   }
+   // The first file stays the oldest generation, the others are the most
+   // recent ones
+   assert( inode( 3 ) == inos[ 0 ] );
+   assert( inode( 2 ) == inos[ 3 ] );
+   assert( inode( 1 ) == inos[ 4 ] );
+   assert( inode( 0 ) == inos[ 5 ] );
+   assert( inode( 4 ) == 0 );
+}
+
+void testMaxAge() {
+   removeAll();
+   QuickTrace::RotationPolicy policy;
+   policy.generations = 3;
+   policy.maxAgeSeconds = 3600;
+   for( int i = 0; i < 3; ++i ) {
+      createFile( policy );
+   }
+   assert( inode( 2 ) != 0 );
+   // Last written to two hours ago
+   struct timeval old[ 2 ];
+   gettimeofday( &old[ 0 ], nullptr );
+   old[ 0 ].tv_sec -= 7200;
+   old[ 1 ] = old[ 0 ];
+   int ret = utimes( generation( 1 ).c_str(), old );
+   assert( ret == 0 );
+   ino_t recent = inode( 0 );
+   createFile( policy );
+   // It has become generation 2
+   waitFor( [] { return inode( 2 ) == 0; } );
+   assert( inode( 1 ) == recent );
+   assert( inode( 3 ) != 0 );
+}
+
+void testMaxTotalBytes() {
+   removeAll();
+   QuickTrace::RotationPolicy policy;
+   policy.generations = 3;
+   createFile( policy );
+   struct stat st;
+   int ret = stat( generation( 0 ).c_str(), &st );
+   assert( ret == 0 );
+   // Room for one rotated file and a half
+   policy.maxTotalBytes = uint64_t( st.st_blocks ) * 512 * 3 / 2;
+   std::vector< ino_t > inos = { inode( 0 ) };
+   for( int i = 0; i < 3; ++i ) {
+      inos.push_back( createFile( policy ) );
+   }
+   waitFor( [] { return inode( 2 ) == 0; } );
+   checkGenerations( inos, 1 );
+}
+
+void testLeftover() {
+   // A process that exits before its rotation thread moved .0 to .1
+   removeAll();
+   QuickTrace::RotationPolicy policy;
+   ino_t leftover = createFile( policy );
+   int ret = rename( outfile.c_str(), ( outfile + ".0" ).c_str() );
+   assert( ret == 0 );
+   ino_t previous = createFile( policy );
+   ino_t current = createFile( policy );
+   assert( inode( 0 ) == current );
+   assert( inode( 1 ) == previous );
+   assert( inode( 2 ) == leftover );
+   assert( access( ( outfile + ".0" ).c_str(), F_OK ) != 0 );
+}
+
+int main() {
+   testGenerations();
+   testKeepOldest();
+   testMaxAge();
+   testMaxTotalBytes();
+   testLeftover();
+   removeAll();
+   return 0;
+}
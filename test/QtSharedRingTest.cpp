@@ -0,0 +1,113 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <QuickTrace/QuickTrace.h>
+
+// Verify multiple threads writing to the rings of a single shared trace
+// file. QuickTrace file output validated in QtSharedRingTest.py
+
+char const * outfile = getenv( "QTFILE" ) ?: "QtSharedRingTest.qt";
+// Traced to after outfile is closed, from the same call sites
+char const * reopenedOutfile = getenv( "QTFILE2" ) ?: "QtSharedRingTest2.qt";
+
+static constexpr int threadCount = 16;
+static constexpr int messageCount = 2000;
+static int threadsDone;
+
+static void *
+qtTestThread( void * arg ) {
+   int index = *( int * )arg;
+   for( int i = 0; i < messageCount; ++i ) {
+      // Level 0 is large enough to hold every message, level 1 is tiny
+      // and wraps constantly while all the threads contend for it.
+      QTRACE0( "thread " << QVAR << " message " << QVAR, index << i );
+      QTRACE1( "wrap " << QVAR << " " << QVAR << " " << QVAR,
+               index << i << "abcdefghijklmnopqrstuvwx" );
+   }
+   __atomic_add_fetch( &threadsDone, 1, __ATOMIC_RELEASE );
+   return NULL;
+}
+
+// Interrupts the threads while they write and commit their records
+static void
+traceSignal( int ) {
+   QTRACE0( "signal", QNULL );
+}
+
+static void
+traceDone() {
+   QTRACE0( "done", QNULL );
+}
+
+int main( int argc, char const ** argv ) {
+   QuickTrace::SizeSpec sizes = { 2048, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+   bool ok = QuickTrace::initializeShared( outfile, &sizes );
+   assert( ok );
+   QuickTrace::TraceFile * tf = QuickTrace::defaultQuickTraceFile();
+   assert( tf != NULL );
+   // The message gets its MsgId outside of the signal handler
+   traceSignal( 0 );
+   struct sigaction sa = {};
+   sa.sa_handler = traceSignal;
+   sa.sa_flags = SA_RESTART;
+   sigaction( SIGUSR1, &sa, NULL );
+
+   pthread_t threads[ threadCount ];
+   int indexes[ threadCount ];
+   for( int i = 0; i < threadCount; ++i ) {
+      indexes[ i ] = i;
+      int ret = pthread_create( &threads[ i ], NULL, qtTestThread, &indexes[ i ] );
+      assert( ret == 0 );
+   }
+   while( __atomic_load_n( &threadsDone, __ATOMIC_ACQUIRE ) < threadCount ) {
+      for( int i = 0; i < threadCount; ++i ) {
+         pthread_kill( threads[ i ], SIGUSR1 );
+      }
+      usleep( 100 );
+   }
+   for( int i = 0; i < threadCount; ++i ) {
+      pthread_join( threads[ i ], NULL );
+      // Every thread writes to the same file
+      assert( QuickTrace::defaultQuickTraceFile() == tf );
+   }
+   traceDone();
+   QuickTrace::close();
+
+   // A new shared TraceFile writes the descriptors of messages that
+   // already have a MsgId
+   ok = QuickTrace::initializeShared( reopenedOutfile, &sizes );
+   assert( ok );
+   traceDone();
+   indexes[ 0 ] = threadCount;
+   qtTestThread( &indexes[ 0 ] );
+   QuickTrace::close();
+   return 0;
+}
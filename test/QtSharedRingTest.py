@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+# Copyright (c) 2026, Arista Networks, Inc.
+# All rights reserved.
+
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+
+# 	* Redistributions of source code must retain the above copyright notice,
+#  	  this list of conditions and the following disclaimer.
+# 	* Redistributions in binary form must reproduce the above copyright notice,
+# 	  this list of conditions and the following disclaimer in the documentation
+# 	  and/or other materials provided with the distribution.
+# 	* Neither the name of Arista Networks nor the names of its contributors may
+# 	  be used to endorse or promote products derived from this software without
+# 	  specific prior written permission.
+
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+# PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+# BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+# ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+from __future__ import absolute_import, division, print_function
+import os, re, subprocess, unittest
+
+QTFILE = '/tmp/QtSharedRingTest.qt'
+QTFILE2 = '/tmp/QtSharedRingTest2.qt'
+threadCount = 16
+messageCount = 2000
+
+class QtSharedRingTest( unittest.TestCase ):
+   def setUp( self ):
+      subprocess.check_call( [ '/usr/bin/timeout', '300s', './QtSharedRingTest' ],
+                             env={ 'QTFILE': QTFILE, 'QTFILE2': QTFILE2 } )
+
+   def tearDown( self ):
+      os.remove( QTFILE )
+      os.remove( QTFILE2 )
+
+   def test( self ):
+      output = subprocess.check_output( [ '/usr/bin/qttail', '-c', QTFILE ],
+                                        universal_newlines=True )
+      # <date> <time> <level> t<tag> +<delta> "<message>"
+      lineRe = re.compile( r'^\S+ \S+ (\d) t(\d+) \+\d+ "(.*)"$' )
+      nextMsg = {}
+      tags = {}
+      wrapped = 0
+      signals = 0
+      for line in output.splitlines(): # pylint: disable=E1103
+         m = lineRe.match( line )
+         self.assertTrue( m, 'unexpected line: %s' % line )
+         level, tag, msg = m.groups()
+         words = msg.split()
+         if level == '0' and words[ 0 ] == 'thread':
+            thread, i = int( words[ 1 ] ), int( words[ 3 ] )
+            # messages of one thread are in order and none are missing
+            self.assertEqual( i, nextMsg.get( thread, 0 ) )
+            nextMsg[ thread ] = i + 1
+            # one tag per thread, and no two threads share a tag
+            self.assertEqual( tags.setdefault( thread, tag ), tag )
+         elif level == '0' and msg == 'signal':
+            # traced by the signal handlers, unless they interrupted a
+            # trace to the same ring
+            signals += 1
+         elif level == '1':
+            thread = int( words[ 1 ] )
+            self.assertEqual( words[ 3 ], 'abcdefghijklmnopqrstuvwx' )
+            self.assertEqual( tags.setdefault( thread, tag ), tag )
+            wrapped += 1
+      self.assertEqual( nextMsg, { t: messageCount for t in range( threadCount ) } )
+      self.assertEqual( len( set( tags.values() ) ), threadCount )
+      self.assertTrue( wrapped > 0 )
+      self.assertTrue( signals > 0 )
+
+   def testReopened( self ):
+      output = subprocess.check_output( [ '/usr/bin/qttail', '-c', QTFILE2 ],
+                                        universal_newlines=True )
+      messages = re.findall( r'^\S+ \S+ 0 t\d+ \+\d+ "(.*)"$', output, re.M )
+      self.assertEqual( messages[ 0 ], 'done' )
+      self.assertEqual( messages[ 1 : ],
+                        [ 'thread %d message %d' % ( threadCount, i )
+                          for i in range( messageCount ) ] )
+
+if __name__ == '__main__':
+   unittest.main()
@@ -0,0 +1,83 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+// Measures the cost of creating a trace file: QuickTrace::initialize()
+// followed by QuickTrace::close(), repeated for a number of files. Most
+// of the work is reserving the blocks of the file and faulting in the
+// mapping, which is system time, so that is reported separately from
+// the elapsed time.
+//
+// Usage: QtStartupBenchmark [files] [KB per trace level]
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <sys/resource.h>
+#include <QuickTrace/QuickTrace.h>
+
+char const * outfile = getenv( "QTFILE" ) ?: "QtStartupBenchmark.qt";
+
+static double
+wallNs() {
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double
+systemNs() {
+   struct rusage ru;
+   getrusage( RUSAGE_SELF, &ru );
+   return ru.ru_stime.tv_sec * 1e9 + ru.ru_stime.tv_usec * 1e3;
+}
+
+int
+main( int argc, char ** argv ) {
+   int files = argc > 1 ? atoi( argv[ 1 ] ) : 10;
+   uint32_t kb = argc > 2 ? atoi( argv[ 2 ] ) : 3200;
+   QuickTrace::SizeSpec sizes;
+   for( int i = 0; i < QuickTrace::SizeSpec::SIZE; ++i ) {
+      sizes.sz[ i ] = kb;
+   }
+
+   double wall = 0;
+   double system = 0;
+   for( int i = 0; i < files; ++i ) {
+      double wallStart = wallNs();
+      double systemStart = systemNs();
+      if( !QuickTrace::initialize( outfile, &sizes ) ) {
+         fprintf( stderr, "QuickTrace::initialize failed\n" );
+         return 1;
+      }
+      QuickTrace::close();
+      wall += wallNs() - wallStart;
+      system += systemNs() - systemStart;
+   }
+   printf( "%d files of %u KB: %.2f ms elapsed, %.2f ms system per file\n",
+           files, kb * QuickTrace::SizeSpec::SIZE,
+           wall / files / 1e6, system / files / 1e6 );
+   return 0;
+}
@@ -0,0 +1,95 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <QuickTrace/QuickTrace.h>
+
+// Trace many more messages than the rings hold from two threads of a
+// multi-threaded TraceHandle, whose TraceFiles are streamed to small
+// segments. Run with "shared" for a shared TraceHandle, which both
+// threads trace into, and with "sync" for the stream thread to write
+// without io_uring, or "io_uring" for it to have to use io_uring. The
+// messages are paced so that the stream thread keeps up with them.
+// QuickTrace file output validated in QtStreamingLogTest.py
+
+static int numMsgs;
+
+static void *
+traceThread( void * arg ) {
+   int index = *( int * )arg;
+   std::string name = "QtStream-" + std::to_string( index );
+   int ret = pthread_setname_np( pthread_self(), name.c_str() );
+   assert( ret == 0 );
+   QuickTrace::defaultQuickTraceHandle->maybeCreateMtTraceFile();
+   for( int i = 0; i < numMsgs; ++i ) {
+      if( i % 7 == 0 ) {
+         QTRACE5( "stream " << QVAR << " " << QVAR, index << i );
+      } else {
+         QTRACE0( "stream " << QVAR << " " << QVAR, index << i );
+      }
+      if( i % 10 == 0 ) {
+         usleep( 1000 );
+      }
+   }
+   return nullptr;
+}
+
+int main( int argc, char const ** argv ) {
+   numMsgs = argc > 1 ? atoi( argv[ 1 ] ) : 2000;
+   bool shared = argc > 2 && !strcmp( argv[ 2 ], "shared" );
+   char const * io = argc > 3 ? argv[ 3 ] : "";
+   bool ioUring = strcmp( io, "sync" ) != 0;
+   QuickTrace::setStreamingLog( 16 * 1024, ioUring );
+   QuickTrace::SizeSpec sizes = { 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 };
+   bool ok = shared ?
+      QuickTrace::initializeShared( "QtStreamingLogTest.qt", &sizes ) :
+      QuickTrace::initializeMt( "-stream.qt", &sizes );
+   assert( ok );
+   pthread_t threads[ 2 ];
+   int indexes[ 2 ] = { 0, 1 };
+   for( int i = 0; i < 2; ++i ) {
+      int ret = pthread_create( &threads[ i ], nullptr, traceThread,
+                                &indexes[ i ] );
+      assert( ret == 0 );
+   }
+   for( int i = 0; i < 2; ++i ) {
+      pthread_join( threads[ i ], nullptr );
+   }
+   if( !ioUring ) {
+      assert( !QuickTrace::streamingLogUsesIoUring() );
+   } else if( !strcmp( io, "io_uring" ) ) {
+      assert( QuickTrace::streamingLogUsesIoUring() );
+   }
+   // The TraceFiles of the threads streamed the rest of their records when
+   // the threads exited, the shared one does when it is closed
+   QuickTrace::close();
+   return 0;
+}
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+# Copyright (c) 2026, Arista Networks, Inc.
+# All rights reserved.
+
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+
+# 	* Redistributions of source code must retain the above copyright notice,
+#  	  this list of conditions and the following disclaimer.
+# 	* Redistributions in binary form must reproduce the above copyright notice,
+# 	  this list of conditions and the following disclaimer in the documentation
+# 	  and/or other materials provided with the distribution.
+# 	* Neither the name of Arista Networks nor the names of its contributors may
+# 	  be used to endorse or promote products derived from this software without
+# 	  specific prior written permission.
+
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+# PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+# BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+# ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+from __future__ import absolute_import, division, print_function
+import ctypes, glob, os, re, shutil, subprocess, tempfile, unittest
+
+NUM_MSGS = 2000
+
+def ioUringAvailable():
+   # io_uring_setup(), which a seccomp filter or the io_uring_disabled sysctl
+   # may refuse, has the same number on every architecture
+   libc = ctypes.CDLL( None, use_errno=True )
+   params = ctypes.create_string_buffer( 120 )
+   fd = libc.syscall( 425, 1, params )
+   if fd < 0:
+      return False
+   os.close( fd )
+   return True
+
+class QtStreamingLogTest( unittest.TestCase ):
+   def setUp( self ):
+      self.qtdir = tempfile.mkdtemp( prefix='QtStreamingLogTest' )
+
+   def tearDown( self ):
+      shutil.rmtree( self.qtdir )
+
+   def trace( self, *args ):
+      env = dict( os.environ, QUICKTRACEDIR=self.qtdir )
+      output = subprocess.check_output(
+         [ './QtStreamingLogTest', str( NUM_MSGS ) ] + list( args ), env=env,
+         stderr=subprocess.STDOUT, universal_newlines=True )
+      # the stream thread reports the records it did not get to
+      self.assertEqual( output, '' )
+
+   def messages( self, files ):
+      output = subprocess.check_output( [ '/usr/bin/qttail', '-c' ] + files,
+                                        universal_newlines=True )
+      # the name of the file, with several files, and the tag of the thread,
+      # with a shared file, come after the level
+      lineRe = re.compile( r'^\S+ \S+ (\d) (?:\S+ )*\+\d+ "stream (\d) (\d+)"$' )
+      messages = {}
+      for line in output.splitlines(): # pylint: disable=E1103
+         m = lineRe.match( line )
+         self.assertTrue( m, 'unexpected line: %s' % line )
+         i = int( m.group( 3 ) )
+         self.assertEqual( int( m.group( 1 ) ), 5 if i % 7 == 0 else 0, line )
+         messages.setdefault( int( m.group( 2 ) ), [] ).append( i )
+      return messages
+
+   def checkSegments( self, qtfile ):
+      segments = sorted( glob.glob( qtfile + '.stream.*.qta' ) )
+      # 2000 messages of 21 bytes do not fit in a 16k segment
+      self.assertGreater( len( segments ), 1, qtfile )
+      return segments
+
+   def checkMultiThreaded( self, path ):
+      # the 16k rings of each thread wrap a few times, the test asserts that
+      # the stream thread wrote through path
+      self.trace( 'mt', path )
+      segments = []
+      for thread in range( 2 ):
+         segments += self.checkSegments(
+            os.path.join( self.qtdir, 'QtStream-%d-stream.qt' % thread ) )
+      self.assertEqual( sorted( glob.glob( self.qtdir + '/*.qta' ) ),
+                        sorted( segments ) )
+      # the segments hold every message once, in order
+      messages = self.messages( segments )
+      for thread in range( 2 ):
+         self.assertEqual( messages[ thread ], list( range( NUM_MSGS ) ) )
+      # and each segment can be read on its own
+      self.assertTrue( self.messages( segments[ -1: ] ) )
+
+   def testMultiThreaded( self ):
+      if not ioUringAvailable():
+         self.skipTest( 'io_uring is not available' )
+      self.checkMultiThreaded( 'io_uring' )
+
+   def testWithoutIoUring( self ):
+      # the stream thread writes the segments one system call at a time
+      self.checkMultiThreaded( 'sync' )
+
+   def testShared( self ):
+      self.trace( 'shared' )
+      segments = self.checkSegments(
+         os.path.join( self.qtdir, 'QtStreamingLogTest.qt' ) )
+      messages = self.messages( segments )
+      for thread in range( 2 ):
+         self.assertEqual( messages[ thread ], list( range( NUM_MSGS ) ) )
+
+if __name__ == '__main__':
+   unittest.main()
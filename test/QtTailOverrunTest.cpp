@@ -51,28 +51,21 @@ emitTraceMsgs( int count, int messageLength, int msgNum ) {
 }
 
 bool
-expectOverrun( int qtTailFd ) {
-   bool gotOverrun = false;
-   for ( int i = 0; i < 10; i++ ) {
-      std::string line = readQtLine( qtTailFd, false );
-      if ( line.empty() ) {
-         std::cout << "*** unexpected EOF from qttail" << std::endl;
-         return false;
-      }
-      if ( isdigit( line[ 0 ] ) ) {
-         std::cout << "*** unexpected message from qttail: " << line;
-         return false;
-      } else {
-         if ( line.compare( 0, 31, "---------- resetting log buffer" ) == 0 ) {
-            gotOverrun = true;
-            break;
-         }
-      }
+expectOverrun( int qtTailFd, int lostMsgs, int lostBytes ) {
+   // qttail notices that the writer went past it before it reads any of the
+   // overwritten messages, which are counted as lost rather than corrupt
+   std::string lost = "--- " + std::to_string( lostMsgs ) + " messages (" +
+                      std::to_string( lostBytes ) + " bytes) lost on level 0";
+   std::string line = readQtLine( qtTailFd, false );
+   if ( line.empty() ) {
+      std::cout << "*** unexpected EOF from qttail" << std::endl;
+      return false;
    }
-   if ( !gotOverrun ) {
-      std::cout << "*** missing overrun message from qttail" << std::endl;
+   if ( line.compare( 0, lost.size(), lost ) != 0 ) {
+      std::cout << "*** expected \"" << lost << "\" from qttail, got: " << line;
+      return false;
    }
-   return gotOverrun;
+   return true;
 }
 
 bool
@@ -121,9 +114,10 @@ testOverrun( int qtTailFd ) {
    totalMsgsNeeded = ( sizeToFill / msgLength ) + 1;
    emitTraceMsgs( totalMsgsNeeded, msgLength, firstMsgNum );
 
-   // let qttail continue and detect the overrun
+   // let qttail continue and detect the overrun. it missed the messages up to
+   // the end of the first lap
    signalProcess( SIGCONT );
-   if ( !expectOverrun( qtTailFd ) ) {
+   if ( !expectOverrun( qtTailFd, numMsgs, numMsgs * 21 ) ) {
       return false;
    }
 
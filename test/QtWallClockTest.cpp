@@ -0,0 +1,57 @@
+// Copyright (c) 2026, Arista Networks, Inc.
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+
+// 	* Redistributions of source code must retain the above copyright notice,
+//  	  this list of conditions and the following disclaimer.
+// 	* Redistributions in binary form must reproduce the above copyright notice,
+// 	  this list of conditions and the following disclaimer in the documentation
+// 	  and/or other materials provided with the distribution.
+// 	* Neither the name of Arista Networks nor the names of its contributors may
+// 	  be used to endorse or promote products derived from this software without
+// 	  specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#define QT_WALL_CLOCK_TSC
+#include <QuickTrace/WallClockQt.h>
+
+// Trace wall-clock messages that only record the TSC, wall-clock messages
+// that also record gettimeofday() (traced in QtWallClockTimeval.cpp), and
+// a regular message.
+// QuickTrace file output validated in QtWallClockTest.py
+
+void traceTimeval( int i );
+
+char const * outfile = getenv( "QTFILE" ) ?: "QtWallClockTest.qt";
+
+int main( int argc, char const ** argv ) {
+   bool ok = QuickTrace::initialize( outfile );
+   assert( ok );
+   // Wait for the file to be calibrated
+   usleep( 200000 );
+
+   for( int i = 0; i < 3; ++i ) {
+      uint64_t big = 0x123456789abcdefULL + ( uint64_t )i;
+      WCQT0( "cheap " << QVAR << " " << QHEX, i << big );
+      traceTimeval( i );
+      QTRACE0( "regular " << QVAR, i );
+   }
+   QuickTrace::close();
+   return 0;
+}
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# Copyright (c) 2026, Arista Networks, Inc.
+# All rights reserved.
+
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+
+# 	* Redistributions of source code must retain the above copyright notice,
+#  	  this list of conditions and the following disclaimer.
+# 	* Redistributions in binary form must reproduce the above copyright notice,
+# 	  this list of conditions and the following disclaimer in the documentation
+# 	  and/or other materials provided with the distribution.
+# 	* Neither the name of Arista Networks nor the names of its contributors may
+# 	  be used to endorse or promote products derived from this software without
+# 	  specific prior written permission.
+
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL ARISTA NETWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+# PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+# BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+# ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+from __future__ import absolute_import, division, print_function
+import datetime, os, re, subprocess, unittest
+
+QTFILE = '/tmp/QtWallClockTest.qt'
+
+class QtWallClockTest( unittest.TestCase ):
+   def tearDown( self ):
+      os.remove( QTFILE )
+
+   def qttail( self, *args ):
+      output = subprocess.check_output( [ '/usr/bin/qttail', '-c' ] + list( args ) +
+                                        [ QTFILE ], universal_newlines=True )
+      # <date> <time> <level> +<delta> [<file>:<line> ]"<message>"
+      lineRe = re.compile( r'^(\S+ \S+) 0 \+\d+ (?:(\S+):(\d+) )?"(.*)"$' )
+      records = []
+      for line in output.splitlines(): # pylint: disable=E1103
+         m = lineRe.match( line )
+         self.assertTrue( m, 'unexpected line: %s' % line )
+         records.append( m.groups() )
+      return records
+
+   def test( self ):
+      before = datetime.datetime.now()
+      subprocess.check_call( [ './QtWallClockTest' ], env={ 'QTFILE': QTFILE } )
+      after = datetime.datetime.now()
+
+      messages = []
+      for i in range( 3 ):
+         messages += [ 'cheap %d %x' % ( i, 0x123456789abcdef + i ),
+                       'timeval %d' % i, 'regular %d' % i ]
+      self.assertEqual( [ r[ 3 ] for r in self.qttail() ], messages )
+
+      # -w only prints the wall-clock messages, with their wall clock time
+      records = self.qttail( '-w', '-f' )
+      self.assertEqual( [ r[ 3 ] for r in records ],
+                        [ m for m in messages if not m.startswith( 'regular' ) ] )
+      slack = datetime.timedelta( seconds=1 )
+      for when, filename, line, _ in records:
+         t = datetime.datetime.strptime( when, '%Y-%m-%d %H:%M:%S.%f' )
+         self.assertTrue( before - slack <= t <= after + slack,
+                          '%s not in [%s, %s]' % ( t, before, after ) )
+         self.assertTrue( filename.endswith( '.cpp' ) )
+         self.assertEqual( line, '0' )
+
+if __name__ == '__main__':
+   unittest.main()